@@ -0,0 +1,105 @@
+"""
+Load balancing of patch decompositions by measured cost.
+
+The cost of a zone is not uniform: the primitive variable recovery takes a
+varying number of Newton iterations, some zones are held fixed, and in gpu
+mode the patches may be on devices of different speeds. A `LoadBalancer`
+times the work done by each patch between rebalances, and proposes new
+patch index ranges over which the measured cost is even. The cost of each
+zone is estimated as its patch's time divided by its number of zones, so on
+devices of different speeds the balance is approached over a few
+rebalances, rather than at once.
+"""
+
+from contextlib import contextmanager
+from time import perf_counter
+from sailfish.subdivide import weighted_subdivide
+
+
+class LoadBalancer:
+    """
+    Accumulates the time spent in the work of each patch, and proposes a
+    repartition of the patch index ranges when the times are uneven.
+
+    The work of patch n is timed by running it inside `timing(n)`. In gpu
+    mode this records a pair of CUDA events on the current stream, so it
+    must be entered inside the patch's execution context, and the launches
+    remain asynchronous. The events are resolved when a repartition is
+    proposed. A repartition is only proposed if the slowest patch takes more
+    than `1 + tolerance` times the mean, and no patch is made smaller than
+    `min_size` zones.
+    """
+
+    def __init__(self, mode, num_patches, tolerance=0.1, min_size=1):
+        self.gpu = mode == "gpu"
+        self.tolerance = tolerance
+        self.min_size = min_size
+        self.seconds = [0.0] * num_patches
+        self.pending = list()
+        self.num_rebalances = 0
+
+    @contextmanager
+    def timing(self, n):
+        if self.gpu:
+            from cupy.cuda import Event
+
+            start, end = Event(), Event()
+            start.record()
+            yield
+            end.record()
+            self.pending.append((n, start, end))
+        else:
+            start = perf_counter()
+            yield
+            self.seconds[n] += perf_counter() - start
+
+    def resolve(self):
+        """
+        Wait for the pending CUDA events, and add their elapsed times to the
+        patch totals.
+        """
+        from cupy.cuda import get_elapsed_time
+
+        for n, start, end in self.pending:
+            end.synchronize()
+            self.seconds[n] += get_elapsed_time(start, end) * 1e-3
+
+        self.pending.clear()
+
+    def imbalance(self):
+        """
+        Return the time of the slowest patch over the mean time, minus one.
+        """
+        if self.pending:
+            self.resolve()
+
+        mean = sum(self.seconds) / len(self.seconds)
+        return max(self.seconds) / mean - 1.0 if mean > 0.0 else 0.0
+
+    def propose(self, index_ranges):
+        """
+        Return a list of new index ranges `(i0, i1)` for the patches, which
+        currently have the given index ranges, or None if the patches are
+        balanced to within the tolerance. The patch times are reset.
+        """
+        imbalance = self.imbalance()
+        seconds = self.seconds
+        self.seconds = [0.0] * len(seconds)
+
+        if imbalance <= self.tolerance:
+            return None
+
+        costs = list()
+
+        for (a, b), t in zip(index_ranges, seconds):
+            costs.extend([t / (b - a)] * (b - a))
+
+        i0 = index_ranges[0][0]
+        parts = weighted_subdivide(costs, len(index_ranges), self.min_size)
+        ranges = [(a + i0, b + i0) for a, b in parts]
+
+        if ranges == list(index_ranges):
+            return None
+
+        self.num_rebalances += 1
+        return ranges
@@ -0,0 +1,290 @@
+"""
+A benchmark suite to measure solver performance, invoked as `sailfish bench`.
+
+Each benchmark case is a solver, an execution mode, a number of patches, and
+a mesh resolution. The solver is constructed from one of the stock setups,
+using `make_solver` in the same way as the driver does, and advanced for a
+number of warm-up iterations before the timed iterations begin. The solver
+construction and the warm-up are not timed, so JIT compilation (or loading
+the compiled modules from the cache) and other first-call costs are excluded
+from the measurement. The results are written to a JSON file, and compared
+against a baseline file from an earlier run, if one is given.
+"""
+
+import json
+import platform
+from datetime import datetime
+from logging import getLogger
+from sailfish.setup_base import SetupBase, SetupError
+from sailfish.solvers import make_solver, SolverInitializationError
+
+logger = getLogger(__name__)
+
+BENCH_SETUPS = {
+    "cbdiso_2d": ("circumbinary-disk", dict()),
+    "cbdgam_2d": ("circumbinary-disk", dict(eos="gamma-law")),
+    "cbdisodg_2d": ("kitp-code-comparison", dict(use_dg=True)),
+    "srhd_1d": ("envelope-shock", dict()),
+    "srhd_2d": ("envelope-shock", dict(polar_extent=0.5)),
+}
+"""
+The setup name and model parameters used to benchmark each solver.
+"""
+
+
+def case_key(record):
+    return (
+        record["solver"],
+        record["mode"],
+        record["num_patches"],
+        record["resolution"],
+    )
+
+
+def run_case(solver_name, mode, num_patches, resolution, warmup, iterations):
+    """
+    Benchmark one solver configuration, and return a dictionary of results.
+
+    The time step is computed once, from the initial maximum wavespeed and
+    the solver's recommended CFL number, and held fixed for all iterations.
+    In gpu mode, the device is synchronized after the warm-up, so that the
+    timed iterations do not include warm-up kernels still in flight.
+    """
+    from sailfish.kernel.system import measure_time
+
+    setup_name, model_parameters = BENCH_SETUPS[solver_name]
+    setup = SetupBase.find_setup_class(setup_name)(**model_parameters)
+    resolution = resolution or setup.default_resolution
+    mesh = setup.mesh(resolution)
+    time = setup.start_time
+
+    with measure_time(mode) as build_time:
+        solver = make_solver(
+            setup.solver,
+            setup.physics,
+            dict(),
+            setup=setup,
+            mesh=mesh,
+            time=time,
+            solution=None,
+            num_patches=num_patches,
+            mode=mode,
+        )
+
+    build_seconds = build_time()
+    dt = mesh.min_spacing(time) / solver.maximum_wavespeed() * solver.recommended_cfl
+
+    for _ in range(warmup):
+        solver.advance(dt)
+
+    if mode == "gpu":
+        from cupy.cuda.runtime import deviceSynchronize
+
+        deviceSynchronize()
+
+    with measure_time(mode) as run_time:
+        for _ in range(iterations):
+            solver.advance(dt)
+
+    seconds = run_time()
+    return dict(
+        solver=solver_name,
+        setup=setup_name,
+        mode=mode,
+        num_patches=num_patches,
+        resolution=resolution,
+        num_zones=mesh.num_total_zones,
+        warmup=warmup,
+        iterations=iterations,
+        build_seconds=build_seconds,
+        seconds=seconds,
+        mzps=mesh.num_total_zones * iterations / seconds * 1e-6,
+    )
+
+
+def compare_to_baseline(results, baseline, tolerance):
+    """
+    Mark each result with the baseline Mzps of the same case (if any), and
+    return the results whose Mzps is less than the baseline's by more than
+    the fractional `tolerance`.
+    """
+    reference = {case_key(r): r["mzps"] for r in baseline["results"] if "mzps" in r}
+    regressions = list()
+
+    for record in results:
+        if "mzps" not in record or case_key(record) not in reference:
+            continue
+
+        baseline_mzps = reference[case_key(record)]
+        record["baseline_mzps"] = baseline_mzps
+        record["regression"] = record["mzps"] < (1.0 - tolerance) * baseline_mzps
+
+        if record["regression"]:
+            regressions.append(record)
+
+    return regressions
+
+
+def run_bench(
+    solvers,
+    modes,
+    patches,
+    resolutions,
+    warmup=5,
+    iterations=20,
+    build_config=dict(),
+):
+    """
+    Run every combination of the given solvers, modes, patch counts, and
+    resolutions, and return a dictionary with the host details and a list of
+    results. A resolution of None means the setup's default resolution.
+
+    Cases which the solver cannot be configured for (for example a number of
+    patches it does not support) are reported with an `error` item instead
+    of the timing results.
+    """
+    from sailfish import __version__ as version
+    from sailfish.kernel.system import configure_build
+
+    results = list()
+
+    for mode in modes:
+        configure_build(**build_config, execution_mode=mode)
+
+        for solver_name in solvers:
+            for num_patches in patches:
+                for resolution in resolutions:
+                    case = dict(
+                        solver=solver_name,
+                        mode=mode,
+                        num_patches=num_patches,
+                        resolution=resolution,
+                    )
+                    try:
+                        record = run_case(
+                            solver_name,
+                            mode,
+                            num_patches,
+                            resolution,
+                            warmup,
+                            iterations,
+                        )
+                        logger.info(
+                            f"{solver_name} {mode} patches={num_patches} "
+                            f"resolution={record['resolution']} "
+                            f"Mzps={record['mzps']:.3f}"
+                        )
+                    except (SetupError, SolverInitializationError, ValueError) as e:
+                        record = dict(case, error=str(e))
+                        logger.warning(f"skip {case}: {e}")
+
+                    results.append(record)
+
+    return dict(
+        sailfish_version=version,
+        host=platform.node(),
+        machine=platform.machine(),
+        date=datetime.now().isoformat(timespec="seconds"),
+        results=results,
+    )
+
+
+def main(argv=None, build_config=dict()):
+    """
+    Command line interface for `sailfish bench`. Returns a non-zero exit
+    status if any case is slower than the baseline.
+    """
+    import argparse
+
+    parser = argparse.ArgumentParser(
+        prog="sailfish bench",
+        description="measure solver performance in Mzps (million zones per second)",
+    )
+    parser.add_argument(
+        "--solvers",
+        nargs="+",
+        default=list(BENCH_SETUPS),
+        choices=list(BENCH_SETUPS),
+        help="solvers to benchmark (default: all)",
+    )
+    parser.add_argument(
+        "--modes",
+        nargs="+",
+        default=["cpu"],
+        choices=["cpu", "omp", "gpu"],
+        help="execution modes (default: cpu)",
+    )
+    parser.add_argument(
+        "--patches",
+        nargs="+",
+        type=int,
+        default=[1],
+        help="numbers of patches (default: 1)",
+    )
+    parser.add_argument(
+        "--resolutions",
+        nargs="+",
+        type=int,
+        default=[None],
+        help="mesh resolutions (default: the setup's default resolution)",
+    )
+    parser.add_argument(
+        "--warmup",
+        type=int,
+        default=5,
+        help="number of untimed iterations before the timed ones",
+    )
+    parser.add_argument(
+        "--iterations",
+        type=int,
+        default=20,
+        help="number of timed iterations",
+    )
+    parser.add_argument(
+        "--output",
+        "-o",
+        default="bench.json",
+        help="file to write the results to",
+    )
+    parser.add_argument(
+        "--baseline",
+        metavar="F",
+        help="results of an earlier run, to check for regressions",
+    )
+    parser.add_argument(
+        "--tolerance",
+        type=float,
+        default=0.1,
+        help="fractional slowdown relative to the baseline flagged as a regression",
+    )
+    args = parser.parse_args(argv)
+
+    report = run_bench(
+        args.solvers,
+        args.modes,
+        args.patches,
+        args.resolutions,
+        warmup=args.warmup,
+        iterations=args.iterations,
+        build_config=build_config,
+    )
+    regressions = list()
+
+    if args.baseline is not None:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+        regressions = compare_to_baseline(report["results"], baseline, args.tolerance)
+
+        for r in regressions:
+            logger.warning(
+                f"regression: {r['solver']} {r['mode']} patches={r['num_patches']} "
+                f"resolution={r['resolution']} Mzps={r['mzps']:.3f} "
+                f"(baseline {r['baseline_mzps']:.3f})"
+            )
+
+    with open(args.output, "w") as f:
+        json.dump(report, f, indent=4)
+        logger.info(f"write benchmark results {args.output}")
+
+    return 1 if regressions else 0
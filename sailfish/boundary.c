@@ -0,0 +1,192 @@
+/*
+MODULE: boundary
+
+DESCRIPTION: Fills all of the guard zones of a 2D patch in one launch, from
+  the neighboring patches and the boundary conditions at the domain edges.
+*/
+
+// ============================ BOUNDARY CONDITIONS ===========================
+// ============================================================================
+#define BC_NEIGHBOR 0
+#define BC_OUTFLOW 1
+#define BC_REFLECTING 2
+#define BC_INFLOW 3
+
+// Map the index n of a guard zone on one axis, for an array with nz zones
+// and ng guard zones on that axis, to the index of the interior zone which
+// the boundary condition copies from. The side is -1 for the lower edge and
+// +1 for the upper edge. The flip flag is set if the normal velocity is
+// reflected.
+PRIVATE int boundary_source_index(int n, int nz, int ng, int side, int bc, int *flip)
+{
+    switch (bc)
+    {
+        case BC_OUTFLOW:
+            return side < 0 ? ng : nz + ng - 1;
+        case BC_REFLECTING:
+            *flip = 1;
+            return side < 0 ? 2 * ng - 1 - n : 2 * (nz + ng) - 1 - n;
+        default:
+            return n;
+    }
+}
+
+
+// ============================ PUBLIC API ====================================
+// ============================================================================
+// The traversal is over the guard zones of the patch: first the ng rows at
+// each end of the first axis (including the corners), and then the ng
+// columns at each end of the second axis, for the interior rows. The array
+// arguments named by a pair of letters are the neighboring patches, where
+// the letters are l, c, or r for the lower, same, or upper block index on
+// each axis; e.g. array_lc is the neighbor on the lower side of the first
+// axis. The neighbors on the first axis have ni_l or ni_r zones on that
+// axis, and those on the second axis have nj_l or nj_r zones on it. The
+// edge codes bc_il, bc_ir, bc_jl, bc_jr are BC_NEIGHBOR if there is a
+// neighbor on that side (which may be the patch itself, if the domain is
+// periodic), or one of the other BC codes at a domain edge. Neighbor arrays
+// which are not used may be any array (e.g. the patch array itself). The
+// guard zones are filled as if the first axis were filled before the second
+// one, so a corner zone comes from the diagonal neighbor if there is one.
+// Only interior zones are read, so the patches can be filled concurrently.
+PUBLIC void apply_boundary_conditions(
+    int num_guard_zones, // :: $ == 2 * ng * (ni + nj + 2 * ng)
+    real *array, // :: $.shape == layout(ni + 2 * ng, nj + 2 * ng, nq)
+    real *array_ll, // :: bc_il or bc_jl or $.shape == layout(ni_l + 2 * ng, nj_l + 2 * ng, nq)
+    real *array_lc, // :: bc_il or $.shape == layout(ni_l + 2 * ng, nj + 2 * ng, nq)
+    real *array_lr, // :: bc_il or bc_jr or $.shape == layout(ni_l + 2 * ng, nj_r + 2 * ng, nq)
+    real *array_cl, // :: bc_jl or $.shape == layout(ni + 2 * ng, nj_l + 2 * ng, nq)
+    real *array_cr, // :: bc_jr or $.shape == layout(ni + 2 * ng, nj_r + 2 * ng, nq)
+    real *array_rl, // :: bc_ir or bc_jl or $.shape == layout(ni_r + 2 * ng, nj_l + 2 * ng, nq)
+    real *array_rc, // :: bc_ir or $.shape == layout(ni_r + 2 * ng, nj + 2 * ng, nq)
+    real *array_rr, // :: bc_ir or bc_jr or $.shape == layout(ni_r + 2 * ng, nj_r + 2 * ng, nq)
+    double *inflow, // :: $.shape == (4, nq)
+    int ni,
+    int nj,
+    int ni_l,
+    int ni_r,
+    int nj_l,
+    int nj_r,
+    int ng, // :: $ > 0
+    int nq,
+    int bc_il,
+    int bc_ir,
+    int bc_jl,
+    int bc_jr,
+    int velocity_i, // the field index of the velocity on each axis, or -1
+    int velocity_j)
+{
+    FOR_EACH_1D(num_guard_zones)
+    {
+        int nrow = 2 * ng * (nj + 2 * ng);
+        int ig;
+        int jg;
+
+        if (i < nrow)
+        {
+            int r = i / (nj + 2 * ng);
+            ig = r < ng ? r : ni + r;
+            jg = i % (nj + 2 * ng);
+        }
+        else
+        {
+            int k = i - nrow;
+            int c = k % (2 * ng);
+            ig = ng + k / (2 * ng);
+            jg = c < ng ? c : nj + c;
+        }
+
+        int xs = ig < ng ? -1 : (ig >= ni + ng ? 1 : 0);
+        int ys = jg < ng ? -1 : (jg >= nj + ng ? 1 : 0);
+        int is = ig;
+        int js = jg;
+        int di = 0;
+        int dj = 0;
+        int flip_i = 0;
+        int flip_j = 0;
+        int fixed = -1;
+
+        // The second axis is filled last, so its edge condition is applied
+        // last, to the zone that the first axis condition maps to.
+        if (ys != 0)
+        {
+            int bc = ys < 0 ? bc_jl : bc_jr;
+
+            if (bc == BC_NEIGHBOR)
+            {
+                dj = ys;
+                js = ys < 0 ? jg + nj_l : jg - nj;
+            }
+            else if (bc == BC_INFLOW)
+            {
+                fixed = ys < 0 ? 2 : 3;
+            }
+            else
+            {
+                js = boundary_source_index(jg, nj, ng, ys, bc, &flip_j);
+            }
+        }
+        if (xs != 0 && fixed == -1)
+        {
+            int bc = xs < 0 ? bc_il : bc_ir;
+
+            if (bc == BC_NEIGHBOR)
+            {
+                di = xs;
+                is = xs < 0 ? ig + ni_l : ig - ni;
+            }
+            else if (bc == BC_INFLOW)
+            {
+                fixed = xs < 0 ? 0 : 1;
+            }
+            else
+            {
+                is = boundary_source_index(ig, ni, ng, xs, bc, &flip_i);
+            }
+        }
+
+        int mi = ni + 2 * ng;
+        int mj = nj + 2 * ng;
+        int si = LAYOUT_STRIDE_I(mi, mj, nq);
+        int sj = LAYOUT_STRIDE_J(mi, mj, nq);
+        int sq = LAYOUT_STRIDE_Q(mi, mj, nq);
+        int n = ig * si + jg * sj;
+
+        if (fixed != -1)
+        {
+            for (int q = 0; q < nq; ++q)
+            {
+                array[n + q * sq] = inflow[fixed * nq + q];
+            }
+        }
+        else
+        {
+            const real *source = array;
+
+            if (di < 0 && dj < 0) source = array_ll;
+            if (di < 0 && dj == 0) source = array_lc;
+            if (di < 0 && dj > 0) source = array_lr;
+            if (di == 0 && dj < 0) source = array_cl;
+            if (di == 0 && dj > 0) source = array_cr;
+            if (di > 0 && dj < 0) source = array_rl;
+            if (di > 0 && dj == 0) source = array_rc;
+            if (di > 0 && dj > 0) source = array_rr;
+
+            int ri = (di < 0 ? ni_l : (di > 0 ? ni_r : ni)) + 2 * ng;
+            int rj = (dj < 0 ? nj_l : (dj > 0 ? nj_r : nj)) + 2 * ng;
+            int m = is * LAYOUT_STRIDE_I(ri, rj, nq) + js * LAYOUT_STRIDE_J(ri, rj, nq);
+            int rq = LAYOUT_STRIDE_Q(ri, rj, nq);
+
+            for (int q = 0; q < nq; ++q)
+            {
+                real u = source[m + q * rq];
+
+                if ((flip_i && q == velocity_i) || (flip_j && q == velocity_j))
+                {
+                    u = -u;
+                }
+                array[n + q * sq] = u;
+            }
+        }
+    }
+}
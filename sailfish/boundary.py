@@ -0,0 +1,189 @@
+"""
+Fills the guard zones of 2D patches with one kernel launch per patch.
+
+This is an alternative to `sailfish.subdivide.GuardZoneExchange`, for runs
+where all of the patches are in one process, and on one device. Rather than
+copying each guard region with a separate array operation, and applying the
+domain edge conditions with Python loops, the `apply_boundary_conditions`
+kernel fills every guard zone of a patch, including those copied from its
+neighbors (and from the patch itself, at periodic edges), in one launch.
+The result is the same as that of the exchange.
+"""
+
+from enum import Enum
+from functools import lru_cache
+from sailfish.kernel.library import Library
+
+
+class BoundaryCondition(Enum):
+    """
+    The condition applied at a (non-periodic) domain edge.
+
+    `OUTFLOW` copies the nearest interior zone, `REFLECTING` mirrors the
+    interior zones and negates the normal velocity, and `INFLOW` sets the
+    guard zones to fixed values.
+    """
+
+    OUTFLOW = 1
+    REFLECTING = 2
+    INFLOW = 3
+
+
+BC_NEIGHBOR = 0
+
+NEIGHBOR_OFFSETS = [
+    (-1, -1),
+    (-1, 0),
+    (-1, 1),
+    (0, -1),
+    (0, 1),
+    (1, -1),
+    (1, 0),
+    (1, 1),
+]
+
+
+@lru_cache(maxsize=None)
+def make_library(mode, layout="aos", precision="double"):
+    """
+    Compile the boundary condition kernel library, once for each mode,
+    layout, and precision.
+    """
+    with open(__file__.replace(".py", ".c")) as f:
+        code = f.read()
+
+    return Library(code, mode=mode, layout=layout, precision=precision)
+
+
+class GuardZoneFill:
+    """
+    Fills the guard zones of the patches in a `BlockDecomposition`, which
+    must all be owned by this process, and be on the same device.
+
+    The `edges` are the boundary conditions at the domain edges, in the order
+    (axis 0 lower, axis 0 upper, axis 1 lower, axis 1 upper); they are not
+    used on periodic axes. The `velocity_fields` are the field indexes of the
+    velocity components on each axis, which are negated by reflecting edges.
+    The `inflow` values, if given, are a sequence of the field values imposed
+    on each edge.
+
+    The patches are filled concurrently: each one waits for its neighbors to
+    finish their pending work before it's filled, and then the neighbors wait
+    for it to be filled before they go on, as in `GuardZoneExchange.fill`.
+    """
+
+    def __init__(
+        self,
+        decomposition,
+        num_guard,
+        num_fields,
+        edges,
+        mode,
+        layout="aos",
+        precision="double",
+        velocity_fields=(-1, -1),
+        inflow=None,
+    ):
+        import numpy as np
+
+        if len(decomposition.owned) != len(decomposition):
+            raise ValueError("all of the patches must be owned by one process")
+
+        self.decomposition = decomposition
+        self.num_guard = num_guard
+        self.num_fields = num_fields
+        self.edges = [BoundaryCondition(e) for e in edges]
+        self.velocity_fields = velocity_fields
+        self.lib = make_library(mode, layout, precision)
+        self.inflow = np.zeros((4, num_fields))
+
+        if inflow is not None:
+            self.inflow[...] = inflow
+
+        self.device_inflow = None
+
+    def neighbor(self, n, di, dj):
+        """
+        Return the index of the patch at the block offset `(di, dj)` from
+        patch n, or None if there is no patch there.
+        """
+        d = self.decomposition
+
+        for axis, offset in ((0, di), (1, dj)):
+            if n is not None and offset != 0:
+                n = d.neighbor(n, axis, (offset + 1) // 2)
+
+        return n
+
+    def edge_codes(self, n):
+        """
+        Return the edge codes passed to the kernel for patch n.
+        """
+        codes = []
+
+        for axis in (0, 1):
+            for side in (0, 1):
+                if self.decomposition.neighbor(n, axis, side) is not None:
+                    codes.append(BC_NEIGHBOR)
+                else:
+                    codes.append(self.edges[2 * axis + side].value)
+
+        return codes
+
+    def patch_shape(self, n, default=None):
+        """
+        Return the shape of patch n, or of the `default` patch if n is None.
+        """
+        if n is None:
+            n = default
+
+        (i0, i1), (j0, j1) = self.decomposition.index_range(n)
+        return i1 - i0, j1 - j0
+
+    def fill(self, arrays, contexts):
+        """
+        Fill the guard zones of the given arrays, one per patch, in storage
+        layout (i.e. not logical views). Each patch is filled in its
+        execution context.
+        """
+        ng = self.num_guard
+        nq = self.num_fields
+        vi, vj = self.velocity_fields
+        ready = [context.record() for context in contexts]
+
+        if self.device_inflow is None:
+            with contexts[0]:
+                self.device_inflow = self.lib.xp.array(self.inflow)
+
+        for n, (array, context) in enumerate(zip(arrays, contexts)):
+            neighbors = [self.neighbor(n, di, dj) for di, dj in NEIGHBOR_OFFSETS]
+            context.wait(*(ready[m] for m in set(neighbors) if m is not None))
+            ni, nj = self.patch_shape(n)
+            ni_l = self.patch_shape(self.neighbor(n, -1, 0), n)[0]
+            ni_r = self.patch_shape(self.neighbor(n, +1, 0), n)[0]
+            nj_l = self.patch_shape(self.neighbor(n, 0, -1), n)[1]
+            nj_r = self.patch_shape(self.neighbor(n, 0, +1), n)[1]
+
+            with context:
+                self.lib.apply_boundary_conditions[2 * ng * (ni + nj + 2 * ng)](
+                    array,
+                    *(array if m is None else arrays[m] for m in neighbors),
+                    self.device_inflow,
+                    ni,
+                    nj,
+                    ni_l,
+                    ni_r,
+                    nj_l,
+                    nj_r,
+                    ng,
+                    nq,
+                    *self.edge_codes(n),
+                    vi,
+                    vj,
+                )
+
+        done = [context.record() for context in contexts]
+
+        for n, context in enumerate(contexts):
+            neighbors = [self.neighbor(n, di, dj) for di, dj in NEIGHBOR_OFFSETS]
+            context.wait(*(done[m] for m in set(neighbors) if m is not None))
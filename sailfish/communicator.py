@@ -0,0 +1,152 @@
+"""
+Inter-process communication for distributed-memory runs.
+
+A communicator is an object with `rank` and `size` attributes, and methods to
+apply collective reductions, to gather data to the root process, to wait at
+a barrier, and to post and complete nonblocking point-to-point messages.
+Solvers obtain the communicator for the run with `get_communicator`. If MPI
+was not initialized by `init_communicator`, that is a `SerialCommunicator`,
+whose methods are trivial, so solvers do not need to special-case
+single-process runs.
+"""
+
+from logging import getLogger
+
+logger = getLogger(__name__)
+
+
+class SerialCommunicator:
+    """
+    A communicator for a single process.
+    """
+
+    rank = 0
+    size = 1
+    cuda_aware = False
+
+    def allreduce(self, value, op="sum"):
+        return value
+
+    def gather(self, value, root=0):
+        return [value]
+
+    def barrier(self):
+        pass
+
+    def start_exchange(self, sends, recvs):
+        if sends or recvs:
+            raise ValueError("serial communicator cannot send messages")
+        return []
+
+    def wait(self, requests):
+        pass
+
+
+class MPICommunicator:
+    """
+    A communicator wrapping an `mpi4py` communicator (MPI_COMM_WORLD by
+    default).
+
+    If `cuda_aware` is true, the MPI library is assumed to accept device
+    buffers, so solvers may pass cupy arrays to `start_exchange` instead of
+    staging them through host memory. Device buffers must be complete (i.e.
+    the stream which wrote them synchronized) before they are sent.
+    """
+
+    def __init__(self, comm=None, cuda_aware=False):
+        from mpi4py import MPI
+
+        self.mpi = MPI
+        self.comm = comm or MPI.COMM_WORLD
+        self.rank = self.comm.Get_rank()
+        self.size = self.comm.Get_size()
+        self.cuda_aware = cuda_aware
+
+    def allreduce(self, value, op="sum"):
+        """
+        Apply a reduction ("sum", "max", or "min") to a Python value over all
+        processes, and return the result on every process.
+        """
+        ops = dict(sum=self.mpi.SUM, max=self.mpi.MAX, min=self.mpi.MIN)
+        return self.comm.allreduce(value, op=ops[op])
+
+    def gather(self, value, root=0):
+        """
+        Return a list of the values on all processes on the root process, and
+        None elsewhere.
+        """
+        return self.comm.gather(value, root=root)
+
+    def barrier(self):
+        """
+        Block until all processes have reached the barrier.
+        """
+        self.comm.Barrier()
+
+    def start_exchange(self, sends, recvs):
+        """
+        Post nonblocking sends and receives, and return a list of requests.
+
+        The `sends` and `recvs` arguments are sequences of `(rank, tag,
+        buffer)` tuples, where `buffer` is a contiguous numpy (or, if the
+        communicator is CUDA-aware, cupy) array. The buffers must not be
+        accessed until `wait` has been called on the returned requests.
+        """
+        requests = []
+
+        for source, tag, buffer in recvs:
+            requests.append(self.comm.Irecv(buffer, source=source, tag=tag))
+
+        for dest, tag, buffer in sends:
+            requests.append(self.comm.Isend(buffer, dest=dest, tag=tag))
+
+        return requests
+
+    def wait(self, requests):
+        """
+        Block until the given requests are complete.
+        """
+        self.mpi.Request.Waitall(requests)
+
+
+communicator = SerialCommunicator()
+
+
+def init_communicator(mode="host"):
+    """
+    Initialize MPI and make it the communicator for this run.
+
+    The `mode` is either "host" (message buffers are staged through host
+    memory) or "cuda-aware" (the MPI library is given device buffers).
+    """
+    global communicator
+
+    if mode not in ("host", "cuda-aware"):
+        raise ValueError(f"mpi mode must be host or cuda-aware, got {mode}")
+
+    communicator = MPICommunicator(cuda_aware=(mode == "cuda-aware"))
+    logger.info(f"MPI rank {communicator.rank} of {communicator.size} ({mode})")
+    return communicator
+
+
+def get_communicator():
+    """
+    Return the communicator for this run.
+    """
+    return communicator
+
+
+def partition_patches(num_patches, comm):
+    """
+    Return the range of global patch indexes owned by the given rank.
+
+    The patches are divided into contiguous blocks, so that neighboring
+    patches are on the same rank whenever possible.
+    """
+    from sailfish.subdivide import subdivide
+
+    if num_patches < comm.size:
+        raise ValueError(
+            f"number of patches {num_patches} is less than mpi size {comm.size}"
+        )
+    return list(subdivide(num_patches, comm.size))[comm.rank]
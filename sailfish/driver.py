@@ -5,18 +5,24 @@ Library functions and command-line access to the simulation driver.
 import os, pickle, pathlib
 from typing import NamedTuple, Dict
 from logging import getLogger
+from sailfish.communicator import init_communicator, get_communicator
+from sailfish.kernel.profiler import profile_summary
 from sailfish.event import Recurrence, RecurringEvent, ParseRecurrenceError
 from sailfish.setup_base import SetupBase, SetupError
 from sailfish.solver_base import SolverBase
+from sailfish.writer import AsyncWriter, snapshot, fsync_path, staging_filename
 from sailfish.solvers import (
     SolverInitializationError,
     register_solver_extension,
     make_solver,
+    build_solver_libraries,
 )
 
 logger = getLogger(__name__)
 user_build_config = dict()
 
+PROFILED_SOLVER_METHODS = ("advance", "set_bc", "maximum_wavespeed", "reductions")
+
 
 class ConfigurationError(Exception):
     """An invalid runtime configuration"""
@@ -140,10 +146,31 @@ def update_where_none(new, old, frozen=[]):
 #         return d
 
 
-def write_checkpoint(number, outdir, state):
+def write_checkpoint(number, outdir, state, writer=None):
     """
-    Write the simulation state to a file, as a pickle.
+    Write the simulation state to a file, as a pickle or an HDF5 file.
+
+    The format is determined by the driver's `chkpt_format`, see
+    `write_checkpoint_hdf5`. If the solver does not provide solution blocks,
+    a pickle is written. In an MPI run, this function must be called on every
+    process, since the solution is gathered to the root process, which writes
+    the file.
+
+    If `writer` is an `AsyncWriter`, the state is copied to the host, and the
+    file is written, flushed to disk, and renamed into place by the writer
+    thread, after this function has returned.
     """
+    fmt = state.driver.chkpt_format or "pickle"
+
+    if fmt not in ("pickle", "hdf5", "hdf5-gzip"):
+        raise ConfigurationError(f"unknown checkpoint format {fmt}")
+
+    if fmt != "pickle":
+        if state.solver.solution_blocks() is not None:
+            compress = fmt == "hdf5-gzip"
+            return write_checkpoint_hdf5(number, outdir, state, compress, writer)
+        logger.warning(f"solver {state.setup.solver} requires pickle checkpoints")
+
     if type(number) is int:
         filename = f"chkpt.{number:04d}.pk"
     elif type(number) is str:
@@ -151,17 +178,116 @@ def write_checkpoint(number, outdir, state):
     else:
         raise ValueError("number arg must be int or str")
 
+    state_checkpoint_dict = dict(
+        iteration=state.iteration,
+        time=state.solver.time,
+        timestep_dt=state.timestep_dt,
+        cfl_number=state.cfl_number,
+        solution=state.solver.solution,
+        primitive=state.solver.primitive,
+        timeseries=state.timeseries,
+        solver=state.setup.solver,
+        solver_options=state.solver.options,
+        event_states=state.event_states,
+        driver=state.driver,
+        model_parameters=state.setup.model_parameter_dict(),
+        setup_name=state.setup.dash_case_class_name(),
+        mesh=state.mesh,
+        profile=profile_summary(),
+        **state.setup.checkpoint_diagnostics(state.solver.time),
+    )
+
+    if get_communicator().rank != 0:
+        return
+
     if outdir is not None:
         pathlib.Path(outdir).mkdir(parents=True, exist_ok=True)
         filename = os.path.join(outdir, filename)
 
-    state_checkpoint_dict = dict(
+    if writer is None:
+        with open(filename, "wb") as chkpt:
+            logger.info(f"write checkpoint {chkpt.name}")
+            pickle.dump(state_checkpoint_dict, chkpt)
+    else:
+        state_checkpoint_dict = snapshot(state_checkpoint_dict)
+        logger.info(f"queue checkpoint {filename}")
+        writer.submit(lambda: write_pickle_durably(filename, state_checkpoint_dict))
+
+
+def write_pickle_durably(filename, obj):
+    """
+    Pickle an object to a staging file, flush it to disk, and then rename it
+    to the given file name, so that the file is either complete or absent.
+    """
+    staging = staging_filename(filename)
+
+    with open(staging, "wb") as f:
+        pickle.dump(obj, f)
+        f.flush()
+        os.fsync(f.fileno())
+
+    os.replace(staging, filename)
+    logger.info(f"wrote checkpoint {filename}")
+
+
+def write_checkpoint_hdf5(number, outdir, state, compress=False, writer=None):
+    """
+    Write the simulation state to an HDF5 file.
+
+    The solution is written to a chunked dataset called `solution`, having
+    chunks the size of the largest patch. Each block returned by
+    `solver.solution_blocks` is copied from its device to the host and
+    written to the file separately, so the solution is never gathered into a
+    single array. If `compress` is true, the chunks are gzip-compressed. All
+    the other items of the state are pickled into a small uint8 dataset
+    called `header`. The file attribute `complete` is written last, so that
+    files left incomplete by an interrupted run can be detected without
+    reading them.
+
+    In an MPI run, the file is opened by all processes with the "mpio" HDF5
+    driver, which requires h5py to be built with parallel HDF5. The writes
+    are collective, so the `writer` is only used in single-process runs; the
+    blocks are then copied to the host at once, and the file is written by
+    the writer thread.
+    """
+    import h5py
+    import numpy as np
+    from sailfish.subdivide import to_host
+
+    comm = get_communicator()
+
+    if type(number) is int:
+        filename = f"chkpt.{number:04d}.h5"
+    elif type(number) is str:
+        filename = f"chkpt.{number}.h5"
+    else:
+        raise ValueError("number arg must be int or str")
+
+    if outdir is not None:
+        if comm.rank == 0:
+            pathlib.Path(outdir).mkdir(parents=True, exist_ok=True)
+        comm.barrier()
+        filename = os.path.join(outdir, filename)
+
+    # Chunks are the size of the largest block on any process, since every
+    # process must pass the same chunk shape to the collective dataset
+    # creation, but capped at 1 GB since HDF5 does not permit chunks larger
+    # than 4 GB. A process which owns no blocks contributes an empty fields
+    # tuple, which compares less than any other.
+    blocks = state.solver.solution_blocks()
+    rows = max((i1 - i0 for ((i0, i1), _), _ in blocks), default=0)
+    cols = max((j1 - j0 for (_, (j0, j1)), _ in blocks), default=0)
+    rows = comm.allreduce(rows, op="max")
+    cols = comm.allreduce(cols, op="max")
+    fields = comm.allreduce(blocks[0][1].shape[2:] if blocks else (), op="max")
+    row_bytes = cols * int(np.prod(fields)) * 8
+    chunks = (max(1, min(rows, 2**30 // row_bytes)), cols) + fields
+    header = dict(
         iteration=state.iteration,
         time=state.solver.time,
         timestep_dt=state.timestep_dt,
         cfl_number=state.cfl_number,
-        solution=state.solver.solution,
-        primitive=state.solver.primitive,
+        primitive=None,
         timeseries=state.timeseries,
         solver=state.setup.solver,
         solver_options=state.solver.options,
@@ -170,29 +296,97 @@ def write_checkpoint(number, outdir, state):
         model_parameters=state.setup.model_parameter_dict(),
         setup_name=state.setup.dash_case_class_name(),
         mesh=state.mesh,
+        profile=profile_summary(),
         **state.setup.checkpoint_diagnostics(state.solver.time),
     )
+    header = np.frombuffer(pickle.dumps(header), dtype=np.uint8)
+    shape = tuple(state.mesh.shape) + fields
 
-    with open(filename, "wb") as chkpt:
-        logger.info(f"write checkpoint {chkpt.name}")
-        pickle.dump(state_checkpoint_dict, chkpt)
+    if comm.size > 1:
+        kwargs = dict(driver="mpio", comm=comm.comm)
+    else:
+        kwargs = dict()
+
+    def write():
+        with h5py.File(filename, "w", **kwargs) as f:
+            f.create_dataset("header", data=header)
+            dset = f.create_dataset(
+                "solution",
+                shape=shape,
+                dtype=np.float64,
+                chunks=chunks,
+                compression="gzip" if compress else None,
+            )
+            for ((i0, i1), (j0, j1)), block in blocks:
+                dset[i0:i1, j0:j1] = to_host(block)
+
+            f.attrs["complete"] = True
+
+    if writer is None or comm.size > 1:
+        logger.info(f"write checkpoint {filename}")
+        write()
+    else:
+        blocks = [(index_range, snapshot(block)) for index_range, block in blocks]
+        logger.info(f"queue checkpoint {filename}")
+
+        def write_durably():
+            write()
+            fsync_path(filename)
+            logger.info(f"wrote checkpoint {filename}")
+
+        writer.submit(write_durably)
 
 
 def load_checkpoint(chkpt_file):
     """
-    Load the simulation state from a pickle file.
+    Load the simulation state from a pickle or HDF5 file.
+
+    For an HDF5 file, the `solution` item is the h5py dataset, so a solver
+    reads only the blocks of the solution that its patches own, when it
+    indexes the dataset with those blocks' index ranges.
     """
     try:
+        if chkpt_file.endswith(".h5"):
+            return load_checkpoint_hdf5(chkpt_file)
+
         with open(chkpt_file, "rb") as file:
             return pickle.load(file)
     except FileNotFoundError:
         raise ConfigurationError(f"could not open checkpoint file {chkpt_file}")
 
 
+def load_checkpoint_hdf5(chkpt_file, validate_only=False):
+    """
+    Load the header of an HDF5 checkpoint, and open its solution dataset.
+
+    The file is left open for reading, until the solution dataset is no
+    longer referenced. If `validate_only` is true, only check that the file
+    was completed, and return None.
+    """
+    import h5py
+
+    if not os.path.exists(chkpt_file):
+        raise FileNotFoundError(chkpt_file)
+
+    f = h5py.File(chkpt_file, "r")
+
+    if not f.attrs.get("complete", False):
+        f.close()
+        raise ConfigurationError(f"checkpoint file {chkpt_file} is incomplete")
+
+    if validate_only:
+        f.close()
+        return None
+
+    state = pickle.loads(f["header"][()].tobytes())
+    state["solution"] = f["solution"]
+    return state
+
+
 def newest_chkpt_in_directory(directory_name):
     import re
 
-    expr = re.compile("chkpt\.([0-9]+)\.pk")
+    expr = re.compile("chkpt\.([0-9]+)\.(pk|h5)")
     list_of_matches = list(
         filter(None, (expr.search(f) for f in os.listdir(directory_name)))
     )
@@ -201,7 +395,10 @@ def newest_chkpt_in_directory(directory_name):
     for match in reversed(list_of_matches):
         try:
             path = os.path.join(directory_name, match.group())
-            load_checkpoint(path)  # exception if checkpoint is corrupted
+            if path.endswith(".h5"):
+                load_checkpoint_hdf5(path, validate_only=True)
+            else:
+                load_checkpoint(path)  # exception if checkpoint is corrupted
             return path
         except:
             logger.warning(f"skipping corrupt checkpoint file {path}")
@@ -237,12 +434,20 @@ class DriverArgs(NamedTuple):
     cfl_number: float = None
     end_time: float = None
     execution_mode: str = None
+    mpi: str = None
+    chkpt_format: str = None
     fold: int = None
     resolution: int = None
     num_patches: int = None
     events: Dict[str, Recurrence] = dict()
     new_timestep_cadence: int = None
     verbose_output: str = ""
+    profile: bool = False
+    peak_bandwidth: float = None
+    predict_timestep: bool = False
+    timestep_safety: float = None
+    timestep_threshold: float = None
+    async_output: int = None
 
     def from_namespace(args):
         """
@@ -256,7 +461,7 @@ class DriverArgs(NamedTuple):
         if args.restart_dir:
             setup_name = None
             chkpt_file = newest_chkpt_in_directory(parts[0])
-        elif parts[0].endswith(".pk"):
+        elif parts[0].endswith(".pk") or parts[0].endswith(".h5"):
             setup_name = None
             chkpt_file = parts[0]
         else:
@@ -295,6 +500,73 @@ class DriverState(NamedTuple):
     timestep_dt: float
 
 
+class TimestepPredictor:
+    """
+    Advances a solver with time steps predicted from the maximum wavespeed
+    of the previous step, so the host does not wait for each step to finish
+    before issuing the next one.
+
+    The maximum wavespeed at the start of each step is reduced at the end of
+    the previous step (with `deferred_maximum_wavespeed`), and read back
+    while the step is running. The next step is given the time step `safety
+    * cfl_number * dx / a`, where `a` is that lagged wavespeed. If the value
+    read back shows that a step violated the CFL condition, the step is
+    undone with `rollback` and redone with the exact time step. If the
+    wavespeed changed by more than the `threshold` fraction since the
+    previous step, the lagged value is not trusted, and the next time step
+    is recomputed from the current wavespeed, which does block the host.
+    """
+
+    def __init__(self, solver, mesh, cfl_number, safety, threshold):
+        self.solver = solver
+        self.mesh = mesh
+        self.cfl_number = cfl_number
+        self.safety = safety
+        self.threshold = threshold
+        self.wavespeed = None
+        self.pending = None
+        self.recompute = True
+        self.num_rollbacks = 0
+        self.num_recomputes = 0
+
+    def advance(self):
+        """
+        Advance the solver by one step, and return the time step used.
+        """
+        solver = self.solver
+        cfl_number = self.cfl_number
+        dx = self.mesh.min_spacing(solver.time)
+
+        if self.recompute:
+            pending = self.pending or solver.deferred_maximum_wavespeed()
+            self.wavespeed = pending()
+            self.num_recomputes += 1
+            dt = cfl_number * dx / self.wavespeed
+            check = None
+        else:
+            dt = self.safety * cfl_number * dx / self.wavespeed
+            check = self.pending
+
+        solver.advance(dt)
+        self.pending = solver.deferred_maximum_wavespeed()
+        self.recompute = False
+
+        if check is not None:
+            wavespeed = check()
+
+            if dt * wavespeed > cfl_number * dx:
+                solver.rollback()
+                dt = cfl_number * dx / wavespeed
+                solver.advance(dt)
+                self.pending = solver.deferred_maximum_wavespeed()
+                self.num_rollbacks += 1
+
+            self.recompute = abs(wavespeed / self.wavespeed - 1.0) > self.threshold
+            self.wavespeed = wavespeed
+
+        return dt
+
+
 def simulate(driver):
     """
     Main generator for running simulations.
@@ -308,6 +580,7 @@ def simulate(driver):
     """
     from sailfish import __version__ as version
     from sailfish.kernel.system import configure_build, log_system_info, measure_time
+    from sailfish.kernel.profiler import enable_profiling, disable_profiling
     from sailfish.event import Recurrence
     from sailfish import solvers
 
@@ -416,6 +689,9 @@ def simulate(driver):
     the platform (Linux or MacOS), but in the future these should also be
     extensible by a system-specific rc-style configuration file.
     """
+    if driver.mpi is not None:
+        init_communicator(driver.mpi)
+
     configure_build(**user_build_config, execution_mode=driver.execution_mode)
     log_system_info(driver.execution_mode or "cpu")
 
@@ -448,6 +724,9 @@ def simulate(driver):
         mode=mode,
     )
 
+    if get_communicator().size > 1 and not solver.supports_mpi:
+        raise ConfigurationError(f"solver {setup.solver} does not support MPI")
+
     if driver.cfl_number is not None and driver.cfl_number > solver.maximum_cfl:
         raise ConfigurationError(
             f"cfl number {driver.cfl_number} "
@@ -456,6 +735,25 @@ def simulate(driver):
         )
 
     cfl_number = driver.cfl_number or solver.recommended_cfl
+    predictor = None
+
+    if driver.predict_timestep:
+        if not solver.supports_rollback:
+            raise ConfigurationError(
+                f"solver {setup.solver} does not support time step prediction"
+            )
+        predictor = TimestepPredictor(
+            solver,
+            mesh,
+            cfl_number,
+            driver.timestep_safety or 0.9,
+            driver.timestep_threshold or 0.05,
+        )
+
+    if driver.profile:
+        profiler = enable_profiling(mode, driver.peak_bandwidth)
+        profiler.instrument(solver, PROFILED_SOLVER_METHODS)
+        logger.info("kernel profiling is enabled")
 
     for name, event in driver.events.items():
         logger.info(f"recurrence for {name} event is {event}")
@@ -463,7 +761,10 @@ def simulate(driver):
     logger.info(f"run until t={end_time}")
     logger.info(f"CFL number is {cfl_number}")
     logger.info(f"simulation time / user time is {reference_time:0.4f}")
-    logger.info(f"recompute dt every {new_timestep_cadence} iterations")
+    if predictor is not None:
+        logger.info(f"predict dt with safety factor {predictor.safety}")
+    else:
+        logger.info(f"recompute dt every {new_timestep_cadence} iterations")
     setup.print_model_parameters(newlines=True, logger=main_logger)
 
     def grab_state():
@@ -505,19 +806,40 @@ def simulate(driver):
 
         with measure_time(mode) as fold_time:
             for _ in range(fold):
-                if dt is None or (iteration % new_timestep_cadence == 0):
-                    dx = mesh.min_spacing(siml_time)
-                    dt = dx / solver.maximum_wavespeed() * cfl_number
-                solver.advance(dt)
+                if predictor is not None:
+                    dt = predictor.advance()
+                else:
+                    if dt is None or (iteration % new_timestep_cadence == 0):
+                        dx = mesh.min_spacing(siml_time)
+                        dt = dx / solver.maximum_wavespeed() * cfl_number
+                    solver.advance(dt)
                 iteration += 1
 
+        solver.end_fold()
         Mzps = mesh.num_total_zones / fold_time() * 1e-6 * fold
         main_logger.info(
             f"[{iteration:04d}] t={user_time:0.3f} dt={dt:.3e} Mzps={Mzps:.3f}"
         )
 
+    if predictor is not None:
+        logger.info(
+            f"time step predictor made {predictor.num_rollbacks} rollbacks "
+            f"and {predictor.num_recomputes} full recomputes"
+        )
+
+    report = solver.runtime_report()
+
+    if report is not None:
+        logger.info(f"\n{report}\n")
+
+    if driver.profile:
+        main_logger.info(f"\n{profiler.table()}\n")
+
     yield "end", None, grab_state()
 
+    if driver.profile:
+        disable_profiling()
+
 
 def run(setup_name, quiet=True, **kwargs):
     """
@@ -579,6 +901,31 @@ def init_logging():
     root_logger.setLevel(INFO)
 
 
+def build_libraries(mode="gpu"):
+    """
+    Precompile the kernel libraries of every solver into the module cache.
+
+    This is the `sailfish build` command. In gpu mode, the libraries are
+    compiled once for each distinct architecture of the visible GPU's, so a
+    cache directory shared by many jobs can be populated ahead of time.
+    """
+    from sailfish.kernel.system import configure_build, gpu_architectures
+
+    configure_build(**user_build_config, execution_mode=mode)
+
+    if mode == "gpu":
+        from cupy.cuda import Device
+
+        for arch, device_id in gpu_architectures().items():
+            logger.info(f"build solver libraries for sm_{arch}")
+
+            with Device(device_id):
+                build_solver_libraries(mode)
+    else:
+        logger.info(f"build solver libraries for {mode} mode")
+        build_solver_libraries(mode)
+
+
 def load_user_config():
     """
     Initialize user extensions: setups and solvers outside the main codebase.
@@ -625,6 +972,7 @@ def main():
     General-purpose command line interface.
     """
     import argparse
+    import sys
     import sailfish
     import sailfish.setups
 
@@ -652,7 +1000,9 @@ def main():
     parser.add_argument(
         "command",
         nargs="?",
-        help="setup name or restart file (if directory, then load newest checkpoint)",
+        help="setup name or restart file (if directory, then load newest checkpoint), "
+        "or 'build' to precompile the solver libraries, "
+        "or 'bench' to run the benchmark suite (see 'sailfish bench --help')",
     )
     parser.add_argument(
         "--describe",
@@ -693,6 +1043,25 @@ def main():
         type=int,
         help="iterations between recomputing the timestep dt",
     )
+    parser.add_argument(
+        "--predict-timestep",
+        action="store_true",
+        help="predict dt from the previous step's wavespeed, rolling back on CFL "
+        "violations, instead of recomputing it with a blocking reduction",
+    )
+    parser.add_argument(
+        "--timestep-safety",
+        metavar="S",
+        type=float,
+        help="factor applied to the predicted dt (default 0.9)",
+    )
+    parser.add_argument(
+        "--timestep-threshold",
+        metavar="T",
+        type=float,
+        help="fractional wavespeed change that triggers a full dt recompute "
+        "(default 0.05)",
+    )
     parser.add_argument(
         "--events",
         nargs="*",
@@ -771,6 +1140,17 @@ def main():
         type=str,
         help="path to a module defining a get_event_handlers function",
     )
+    parser.add_argument(
+        "--profile",
+        action="store_true",
+        help="time each kernel launch and print a summary at the end of the run",
+    )
+    parser.add_argument(
+        "--peak-bandwidth",
+        metavar="B",
+        type=float,
+        help="peak memory bandwidth in GB/s for the profile (default: from the GPU)",
+    )
     parser.add_argument(
         "--verbose-output",
         metavar="P",
@@ -778,6 +1158,27 @@ def main():
         default="",
         help="detailed print solver structs [physics,options]",
     )
+    parser.add_argument(
+        "--checkpoint-format",
+        dest="chkpt_format",
+        choices=["pickle", "hdf5", "hdf5-gzip"],
+        help="checkpoint file format (hdf5 requires h5py)",
+    )
+    parser.add_argument(
+        "--async-output",
+        metavar="N",
+        nargs="?",
+        const=1,
+        type=int,
+        help="write checkpoints on a background thread, with up to N queued",
+    )
+    parser.add_argument(
+        "--mpi",
+        nargs="?",
+        const="host",
+        choices=["host", "cuda-aware"],
+        help="distribute patches over MPI processes (requires mpi4py)",
+    )
     exec_group = parser.add_mutually_exclusive_group()
     exec_group.add_argument(
         "--mode",
@@ -806,12 +1207,20 @@ def main():
         init_logging()
         load_user_config()
 
+        if sys.argv[1:2] == ["bench"]:
+            from sailfish.bench import main as bench_main
+
+            sys.exit(bench_main(sys.argv[2:], build_config=user_build_config))
+
         args = parser.parse_args()
 
         if args.describe and args.command is not None:
             setup_name = args.command.split(":")[0]
             SetupBase.find_setup_class(setup_name).describe_class()
 
+        elif args.command == "build":
+            build_libraries(args.execution_mode or "gpu")
+
         elif args.command is None:
             print("specify setup:")
             for setup in SetupBase.__subclasses__():
@@ -837,18 +1246,27 @@ def main():
             else:
                 events_dict = dict()
 
-            for name, number, state in simulate(driver):
-                if name == "timeseries":
-                    append_timeseries(state)
-                elif name == "checkpoint":
-                    write_checkpoint(number, outdir, state)
-                elif name == "end":
-                    if args.final_chkpt:
-                        write_checkpoint("final", outdir, state)
-                elif name in events_dict:
-                    events_dict[name](number, outdir, state, logger)
-                else:
-                    logger.warning(f"unrecognized event {name}")
+            if driver.async_output:
+                writer = AsyncWriter(max_pending=driver.async_output)
+            else:
+                writer = None
+
+            try:
+                for name, number, state in simulate(driver):
+                    if name == "timeseries":
+                        append_timeseries(state)
+                    elif name == "checkpoint":
+                        write_checkpoint(number, outdir, state, writer)
+                    elif name == "end":
+                        if args.final_chkpt:
+                            write_checkpoint("final", outdir, state, writer)
+                    elif name in events_dict:
+                        events_dict[name](number, outdir, state, logger)
+                    else:
+                        logger.warning(f"unrecognized event {name}")
+            finally:
+                if writer is not None:
+                    writer.close()
 
     except ConfigurationError as e:
         print(f"bad configuration: {e}")
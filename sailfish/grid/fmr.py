@@ -1,3 +1,6 @@
+from .node import Node4, geo_to_top
+
+
 class CartesianMesh:
     def __init__(
         self,
@@ -66,6 +69,123 @@ class CartesianMesh:
         return self.coordinate_array(location="vert", *args, **kwargs)
 
 
+class BlockHierarchy:
+    """
+    A fixed hierarchy of square 2D blocks, refined by factors of two.
+
+    Level 0 is a uniform `num_blocks x num_blocks` grid of blocks covering
+    the domain `extent = ((x0, x1), (y0, y1))`, where `num_blocks` is a power
+    of two. A block at level `n < max_level` is replaced by its four children
+    at level `n + 1` if `refine(n, block_extent)` is true, and if all eight
+    of its neighbors at level `n` exist (or are outside the domain). The
+    second condition keeps the hierarchy properly nested, so that blocks
+    which share an edge or a corner differ by at most one level.
+
+    Blocks are identified by a geometrical index `(level, (i, j))`. They are
+    also stored in a `Node4` quad-tree, at the topological index of depth
+    `log2(num_blocks) + level`; the tree is how the structure would be
+    generalized to three dimensions and written to a checkpoint.
+    """
+
+    def __init__(self, extent, num_blocks, max_level, refine):
+        if num_blocks < 1 or num_blocks & (num_blocks - 1):
+            raise ValueError("num_blocks must be a power of two")
+
+        self._extent = extent
+        self._num_blocks = num_blocks
+        self._depth = num_blocks.bit_length() - 1
+        self._levels = [{(i, j) for i in range(num_blocks) for j in range(num_blocks)}]
+        self.tree = Node4()
+
+        for level in range(max_level):
+            children = set()
+
+            for index in sorted(self._levels[level]):
+                if self.is_nested(level, index) and refine(
+                    level, self.block_extent(level, index)
+                ):
+                    i, j = index
+                    children.update(
+                        (2 * i + di, 2 * j + dj) for di in range(2) for dj in range(2)
+                    )
+
+            if not children:
+                break
+
+            self._levels.append(children)
+
+        for level, index in self.blocks():
+            self.tree.require(self.topological_index(level, index)).value = index
+
+    def topological_index(self, level, index):
+        """
+        Return the path from the root of the tree to the given block. The
+        first element of the `geo_to_top` index is from the least significant
+        bit of the geometrical index, so it's reversed here, to put parents
+        before their children.
+        """
+        return tuple(reversed(tuple(geo_to_top(self._depth + level, index))))
+
+    @property
+    def num_levels(self):
+        """
+        Return the number of levels which have blocks.
+        """
+        return len(self._levels)
+
+    def blocks(self, level=None):
+        """
+        Return a sorted list of the `(level, (i, j))` indexes of the blocks,
+        at the given level or at every level.
+        """
+        levels = range(self.num_levels) if level is None else [level]
+        return [(n, index) for n in levels for index in sorted(self._levels[n])]
+
+    def contains(self, level, index):
+        return 0 <= level < self.num_levels and index in self._levels[level]
+
+    def in_domain(self, level, index):
+        n = self._num_blocks << level
+        return all(0 <= i < n for i in index)
+
+    def is_nested(self, level, index):
+        """
+        Return true if every neighbor of the given block, at the same level,
+        either exists or is outside the domain.
+        """
+        i, j = index
+        return all(
+            self.contains(level, (i + di, j + dj))
+            or not self.in_domain(level, (i + di, j + dj))
+            for di in (-1, 0, 1)
+            for dj in (-1, 0, 1)
+        )
+
+    def parent(self, level, index):
+        """
+        Return the index of the parent block, and the quadrant of the parent
+        which the block covers, or None for a level 0 block.
+        """
+        if level == 0:
+            return None
+        i, j = index
+        return (level - 1, (i // 2, j // 2)), (i % 2, j % 2)
+
+    def has_children(self, level, index):
+        return not self.tree[self.topological_index(level, index)].is_leaf()
+
+    def block_extent(self, level, index):
+        """
+        Return the region `((x0, x1), (y0, y1))` covered by the given block.
+        """
+        (x0, x1), (y0, y1) = self._extent
+        n = self._num_blocks << level
+        i, j = index
+        dx = (x1 - x0) / n
+        dy = (y1 - y0) / n
+        return (x0 + dx * i, x0 + dx * (i + 1)), (y0 + dy * j, y0 + dy * (j + 1))
+
+
 def test_grid():
     def initial_data(xyz):
         from numpy import exp
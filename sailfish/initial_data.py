@@ -0,0 +1,86 @@
+"""
+Generation of initial data on blocks of 2D planar cartesian meshes.
+
+Calling a setup's `primitive` method once per zone dominates the startup
+time of large runs. `initial_primitive` uses the setup's vectorized
+`primitive_array` method instead, when the setup implements one, to
+evaluate a whole block at once, with the array module of the patch that
+will own the block; in gpu mode the data is then generated on the patch's
+device. Otherwise it falls back to the per-zone method, which it can spread
+over a pool of worker processes.
+"""
+
+from concurrent.futures import ProcessPoolExecutor
+from itertools import repeat
+from sailfish.subdivide import subdivide
+
+
+def cell_coordinate_arrays(mesh, index_range, xp):
+    """
+    Return arrays of the x and y coordinates of the zone centers in the
+    block `((i0, i1), (j0, j1))` of a `PlanarCartesian2DMesh`. The values
+    are the same as those returned by `mesh.cell_coordinates`.
+    """
+    (i0, i1), (j0, j1) = index_range
+    x = mesh.x0 + (xp.arange(i0, i1) + 0.5) * mesh.dx
+    y = mesh.y0 + (xp.arange(j0, j1) + 0.5) * mesh.dy
+    return xp.meshgrid(x, y, indexing="ij")
+
+
+def primitive_by_zone(setup, mesh, time, index_range, num_fields):
+    """
+    Return the primitive data on a block of the mesh, as a numpy array,
+    calling the setup's `primitive` method once per zone.
+    """
+    import numpy as np
+
+    (i0, i1), (j0, j1) = index_range
+    primitive = np.zeros([i1 - i0, j1 - j0, num_fields])
+
+    for i in range(i0, i1):
+        for j in range(j0, j1):
+            x = mesh.cell_coordinates(i, j)
+            setup.primitive(time, x, primitive[i - i0, j - j0])
+
+    return primitive
+
+
+def initial_primitive(setup, mesh, time, index_range, num_fields, xp, num_workers=1):
+    """
+    Return the primitive data on the block `((i0, i1), (j0, j1))` of a 2D
+    planar cartesian mesh, as an array of shape `(i1 - i0, j1 - j0,
+    num_fields)`, allocated with the array module `xp` on the current device.
+
+    If the setup does not implement `primitive_array`, and `num_workers` is
+    greater than one, the rows of the block are divided among that many
+    worker processes, each calling `setup.primitive` once per zone. The setup
+    and mesh must then be picklable.
+    """
+    x, y = cell_coordinate_arrays(mesh, index_range, xp)
+    primitive = setup.primitive_array(time, x, y, xp)
+
+    if primitive is not None:
+        return primitive
+
+    (i0, i1), (j0, j1) = index_range
+
+    if num_workers > 1 and i1 - i0 > 1:
+        import numpy as np
+
+        rows = subdivide((i0, i1), min(4 * num_workers, i1 - i0))
+        blocks = [((a, b), (j0, j1)) for a, b in rows]
+
+        with ProcessPoolExecutor(num_workers) as pool:
+            parts = pool.map(
+                primitive_by_zone,
+                repeat(setup),
+                repeat(mesh),
+                repeat(time),
+                blocks,
+                repeat(num_fields),
+            )
+            primitive = np.concatenate(list(parts))
+    else:
+        primitive = primitive_by_zone(setup, mesh, time, index_range, num_fields)
+
+    return xp.asarray(primitive)
@@ -1,20 +1,22 @@
 """
 Defines a `Library` utility class to encapulsate CPU/GPU compiled kernels.
 
-CPU modules are built with the cffi module. Build products including the .so
-file itself are placed in this module's __pycache__ directory, and stored for
-reuse based on the SHA value of the source code and #define macros. GPU
-modules are JIT-compiled with cupy. No caching is presently done for the GPU
-modules.
+CPU modules are built with the cffi module. GPU modules are compiled with
+NVRTC (through cupy) to a cubin for the current device's architecture. In
+both cases the build products are stored for reuse, keyed by the SHA value of
+the source code, #define macros, and build options (and for GPU modules, the
+architecture and NVRTC version). The cache is this module's __pycache__
+directory, unless the `cache_dir` build option is set.
 """
 
 from platform import system
-from ctypes import c_double, c_int, POINTER, CDLL
+from ctypes import c_double, c_float, c_int, c_void_p, POINTER, CDLL, ArgumentError
 from hashlib import sha256
 from logging import getLogger
-from os import listdir
-from os.path import join, dirname
+from os import listdir, makedirs, replace, getpid
+from os.path import join, dirname, exists
 
+from . import profiler
 from .parse_api import parse_api
 from .system import build_config, measure_time
 
@@ -33,9 +35,11 @@ KERNEL_LIB_HEADER = r"""
 #include <stddef.h>
 #define PRIVATE static
 #define PUBLIC
+#define CONSTANT static const
 #else
 #define PRIVATE static __device__
 #define PUBLIC extern "C" __global__
+#define CONSTANT static __constant__ const
 #endif
 
 #if (EXEC_MODE == EXEC_CPU)
@@ -51,14 +55,46 @@ for (int i = 0; i < NI; ++i) \
 for (int j = 0; j < NJ; ++j) \
 for (int k = 0; k < NK; ++k) \
 
+#define FOR_EACH_2D_TILED(NI, NJ, TI, TJ) FOR_EACH_2D(NI, NJ)
+
+#define FOR_EACH_2D_SIMD(NI, NJ) \
+for (int i = 0; i < NI; ++i) \
+_Pragma("omp simd") \
+for (int j = 0; j < NJ; ++j) \
+
 #elif (EXEC_MODE == EXEC_OMP)
+#ifndef OMP_TILE_I
+#define OMP_TILE_I 1
+#endif
+#ifndef OMP_TILE_J
+#define OMP_TILE_J (1 << 30)
+#endif
+#ifndef OMP_COLLAPSE
+#define OMP_COLLAPSE 1
+#endif
+#ifndef OMP_LOOP_SCHEDULE
+#define OMP_LOOP_SCHEDULE static
+#endif
+#define OMP_PRAGMA_(...) _Pragma(#__VA_ARGS__)
+#define OMP_PRAGMA(...) OMP_PRAGMA_(__VA_ARGS__)
+
 #define FOR_EACH_1D(NI) \
 _Pragma("omp parallel for") \
 for (int i = 0; i < NI; ++i) \
 
-#define FOR_EACH_2D(NI, NJ) \
-_Pragma("omp parallel for") \
+#define FOR_EACH_2D_TILED(NI, NJ, TI, TJ) \
+OMP_PRAGMA(omp parallel for schedule(OMP_LOOP_SCHEDULE) collapse(OMP_COLLAPSE)) \
+for (int ti_ = 0; ti_ < (NI); ti_ += (TI)) \
+for (int tj_ = 0; tj_ < (NJ); tj_ += (TJ)) \
+for (int i = ti_; i < ((NI) < ti_ + (TI) ? (NI) : ti_ + (TI)); ++i) \
+for (int j = tj_; j < ((NJ) < tj_ + (TJ) ? (NJ) : tj_ + (TJ)); ++j) \
+
+#define FOR_EACH_2D(NI, NJ) FOR_EACH_2D_TILED(NI, NJ, OMP_TILE_I, OMP_TILE_J)
+
+#define FOR_EACH_2D_SIMD(NI, NJ) \
+OMP_PRAGMA(omp parallel for schedule(OMP_LOOP_SCHEDULE)) \
 for (int i = 0; i < NI; ++i) \
+_Pragma("omp simd") \
 for (int j = 0; j < NJ; ++j) \
 
 #define FOR_EACH_3D(NI, NJ, NK) \
@@ -83,94 +119,211 @@ int j = threadIdx.y + blockIdx.y * blockDim.y; \
 int k = threadIdx.z + blockIdx.z * blockDim.z; \
 if (i >= NI || j >= NJ || k >= NK) return; \
 
+#define FOR_EACH_2D_TILED(NI, NJ, TI, TJ) FOR_EACH_2D(NI, NJ)
+#define FOR_EACH_2D_SIMD(NI, NJ) FOR_EACH_2D(NI, NJ)
+
+#endif
+
+#define LAYOUT_AOS 0
+#define LAYOUT_SOA 1
+
+#ifndef LAYOUT
+#define LAYOUT LAYOUT_AOS
+#endif
+
+#if (LAYOUT == LAYOUT_SOA)
+#define LAYOUT_STRIDE_I(NI, NJ, NQ) (NJ)
+#define LAYOUT_STRIDE_J(NI, NJ, NQ) 1
+#define LAYOUT_STRIDE_Q(NI, NJ, NQ) ((NI) * (NJ))
+#else
+#define LAYOUT_STRIDE_I(NI, NJ, NQ) ((NJ) * (NQ))
+#define LAYOUT_STRIDE_J(NI, NJ, NQ) (NQ)
+#define LAYOUT_STRIDE_Q(NI, NJ, NQ) ((void) (NI), 1)
+#endif
+
+#ifndef REAL_TYPE
+#define REAL_TYPE double
 #endif
+
+typedef REAL_TYPE real;
 """
 
 
 class KernelInvocation:
     """
     A kernel whose execution shape is specified and is ready to be invoked.
+
+    Invocations are cached by their kernel, one per shape, so the GPU grid
+    dimensions are only computed once per shape. If profiling is enabled
+    (see the `profiler` module), each launch is timed, and the estimated
+    cost of the invocation is computed once and kept in `cost`.
     """
 
     def __init__(self, kernel, shape):
         self.kernel = kernel
         self.shape = shape
+        self.shape_args = tuple(shape)
+        self.cost = None
 
-    def __call__(self, *args):
-        lib = self.kernel.lib
-        rank = len(self.shape)
-        name = self.kernel.symbol.name
-        spec = self.kernel.symbol.args
-
-        if lib.cpu_mode:
-            kernel = getattr(lib.module, name)
-        else:
-            kernel = lib.module.get_function(name)
+        if not kernel.lib.cpu_mode:
+            rank = len(shape)
+            bs = (THREAD_BLOCK_SIZE_1D, THREAD_BLOCK_SIZE_2D, THREAD_BLOCK_SIZE_3D)
+            bs = bs[rank - 1]
+            nb = tuple((n + t - 1) // t for n, t in zip(shape, bs))
+            self.grid = (nb, bs)
 
-        args = list(self.shape) + list(args)
+    def __call__(self, *args):
+        kernel = self.kernel
+        lib = kernel.lib
+        args = self.shape_args + args
 
         if lib.debug:
-            validate_types(args, tuple(spec), name, lib.xp)
-            validate_constraints(args, tuple(spec), name)
+            spec = tuple(kernel.symbol.args)
+            name = kernel.symbol.name
+            validate_types(args, spec, name, lib.xp, lib.real)
+            validate_constraints(args, spec, name, lib.storage_shape, lib.define_macros)
 
-        if lib.cpu_mode:
-            kernel(*to_ctypes(args, spec))
+        if profiler.current is not None:
+            profiler.current.launch(self, args, lambda: self.launch(args))
         else:
-            if rank == 1:
-                (ti,) = bs = THREAD_BLOCK_SIZE_1D
-                (ni,) = self.shape
-                nb = ((ni + ti - 1) // ti,)
-                kernel(nb, bs, args)
+            self.launch(args)
 
-            elif rank == 2:
-                ti, tj = bs = THREAD_BLOCK_SIZE_2D
-                ni, nj = self.shape
-                nb = ((ni + ti - 1) // ti, (nj + tj - 1) // tj)
-                kernel(nb, bs, args)
+    def launch(self, args):
+        kernel = self.kernel
 
-            elif rank == 3:
-                ti, tj, tk = bs = THREAD_BLOCK_SIZE_3D
-                ni, nj, nk = self.shape
-                nb = ((ni + ti - 1) // ti, (nj + tj - 1) // tj, (nk + tk - 1) // tk)
-                kernel(nb, bs, args)
+        if kernel.lib.cpu_mode:
+            kernel.call_cpu(args)
+        else:
+            nb, bs = self.grid
+            kernel.function(nb, bs, kernel.device_args(args))
 
 
 class Kernel:
     """
     An object that uses `__getitem__` syntax to return a
     :py:class:`KernelInvocation` instance.
+
+    The compiled function is looked up once, when the kernel is first
+    accessed on its library. In CPU modes the function's ctypes `argtypes`
+    are also set once, so that most arguments can be passed to it without
+    being wrapped in ctypes objects.
     """
 
     def __init__(self, lib, symbol):
         self.lib = lib
         self.symbol = symbol
+        self.invocations = dict()
+        spec = symbol.args
+
+        if lib.cpu_mode:
+            self.function = getattr(lib.module, symbol.name)
+            self.function.argtypes = ctypes_argtypes(spec, lib.precision)
+            self.pointer_args = [n for n, (t, _, _) in enumerate(spec) if t[-1] == "*"]
+        else:
+            self.function = lib.module.get_function(symbol.name)
+            self.real_args = [n for n, (t, _, _) in enumerate(spec) if t == "real"]
 
     def __getitem__(self, shape):
         if type(shape) == int:
             return self[(shape,)]
+
+        try:
+            return self.invocations[shape]
+        except KeyError:
+            pass
+
         if len(shape) != self.symbol.rank:
             raise ValueError(
                 f"incompatible shape {shape} for kernel "
                 f"{self.symbol.name} with rank {self.symbol.rank}"
             )
         else:
-            return KernelInvocation(self, shape)
+            invocation = self.invocations[shape] = KernelInvocation(self, shape)
+            return invocation
+
+    def call_cpu(self, args):
+        """
+        Call the compiled CPU function, passing the arrays by their address.
+        If an argument is not accepted by the function's `argtypes` (e.g.
+        a numpy integer), all the arguments are converted with `to_ctypes`.
+        """
+        cargs = list(args)
+
+        for n in self.pointer_args:
+            cargs[n] = cargs[n].ctypes.data
+
+        try:
+            self.function(*cargs)
+        except ArgumentError:
+            spec = self.symbol.args
+            self.function(*to_ctypes(args, spec, self.lib.precision))
+
+    def device_args(self, args):
+        """
+        Return the arguments to a GPU kernel, converting the `real` scalars to
+        the `real` type. This is needed because cupy passes Python floats to
+        the kernel as 64-bit values.
+        """
+        if not self.real_args:
+            return args
+
+        args = list(args)
+        for n in self.real_args:
+            args[n] = self.lib.real(args[n])
+        return args
 
 
 class Library:
     """
     Builds and maintains (in memory) a CPU or GPU dynamically compiled module.
+
+    The `layout` argument is either "aos" or "soa", and determines the memory
+    layout of multi-field arrays, for kernels that index their arrays through
+    the `LAYOUT_STRIDE` macros. In the "aos" layout, an array with `nq`
+    fields on an `(ni, nj)` grid has shape `(ni, nj, nq)`, and in the "soa"
+    layout it has shape `(nq, ni, nj)`. The `storage_shape`, `to_storage`,
+    and `logical_view` methods convert between the two.
+
+    The `precision` argument is either "double" or "single", and determines
+    the C type of the `real` and `real*` kernel arguments (`double` or
+    `float`). Arguments declared as `double` are not affected. The numpy (or
+    cupy) scalar type of `real` is available as the `real` attribute.
+
+    The `define_macros` are passed to the compiler, and are also in scope for
+    the kernel argument constraints, so that array shapes can depend on
+    compile-time constants, e.g. `$.shape == (ni, nj, ORDER)`.
     """
 
     def __init__(
-        self, code=None, mode="cpu", name="module", debug=True, define_macros=dict()
+        self,
+        code=None,
+        mode="cpu",
+        name="module",
+        debug=True,
+        define_macros=dict(),
+        layout="aos",
+        precision="double",
     ):
+        if layout not in ("aos", "soa"):
+            raise ValueError(f"unknown memory layout {layout}, must be [aos|soa]")
+
+        if precision not in ("double", "single"):
+            raise ValueError(f"unknown precision {precision}, must be [double|single]")
+
         code = f"{KERNEL_LIB_HEADER} {code}"
+        define_macros = dict(
+            define_macros,
+            LAYOUT=dict(aos=0, soa=1)[layout],
+            REAL_TYPE=dict(double="double", single="float")[precision],
+        )
         logger.info(f"debug mode {'enabled' if debug else 'disabled'}")
         logger.info(f"prepare {name} for {mode} execution")
 
         with measure_time(mode) as prep_time:
             self.debug = debug
+            self.define_macros = define_macros
+            self.layout = layout
+            self.precision = precision
             self.cpu_mode = mode != "gpu"
             self.api = parse_api(code)
 
@@ -181,6 +334,8 @@ class Library:
 
             logger.info(f"module preparation took {prep_time():0.3}s")
 
+        self.real = dict(double=self.xp.float64, single=self.xp.float32)[precision]
+
         for symbol in self.api:
             logger.info(f"+-- {symbol}")
 
@@ -201,6 +356,7 @@ class Library:
             raise ValueError("CPU execution mode not supported on windows")
 
         exec_mode = dict(cpu=0, omp=1)[mode]
+        define_macros = {**build_config["define_macros"], **define_macros}
         define_macros = list(define_macros.items()) + [("EXEC_MODE", exec_mode)]
 
         ffi = cffi.FFI()
@@ -217,8 +373,8 @@ class Library:
         sha = sha256()
         sha.update(code.encode("utf-8"))
         sha.update(str(define_macros).encode("utf-8"))
-        sha.update(str(build_config).encode("utf-8"))
-        cache_dir = join(dirname(__file__), "__pycache__", sha.hexdigest())
+        sha.update(str({**build_config, "cache_dir": None}).encode("utf-8"))
+        cache_dir = join(module_cache_dir(), sha.hexdigest())
 
         try:
             so_name = join(
@@ -236,25 +392,144 @@ class Library:
 
     def load_gpu_module(self, code, define_macros):
         import cupy
+        from cupy.cuda import nvrtc
 
         options = tuple(f"-D {k}={v}" for k, v in define_macros.items()) + (
             "-D EXEC_MODE=2",
         )
-        module = cupy.RawModule(code=code, options=options)
-        module.compile()
-        self.module = module
+        arch = cupy.cuda.Device().compute_capability
+
+        sha = sha256()
+        sha.update(code.encode("utf-8"))
+        sha.update(str(options).encode("utf-8"))
+        sha.update(str((arch, nvrtc.getVersion())).encode("utf-8"))
+        cubin = join(module_cache_dir(), sha.hexdigest(), "module.cubin")
+
+        if exists(cubin):
+            logger.info(f"load cached module for sm_{arch}")
+        else:
+            write_atomic(cubin, compile_cubin(code, options, arch))
+            logger.info(f"recompile module for sm_{arch}")
+
+        self.module = cupy.RawModule(path=cubin)
         self.xp = cupy
 
+    def storage_shape(self, ni, nj, nq):
+        """
+        Return the shape of an array of `nq` fields on an `(ni, nj)` grid.
+        """
+        if self.layout == "soa":
+            return (nq, ni, nj)
+        else:
+            return (ni, nj, nq)
+
+    def to_storage(self, array, dtype=None):
+        """
+        Return a C-contiguous copy of an `(ni, nj, nq)` array, in this
+        library's memory layout, allocated on the current device. If `dtype`
+        is given, the copy is converted to that data type.
+        """
+        if self.layout == "soa":
+            array = self.xp.array(array, dtype=dtype).transpose(2, 0, 1)
+            return self.xp.ascontiguousarray(array)
+        else:
+            return self.xp.array(array, dtype=dtype)
+
+    def logical_view(self, array):
+        """
+        Return a view of an array in this library's memory layout, which is
+        indexed as `(i, j, q)`, regardless of the layout.
+        """
+        if self.layout == "soa":
+            return array.transpose(1, 2, 0)
+        else:
+            return array
+
     def __getattr__(self, symbol):
-        return Kernel(self, self.api[symbol])
+        kernels = self.__dict__.setdefault("kernels", dict())
+
+        try:
+            return kernels[symbol]
+        except KeyError:
+            kernel = kernels[symbol] = Kernel(self, self.api[symbol])
+            return kernel
 
 
-def to_ctypes(args, spec):
+def module_cache_dir():
+    """
+    Return the directory where compiled modules are cached.
+
+    This is the `cache_dir` build option if it's set (e.g. a directory on a
+    shared file system, so that the modules are compiled once for many
+    jobs), and otherwise this module's `__pycache__` directory.
+    """
+    return build_config["cache_dir"] or join(dirname(__file__), "__pycache__")
+
+
+def compile_cubin(code, options, arch):
+    """
+    Compile CUDA source code with NVRTC for the `sm_<arch>` architecture, and
+    return the cubin image as bytes.
+    """
+    from cupy.cuda import nvrtc
+
+    prog = nvrtc.createProgram(code, "module.cu", [], [])
+
+    try:
+        nvrtc.compileProgram(prog, list(options) + [f"-arch=sm_{arch}"])
+        return nvrtc.getCUBIN(prog)
+    except nvrtc.NVRTCError as e:
+        raise RuntimeError(f"{e}\n{nvrtc.getProgramLog(prog)}")
+    finally:
+        nvrtc.destroyProgram(prog)
+
+
+def write_atomic(path, data):
+    """
+    Write bytes to a file, such that other processes reading the path never
+    see a partially written file (the data is written to a temporary file
+    which is then renamed).
+    """
+    makedirs(dirname(path), exist_ok=True)
+    temp = f"{path}.{getpid()}.tmp"
+
+    with open(temp, "wb") as f:
+        f.write(data)
+
+    replace(temp, path)
+
+
+def constant_table(name, values, ctype="double"):
+    """
+    Return C source code declaring a `CONSTANT` array with the given name.
+
+    The `values` is a (nested) sequence or numpy array; its shape gives the
+    array dimensions. Floating point values are printed with `repr`, so the
+    table holds exactly the Python values. This is intended for tables
+    generated in Python, to be prepended to the kernel source code.
+    """
+    import numpy
+
+    values = numpy.asarray(values)
+
+    def braces(v):
+        if isinstance(v, list):
+            return "{" + ", ".join(braces(x) for x in v) + "}"
+        return repr(v)
+
+    shape = "".join(f"[{n}]" for n in values.shape)
+    return f"CONSTANT {ctype} {name}{shape} = {braces(values.tolist())};\n"
+
+
+def to_ctypes(args, spec, precision="double"):
     """
     Coerce a sequence of values to their appropriate ctype.
 
-    The expected type is determined from the `spec` list.
+    The expected type is determined from the `spec` list. The ctype of `real`
+    arguments is determined by the `precision`, which is "double" or "single".
     """
+    c_real = dict(double=c_double, single=c_float)[precision]
+
     for arg, (typename, _, _) in zip(args, spec):
         if typename == "int":
             yield c_int(arg)
@@ -262,6 +537,28 @@ def to_ctypes(args, spec):
             yield c_double(arg)
         elif typename == "double*":
             yield arg.ctypes.data_as(POINTER(c_double))
+        elif typename == "real":
+            yield c_real(arg)
+        elif typename == "real*":
+            yield arg.ctypes.data_as(POINTER(c_real))
+
+
+def ctypes_argtypes(spec, precision="double"):
+    """
+    Return the list of ctypes `argtypes` for a kernel signature.
+
+    Array arguments are declared as `c_void_p`, so they can be passed as
+    integer addresses.
+    """
+    c_real = dict(double=c_double, single=c_float)[precision]
+    ctype = {
+        "int": c_int,
+        "double": c_double,
+        "real": c_real,
+        "double*": c_void_p,
+        "real*": c_void_p,
+    }
+    return [ctype[typename] for typename, _, _ in spec]
 
 
 def type_error(sym, n, a, b):
@@ -280,7 +577,7 @@ def layout_error(sym, n):
     return TypeError(f"arg {n} to {sym} is not c-contiguous")
 
 
-def validate_types(args, spec, symbol, xp):
+def validate_types(args, spec, symbol, xp, real=None):
     if len(args) != len(spec):
         raise arglen_error(symbol, args, spec)
 
@@ -298,16 +595,32 @@ def validate_types(args, spec, symbol, xp):
                 raise dtype_error(symbol, n, arg, "float64")
             if not arg.flags["C_CONTIGUOUS"]:
                 raise layout_error(symbol, n)
+        elif typename == "real":
+            if type(arg) not in [float, xp.float64, xp.float32]:
+                raise type_error(symbol, n, arg, "float")
+        elif typename == "real*":
+            real = real or xp.float64
+            if type(arg) is not xp.ndarray:
+                raise type_error(symbol, n, arg, "ndarray")
+            if arg.dtype != real:
+                raise dtype_error(symbol, n, arg, xp.dtype(real).name)
+            if not arg.flags["C_CONTIGUOUS"]:
+                raise layout_error(symbol, n)
 
 
-def validate_constraints(args, spec, symbol):
+def validate_constraints(args, spec, symbol, layout=None, macros=dict()):
     """
     Validate kernel argument constraints for a symbol.
 
     Constraints are optionally defined in C code and extracted in the
-    `parse_api` module.
+    `parse_api` module. If given, the `layout` function is available to the
+    constraint expression, for example `$.shape == layout(ni, nj, 3)`, as are
+    the values of the `macros` dictionary (the kernel arguments take
+    precedence).
     """
-    scope = dict(zip([a[1] for a in spec], args))
+    scope = dict(macros)
+    scope.update(zip([a[1] for a in spec], args))
+    scope["layout"] = layout
     for arg, (_, name, constraint) in zip(args, spec):
         if constraint:
             c = constraint.replace("$", name)
@@ -14,6 +14,7 @@ class Argument(NamedTuple):
 class Symbol(NamedTuple):
     name: str
     args: List[Argument]
+    flops: int = None
 
     @property
     def rank(self):
@@ -32,7 +33,10 @@ def scan(lines):
     """
     import re
 
-    function_name = re.compile(r"\s*PUBLIC\s+void\s+(?P<symbol>\w+)")
+    function_name = re.compile(
+        r"\s*PUBLIC\s+void\s+(?P<symbol>\w+)\s*\(?"
+        r"\s*(?://\s*::\s*flops\s*=\s*(?P<flops>\d+))?"
+    )
     argument_name = re.compile(
         r"\s*(?P<dtype>\w+\s*\**)\s*(?P<argname>\w+)\s*[,\)]\s*(?://)?\s*(?P<comment>.*)"
     )
@@ -42,7 +46,8 @@ def scan(lines):
             match = function_name.match(line)
             if match is not None:
                 symbol = match.group("symbol")
-                yield "start_symbol", symbol
+                flops = match.group("flops")
+                yield "start_symbol", (symbol, flops and int(flops))
         else:
             match = argument_name.match(line)
             if match is not None:
@@ -64,17 +69,19 @@ def parse_api(code):
     names of the public functions (or kernels) in the code, and the values are
     lists of the (positional) arguments describing the function signature. Each
     function argument is a tuple of the data type, the argument name, and an
-    optional constraint which could be validated at runtime.
+    optional constraint which could be validated at runtime. A comment of the
+    form `// :: flops = N` on the line declaring the function gives an
+    estimate of the floating point operations per zone, used for profiling.
     """
     api = dict()
     for event, value in scan(code.splitlines()):
         if event == "start_symbol":
             args = []
-            name = value
+            name, flops = value
         elif event == "argument":
             args.append(Argument(*value))
         elif event == "end_symbol":
-            api[name] = Symbol(name=name, args=args)
+            api[name] = Symbol(name=name, args=args, flops=flops)
 
     for symbol in api.values():
         if not 1 <= symbol.rank <= 3:
@@ -0,0 +1,330 @@
+"""
+Per-kernel timing and memory traffic accounting.
+
+Profiling is disabled by default. When it's enabled with `enable_profiling`,
+every kernel launch is timed, with CUDA events in gpu mode and with
+`time.perf_counter` otherwise. Each launch is also charged an estimate of the
+bytes it moves and the floating point operations it does, so that a summary
+can report the achieved memory bandwidth and flop rate of each kernel, and
+compare the bandwidth against the peak value for the device.
+
+The bytes moved by a launch are the sizes of its array arguments, each
+counted once. The sizes are computed from the `$.shape == ...` constraints
+parsed from the kernel source, or from the arrays themselves if a constraint
+is not given. This is the compulsory traffic of the kernel: a kernel which
+re-reads data that has fallen out of cache moves more than this. The flops
+per zone are taken from a `// :: flops = N` comment on the kernel's `PUBLIC`
+line, if there is one; these are rough counts made by hand.
+
+Python methods, such as a solver's `set_bc` or `reductions`, can also be
+timed as sections, by wrapping them with `Profiler.instrument`. In gpu mode,
+the device is synchronized before and after each section. Section times are
+inclusive of the kernels launched inside them, which are also accounted for
+separately. Kernels launched from a CUDA graph are not timed individually.
+"""
+
+import re
+from contextlib import contextmanager
+from functools import wraps
+from time import perf_counter
+
+current = None
+"""
+The active `Profiler` instance, or None if profiling is disabled. Kernel
+invocations check this variable on every launch.
+"""
+
+MAX_PENDING_EVENTS = 1000
+
+SHAPE_CONSTRAINT = re.compile(r"^\s*\$\.shape\s*==\s*(?P<shape>.+?)\s*$")
+
+
+def enable_profiling(mode, peak_bandwidth=None):
+    """
+    Create a `Profiler` for the given execution mode, and make it current.
+
+    The `peak_bandwidth` is in GB/s. If it's not given, then in gpu mode it's
+    inferred from the memory clock rate and bus width of the current device.
+    """
+    global current
+    current = Profiler(mode, peak_bandwidth)
+    return current
+
+
+def disable_profiling():
+    """
+    Stop profiling, and return the profiler that was current (if any).
+    """
+    global current
+    profiler, current = current, None
+    return profiler
+
+
+def profile_summary():
+    """
+    Return the summary of the current profiler, or None if profiling is
+    disabled.
+    """
+    if current is not None:
+        return current.summary()
+
+
+def device_peak_bandwidth():
+    """
+    Return the theoretical peak memory bandwidth of the current GPU, in GB/s.
+    """
+    from cupy.cuda import Device
+    from cupy.cuda.runtime import getDeviceProperties
+
+    props = getDeviceProperties(Device().id)
+    return 2.0 * props["memoryClockRate"] * 1e3 * props["memoryBusWidth"] / 8 * 1e-9
+
+
+def product(values):
+    result = 1
+    for n in values:
+        result *= int(n)
+    return result
+
+
+def kernel_cost(invocation, args):
+    """
+    Return the estimated bytes moved and flops done by an invocation of a
+    kernel, with the given arguments (which include the shape arguments).
+    """
+    lib = invocation.kernel.lib
+    symbol = invocation.kernel.symbol
+    scope = dict(lib.define_macros)
+    scope.update(zip([a.name for a in symbol.args], args))
+    scope["layout"] = lib.storage_shape
+    num_bytes = 0
+
+    for arg, (dtype, name, constraint) in zip(args, symbol.args):
+        if dtype[-1] != "*":
+            continue
+
+        match = SHAPE_CONSTRAINT.match(constraint)
+
+        if match is None:
+            num_bytes += arg.nbytes
+        else:
+            shape = eval(match.group("shape"), None, scope)
+            num_bytes += product(shape) * arg.itemsize
+
+    num_zones = product(invocation.shape)
+    num_flops = (symbol.flops or 0) * num_zones
+    return num_bytes, num_flops, num_zones
+
+
+class Entry:
+    """
+    Accumulated totals for one kernel or section.
+    """
+
+    def __init__(self, kind):
+        self.kind = kind
+        self.calls = 0
+        self.seconds = 0.0
+        self.bytes = 0
+        self.flops = 0
+        self.zones = 0
+
+    def as_dict(self):
+        return dict(
+            kind=self.kind,
+            calls=self.calls,
+            seconds=self.seconds,
+            bytes=self.bytes,
+            flops=self.flops,
+            zones=self.zones,
+        )
+
+
+class Profiler:
+    """
+    Accumulates the time spent in kernels and in instrumented sections.
+
+    In gpu mode the kernel timings are CUDA event pairs recorded on the
+    current stream, so launches remain asynchronous. The events are resolved
+    to elapsed times when a summary is requested, or when too many of them
+    are pending.
+    """
+
+    def __init__(self, mode, peak_bandwidth=None):
+        self.gpu = mode == "gpu"
+        self.entries = dict()
+        self.pending = list()
+
+        if peak_bandwidth is None and self.gpu:
+            peak_bandwidth = device_peak_bandwidth()
+
+        self.peak_bandwidth = peak_bandwidth
+
+    def entry(self, name, kind):
+        try:
+            return self.entries[name]
+        except KeyError:
+            entry = self.entries[name] = Entry(kind)
+            return entry
+
+    def launch(self, invocation, args, function):
+        """
+        Call `function()`, which launches the given kernel invocation, and
+        account for its time and cost.
+        """
+        entry = self.entry(invocation.kernel.symbol.name, "kernel")
+
+        if invocation.cost is None:
+            invocation.cost = kernel_cost(invocation, args)
+
+        num_bytes, num_flops, num_zones = invocation.cost
+
+        if self.capturing():
+            # Work captured to a CUDA graph is not executed here.
+            function()
+            return
+
+        if self.gpu:
+            from cupy.cuda import Event
+
+            start, end = Event(), Event()
+            start.record()
+            function()
+            end.record()
+            self.pending.append((entry, start, end))
+
+            if len(self.pending) > MAX_PENDING_EVENTS:
+                self.resolve()
+        else:
+            start = perf_counter()
+            function()
+            entry.seconds += perf_counter() - start
+
+        entry.calls += 1
+        entry.bytes += num_bytes
+        entry.flops += num_flops
+        entry.zones += num_zones
+
+    def resolve(self):
+        """
+        Wait for the pending CUDA events, and add their elapsed times to the
+        kernel totals.
+        """
+        from cupy.cuda import get_elapsed_time
+
+        for entry, start, end in self.pending:
+            end.synchronize()
+            entry.seconds += get_elapsed_time(start, end) * 1e-3
+
+        self.pending.clear()
+
+    def capturing(self):
+        """
+        Return true if the current stream is being captured to a CUDA graph.
+        """
+        if self.gpu:
+            from cupy.cuda import get_current_stream
+
+            return get_current_stream().is_capturing()
+        return False
+
+    def synchronize(self):
+        if self.gpu:
+            from cupy.cuda.runtime import deviceSynchronize
+
+            deviceSynchronize()
+
+    @contextmanager
+    def section(self, name):
+        """
+        A context manager which times the enclosed code as a section.
+        """
+        if self.capturing():
+            yield
+            return
+
+        entry = self.entry(name, "section")
+        self.synchronize()
+        start = perf_counter()
+        try:
+            yield
+        finally:
+            self.synchronize()
+            entry.seconds += perf_counter() - start
+            entry.calls += 1
+
+    def instrument(self, obj, names):
+        """
+        Replace each of the named methods of `obj` (if it has them) with a
+        wrapper that times it as a section.
+
+        The wrappers are set as attributes of the instance, so calls made
+        from inside the object's other methods are timed as well.
+        """
+        for name in names:
+            method = getattr(obj, name, None)
+
+            if method is None:
+                continue
+
+            def timed(method, label):
+                @wraps(method)
+                def wrapper(*args, **kwargs):
+                    with self.section(label):
+                        return method(*args, **kwargs)
+
+                return wrapper
+
+            setattr(obj, name, timed(method, f"{type(obj).__name__}.{name}"))
+
+    def summary(self):
+        """
+        Return a dictionary of the accumulated totals, keyed by the kernel or
+        section name. The values are dictionaries of plain numbers, so the
+        summary can be written to a checkpoint.
+        """
+        if self.pending:
+            self.resolve()
+
+        return dict(
+            peak_bandwidth=self.peak_bandwidth,
+            entries={k: e.as_dict() for k, e in self.entries.items()},
+        )
+
+    def table(self):
+        """
+        Return a printable table of the accumulated totals, sorted by the
+        total time. The bandwidth column is in GB/s, and the flop rate is in
+        GFlop/s.
+        """
+        summary = self.summary()
+        peak = summary["peak_bandwidth"]
+        entries = sorted(summary["entries"].items(), key=lambda e: -e[1]["seconds"])
+        kernel_time = sum(e["seconds"] for _, e in entries if e["kind"] == "kernel")
+        header = (
+            f"{'name':<40} {'calls':>8} {'time [s]':>10} {'frac':>6} "
+            f"{'B/zone':>8} {'GB/s':>8} {'%peak':>6} {'GFlop/s':>8}"
+        )
+        lines = [header, "-" * len(header)]
+
+        for name, e in entries:
+            if e["kind"] == "section":
+                lines.append(f"{name:<40} {e['calls']:>8} {e['seconds']:>10.4f}")
+                continue
+
+            seconds = e["seconds"] or float("inf")
+            frac = e["seconds"] / kernel_time if kernel_time else 0.0
+            bytes_per_zone = e["bytes"] / e["zones"] if e["zones"] else 0.0
+            bandwidth = e["bytes"] / seconds * 1e-9
+            flop_rate = e["flops"] / seconds * 1e-9
+            percent = f"{100 * bandwidth / peak:>6.1f}" if peak else f"{'-':>6}"
+            gflops = f"{flop_rate:>8.2f}" if e["flops"] else f"{'-':>8}"
+            lines.append(
+                f"{name:<40} {e['calls']:>8} {e['seconds']:>10.4f} {frac:>6.3f} "
+                f"{bytes_per_zone:>8.1f} {bandwidth:>8.2f} {percent} {gflops}"
+            )
+
+        if peak:
+            lines.append(f"peak memory bandwidth is {peak:.1f} GB/s")
+
+        return "\n".join(lines)
@@ -0,0 +1,117 @@
+"""
+Reusable scratch arrays for the temporaries of solver hot paths.
+
+A `ScratchArena` hands out arrays by key. The first request for a key
+allocates the array, and later requests with the same shape and dtype return
+the same array, so a hot path which needs a temporary on every call does not
+allocate one each time. The memory used by a solver's scratch arrays is then
+fixed after its first time step, and the arena keeps count of it.
+
+Arenas are meant to be owned by a patch, so that their arrays are on the
+patch's device; device arrays are allocated with `xp`, which in gpu mode
+draws from cupy's memory pool. An arena can also hand out host arrays, for
+staging device-to-host copies. If the arena is created with `pinned=True` in
+gpu mode, those are in page-locked memory, which speeds up the copies, but
+is a scarce resource and should only be used for modest sizes.
+"""
+
+
+class ScratchArena:
+    """
+    Hands out reusable scratch arrays, keyed by any hashable object.
+
+    An array returned for a key is overwritten by whoever next requests that
+    key, so it's only valid until then. Requesting a key with a different
+    shape or dtype frees the old array and allocates a new one.
+    """
+
+    def __init__(self, xp, pinned=False):
+        self.xp = xp
+        self.pinned = pinned and xp.__name__ == "cupy"
+        self.buffers = dict()
+        self.nbytes = 0
+        self.peak_nbytes = 0
+        self.num_allocations = 0
+
+    def get(self, key, shape, dtype, allocate):
+        import numpy as np
+
+        shape = tuple(shape)
+        dtype = np.dtype(dtype)
+        buffer = self.buffers.get(key)
+
+        if buffer is None or buffer.shape != shape or buffer.dtype != dtype:
+            if buffer is not None:
+                self.nbytes -= buffer.nbytes
+
+            buffer = self.buffers[key] = allocate(shape, dtype)
+            self.nbytes += buffer.nbytes
+            self.peak_nbytes = max(self.peak_nbytes, self.nbytes)
+            self.num_allocations += 1
+
+        return buffer
+
+    def empty(self, key, shape, dtype=float):
+        """
+        Return an uninitialized array on the device.
+        """
+        return self.get(("device", key), shape, dtype, self.xp.empty)
+
+    def zeros(self, key, shape, dtype=float):
+        """
+        Return an array of zeros on the device.
+        """
+        buffer = self.empty(key, shape, dtype)
+        buffer.fill(0)
+        return buffer
+
+    def zeroed(self, key, shape, dtype=float):
+        """
+        Return an array on the device which was filled with zeros when it was
+        allocated. Unlike `zeros`, the array is not cleared by later requests,
+        so the caller is responsible for restoring the zeros it overwrites.
+        """
+        return self.get(("zeroed", key), shape, dtype, self.xp.zeros)
+
+    def host(self, key, shape, dtype=float):
+        """
+        Return an uninitialized array on the host, which is in pinned memory
+        if the arena was created with `pinned=True` in gpu mode.
+        """
+        if self.pinned:
+            from cupyx import empty_pinned as allocate
+        else:
+            from numpy import empty as allocate
+
+        return self.get(("host", key), shape, dtype, allocate)
+
+    def release(self):
+        """
+        Drop all of the scratch arrays. In gpu mode, the device memory is
+        returned to cupy's memory pool, rather than to the device.
+        """
+        self.buffers.clear()
+        self.nbytes = 0
+
+
+def scratch_report(arenas, xp=None):
+    """
+    Return a printable summary of the scratch memory used by a sequence of
+    arenas, and in gpu mode, of the memory held by cupy's default pool.
+    """
+    arenas = list(arenas)
+    peak = sum(a.peak_nbytes for a in arenas)
+    allocations = sum(a.num_allocations for a in arenas)
+    lines = [
+        f"peak scratch memory is {peak / 1e6:.2f} MB on {len(arenas)} patches, "
+        f"in {allocations} allocations"
+    ]
+
+    if xp is not None and xp.__name__ == "cupy":
+        pool = xp.get_default_memory_pool()
+        lines.append(
+            f"device memory pool holds {pool.total_bytes() / 1e6:.2f} MB, "
+            f"of which {pool.used_bytes() / 1e6:.2f} MB is in use"
+        )
+
+    return "\n".join(lines)
@@ -42,6 +42,8 @@ build_config = {
     "enable_openmp": True,
     "extra_compile_args": [],
     "extra_link_args": [],
+    "define_macros": {},
+    "cache_dir": None,
 }
 
 
@@ -49,6 +51,11 @@ def configure_build(
     enable_openmp=True,
     extra_compile_args=None,
     extra_link_args=None,
+    omp_tile_size=None,
+    omp_collapse=None,
+    omp_schedule=None,
+    native_arch=False,
+    cache_dir=None,
     execution_mode=None,
 ):
     """
@@ -58,6 +65,22 @@ def configure_build(
     Windows platforms and specific Linux flavors should be added soon. The
     keyword arguemnts may be Python objects, or strings to facilitate passing
     values right from a configparser instance.
+
+    The `omp_tile_size`, `omp_collapse`, and `omp_schedule` arguments control
+    the loop nest generated by the `FOR_EACH_2D` macro in omp mode. The tile
+    size is a pair of integers (or a string like "8 64"), the collapse is 1
+    or 2, and the schedule is an OpenMP schedule clause such as "dynamic" or
+    "guided,4". They are passed to every CPU-compiled library as define
+    macros, but individual libraries may override them.
+
+    If `native_arch` is true, CPU libraries are compiled with `-march=native`
+    and `-fopenmp-simd`. This lets the compiler use the widest vector
+    instructions of the build host, and honor the `omp simd` loops emitted by
+    the `FOR_EACH_2D_SIMD` macro, even when OpenMP is disabled. The resulting
+    build products are not portable to other CPU models.
+
+    The `cache_dir`, if given, is where compiled CPU and GPU modules are
+    cached, instead of the `sailfish/kernel/__pycache__` directory.
     """
 
     if type(enable_openmp) is str:
@@ -71,6 +94,9 @@ def configure_build(
     if type(extra_link_args) is str:
         extra_link_args = extra_link_args.split()
 
+    if type(native_arch) is str:
+        native_arch = {"True": True, "False": False}[native_arch]
+
     if platform.system() == "Darwin":
         logger.info("configure JIT build for MacOS")
         sys_compile_args = ["-Xpreprocessor", "-fopenmp"]
@@ -89,11 +115,46 @@ def configure_build(
         sys_link_args = []
 
     if enable_openmp:
-        build_config["extra_compile_args"] = extra_compile_args or sys_compile_args
-        build_config["extra_link_args"] = extra_link_args or sys_link_args
+        compile_args = list(extra_compile_args or sys_compile_args)
+        link_args = list(extra_link_args or sys_link_args)
+    else:
+        compile_args = list()
+        link_args = list()
 
+    if native_arch:
+        compile_args += ["-march=native", "-fopenmp-simd"]
+
+    build_config["extra_compile_args"] = compile_args
+    build_config["extra_link_args"] = link_args
     build_config["enable_openmp"] = enable_openmp
     logger.info(f"OpenMP is {'enabled' if enable_openmp else 'disabled'}")
+    logger.info(f"native CPU architecture is {'enabled' if native_arch else 'disabled'}")
+
+    define_macros = dict()
+
+    if omp_tile_size is not None:
+        if type(omp_tile_size) is str:
+            omp_tile_size = omp_tile_size.replace(",", " ").split()
+        tile_i, tile_j = (int(n) for n in omp_tile_size)
+        define_macros["OMP_TILE_I"] = tile_i
+        define_macros["OMP_TILE_J"] = tile_j
+
+    if omp_collapse is not None:
+        if int(omp_collapse) not in (1, 2):
+            raise ValueError("omp_collapse must be 1 or 2")
+        define_macros["OMP_COLLAPSE"] = int(omp_collapse)
+
+    if omp_schedule is not None:
+        define_macros["OMP_LOOP_SCHEDULE"] = omp_schedule
+
+    build_config["define_macros"] = define_macros
+    build_config["cache_dir"] = cache_dir
+
+    if cache_dir is not None:
+        logger.info(f"module cache directory is {cache_dir}")
+
+    if define_macros:
+        logger.info(f"OpenMP loop options are {define_macros}")
 
 
 def get_array_module(mode):
@@ -119,13 +180,129 @@ def get_array_module(mode):
         raise ValueError(f"unknown execution mode {mode}, must be [cpu|omp|gpu]")
 
 
-def execution_context(mode, device_id=None):
+class StreamContext:
+    """
+    An execution context which owns a stream on a specific GPU device.
+
+    Kernel launches and array operations made inside the context are issued
+    to the stream, so operations issued to different streams may overlap. The
+    `record` and `wait` methods are used to order operations between streams,
+    for example to make a guard zone copy wait until the neighboring patch
+    has finished writing the source array. In cpu and omp modes there is no
+    stream, operations are synchronous, and `record` and `wait` are no-ops.
+
+    The stream is a blocking stream, i.e. it is synchronized with the legacy
+    default stream. This means that host reads done outside the context (for
+    example `to_host` in `concat_on_host`) still see the completed results of
+    operations issued to the stream.
+    """
+
+    def __init__(self, mode, device_id=None):
+        if mode == "gpu":
+            from cupy.cuda import Device, Stream
+
+            self.device = Device(device_id)
+
+            with self.device:
+                self.stream = Stream(non_blocking=False)
+        else:
+            self.device = nullcontext()
+            self.stream = None
+
+    def __enter__(self):
+        self.device.__enter__()
+        if self.stream is not None:
+            self.stream.__enter__()
+        return self
+
+    def __exit__(self, *exc):
+        if self.stream is not None:
+            self.stream.__exit__(*exc)
+        self.device.__exit__(*exc)
+
+    def record(self):
+        """
+        Record an event on this stream, and return it (None if no stream).
+        """
+        if self.stream is not None:
+            with self.device:
+                return self.stream.record()
+
+    def wait(self, *events):
+        """
+        Make future work on this stream wait for the given events.
+        """
+        if self.stream is not None:
+            with self.device:
+                for event in events:
+                    if event is not None:
+                        self.stream.wait_event(event)
+
+    def synchronize(self):
+        """
+        Block the host until all work issued to this stream is complete.
+        """
+        if self.stream is not None:
+            self.stream.synchronize()
+
+    def capture(self, function):
+        """
+        Capture the work issued to this stream by `function()` as a CUDA
+        graph, and return the graph.
+
+        The work is recorded but not executed; it's run by calling
+        `graph.launch()` inside the context, as many times as needed. Kernel
+        arguments, including array addresses, are frozen in the graph, so
+        any values that change between launches must be read by the kernels
+        from device arrays which are updated in place. Only supported in gpu
+        mode.
+        """
+        if self.stream is None:
+            raise ValueError("graph capture requires gpu mode")
+
+        with self:
+            self.stream.begin_capture()
+            try:
+                function()
+            finally:
+                graph = self.stream.end_capture()
+        return graph
+
+
+def peer_copy(dst, src):
+    """
+    Copy the contents of the array `src` into the array `dst`.
+
+    If both are C-contiguous cupy arrays of the same size, the copy is issued
+    as an asynchronous memcpy on the current stream, which is a direct
+    device-to-device (peer) transfer if the arrays are on different GPU's.
+    Otherwise it's an ordinary element-wise array assignment.
+    """
+    if (
+        type(dst).__module__.startswith("cupy")
+        and dst.flags.c_contiguous
+        and src.flags.c_contiguous
+        and dst.dtype == src.dtype
+        and dst.nbytes == src.nbytes
+    ):
+        dst.data.copy_from_device_async(src.data, src.nbytes)
+    else:
+        dst[...] = src
+
+
+def execution_context(mode, device_id=None, stream=False):
     """
     Return a context manager appropriate for the given exuction mode.
 
     If `mode` is "gpu", then a specific device id may be provided to specify
-    the GPU onto which kernel launches should be spawned.
+    the GPU onto which kernel launches should be spawned. If `stream` is
+    true, a :py:class:`StreamContext` is returned, which owns a new stream on
+    that device (the returned object is also a valid context in cpu and omp
+    modes).
     """
+    if stream:
+        return StreamContext(mode, device_id)
+
     if mode in ["cpu", "omp"]:
         return nullcontext()
 
@@ -145,6 +322,21 @@ def num_devices(mode):
         return getDeviceCount()
 
 
+def gpu_architectures():
+    """
+    Return a dictionary mapping each distinct compute capability of the
+    visible GPU's (e.g. "80") to the id of a device which has it.
+    """
+    from cupy.cuda import Device
+
+    archs = dict()
+
+    for device_id in range(num_devices("gpu")):
+        archs.setdefault(Device(device_id).compute_capability, device_id)
+
+    return archs
+
+
 def log_system_info(mode):
     """
     Log relevant details of the system's compute capabilities.
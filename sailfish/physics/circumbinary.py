@@ -148,6 +148,13 @@ class Physics(NamedTuple):
        between the domain radius (the half-width of a square domain), extending
        inwards by an amount specified by the :obj:`buffer_onset_width`
        parameter.
+
+    6. Ensemble members
+
+       The cbdiso_2d_ensemble solver advances many simulations at once, which
+       share all of the configuration above except for the point masses.
+       Each member's point masses are supplied by its own callback function,
+       in the :obj:`ensemble_point_mass_functions` list.
     """
 
     eos_type: EquationOfState = EquationOfState.GLOBALLY_ISOTHERMAL
@@ -183,6 +190,9 @@ class Physics(NamedTuple):
     point_mass_function: Callable[[float], List[PointMass]] = None
     """ Callback function to supply point masses as a function of time """
 
+    ensemble_point_mass_functions: List[Callable[[float], List[PointMass]]] = []
+    """ Point mass callbacks for each member of an ensemble run (if any) """
+
     cooling_coefficient: float = 0.0
     """ Strength of the cooling term """
 
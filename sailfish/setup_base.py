@@ -177,6 +177,21 @@ class SetupBase(ABC):
         """
         pass
 
+    def primitive_array(self, time, x, y, xp):
+        """
+        Return initial data on arrays of points, or None if the setup does
+        not implement this.
+
+        Setups may override this to evaluate the same data as `primitive`,
+        for arrays of coordinates `x` and `y` (of the same shape) at once,
+        using the array module `xp`, which is either numpy or cupy. The
+        result is an array of shape `x.shape + (num_fields,)`. Solvers on 2D
+        planar cartesian meshes use this to generate their initial data much
+        faster than by calling `primitive` once per zone (see
+        `sailfish.initial_data`).
+        """
+        return None
+
     @abstractmethod
     def mesh(self, resolution: int):
         """
@@ -2,6 +2,8 @@
 2D disk setups for binary problems.
 """
 
+from functools import partial
+from itertools import product
 from math import sqrt, exp, pi
 from sailfish.mesh import LogSphericalMesh, PlanarCartesian2DMesh
 from sailfish.physics.circumbinary import (
@@ -38,10 +40,19 @@ class CircumbinaryDisk(SetupBase):
     .. math::
         \Sigma \propto r^{-3/5}, \, \mathcal{P} \propto r^{-3/2}
 
+    For parameter surveys, the `ensemble_*` parameters can be given tuples of
+    values, e.g. `ensemble_mass_ratio=(0.5,1.0)`. The run is then an ensemble
+    of independent simulations, one for each combination of the given
+    values, advanced together by the cbdiso_2d_ensemble solver (isothermal
+    mode only). Parameters whose ensemble tuple is empty take their usual
+    value in every member.
+
     .. _Shakura & Sunyaev (1973): https://ui.adsabs.harvard.edu/abs/1973A%26A....24..337S
     .. _Goodman (2003): https://ui.adsabs.harvard.edu/abs/2003MNRAS.339..937G
     """
 
+    ensemble_keys = ("mass_ratio", "eccentricity", "sink_rate", "sink_radius")
+
     eos = param("isothermal", "EOS type: either isothermal or gamma-law")
     domain_radius = param(12.0, "half side length of the square computational domain")
     mach_number = param(10.0, "orbital Mach number (isothermal)", mutable=True)
@@ -62,6 +73,10 @@ class CircumbinaryDisk(SetupBase):
     constant_softening = param(True, "whether to use constant softening (gamma-law)")
     gamma_law_index = param(5.0 / 3.0, "adiabatic index (gamma-law)")
     which_diagnostics = param("none", "diagnostics set to get from solver [none|mdots]")
+    ensemble_mass_ratio = param((), "mass ratios of the ensemble members")
+    ensemble_eccentricity = param((), "eccentricities of the ensemble members")
+    ensemble_sink_rate = param((), "sink rates of the ensemble members")
+    ensemble_sink_radius = param((), "sink radii of the ensemble members")
 
     def validate(self):
         if not self.is_isothermal and not self.is_gamma_law:
@@ -70,6 +85,12 @@ class CircumbinaryDisk(SetupBase):
             raise SetupError(
                 f"which_diagnostics must be none or mdots, got {self.which_diagnostics}"
             )
+        for key in self.ensemble_keys:
+            for x in getattr(self, f"ensemble_{key}"):
+                if type(x) is not float:
+                    raise SetupError(f"ensemble_{key} values must be float")
+        if self.is_ensemble and not self.is_isothermal:
+            raise SetupError("ensemble runs are only supported in isothermal mode")
 
     @property
     def is_isothermal(self):
@@ -79,6 +100,20 @@ class CircumbinaryDisk(SetupBase):
     def is_gamma_law(self):
         return self.eos == "gamma-law"
 
+    @property
+    def is_ensemble(self):
+        return any(getattr(self, f"ensemble_{key}") for key in self.ensemble_keys)
+
+    @property
+    def ensemble_members(self):
+        """
+        Return a list of dicts, one per ensemble member, with the point mass
+        parameters of that member.
+        """
+        keys = self.ensemble_keys
+        values = [getattr(self, f"ensemble_{k}") or (getattr(self, k),) for k in keys]
+        return [dict(zip(keys, v)) for v in product(*values)]
+
     def primitive(self, t, coords, primitive):
         GM = 1.0
         x, y = coords
@@ -107,6 +142,24 @@ class CircumbinaryDisk(SetupBase):
                 * (0.0001 + 0.9999 * exp(-((1.0 / r_softened) ** 30)))
             )
 
+    def primitive_array(self, t, x, y, xp):
+        GM = 1.0
+        r = xp.sqrt(x * x + y * y)
+        eps2 = self.softening_length * self.softening_length
+        r_softened = xp.sqrt(x * x + y * y + eps2)
+        vx = xp.sqrt(GM / r_softened) * (-y / xp.maximum(r, 1e-12))
+        vy = xp.sqrt(GM / r_softened) * (+x / xp.maximum(r, 1e-12))
+
+        if self.is_isothermal:
+            sigma = xp.full_like(x, self.initial_sigma)
+            return xp.stack([sigma, vx, vy], axis=-1)
+
+        elif self.is_gamma_law:
+            profile = 0.0001 + 0.9999 * xp.exp(-((1.0 / r_softened) ** 30))
+            sigma = self.initial_sigma * r_softened ** (-3.0 / 5.0) * profile
+            pressure = self.initial_pressure * r_softened ** (-3.0 / 2.0) * profile
+            return xp.stack([sigma, vx, vy, pressure], axis=-1)
+
     def mesh(self, resolution):
         return PlanarCartesian2DMesh.centered_square(self.domain_radius, resolution)
 
@@ -132,6 +185,12 @@ class CircumbinaryDisk(SetupBase):
                 viscosity_coefficient=self.nu,
                 alpha=0.0,
                 diagnostics=self.diagnostics,
+                ensemble_point_mass_functions=[
+                    partial(self.point_masses, **member)
+                    for member in self.ensemble_members
+                ]
+                if self.is_ensemble
+                else [],
             )
 
         elif self.is_gamma_law:
@@ -165,7 +224,9 @@ class CircumbinaryDisk(SetupBase):
 
     @property
     def solver(self):
-        if self.is_isothermal:
+        if self.is_ensemble:
+            return "cbdiso_2d_ensemble"
+        elif self.is_isothermal:
             return "cbdiso_2d"
         elif self.is_gamma_law:
             return "cbdgam_2d"
@@ -191,27 +252,44 @@ class CircumbinaryDisk(SetupBase):
             eccentricity=self.eccentricity,
         )
 
-    def point_masses(self, time):
-        m1, m2 = self.orbital_elements.orbital_state(time)
+    def point_masses(self, time, **member):
+        """
+        Return the point masses at the given time. Keyword arguments, if given,
+        override the model parameters of the same name (see
+        `ensemble_members`).
+        """
+        mass_ratio = member.get("mass_ratio", self.mass_ratio)
+        eccentricity = member.get("eccentricity", self.eccentricity)
+        sink_rate = member.get("sink_rate", self.sink_rate)
+        sink_radius = member.get("sink_radius", self.sink_radius)
+        elements = self.orbital_elements._replace(
+            mass_ratio=mass_ratio, eccentricity=eccentricity
+        )
+        m1, m2 = elements.orbital_state(time)
 
         return (
             PointMass(
                 softening_length=self.softening_length,
                 sink_model=SinkModel[self.sink_model.upper()],
-                sink_rate=self.sink_rate,
-                sink_radius=self.sink_radius,
+                sink_rate=sink_rate,
+                sink_radius=sink_radius,
                 **m1._asdict(),
             ),
             PointMass(
                 softening_length=self.softening_length,
                 sink_model=SinkModel[self.sink_model.upper()],
-                sink_rate=self.sink_rate,
-                sink_radius=self.sink_radius,
+                sink_rate=sink_rate,
+                sink_radius=sink_radius,
                 **m2._asdict(),
             ),
         )
 
     def checkpoint_diagnostics(self, time):
+        if self.is_ensemble:
+            return dict(
+                point_masses=self.point_masses(time),
+                ensemble_members=self.ensemble_members,
+            )
         return dict(point_masses=self.point_masses(time))
 
 
@@ -262,6 +340,26 @@ class KitpCodeComparison(SetupBase):
         primitive[1] = omega * -y + vr_pert * x / r
         primitive[2] = omega * +x + vr_pert * y / r
 
+    def primitive_array(self, t, x, y, xp):
+        r = xp.sqrt(x * x + y * y)
+
+        r_cav = 2.5
+        delta0 = 1e-5
+        sigma0 = 1.0
+        sigma = sigma0 * (delta0 + (1 - delta0) * xp.exp(-((r_cav / r) ** 12)))
+
+        GM = 1.0
+        a = 1.0
+        n = 4.0
+        omegaB = (GM / a**3) ** 0.5
+        omega0 = (GM / r**3 * (1.0 - 1.0 / self.mach_number**2)) ** 0.5
+        omega = (omega0**-n + omegaB**-n) ** (-1 / n)
+
+        vr_pert = self.disk_kick * y * xp.exp(-((r / 3.5) ** 6))
+        vx = omega * -y + vr_pert * x / r
+        vy = omega * +x + vr_pert * y / r
+        return xp.stack([sigma, vx, vy], axis=-1)
+
     def mesh(self, resolution):
         return PlanarCartesian2DMesh.centered_square(self.domain_radius, resolution)
 
@@ -110,6 +110,18 @@ class SolverBase(ABC):
         """
         pass
 
+    def deferred_maximum_wavespeed(self):
+        """
+        Start computing the largest wavespeed on the grid, and return a
+        callable which returns it.
+
+        Solvers can override this to issue the computation without waiting
+        for it to finish, so that more work can be queued before the value
+        is needed. The default implementation computes it right away.
+        """
+        wavespeed = self.maximum_wavespeed()
+        return lambda: wavespeed
+
     @abstractmethod
     def advance(self, dt):
         """
@@ -117,6 +129,55 @@ class SolverBase(ABC):
         """
         pass
 
+    @property
+    def supports_rollback(self):
+        """
+        Return True if the solver implements `rollback`.
+        """
+        return False
+
+    def rollback(self):
+        """
+        Restore the solution state to the start of the most recent call to
+        `advance`. This is only called if `supports_rollback` is True.
+        """
+        raise NotImplementedError
+
+    def solution_blocks(self):
+        """
+        Return a list of `(index_range, array)` pairs, which cover the part of
+        the solution array owned by this process.
+
+        The index range is `((i0, i1), (j0, j1))`, and the array has the
+        shape of that block (with no guard zones), and may be allocated on a
+        GPU device. This is used to write checkpoints without gathering the
+        solution to a single array. Solvers do not need to implement it; if
+        they don't then checkpoints are written with the `solution` property.
+        """
+        return None
+
+    @property
+    def supports_mpi(self):
+        """
+        Return True if the solver distributes its patches over MPI processes.
+        """
+        return False
+
+    def end_fold(self):
+        """
+        Called by the driver at the end of each fold of iterations, before
+        any events (such as checkpoints) are handled. Solvers may use it for
+        occasional work, such as load balancing. The default does nothing.
+        """
+        pass
+
+    def runtime_report(self):
+        """
+        Return a printable summary of solver-specific runtime statistics, or
+        None. The driver logs it at the end of a run.
+        """
+        return None
+
     def reductions(self):
         """
         Return a set of measurements derived from the solution state.
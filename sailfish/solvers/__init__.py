@@ -15,9 +15,9 @@ def register_solver_extension(solver_name):
     __solver_extension_modules.append(solver_name)
 
 
-def make_solver(name, physics, options, **kwargs):
+def solver_modules():
     """
-    Find a solver with the given name and construct it.
+    Return a dictionary of the solver modules, including extensions, by name.
     """
     from importlib import import_module
     from . import srhd_1d
@@ -25,6 +25,8 @@ def make_solver(name, physics, options, **kwargs):
     from . import scdg_1d
     from . import cbdgam_2d
     from . import cbdiso_2d
+    from . import cbdiso_2d_ensemble
+    from . import cbdiso_2d_fmr
     from . import cbdisodg_2d
 
     solvers = dict(
@@ -33,14 +35,37 @@ def make_solver(name, physics, options, **kwargs):
         scdg_1d=scdg_1d,
         cbdgam_2d=cbdgam_2d,
         cbdiso_2d=cbdiso_2d,
+        cbdiso_2d_ensemble=cbdiso_2d_ensemble,
+        cbdiso_2d_fmr=cbdiso_2d_fmr,
         cbdisodg_2d=cbdisodg_2d,
     )
     for ext_name in __solver_extension_modules:
         solvers[ext_name] = import_module(ext_name)
 
+    return solvers
+
+
+def make_solver(name, physics, options, **kwargs):
+    """
+    Find a solver with the given name and construct it.
+    """
+    solvers = solver_modules()
+
     try:
         return solvers[name].Solver(
             physics=physics or dict(), options=options or dict(), **kwargs
         )
     except (TypeError, ValueError) as e:
         raise SolverInitializationError(e)
+
+
+def build_solver_libraries(mode):
+    """
+    Compile the kernel libraries of every solver module which has a
+    `make_library(options, mode)` function, with its default options. The
+    compiled modules are written to the module cache, so that later runs
+    with the same options skip the compilation.
+    """
+    for name, module in solver_modules().items():
+        if hasattr(module, "make_library"):
+            module.make_library(module.Options(), mode)
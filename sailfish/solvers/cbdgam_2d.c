@@ -41,6 +41,25 @@ PRIVATE void plm_gradient(double *yl, double *y0, double *yr, double *g)
 }
 
 
+// ============================ MEMORY LAYOUT =================================
+// ============================================================================
+PRIVATE void load_fields(const double *array, int n, int sq, double *fields)
+{
+    for (int q = 0; q < NCONS; ++q)
+    {
+        fields[q] = array[n + q * sq];
+    }
+}
+
+PRIVATE void store_fields(double *array, int n, int sq, const double *fields)
+{
+    for (int q = 0; q < NCONS; ++q)
+    {
+        array[n + q * sq] = fields[q];
+    }
+}
+
+
 // ============================ INTERNAL STRUCTS ==============================
 // ============================================================================
 struct PointMass {
@@ -443,9 +462,9 @@ PUBLIC void cbdgam_2d_advance_rk(
     double patch_xr,
     double patch_yl,
     double patch_yr,
-    double *conserved_rk, // :: $.shape == (ni + 4, nj + 4, 4)
-    double *primitive_rd, // :: $.shape == (ni + 4, nj + 4, 4)
-    double *primitive_wr, // :: $.shape == (ni + 4, nj + 4, 4)
+    double *conserved_rk, // :: $.shape == layout(ni + 4, nj + 4, 4)
+    double *primitive_rd, // :: $.shape == layout(ni + 4, nj + 4, 4)
+    double *primitive_wr, // :: $.shape == layout(ni + 4, nj + 4, 4)
     double gamma_law_index,
     double buffer_surface_density,
     double buffer_surface_pressure,
@@ -499,8 +518,9 @@ PUBLIC void cbdgam_2d_advance_rk(
     double dy = (patch_yr - patch_yl) / nj;
 
     int ng = 2; // number of guard zones
-    int si = NCONS * (nj + 2 * ng);
-    int sj = NCONS;
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
 
     FOR_EACH_2D(ni, nj)
     {
@@ -545,20 +565,35 @@ PUBLIC void cbdgam_2d_advance_rk(
         int nrl = (i + 1 + ng) * si + (j - 1 + ng) * sj;
         int nrr = (i + 1 + ng) * si + (j + 1 + ng) * sj;
 
-        double *un = &conserved_rk[ncc];
-        double *pcc = &primitive_rd[ncc];
-        double *pli = &primitive_rd[nli];
-        double *pri = &primitive_rd[nri];
-        double *plj = &primitive_rd[nlj];
-        double *prj = &primitive_rd[nrj];
-        double *pki = &primitive_rd[nki];
-        double *pti = &primitive_rd[nti];
-        double *pkj = &primitive_rd[nkj];
-        double *ptj = &primitive_rd[ntj];
-        double *pll = &primitive_rd[nll];
-        double *plr = &primitive_rd[nlr];
-        double *prl = &primitive_rd[nrl];
-        double *prr = &primitive_rd[nrr];
+        double un[NCONS];
+        double pcc[NCONS];
+        double pli[NCONS];
+        double pri[NCONS];
+        double plj[NCONS];
+        double prj[NCONS];
+        double pki[NCONS];
+        double pti[NCONS];
+        double pkj[NCONS];
+        double ptj[NCONS];
+        double pll[NCONS];
+        double plr[NCONS];
+        double prl[NCONS];
+        double prr[NCONS];
+
+        load_fields(conserved_rk, ncc, sq, un);
+        load_fields(primitive_rd, ncc, sq, pcc);
+        load_fields(primitive_rd, nli, sq, pli);
+        load_fields(primitive_rd, nri, sq, pri);
+        load_fields(primitive_rd, nlj, sq, plj);
+        load_fields(primitive_rd, nrj, sq, prj);
+        load_fields(primitive_rd, nki, sq, pki);
+        load_fields(primitive_rd, nti, sq, pti);
+        load_fields(primitive_rd, nkj, sq, pkj);
+        load_fields(primitive_rd, ntj, sq, ptj);
+        load_fields(primitive_rd, nll, sq, pll);
+        load_fields(primitive_rd, nlr, sq, plr);
+        load_fields(primitive_rd, nrl, sq, prl);
+        load_fields(primitive_rd, nrr, sq, prr);
 
         double plip[NCONS];
         double plim[NCONS];
@@ -677,21 +712,335 @@ PUBLIC void cbdgam_2d_advance_rk(
             ucc[q] = (1.0 - a) * ucc[q] + a * un[q];
         }
 
-        double *pout = &primitive_wr[ncc];
+        double pout[NCONS];
         conserved_to_primitive(ucc, pout, velocity_ceiling, density_floor, pressure_floor, gamma_law_index);
+        store_fields(primitive_wr, ncc, sq, pout);
+    }
+}
+
+// The three kernels below are an alternative to cbdgam_2d_advance_rk, which
+// compute every PLM gradient and Riemann flux once per zone rather than once
+// per face. The gradient kernel is launched over the patch interior plus one
+// layer of guard zones, and the flux kernel is launched over the patch faces
+// (one more than the number of zones on each axis); the ni and nj arguments
+// of these two kernels are the launch shape, not the number of interior
+// zones.
+//
+// Note: cbdgam_2d_advance_rk evaluates the face sound speed and the
+// neighbor zone viscosity from one side of the face only, so the two zones
+// sharing a face see slightly different fluxes. Here the flux must be
+// unique, so the face sound speed is the larger of the two zone values, and
+// the viscosity of each zone is evaluated at its own center.
+
+PUBLIC void cbdgam_2d_plm_gradients(
+    int ni, // number of interior zones + 2
+    int nj,
+    double *primitive, // :: $.shape == layout(ni + 2, nj + 2, 4)
+    double *gradient_x, // :: $.shape == layout(ni + 2, nj + 2, 4)
+    double *gradient_y) // :: $.shape == layout(ni + 2, nj + 2, 4)
+{
+    int ng = 1; // number of guard zones remaining outside the launch shape
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
+
+    FOR_EACH_2D(ni, nj)
+    {
+        int ncc = (i     + ng) * si + (j     + ng) * sj;
+        int nli = (i - 1 + ng) * si + (j     + ng) * sj;
+        int nri = (i + 1 + ng) * si + (j     + ng) * sj;
+        int nlj = (i     + ng) * si + (j - 1 + ng) * sj;
+        int nrj = (i     + ng) * si + (j + 1 + ng) * sj;
+
+        double pcc[NCONS];
+        double pli[NCONS];
+        double pri[NCONS];
+        double plj[NCONS];
+        double prj[NCONS];
+        double gx[NCONS];
+        double gy[NCONS];
+
+        load_fields(primitive, ncc, sq, pcc);
+        load_fields(primitive, nli, sq, pli);
+        load_fields(primitive, nri, sq, pri);
+        load_fields(primitive, nlj, sq, plj);
+        load_fields(primitive, nrj, sq, prj);
+        plm_gradient(pli, pcc, pri, gx);
+        plm_gradient(plj, pcc, prj, gy);
+        store_fields(gradient_x, ncc, sq, gx);
+        store_fields(gradient_y, ncc, sq, gy);
+    }
+}
+
+PUBLIC void cbdgam_2d_godunov_fluxes(
+    int ni, // number of interior zones + 1
+    int nj,
+    double patch_xl, // mesh
+    double patch_xr,
+    double patch_yl,
+    double patch_yr,
+    double *primitive, // :: $.shape == layout(ni + 3, nj + 3, 4)
+    double *gradient_x, // :: $.shape == layout(ni + 3, nj + 3, 4)
+    double *gradient_y, // :: $.shape == layout(ni + 3, nj + 3, 4)
+    double *flux_x, // :: $.shape == layout(ni, nj, 4)
+    double *flux_y, // :: $.shape == layout(ni, nj, 4)
+    double gamma_law_index,
+    double x1, // point mass 1
+    double y1,
+    double vx1,
+    double vy1,
+    double mass1,
+    double softening_length1,
+    double sink_rate1,
+    double sink_radius1,
+    int sink_model1,
+    double x2, // point mass 2
+    double y2,
+    double vx2,
+    double vy2,
+    double mass2,
+    double softening_length2,
+    double sink_rate2,
+    double sink_radius2,
+    int sink_model2,
+    double alpha) // viscosity coefficient
+{
+    struct PointMass m1 = {x1, y1, vx1, vy1, mass1, softening_length1, sink_rate1, sink_radius1, sink_model1};
+    struct PointMass m2 = {x2, y2, vx2, vy2, mass2, softening_length2, sink_rate2, sink_radius2, sink_model2};
+    struct PointMassList mass_list = {{m1, m2}};
+
+    double dx = (patch_xr - patch_xl) / (ni - 1);
+    double dy = (patch_yr - patch_yl) / (nj - 1);
+
+    int ng = 2; // number of guard zones
+    int si = LAYOUT_STRIDE_I(ni - 1 + 2 * ng, nj - 1 + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni - 1 + 2 * ng, nj - 1 + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni - 1 + 2 * ng, nj - 1 + 2 * ng, NCONS);
+    int fi = LAYOUT_STRIDE_I(ni, nj, NCONS);
+    int fj = LAYOUT_STRIDE_J(ni, nj, NCONS);
+    int fq = LAYOUT_STRIDE_Q(ni, nj, NCONS);
+
+    FOR_EACH_2D_SIMD(ni, nj)
+    {
+        double xc = patch_xl + (i + 0.5) * dx;
+        double yc = patch_yl + (j + 0.5) * dy;
+        int ncc = (i     + ng) * si + (j     + ng) * sj;
+        int nli = (i - 1 + ng) * si + (j     + ng) * sj;
+        int nlj = (i     + ng) * si + (j - 1 + ng) * sj;
+        int nf = i * fi + j * fj;
+
+        double pr[NCONS];
+        double gxr[NCONS];
+        double gyr[NCONS];
+        load_fields(primitive, ncc, sq, pr);
+        load_fields(gradient_x, ncc, sq, gxr);
+        load_fields(gradient_y, ncc, sq, gyr);
+
+        double cs2r = sound_speed_squared(gamma_law_index, pr);
+        double nur = 0.0;
+
+        if (alpha > 0.0)
+        {
+            nur = alpha * disk_height(&mass_list, xc, yc, pr) * sqrt(cs2r);
+        }
+
+        if (j < nj - 1)
+        {
+            // flux through the face between zones li and cc
+            double pl[NCONS];
+            double gxl[NCONS];
+            double gyl[NCONS];
+            double pm[NCONS];
+            double pp[NCONS];
+            double f[NCONS];
+
+            load_fields(primitive, nli, sq, pl);
+            load_fields(gradient_x, nli, sq, gxl);
+            load_fields(gradient_y, nli, sq, gyl);
+
+            for (int q = 0; q < NCONS; ++q)
+            {
+                pm[q] = pl[q] + 0.5 * gxl[q];
+                pp[q] = pr[q] - 0.5 * gxr[q];
+            }
+            double cs2l = sound_speed_squared(gamma_law_index, pl);
+            riemann_hlle(pm, pp, f, max2(cs2l, cs2r), 0, gamma_law_index);
+
+            if (alpha > 0.0)
+            {
+                double sl[4];
+                double sr[4];
+                double nul = alpha * disk_height(&mass_list, xc - dx, yc, pl) * sqrt(cs2l);
+                shear_strain(gxl, gyl, dx, dy, sl);
+                shear_strain(gxr, gyr, dx, dy, sr);
+                f[1] -= 0.5 * (nul * pl[0] * sl[0] + nur * pr[0] * sr[0]); // x-x
+                f[2] -= 0.5 * (nul * pl[0] * sl[1] + nur * pr[0] * sr[1]); // x-y
+                f[3] -= 0.5 * (nul * pl[0] * sl[0] * pl[1] + nur * pr[0] * sr[0] * pr[1]); // v^x \tau^x_x
+                f[3] -= 0.5 * (nul * pl[0] * sl[1] * pl[2] + nur * pr[0] * sr[1] * pr[2]); // v^y \tau^x_y
+            }
+            store_fields(flux_x, nf, fq, f);
+        }
+
+        if (i < ni - 1)
+        {
+            // flux through the face between zones lj and cc
+            double pl[NCONS];
+            double gxl[NCONS];
+            double gyl[NCONS];
+            double pm[NCONS];
+            double pp[NCONS];
+            double f[NCONS];
+
+            load_fields(primitive, nlj, sq, pl);
+            load_fields(gradient_x, nlj, sq, gxl);
+            load_fields(gradient_y, nlj, sq, gyl);
+
+            for (int q = 0; q < NCONS; ++q)
+            {
+                pm[q] = pl[q] + 0.5 * gyl[q];
+                pp[q] = pr[q] - 0.5 * gyr[q];
+            }
+            double cs2l = sound_speed_squared(gamma_law_index, pl);
+            riemann_hlle(pm, pp, f, max2(cs2l, cs2r), 1, gamma_law_index);
+
+            if (alpha > 0.0)
+            {
+                double sl[4];
+                double sr[4];
+                double nul = alpha * disk_height(&mass_list, xc, yc - dy, pl) * sqrt(cs2l);
+                shear_strain(gxl, gyl, dx, dy, sl);
+                shear_strain(gxr, gyr, dx, dy, sr);
+                f[1] -= 0.5 * (nul * pl[0] * sl[2] + nur * pr[0] * sr[2]); // y-x
+                f[2] -= 0.5 * (nul * pl[0] * sl[3] + nur * pr[0] * sr[3]); // y-y
+                f[3] -= 0.5 * (nul * pl[0] * sl[2] * pl[1] + nur * pr[0] * sr[2] * pr[1]); // v^x \tau^y_x
+                f[3] -= 0.5 * (nul * pl[0] * sl[3] * pl[2] + nur * pr[0] * sr[3] * pr[2]); // v^y \tau^y_y
+            }
+            store_fields(flux_y, nf, fq, f);
+        }
+    }
+}
+
+PUBLIC void cbdgam_2d_update_from_fluxes(
+    int ni,
+    int nj,
+    double patch_xl, // mesh
+    double patch_xr,
+    double patch_yl,
+    double patch_yr,
+    double *conserved_rk, // :: $.shape == layout(ni + 4, nj + 4, 4)
+    double *primitive_rd, // :: $.shape == layout(ni + 4, nj + 4, 4)
+    double *primitive_wr, // :: $.shape == layout(ni + 4, nj + 4, 4)
+    double *flux_x, // :: $.shape == layout(ni + 1, nj + 1, 4)
+    double *flux_y, // :: $.shape == layout(ni + 1, nj + 1, 4)
+    double gamma_law_index,
+    double buffer_surface_density,
+    double buffer_surface_pressure,
+    double buffer_central_mass,
+    double buffer_driving_rate,
+    double buffer_outer_radius,
+    double buffer_onset_width,
+    int buffer_is_enabled,
+    double x1, // point mass 1
+    double y1,
+    double vx1,
+    double vy1,
+    double mass1,
+    double softening_length1,
+    double sink_rate1,
+    double sink_radius1,
+    int sink_model1,
+    double x2, // point mass 2
+    double y2,
+    double vx2,
+    double vy2,
+    double mass2,
+    double softening_length2,
+    double sink_rate2,
+    double sink_radius2,
+    int sink_model2,
+    double a, // other
+    double dt,
+    double velocity_ceiling,
+    double cooling_coefficient,
+    double mach_ceiling,
+    double density_floor,
+    double pressure_floor,
+    int constant_softening)
+{
+    struct KeplerianBuffer buffer = {
+        buffer_surface_density,
+        buffer_surface_pressure,
+        buffer_central_mass,
+        buffer_driving_rate,
+        buffer_outer_radius,
+        buffer_onset_width,
+        buffer_is_enabled
+    };
+    struct PointMass m1 = {x1, y1, vx1, vy1, mass1, softening_length1, sink_rate1, sink_radius1, sink_model1};
+    struct PointMass m2 = {x2, y2, vx2, vy2, mass2, softening_length2, sink_rate2, sink_radius2, sink_model2};
+    struct PointMassList mass_list = {{m1, m2}};
+
+    double dx = (patch_xr - patch_xl) / ni;
+    double dy = (patch_yr - patch_yl) / nj;
+
+    int ng = 2; // number of guard zones
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int fi = LAYOUT_STRIDE_I(ni + 1, nj + 1, NCONS);
+    int fj = LAYOUT_STRIDE_J(ni + 1, nj + 1, NCONS);
+    int fq = LAYOUT_STRIDE_Q(ni + 1, nj + 1, NCONS);
+
+    FOR_EACH_2D(ni, nj)
+    {
+        double xc = patch_xl + (i + 0.5) * dx;
+        double yc = patch_yl + (j + 0.5) * dy;
+        int ncc = (i + ng) * si + (j + ng) * sj;
+
+        double un[NCONS];
+        double pcc[NCONS];
+        double fli[NCONS];
+        double fri[NCONS];
+        double flj[NCONS];
+        double frj[NCONS];
+        double ucc[NCONS];
+
+        load_fields(conserved_rk, ncc, sq, un);
+        load_fields(primitive_rd, ncc, sq, pcc);
+        load_fields(flux_x, (i + 0) * fi + (j + 0) * fj, fq, fli);
+        load_fields(flux_x, (i + 1) * fi + (j + 0) * fj, fq, fri);
+        load_fields(flux_y, (i + 0) * fi + (j + 0) * fj, fq, flj);
+        load_fields(flux_y, (i + 0) * fi + (j + 1) * fj, fq, frj);
+        double hcc = disk_height(&mass_list, xc, yc, pcc);
+
+        primitive_to_conserved(pcc, ucc, gamma_law_index);
+        buffer_source_term(&buffer, xc, yc, dt, ucc, gamma_law_index);
+        point_masses_source_term(&mass_list, xc, yc, dt, pcc, hcc, ucc, constant_softening, gamma_law_index);
+        cooling_term(cooling_coefficient, mach_ceiling, dt, pcc, ucc, gamma_law_index);
+
+        for (int q = 0; q < NCONS; ++q)
+        {
+            ucc[q] -= ((fri[q] - fli[q]) / dx + (frj[q] - flj[q]) / dy) * dt;
+            ucc[q] = (1.0 - a) * ucc[q] + a * un[q];
+        }
+
+        double pout[NCONS];
+        conserved_to_primitive(ucc, pout, velocity_ceiling, density_floor, pressure_floor, gamma_law_index);
+        store_fields(primitive_wr, ncc, sq, pout);
     }
 }
 
 PUBLIC void cbdgam_2d_wavespeed(
     int ni,
     int nj,
-    double *primitive, // :: $.shape == (ni + 4, nj + 4, 4)
+    double *primitive, // :: $.shape == layout(ni + 4, nj + 4, 4)
     double *wavespeed, // :: $.shape == (ni + 4, nj + 4)
     double gamma_law_index)
 {
     int ng = 2; // number of guard zones
-    int si = NCONS * (nj + 2 * ng);
-    int sj = NCONS;
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
     int ti = nj + 2 * ng;
     int tj = 1;
 
@@ -700,7 +1049,9 @@ PUBLIC void cbdgam_2d_wavespeed(
         int np = (i + ng) * si + (j + ng) * sj;
         int na = (i + ng) * ti + (j + ng) * tj;
 
-        double *pc = &primitive[np];
+        double pc[NCONS];
+        load_fields(primitive, np, sq, pc);
+
         double cs2 = sound_speed_squared(gamma_law_index, pc);
         double a = primitive_max_wavespeed(pc, cs2);
         wavespeed[na] = a;
@@ -710,21 +1061,24 @@ PUBLIC void cbdgam_2d_wavespeed(
 PUBLIC void cbdgam_2d_primitive_to_conserved(
     int ni,
     int nj,
-    double *primitive, // :: $.shape == (ni + 4, nj + 4, 4)
-    double *conserved, // :: $.shape == (ni + 4, nj + 4, 4)
+    double *primitive, // :: $.shape == layout(ni + 4, nj + 4, 4)
+    double *conserved, // :: $.shape == layout(ni + 4, nj + 4, 4)
     double gamma_law_index)
 {
     int ng = 2; // number of guard zones
-    int si = NCONS * (nj + 2 * ng);
-    int sj = NCONS;
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
 
     FOR_EACH_2D(ni, nj)
     {
         int n = (i + ng) * si + (j + ng) * sj;
 
-        double *pc = &primitive[n];
-        double *uc = &conserved[n];
+        double pc[NCONS];
+        double uc[NCONS];
+        load_fields(primitive, n, sq, pc);
         primitive_to_conserved(pc, uc, gamma_law_index);
+        store_fields(conserved, n, sq, uc);
     }
 }
 
@@ -754,8 +1108,8 @@ PUBLIC void cbdgam_2d_point_mass_source_term(
     double sink_radius2,
     int sink_model2,
     int which_mass, // :: $ in [1, 2]
-    double *primitive, // :: $.shape == (ni + 4, nj + 4, 4)
-    double *cons_rate, // :: $.shape == (ni + 4, nj + 4, 4)
+    double *primitive, // :: $.shape == layout(ni + 4, nj + 4, 4)
+    double *cons_rate, // :: $.shape == layout(ni + 4, nj + 4, 4)
     int constant_softening,
     double gamma_law_index)
 {
@@ -764,8 +1118,9 @@ PUBLIC void cbdgam_2d_point_mass_source_term(
     struct PointMassList mass_list = {{m1, m2}};
 
     int ng = 2; // number of guard zones
-    int si = NCONS * (nj + 2 * ng);
-    int sj = NCONS;
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
 
     double dx = (patch_xr - patch_xl) / ni;
     double dy = (patch_yr - patch_yl) / nj;
@@ -776,9 +1131,12 @@ PUBLIC void cbdgam_2d_point_mass_source_term(
 
         double xc = patch_xl + (i + 0.5) * dx;
         double yc = patch_yl + (j + 0.5) * dy;
-        double *pc = &primitive[ncc];
-        double *uc = &cons_rate[ncc];
+        double pc[NCONS];
+        double uc[NCONS];
+        load_fields(primitive, ncc, sq, pc);
+
         double h = disk_height(&mass_list, xc, yc, pc);
         point_mass_source_term(&mass_list.masses[which_mass - 1], xc, yc, 1.0, pc, h, uc, constant_softening, gamma_law_index);
+        store_fields(cons_rate, ncc, sq, uc);
     }
 }
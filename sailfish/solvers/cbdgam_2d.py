@@ -4,8 +4,14 @@ Energy-conserving solver for the binary accretion problem in 2D.
 
 from typing import NamedTuple
 from logging import getLogger
+from sailfish.boundary import GuardZoneFill, BoundaryCondition
+from sailfish.initial_data import initial_primitive
 from sailfish.kernel.library import Library
-from sailfish.kernel.system import get_array_module, execution_context, num_devices
+from sailfish.kernel.system import (
+    get_array_module,
+    execution_context,
+    num_devices,
+)
 from sailfish.mesh import PlanarCartesian2DMesh
 from sailfish.physics.circumbinary import (
     Physics,
@@ -14,33 +20,71 @@ from sailfish.physics.circumbinary import (
     Diagnostic,
 )
 from sailfish.solver_base import SolverBase
-from sailfish.subdivide import subdivide, to_host, concat_on_host, lazy_reduce
+from sailfish.subdivide import (
+    BlockDecomposition,
+    GuardZoneExchange,
+    to_host,
+    concat_blocks_on_host,
+    lazy_reduce,
+)
 
 
 logger = getLogger(__name__)
 
 
 class Options(NamedTuple):
+    """
+    Contains parameters which are solver specific options.
+
+    If `two_phase` is true, each RK stage first computes the PLM gradients
+    once per zone, and then the Godunov fluxes once per face, into scratch
+    arrays owned by each patch. The zone update then only differences the
+    fluxes.
+
+    The `layout` option is either "aos" (the fields of each zone are
+    contiguous in memory) or "soa" (each field is contiguous in memory). The
+    solution array is always returned as an "aos" array.
+
+    The domain is divided into a 2D grid of patches, chosen to minimize the
+    number of guard zones exchanged between patches. The `patch_blocks`
+    option, if given, is the number of patches `(pi, pj)` along each axis.
+
+    If `bc_kernel` is true, the guard zones of each patch are filled by one
+    launch of the `apply_boundary_conditions` kernel (see
+    `sailfish.boundary`). It requires all of the patches to be on one device.
+
+    The `startup_workers` option is the number of processes used to generate
+    the initial data of each patch, if the setup has no vectorized
+    `primitive_array` (see the `cbdiso_2d` solver).
+    """
+
     pressure_floor: float = 1e-12
     density_floor: float = 1e-10
     velocity_ceiling: float = 1e16
     mach_ceiling: float = 1e5
+    two_phase: bool = False
+    layout: str = "aos"
+    patch_blocks: tuple = None
+    bc_kernel: bool = False
+    startup_workers: int = 1
 
 
-def initial_condition(setup, mesh, time):
+def initial_condition(setup, mesh, time, index_range=None, xp=None, num_workers=1):
     """
     Generate a 2D array of primitive data from a mesh and a setup.
+
+    If `index_range` is given, only the zones in the block `((i0, i1), (j0,
+    j1))` are generated. The array is allocated with the array module `xp`
+    (numpy by default) on the current device. The setup's `primitive_array`
+    is used if it implements one, and otherwise its `primitive` method is
+    called once per zone, in `num_workers` processes (see
+    `sailfish.initial_data.initial_primitive`).
     """
     import numpy as np
 
-    ni, nj = mesh.shape
-    primitive = np.zeros([ni, nj, 4])
-
-    for i in range(ni):
-        for j in range(nj):
-            setup.primitive(time, mesh.cell_coordinates(i, j), primitive[i, j])
-
-    return primitive
+    index_range = index_range or ((0, mesh.shape[0]), (0, mesh.shape[1]))
+    xp = xp or np
+    return initial_primitive(setup, mesh, time, index_range, 4, xp, num_workers)
 
 
 class Patch:
@@ -64,18 +108,19 @@ class Patch:
         xp,
         execution_context,
     ):
-        i0, i1 = index_range
-        ni, nj = i1 - i0, mesh.shape[1]
+        (i0, i1), (j0, j1) = index_range
+        ni, nj = i1 - i0, j1 - j0
         self.lib = lib
         self.mesh = mesh
         self.xp = xp
         self.execution_context = execution_context
         self.time = self.time0 = time
-        self.shape = (i1 - i0, nj)  # not including guard zones
+        self.index_range = index_range
+        self.shape = (ni, nj)  # not including guard zones
         self.physics = physics
         self.options = options
-        self.xl, self.yl = mesh.vertex_coordinates(i0, 0)
-        self.xr, self.yr = mesh.vertex_coordinates(i1, nj)
+        self.xl, self.yl = mesh.vertex_coordinates(i0, j0)
+        self.xr, self.yr = mesh.vertex_coordinates(i1, j1)
         self.buffer_outer_radius = buffer_outer_radius
         self.buffer_surface_density = buffer_surface_density
         self.buffer_surface_pressure = buffer_surface_pressure
@@ -88,9 +133,15 @@ class Patch:
             self.coordinate_array_x = xp.linspace(x0, x1, ni)[:, None]
             self.coordinate_array_y = xp.linspace(y0, y1, nj)[None, :]
             self.wavespeeds = self.xp.zeros(primitive.shape[:2])
-            self.primitive1 = self.xp.array(primitive)
-            self.primitive2 = self.xp.array(primitive)
-            self.conserved0 = self.xp.zeros(primitive.shape)
+            self.primitive1 = lib.to_storage(primitive)
+            self.primitive2 = lib.to_storage(primitive)
+            self.conserved0 = self.xp.zeros(lib.storage_shape(*primitive.shape))
+
+            if options.two_phase:
+                self.gradient_x = xp.zeros(lib.storage_shape(*primitive.shape))
+                self.gradient_y = xp.zeros(lib.storage_shape(*primitive.shape))
+                self.flux_x = xp.zeros(lib.storage_shape(ni + 1, nj + 1, 4))
+                self.flux_y = xp.zeros(lib.storage_shape(ni + 1, nj + 1, 4))
 
     @property
     def cell_center_coordinate_arrays(self):
@@ -140,7 +191,7 @@ class Patch:
                 int(self.physics.constant_softening),
                 self.physics.gamma_law_index,
             )
-            return cons_rate[ng:-ng, ng:-ng]
+            return self.lib.logical_view(cons_rate)[ng:-ng, ng:-ng]
 
     def maximum_wavespeed(self):
         with self.execution_context:
@@ -160,6 +211,10 @@ class Patch:
             )
 
     def advance_rk(self, rk_param, dt):
+        if self.options.two_phase:
+            self.advance_rk_two_phase(rk_param, dt)
+            return
+
         m1, m2 = self.physics.point_masses(self.time)
         buffer_central_mass = m1.mass + m2.mass
         buffer_surface_density = self.buffer_surface_density
@@ -214,13 +269,120 @@ class Patch:
         self.time = self.time0 * rk_param + (self.time + dt) * (1.0 - rk_param)
         self.primitive1, self.primitive2 = self.primitive2, self.primitive1
 
+    def advance_rk_two_phase(self, rk_param, dt):
+        """
+        Same as `advance_rk`, but computes the PLM gradients and the Godunov
+        fluxes in separate passes, once per zone and once per face.
+        """
+        m1, m2 = self.physics.point_masses(self.time)
+        buffer_central_mass = m1.mass + m2.mass
+        buffer_surface_density = self.buffer_surface_density
+        buffer_surface_pressure = self.buffer_surface_pressure
+        ni, nj = self.shape
+
+        with self.execution_context:
+            self.lib.cbdgam_2d_plm_gradients[ni + 2, nj + 2](
+                self.primitive1,
+                self.gradient_x,
+                self.gradient_y,
+            )
+            self.lib.cbdgam_2d_godunov_fluxes[ni + 1, nj + 1](
+                self.xl,
+                self.xr,
+                self.yl,
+                self.yr,
+                self.primitive1,
+                self.gradient_x,
+                self.gradient_y,
+                self.flux_x,
+                self.flux_y,
+                self.physics.gamma_law_index,
+                m1.position_x,
+                m1.position_y,
+                m1.velocity_x,
+                m1.velocity_y,
+                m1.mass,
+                m1.softening_length,
+                m1.sink_rate,
+                m1.sink_radius,
+                m1.sink_model.value,
+                m2.position_x,
+                m2.position_y,
+                m2.velocity_x,
+                m2.velocity_y,
+                m2.mass,
+                m2.softening_length,
+                m2.sink_rate,
+                m2.sink_radius,
+                m2.sink_model.value,
+                self.physics.alpha,
+            )
+            self.lib.cbdgam_2d_update_from_fluxes[self.shape](
+                self.xl,
+                self.xr,
+                self.yl,
+                self.yr,
+                self.conserved0,
+                self.primitive1,
+                self.primitive2,
+                self.flux_x,
+                self.flux_y,
+                self.physics.gamma_law_index,
+                buffer_surface_density,
+                buffer_surface_pressure,
+                buffer_central_mass,
+                self.physics.buffer_driving_rate,
+                self.buffer_outer_radius,
+                self.physics.buffer_onset_width,
+                int(self.physics.buffer_is_enabled),
+                m1.position_x,
+                m1.position_y,
+                m1.velocity_x,
+                m1.velocity_y,
+                m1.mass,
+                m1.softening_length,
+                m1.sink_rate,
+                m1.sink_radius,
+                m1.sink_model.value,
+                m2.position_x,
+                m2.position_y,
+                m2.velocity_x,
+                m2.velocity_y,
+                m2.mass,
+                m2.softening_length,
+                m2.sink_rate,
+                m2.sink_radius,
+                m2.sink_model.value,
+                rk_param,
+                dt,
+                self.options.velocity_ceiling,
+                self.physics.cooling_coefficient,
+                self.options.mach_ceiling,
+                self.options.density_floor,
+                self.options.pressure_floor,
+                int(self.physics.constant_softening),
+            )
+
+        self.time = self.time0 * rk_param + (self.time + dt) * (1.0 - rk_param)
+        self.primitive1, self.primitive2 = self.primitive2, self.primitive1
+
     def new_iteration(self):
         self.time0 = self.time
         self.recompute_conserved()
 
     @property
     def primitive(self):
-        return self.primitive1
+        return self.lib.logical_view(self.primitive1)
+
+
+def make_library(options, mode):
+    """
+    Compile the kernel library used by the solver with the given options.
+    """
+    with open(__file__.replace(".py", ".c")) as f:
+        code = f.read()
+
+    return Library(code, mode=mode, debug=False, layout=options.layout)
 
 
 class Solver(SolverBase):
@@ -239,8 +401,6 @@ class Solver(SolverBase):
         physics=dict(),
         options=dict(),
     ):
-        import numpy as np
-
         physics["diagnostics"] = [
             Diagnostic(**v) for v in physics.get("diagnostics", [])
         ]
@@ -263,12 +423,14 @@ class Solver(SolverBase):
         if physics.eos_type != EquationOfState.GAMMA_LAW:
             raise ValueError("solver only supports isothermal equation of states")
 
+        if options.bc_kernel and mode == "gpu":
+            if num_devices(mode) > 1 and num_patches > 1:
+                raise ValueError("bc_kernel requires a single device")
+
         xp = get_array_module(mode)
         ng = 2  # number of guard zones
         nq = 4  # number of conserved quantities
-        with open(__file__.replace(".py", ".c")) as f:
-            code = f.read()
-        lib = Library(code, mode=mode, debug=False)
+        lib = make_library(options, mode)
 
         logger.info(f"initiate with time={time:0.4f}")
         logger.info(f"subdivide grid over {num_patches} patches")
@@ -285,11 +447,6 @@ class Solver(SolverBase):
         self.domain_radius = self.mesh.x1
         self.buffer_onset_width = 0.1
 
-        if solution is None:
-            primitive = initial_condition(setup, mesh, time)
-        else:
-            primitive = solution
-
         if physics.buffer_is_enabled:
             # Here we sample the initial condition at the buffer onset radius
             # to determine the disk surface density at the radius where the
@@ -306,14 +463,49 @@ class Solver(SolverBase):
             buffer_surface_density = 0.0
             buffer_surface_pressure = 0.0
 
-        for n, (a, b) in enumerate(subdivide(ni, num_patches)):
-            prim = np.zeros([b - a + 2 * ng, nj + 2 * ng, nq])
-            prim[ng:-ng, ng:-ng] = primitive[a:b]
+        self.decomposition = BlockDecomposition(
+            mesh.shape, num_patches, options.patch_blocks
+        )
+        self.exchange = GuardZoneExchange(self.decomposition, ng)
+        logger.info(f"patch blocks are {self.decomposition.blocks}")
+
+        if options.bc_kernel:
+            self.guard_zone_fill = GuardZoneFill(
+                self.decomposition,
+                ng,
+                nq,
+                [BoundaryCondition.OUTFLOW] * 4,
+                mode,
+                layout=options.layout,
+            )
+        else:
+            self.guard_zone_fill = None
+
+        for n in self.decomposition.owned:
+            (a, b), (c, d) = index_range = self.decomposition.index_range(n)
+            context = execution_context(
+                mode, device_id=n % num_devices(mode), stream=True
+            )
+
+            with context:
+                prim = xp.zeros([b - a + 2 * ng, d - c + 2 * ng, nq])
+                if solution is None:
+                    prim[ng:-ng, ng:-ng] = initial_condition(
+                        setup,
+                        mesh,
+                        time,
+                        index_range,
+                        xp,
+                        options.startup_workers,
+                    )
+                else:
+                    prim[ng:-ng, ng:-ng] = xp.asarray(solution[a:b, c:d])
+
             patch = Patch(
                 time,
                 prim,
                 mesh,
-                (a, b),
+                index_range,
                 physics,
                 options,
                 buffer_outer_radius,
@@ -321,14 +513,16 @@ class Solver(SolverBase):
                 buffer_surface_pressure,
                 lib,
                 xp,
-                execution_context(mode, device_id=n % num_devices(mode)),
+                context,
             )
             self.patches.append(patch)
 
     @property
     def solution(self):
-        return concat_on_host(
-            [p.primitive for p in self.patches], (self.num_guard, self.num_guard)
+        return concat_blocks_on_host(
+            [p.primitive for p in self.patches],
+            [p.index_range for p in self.patches],
+            (self.num_guard, self.num_guard),
         )
 
     @property
@@ -338,6 +532,10 @@ class Solver(SolverBase):
         """
         return None
 
+    def solution_blocks(self):
+        ng = self.num_guard
+        return [(p.index_range, p.primitive[ng:-ng, ng:-ng]) for p in self.patches]
+
     def reductions(self):
         """
         Generate runtime reductions on the solution data for time series.
@@ -481,39 +679,43 @@ class Solver(SolverBase):
             patch.advance_rk(rk_param, dt)
 
     def set_bc(self, array):
-        ng = self.num_guard
-        num_patches = len(self.patches)
-        for i0 in range(num_patches):
-            il = (i0 + num_patches - 1) % num_patches
-            ir = (i0 + num_patches + 1) % num_patches
-            pl = getattr(self.patches[il], array)
-            pc = getattr(self.patches[i0], array)
-            pr = getattr(self.patches[ir], array)
-            self.set_bc_patch(pl, pc, pr, i0)
-
-    def set_bc_patch(self, pl, pc, pr, patch_index):
-        ni, nj = self.mesh.shape
-        ng = self.num_guard
+        """
+        Fill the guard zones of the given array on each patch (see
+        `GuardZoneExchange.fill` and `GuardZoneFill.fill`).
+        """
+        if self.guard_zone_fill is not None:
+            self.guard_zone_fill.fill(
+                [getattr(p, array) for p in self.patches],
+                [p.execution_context for p in self.patches],
+            )
+            return
+
+        self.exchange.fill(
+            [p.lib.logical_view(getattr(p, array)) for p in self.patches],
+            [p.execution_context for p in self.patches],
+            self.set_bc_edge,
+        )
 
-        with self.patches[patch_index].execution_context:
-            # 1. write to the guard zones of pc, the internal BC
-            pc[:+ng] = pl[-2 * ng : -ng]
-            pc[-ng:] = pr[+ng : +2 * ng]
+    def set_bc_edge(self, pc, n, axis, side):
+        """
+        Set outflow BC on one of the domain edges of the array pc.
+        """
+        ng = self.num_guard
 
-            # 2. Set outflow BC on the left/right patch edges
-            if patch_index == 0:
+        if axis == 0:
+            if side == 0:
                 for i in range(ng):
                     pc[i] = pc[ng]
-            if patch_index == len(self.patches) - 1:
+            else:
                 for i in range(pc.shape[0] - ng, pc.shape[0]):
                     pc[i] = pc[-ng - 1]
-
-            # 3. Set outflow BC on bottom and top edges
-            for i in range(ng):
-                pc[:, i] = pc[:, ng]
-
-            for i in range(pc.shape[1] - ng, pc.shape[1]):
-                pc[:, i] = pc[:, -ng - 1]
+        else:
+            if side == 0:
+                for i in range(ng):
+                    pc[:, i] = pc[:, ng]
+            else:
+                for i in range(pc.shape[1] - ng, pc.shape[1]):
+                    pc[:, i] = pc[:, -ng - 1]
 
     def new_iteration(self):
         for patch in self.patches:
@@ -37,6 +37,44 @@ PRIVATE void plm_gradient(double *yl, double *y0, double *yr, double *g)
 }
 
 
+// ============================ MEMORY LAYOUT =================================
+// ============================================================================
+PRIVATE void load_fields(const double *array, int n, int sq, double *fields)
+{
+    for (int q = 0; q < NCONS; ++q)
+    {
+        fields[q] = array[n + q * sq];
+    }
+}
+
+PRIVATE void store_fields(double *array, int n, int sq, const double *fields)
+{
+    for (int q = 0; q < NCONS; ++q)
+    {
+        array[n + q * sq] = fields[q];
+    }
+}
+
+// The primitive arrays are stored with the `real` type, which may be single
+// precision. Zone data is always converted to double on load, so the
+// reconstruction, fluxes, and conserved variable update are done in double.
+PRIVATE void load_real_fields(const real *array, int n, int sq, double *fields)
+{
+    for (int q = 0; q < NCONS; ++q)
+    {
+        fields[q] = (double)array[n + q * sq];
+    }
+}
+
+PRIVATE void store_real_fields(real *array, int n, int sq, const double *fields)
+{
+    for (int q = 0; q < NCONS; ++q)
+    {
+        array[n + q * sq] = (real)fields[q];
+    }
+}
+
+
 // ============================ INTERNAL STRUCTS ==============================
 // ============================================================================
 struct PointMass {
@@ -67,6 +105,17 @@ struct KeplerianBuffer {
 
 // ============================ GRAVITY =======================================
 // ============================================================================
+// The cached gravity field of a patch has shape (ni + 1, nj + 1, 9). At index
+// (i, j) it holds the gravitational potential at the left x-face, the left
+// y-face, and the center of zone (i, j), followed by the point mass profile
+// (see point_mass_profile) of each point mass at the zone center. The extra
+// row and column hold the potential at the right-most faces.
+#define GRAVITY_FIELD_PHI_X 0
+#define GRAVITY_FIELD_PHI_Y 1
+#define GRAVITY_FIELD_PHI_C 2
+#define GRAVITY_FIELD_PROFILE 3
+#define NUM_GRAVITY_FIELDS 9
+
 PRIVATE double gravitational_potential(
     struct PointMassList *mass_list,
     double x1,
@@ -94,28 +143,44 @@ PRIVATE double gravitational_potential(
     return phi;
 }
 
-PRIVATE void point_mass_source_term(
+// The gravitational acceleration (x, y) and the sink rate profile of a point
+// mass, at the point (x1, y1). These are the parts of the point mass source
+// term which do not depend on the fluid state, so they can be cached while
+// the point masses are fixed (see cbdiso_2d_gravity_field).
+PRIVATE void point_mass_profile(
     struct PointMass *mass,
     double x1,
     double y1,
-    double dt,
-    double *prim,
-    double *delta_cons)
+    double *profile)
 {
     double x0 = mass->x;
     double y0 = mass->y;
-    double sigma = prim[0];
     double dx = x1 - x0;
     double dy = y1 - y0;
     double r2 = dx * dx + dy * dy;
     double dr = sqrt(r2);
     double r_sink = mass->sink_radius;
     double r_soft = mass->softening_length;
+    double g = mass->mass * pow(r2 + r_soft * r_soft, -1.5);
 
-    double fgrav_numerator = sigma * mass->mass * pow(r2 + r_soft * r_soft, -1.5);
-    double fx = -fgrav_numerator * dx;
-    double fy = -fgrav_numerator * dy;
-    double sink_rate = (dr < 4.0 * r_sink) ? mass->sink_rate * exp(-pow(dr / r_sink, 4.0)) : 0.0;
+    profile[0] = -g * dx;
+    profile[1] = -g * dy;
+    profile[2] = (dr < 4.0 * r_sink) ? mass->sink_rate * exp(-pow(dr / r_sink, 4.0)) : 0.0;
+}
+
+PRIVATE void point_mass_source_term_from_profile(
+    struct PointMass *mass,
+    double x1,
+    double y1,
+    double dt,
+    double *prim,
+    const double *profile,
+    double *delta_cons)
+{
+    double sigma = prim[0];
+    double fx = sigma * profile[0];
+    double fy = sigma * profile[1];
+    double sink_rate = profile[2];
     double mdot = 0.0;
 
     if (sink_rate > 0.0)
@@ -143,6 +208,9 @@ PRIVATE void point_mass_source_term(
         }
         case 2: // torque-free
         {
+            double dx = x1 - mass->x;
+            double dy = y1 - mass->y;
+            double dr = sqrt(dx * dx + dy * dy);
             double vx = prim[1];
             double vy = prim[2];
             double vx0 = mass->vx;
@@ -174,6 +242,19 @@ PRIVATE void point_mass_source_term(
     }
 }
 
+PRIVATE void point_mass_source_term(
+    struct PointMass *mass,
+    double x1,
+    double y1,
+    double dt,
+    double *prim,
+    double *delta_cons)
+{
+    double profile[3];
+    point_mass_profile(mass, x1, y1, profile);
+    point_mass_source_term_from_profile(mass, x1, y1, dt, prim, profile, delta_cons);
+}
+
 PRIVATE void point_masses_source_term(
     struct PointMassList *mass_list,
     double x1,
@@ -210,6 +291,23 @@ PRIVATE double sound_speed_squared(
     }
 }
 
+PRIVATE double sound_speed_squared_from_potential(
+    double cs2,
+    double mach_squared,
+    int eos_type,
+    double phi)
+{
+    switch (eos_type)
+    {
+        case 1: // globally isothermal
+            return cs2;
+        case 2: // locally Isothermal
+            return -phi / mach_squared;
+        default:
+            return 1.0; // WARNING
+    }
+}
+
 PRIVATE void buffer_source_term(
     struct KeplerianBuffer *buffer,
     double xc,
@@ -380,18 +478,380 @@ PRIVATE void riemann_hlle(
 }
 
 
+// ============================ ZONE UPDATE ===================================
+// ============================================================================
+PRIVATE void advance_rk_zone(
+    int i,
+    int j,
+    int nj,
+    int si,
+    int sj,
+    int sq,
+    double patch_xl,
+    double patch_yl,
+    double dx,
+    double dy,
+    double *conserved_rk,
+    const real *primitive_rd,
+    real *primitive_wr,
+    double *wavespeed,
+    struct KeplerianBuffer *buffer,
+    struct PointMassList *mass_list,
+    const double *gravity_field,
+    double cs2,
+    double mach_squared,
+    int eos_type,
+    double nu,
+    double a,
+    double dt,
+    double velocity_ceiling,
+    double density_floor,
+    int first_stage,
+    int final_stage)
+{
+    int ng = 2; // number of guard zones
+    int ti = nj + 2 * ng;
+    int tj = 1;
+
+    double xl = patch_xl + (i + 0.0) * dx;
+    double xc = patch_xl + (i + 0.5) * dx;
+    double xr = patch_xl + (i + 1.0) * dx;
+    double yl = patch_yl + (j + 0.0) * dy;
+    double yc = patch_yl + (j + 0.5) * dy;
+    double yr = patch_yl + (j + 1.0) * dy;
+
+    // ------------------------------------------------------------------------
+    //                 tj
+    //
+    //      +-------+-------+-------+
+    //      |       |       |       |
+    //      |  lr   |  rj   |   rr  |
+    //      |       |       |       |
+    //      +-------+-------+-------+
+    //      |       |       |       |
+    //  ki  |  li  -|+  c  -|+  ri  |  ti
+    //      |       |       |       |
+    //      +-------+-------+-------+
+    //      |       |       |       |
+    //      |  ll   |  lj   |   rl  |
+    //      |       |       |       |
+    //      +-------+-------+-------+
+    //
+    //                 kj
+    // ------------------------------------------------------------------------
+
+    int ncc = (i     + ng) * si + (j     + ng) * sj;
+    int nli = (i - 1 + ng) * si + (j     + ng) * sj;
+    int nri = (i + 1 + ng) * si + (j     + ng) * sj;
+    int nlj = (i     + ng) * si + (j - 1 + ng) * sj;
+    int nrj = (i     + ng) * si + (j + 1 + ng) * sj;
+    int nki = (i - 2 + ng) * si + (j     + ng) * sj;
+    int nti = (i + 2 + ng) * si + (j     + ng) * sj;
+    int nkj = (i     + ng) * si + (j - 2 + ng) * sj;
+    int ntj = (i     + ng) * si + (j + 2 + ng) * sj;
+    int nll = (i - 1 + ng) * si + (j - 1 + ng) * sj;
+    int nlr = (i - 1 + ng) * si + (j + 1 + ng) * sj;
+    int nrl = (i + 1 + ng) * si + (j - 1 + ng) * sj;
+    int nrr = (i + 1 + ng) * si + (j + 1 + ng) * sj;
+
+    double un[NCONS];
+    double pcc[NCONS];
+    double pli[NCONS];
+    double pri[NCONS];
+    double plj[NCONS];
+    double prj[NCONS];
+    double pki[NCONS];
+    double pti[NCONS];
+    double pkj[NCONS];
+    double ptj[NCONS];
+    double pll[NCONS];
+    double plr[NCONS];
+    double prl[NCONS];
+    double prr[NCONS];
+
+    load_real_fields(primitive_rd, ncc, sq, pcc);
+    load_real_fields(primitive_rd, nli, sq, pli);
+    load_real_fields(primitive_rd, nri, sq, pri);
+    load_real_fields(primitive_rd, nlj, sq, plj);
+    load_real_fields(primitive_rd, nrj, sq, prj);
+    load_real_fields(primitive_rd, nki, sq, pki);
+    load_real_fields(primitive_rd, nti, sq, pti);
+    load_real_fields(primitive_rd, nkj, sq, pkj);
+    load_real_fields(primitive_rd, ntj, sq, ptj);
+    load_real_fields(primitive_rd, nll, sq, pll);
+    load_real_fields(primitive_rd, nlr, sq, plr);
+    load_real_fields(primitive_rd, nrl, sq, prl);
+    load_real_fields(primitive_rd, nrr, sq, prr);
+
+    double plip[NCONS];
+    double plim[NCONS];
+    double prip[NCONS];
+    double prim[NCONS];
+    double pljp[NCONS];
+    double pljm[NCONS];
+    double prjp[NCONS];
+    double prjm[NCONS];
+
+    double gxli[NCONS];
+    double gxri[NCONS];
+    double gyli[NCONS];
+    double gyri[NCONS];
+    double gxlj[NCONS];
+    double gxrj[NCONS];
+    double gylj[NCONS];
+    double gyrj[NCONS];
+    double gxcc[NCONS];
+    double gycc[NCONS];
+
+    plm_gradient(pki, pli, pcc, gxli);
+    plm_gradient(pli, pcc, pri, gxcc);
+    plm_gradient(pcc, pri, pti, gxri);
+    plm_gradient(pkj, plj, pcc, gylj);
+    plm_gradient(plj, pcc, prj, gycc);
+    plm_gradient(pcc, prj, ptj, gyrj);
+    plm_gradient(pll, pli, plr, gyli);
+    plm_gradient(prl, pri, prr, gyri);
+    plm_gradient(pll, plj, prl, gxlj);
+    plm_gradient(plr, prj, prr, gxrj);
+
+    for (int q = 0; q < NCONS; ++q)
+    {
+        plim[q] = pli[q] + 0.5 * gxli[q];
+        plip[q] = pcc[q] - 0.5 * gxcc[q];
+        prim[q] = pcc[q] + 0.5 * gxcc[q];
+        prip[q] = pri[q] - 0.5 * gxri[q];
+
+        pljm[q] = plj[q] + 0.5 * gylj[q];
+        pljp[q] = pcc[q] - 0.5 * gycc[q];
+        prjm[q] = pcc[q] + 0.5 * gycc[q];
+        prjp[q] = prj[q] - 0.5 * gyrj[q];
+    }
+
+    double fli[NCONS];
+    double fri[NCONS];
+    double flj[NCONS];
+    double frj[NCONS];
+    double ucc[NCONS];
+
+    double cs2li;
+    double cs2ri;
+    double cs2lj;
+    double cs2rj;
+
+    // The cached gravity field (if any) at this zone, and at the zones to
+    // the right of it on each axis.
+    const double *gcc = NULL;
+    const double *gri = NULL;
+    const double *grj = NULL;
+
+    if (gravity_field != NULL)
+    {
+        gcc = &gravity_field[(i * (nj + 1) + j) * NUM_GRAVITY_FIELDS];
+        gri = &gravity_field[((i + 1) * (nj + 1) + j) * NUM_GRAVITY_FIELDS];
+        grj = &gravity_field[(i * (nj + 1) + j + 1) * NUM_GRAVITY_FIELDS];
+        cs2li = sound_speed_squared_from_potential(cs2, mach_squared, eos_type, gcc[GRAVITY_FIELD_PHI_X]);
+        cs2ri = sound_speed_squared_from_potential(cs2, mach_squared, eos_type, gri[GRAVITY_FIELD_PHI_X]);
+        cs2lj = sound_speed_squared_from_potential(cs2, mach_squared, eos_type, gcc[GRAVITY_FIELD_PHI_Y]);
+        cs2rj = sound_speed_squared_from_potential(cs2, mach_squared, eos_type, grj[GRAVITY_FIELD_PHI_Y]);
+    }
+    else
+    {
+        cs2li = sound_speed_squared(cs2, mach_squared, eos_type, xl, yc, mass_list);
+        cs2ri = sound_speed_squared(cs2, mach_squared, eos_type, xr, yc, mass_list);
+        cs2lj = sound_speed_squared(cs2, mach_squared, eos_type, xc, yl, mass_list);
+        cs2rj = sound_speed_squared(cs2, mach_squared, eos_type, xc, yr, mass_list);
+    }
+
+    riemann_hlle(plim, plip, fli, cs2li, 0);
+    riemann_hlle(prim, prip, fri, cs2ri, 0);
+    riemann_hlle(pljm, pljp, flj, cs2lj, 1);
+    riemann_hlle(prjm, prjp, frj, cs2rj, 1);
+
+    if (nu > 0.0)
+    {
+        double sli[4];
+        double sri[4];
+        double slj[4];
+        double srj[4];
+        double scc[4];
+
+        shear_strain(gxli, gyli, dx, dy, sli);
+        shear_strain(gxri, gyri, dx, dy, sri);
+        shear_strain(gxlj, gylj, dx, dy, slj);
+        shear_strain(gxrj, gyrj, dx, dy, srj);
+        shear_strain(gxcc, gycc, dx, dy, scc);
+
+        fli[1] -= 0.5 * nu * (pli[0] * sli[0] + pcc[0] * scc[0]); // x-x
+        fli[2] -= 0.5 * nu * (pli[0] * sli[1] + pcc[0] * scc[1]); // x-y
+        fri[1] -= 0.5 * nu * (pcc[0] * scc[0] + pri[0] * sri[0]); // x-x
+        fri[2] -= 0.5 * nu * (pcc[0] * scc[1] + pri[0] * sri[1]); // x-y
+        flj[1] -= 0.5 * nu * (plj[0] * slj[2] + pcc[0] * scc[2]); // y-x
+        flj[2] -= 0.5 * nu * (plj[0] * slj[3] + pcc[0] * scc[3]); // y-y
+        frj[1] -= 0.5 * nu * (pcc[0] * scc[2] + prj[0] * srj[2]); // y-x
+        frj[2] -= 0.5 * nu * (pcc[0] * scc[3] + prj[0] * srj[3]); // y-y
+    }
+    double delta_cons[3] = {0.0, 0.0, 0.0};
+    primitive_to_conserved(pcc, ucc);
+
+    if (first_stage)
+    {
+        // The conserved state at the start of the step is just the
+        // current one, so it is written here rather than by a separate
+        // primitive-to-conserved pass.
+        for (int q = 0; q < NCONS; ++q)
+        {
+            un[q] = ucc[q];
+        }
+        store_fields(conserved_rk, ncc, sq, un);
+    }
+    else
+    {
+        load_fields(conserved_rk, ncc, sq, un);
+    }
+    buffer_source_term(buffer, xc, yc, dt, ucc, delta_cons);
+
+    if (gcc != NULL)
+    {
+        for (int p = 0; p < 2; ++p)
+        {
+            const double *profile = &gcc[GRAVITY_FIELD_PROFILE + 3 * p];
+            point_mass_source_term_from_profile(&mass_list->masses[p], xc, yc, dt, pcc, profile, delta_cons);
+        }
+    }
+    else
+    {
+        point_masses_source_term(mass_list, xc, yc, dt, pcc, delta_cons);
+    }
+
+    for (int q = 0; q < NCONS; ++q)
+    {
+        delta_cons[q] -= ((fri[q] - fli[q]) / dx + (frj[q] - flj[q]) / dy) * dt;
+    }
+    for (int q = 0; q < NCONS; ++q)
+    {
+        ucc[q] += delta_cons[q];
+        ucc[q] = (1.0 - a) * ucc[q] + a * un[q];
+    }
+    double pout[NCONS];
+    conserved_to_primitive(ucc, pout, velocity_ceiling, density_floor);
+    store_real_fields(primitive_wr, ncc, sq, pout);
+
+    if (final_stage)
+    {
+        // Note: the sound speed here uses the point mass positions at the
+        // start of the stage, not at the end of the time step.
+        double cs2cc = gcc != NULL
+            ? sound_speed_squared_from_potential(cs2, mach_squared, eos_type, gcc[GRAVITY_FIELD_PHI_C])
+            : sound_speed_squared(cs2, mach_squared, eos_type, xc, yc, mass_list);
+        wavespeed[(i + ng) * ti + (j + ng) * tj] = primitive_max_wavespeed(pout, cs2cc);
+    }
+}
+
+
+// ============================ DIAGNOSTICS ===================================
+// ============================================================================
+#define MAX_DIAGNOSTICS 32
+#define DIAGNOSTIC_COLUMNS 6
+
+// Quantity codes in the first column of the diagnostic descriptor table.
+// Codes 0, 1, 2 are the components of the point mass source term.
+#define DIAGNOSTIC_TORQUE 3
+#define DIAGNOSTIC_POWER 4
+#define DIAGNOSTIC_SIGMA_M1 5
+#define DIAGNOSTIC_ECCENTRICITY_VECTOR 6
+#define DIAGNOSTIC_ANGULAR_MOMENTUM 7
+#define DIAGNOSTIC_MASS 8
+
+// Add the value of one diagnostic in a zone to the pair (re, im). The
+// descriptor row is: quantity code, which mass (1, 2, or 3 for both), the
+// gravity and accretion flags, and the radial cut (r0, r1). The source terms
+// u_grav and u_accr are the gravity-only and accretion-only rates due to each
+// of the two point masses.
+PRIVATE void accumulate_diagnostic(
+    const double *row,
+    double x,
+    double y,
+    const double *prim,
+    double u_grav[2][NCONS],
+    double u_accr[2][NCONS],
+    const struct PointMassList *mass_list,
+    double *acc)
+{
+    int quantity = (int)row[0];
+    int which_mass = (int)row[1];
+    double r = sqrt(x * x + y * y);
+
+    if (!(row[4] < r && r < row[5]))
+    {
+        return;
+    }
+
+    double sigma = prim[0];
+    double vx = prim[1];
+    double vy = prim[2];
+    double u[NCONS] = {0.0, 0.0, 0.0};
+
+    if (quantity <= DIAGNOSTIC_POWER)
+    {
+        double (*rate)[NCONS] = row[3] != 0.0 ? u_accr : u_grav;
+
+        for (int q = 0; q < NCONS; ++q)
+        {
+            u[q] = (which_mass & 1 ? rate[0][q] : 0.0) + (which_mass & 2 ? rate[1][q] : 0.0);
+        }
+    }
+
+    switch (quantity)
+    {
+        case 0:
+        case 1:
+        case 2:
+            acc[0] += u[quantity];
+            break;
+        case DIAGNOSTIC_TORQUE:
+            acc[0] += x * u[2] - y * u[1];
+            break;
+        case DIAGNOSTIC_POWER:
+        {
+            const struct PointMass *m = &mass_list->masses[which_mass - 1];
+            acc[0] += m->vx * u[1] + m->vy * u[2];
+            break;
+        }
+        case DIAGNOSTIC_SIGMA_M1:
+            acc[0] += sigma * x / r;
+            acc[1] += sigma * y / r;
+            break;
+        case DIAGNOSTIC_ECCENTRICITY_VECTOR:
+        {
+            double v_dot_v = vx * vx + vy * vy;
+            double v_dot_r = vx * x + vy * y;
+            acc[0] += sigma * ((v_dot_v * x - v_dot_r * vx) - x / r);
+            acc[1] += sigma * ((v_dot_v * y - v_dot_r * vy) - y / r);
+            break;
+        }
+        case DIAGNOSTIC_ANGULAR_MOMENTUM:
+            acc[0] += sigma * (x * vy - y * vx);
+            break;
+        case DIAGNOSTIC_MASS:
+            acc[0] += sigma;
+            break;
+    }
+}
+
+
 // ============================ PUBLIC API ====================================
 // ============================================================================
-PUBLIC void cbdiso_2d_advance_rk(
+PUBLIC void cbdiso_2d_advance_rk( // :: flops = 1100
     int ni,
     int nj,
     double patch_xl, // mesh
     double patch_xr,
     double patch_yl,
     double patch_yr,
-    double *conserved_rk, // :: $.shape == (ni + 4, nj + 4, 3)
-    double *primitive_rd, // :: $.shape == (ni + 4, nj + 4, 3)
-    double *primitive_wr, // :: $.shape == (ni + 4, nj + 4, 3)
+    double *conserved_rk, // :: $.shape == layout(ni + 4, nj + 4, 3)
+    real *primitive_rd, // :: $.shape == layout(ni + 4, nj + 4, 3)
+    real *primitive_wr, // :: $.shape == layout(ni + 4, nj + 4, 3)
+    double *wavespeed, // :: $.shape == (ni + 4, nj + 4)
     double buffer_surface_density,
     double buffer_central_mass,
     double buffer_driving_rate,
@@ -423,7 +883,9 @@ PUBLIC void cbdiso_2d_advance_rk(
     double a, // RK parameter
     double dt, // timestep
     double velocity_ceiling,
-    double density_floor)
+    double density_floor,
+    int first_stage, // if non-zero, also write conserved_rk from primitive_rd
+    int final_stage) // if non-zero, also write the signal speed to wavespeed
 {
     struct KeplerianBuffer buffer = {
         buffer_surface_density,
@@ -441,196 +903,66 @@ PUBLIC void cbdiso_2d_advance_rk(
     double dy = (patch_yr - patch_yl) / nj;
 
     int ng = 2; // number of guard zones
-    int si = NCONS * (nj + 2 * ng);
-    int sj = NCONS;
-
-    FOR_EACH_2D(ni, nj)
-    {
-        double xl = patch_xl + (i + 0.0) * dx;
-        double xc = patch_xl + (i + 0.5) * dx;
-        double xr = patch_xl + (i + 1.0) * dx;
-        double yl = patch_yl + (j + 0.0) * dy;
-        double yc = patch_yl + (j + 0.5) * dy;
-        double yr = patch_yl + (j + 1.0) * dy;
-
-        // ------------------------------------------------------------------------
-        //                 tj
-        //
-        //      +-------+-------+-------+
-        //      |       |       |       |
-        //      |  lr   |  rj   |   rr  |
-        //      |       |       |       |
-        //      +-------+-------+-------+
-        //      |       |       |       |
-        //  ki  |  li  -|+  c  -|+  ri  |  ti
-        //      |       |       |       |
-        //      +-------+-------+-------+
-        //      |       |       |       |
-        //      |  ll   |  lj   |   rl  |
-        //      |       |       |       |
-        //      +-------+-------+-------+
-        //
-        //                 kj
-        // ------------------------------------------------------------------------
-
-        int ncc = (i     + ng) * si + (j     + ng) * sj;
-        int nli = (i - 1 + ng) * si + (j     + ng) * sj;
-        int nri = (i + 1 + ng) * si + (j     + ng) * sj;
-        int nlj = (i     + ng) * si + (j - 1 + ng) * sj;
-        int nrj = (i     + ng) * si + (j + 1 + ng) * sj;
-        int nki = (i - 2 + ng) * si + (j     + ng) * sj;
-        int nti = (i + 2 + ng) * si + (j     + ng) * sj;
-        int nkj = (i     + ng) * si + (j - 2 + ng) * sj;
-        int ntj = (i     + ng) * si + (j + 2 + ng) * sj;
-        int nll = (i - 1 + ng) * si + (j - 1 + ng) * sj;
-        int nlr = (i - 1 + ng) * si + (j + 1 + ng) * sj;
-        int nrl = (i + 1 + ng) * si + (j - 1 + ng) * sj;
-        int nrr = (i + 1 + ng) * si + (j + 1 + ng) * sj;
-
-        double *un = &conserved_rk[ncc];
-        double *pcc = &primitive_rd[ncc];
-        double *pli = &primitive_rd[nli];
-        double *pri = &primitive_rd[nri];
-        double *plj = &primitive_rd[nlj];
-        double *prj = &primitive_rd[nrj];
-        double *pki = &primitive_rd[nki];
-        double *pti = &primitive_rd[nti];
-        double *pkj = &primitive_rd[nkj];
-        double *ptj = &primitive_rd[ntj];
-        double *pll = &primitive_rd[nll];
-        double *plr = &primitive_rd[nlr];
-        double *prl = &primitive_rd[nrl];
-        double *prr = &primitive_rd[nrr];
-
-        double plip[NCONS];
-        double plim[NCONS];
-        double prip[NCONS];
-        double prim[NCONS];
-        double pljp[NCONS];
-        double pljm[NCONS];
-        double prjp[NCONS];
-        double prjm[NCONS];
-
-        double gxli[NCONS];
-        double gxri[NCONS];
-        double gyli[NCONS];
-        double gyri[NCONS];
-        double gxlj[NCONS];
-        double gxrj[NCONS];
-        double gylj[NCONS];
-        double gyrj[NCONS];
-        double gxcc[NCONS];
-        double gycc[NCONS];
-
-        plm_gradient(pki, pli, pcc, gxli);
-        plm_gradient(pli, pcc, pri, gxcc);
-        plm_gradient(pcc, pri, pti, gxri);
-        plm_gradient(pkj, plj, pcc, gylj);
-        plm_gradient(plj, pcc, prj, gycc);
-        plm_gradient(pcc, prj, ptj, gyrj);
-        plm_gradient(pll, pli, plr, gyli);
-        plm_gradient(prl, pri, prr, gyri);
-        plm_gradient(pll, plj, prl, gxlj);
-        plm_gradient(plr, prj, prr, gxrj);
-
-        for (int q = 0; q < NCONS; ++q)
-        {
-            plim[q] = pli[q] + 0.5 * gxli[q];
-            plip[q] = pcc[q] - 0.5 * gxcc[q];
-            prim[q] = pcc[q] + 0.5 * gxcc[q];
-            prip[q] = pri[q] - 0.5 * gxri[q];
-
-            pljm[q] = plj[q] + 0.5 * gylj[q];
-            pljp[q] = pcc[q] - 0.5 * gycc[q];
-            prjm[q] = pcc[q] + 0.5 * gycc[q];
-            prjp[q] = prj[q] - 0.5 * gyrj[q];
-        }
-
-        double fli[NCONS];
-        double fri[NCONS];
-        double flj[NCONS];
-        double frj[NCONS];
-        double ucc[NCONS];
-
-        double cs2li = sound_speed_squared(cs2, mach_squared, eos_type, xl, yc, &mass_list);
-        double cs2ri = sound_speed_squared(cs2, mach_squared, eos_type, xr, yc, &mass_list);
-        double cs2lj = sound_speed_squared(cs2, mach_squared, eos_type, xc, yl, &mass_list);
-        double cs2rj = sound_speed_squared(cs2, mach_squared, eos_type, xc, yr, &mass_list);
-
-        riemann_hlle(plim, plip, fli, cs2li, 0);
-        riemann_hlle(prim, prip, fri, cs2ri, 0);
-        riemann_hlle(pljm, pljp, flj, cs2lj, 1);
-        riemann_hlle(prjm, prjp, frj, cs2rj, 1);
-
-        if (nu > 0.0)
-        {
-            double sli[4];
-            double sri[4];
-            double slj[4];
-            double srj[4];
-            double scc[4];
-
-            shear_strain(gxli, gyli, dx, dy, sli);
-            shear_strain(gxri, gyri, dx, dy, sri);
-            shear_strain(gxlj, gylj, dx, dy, slj);
-            shear_strain(gxrj, gyrj, dx, dy, srj);
-            shear_strain(gxcc, gycc, dx, dy, scc);
-
-            fli[1] -= 0.5 * nu * (pli[0] * sli[0] + pcc[0] * scc[0]); // x-x
-            fli[2] -= 0.5 * nu * (pli[0] * sli[1] + pcc[0] * scc[1]); // x-y
-            fri[1] -= 0.5 * nu * (pcc[0] * scc[0] + pri[0] * sri[0]); // x-x
-            fri[2] -= 0.5 * nu * (pcc[0] * scc[1] + pri[0] * sri[1]); // x-y
-            flj[1] -= 0.5 * nu * (plj[0] * slj[2] + pcc[0] * scc[2]); // y-x
-            flj[2] -= 0.5 * nu * (plj[0] * slj[3] + pcc[0] * scc[3]); // y-y
-            frj[1] -= 0.5 * nu * (pcc[0] * scc[2] + prj[0] * srj[2]); // y-x
-            frj[2] -= 0.5 * nu * (pcc[0] * scc[3] + prj[0] * srj[3]); // y-y
-        }
-        double delta_cons[3] = {0.0, 0.0, 0.0};
-        primitive_to_conserved(pcc, ucc);
-        buffer_source_term(&buffer, xc, yc, dt, ucc, delta_cons);
-        point_masses_source_term(&mass_list, xc, yc, dt, pcc, delta_cons);
-
-        for (int q = 0; q < NCONS; ++q)
-        {
-            delta_cons[q] -= ((fri[q] - fli[q]) / dx + (frj[q] - flj[q]) / dy) * dt;
-        }
-        for (int q = 0; q < NCONS; ++q)
-        {
-            ucc[q] += delta_cons[q];
-            ucc[q] = (1.0 - a) * ucc[q] + a * un[q];
-        }
-        conserved_to_primitive(ucc, &primitive_wr[ncc], velocity_ceiling, density_floor);
-    }
-}
-
-PUBLIC void cbdiso_2d_primitive_to_conserved(
-    int ni,
-    int nj,
-    double *primitive, // :: $.shape == (ni + 4, nj + 4, 3)
-    double *conserved) // :: $.shape == (ni + 4, nj + 4, 3)
-{
-    int ng = 2; // number of guard zones
-    int si = NCONS * (nj + 2 * ng);
-    int sj = NCONS;
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
 
     FOR_EACH_2D(ni, nj)
     {
-        int n = (i + ng) * si + (j + ng) * sj;
-
-        double *pc = &primitive[n];
-        double *uc = &conserved[n];
-        primitive_to_conserved(pc, uc);
+        advance_rk_zone(
+            i,
+            j,
+            nj,
+            si,
+            sj,
+            sq,
+            patch_xl,
+            patch_yl,
+            dx,
+            dy,
+            conserved_rk,
+            primitive_rd,
+            primitive_wr,
+            wavespeed,
+            &buffer,
+            &mass_list,
+            NULL,
+            cs2,
+            mach_squared,
+            eos_type,
+            nu,
+            a,
+            dt,
+            velocity_ceiling,
+            density_floor,
+            first_stage,
+            final_stage);
     }
 }
 
-PUBLIC void cbdiso_2d_point_mass_source_term(
+// Same as cbdiso_2d_advance_rk, except the gravitational potential, the
+// gravitational acceleration, and the sink rate profiles are read from a
+// gravity field written by cbdiso_2d_gravity_field, rather than computed in
+// every zone. The point masses are still needed for the sink models.
+PUBLIC void cbdiso_2d_advance_rk_cached( // :: flops = 900
     int ni,
     int nj,
     double patch_xl, // mesh
     double patch_xr,
     double patch_yl,
     double patch_yr,
-    double x1, // particle
+    double *conserved_rk, // :: $.shape == layout(ni + 4, nj + 4, 3)
+    real *primitive_rd, // :: $.shape == layout(ni + 4, nj + 4, 3)
+    real *primitive_wr, // :: $.shape == layout(ni + 4, nj + 4, 3)
+    double *wavespeed, // :: $.shape == (ni + 4, nj + 4)
+    double *gravity_field, // :: $.shape == (ni + 1, nj + 1, 9)
+    double buffer_surface_density,
+    double buffer_central_mass,
+    double buffer_driving_rate,
+    double buffer_outer_radius,
+    double buffer_onset_width,
+    int buffer_is_enabled,
+    double x1, // point mass 1
     double y1,
     double vx1,
     double vy1,
@@ -639,31 +971,886 @@ PUBLIC void cbdiso_2d_point_mass_source_term(
     double sink_rate1,
     double sink_radius1,
     int sink_model1,
-    double *primitive, // :: $.shape == (ni + 4, nj + 4, 3)
-    double *cons_rate) // :: $.shape == (ni + 4, nj + 4, 3)
+    double x2, // point mass 2
+    double y2,
+    double vx2,
+    double vy2,
+    double mass2,
+    double softening_length2,
+    double sink_rate2,
+    double sink_radius2,
+    int sink_model2,
+    double cs2, // equation of state
+    double mach_squared,
+    int eos_type,
+    double nu, // kinematic viscosity coefficient
+    double a, // RK parameter
+    double dt, // timestep
+    double velocity_ceiling,
+    double density_floor,
+    int first_stage, // if non-zero, also write conserved_rk from primitive_rd
+    int final_stage) // if non-zero, also write the signal speed to wavespeed
 {
+    struct KeplerianBuffer buffer = {
+        buffer_surface_density,
+        buffer_central_mass,
+        buffer_driving_rate,
+        buffer_outer_radius,
+        buffer_onset_width,
+        buffer_is_enabled
+    };
     struct PointMass m1 = {x1, y1, vx1, vy1, mass1, softening_length1, sink_rate1, sink_radius1, sink_model1};
-
-    int ng = 2; // number of guard zones
-    int si = NCONS * (nj + 2 * ng);
-    int sj = NCONS;
+    struct PointMass m2 = {x2, y2, vx2, vy2, mass2, softening_length2, sink_rate2, sink_radius2, sink_model2};
+    struct PointMassList mass_list = {{m1, m2}};
 
     double dx = (patch_xr - patch_xl) / ni;
     double dy = (patch_yr - patch_yl) / nj;
 
-    FOR_EACH_2D(ni, nj)
+    int ng = 2; // number of guard zones
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
+
+    FOR_EACH_2D(ni, nj)
     {
+        advance_rk_zone(
+            i,
+            j,
+            nj,
+            si,
+            sj,
+            sq,
+            patch_xl,
+            patch_yl,
+            dx,
+            dy,
+            conserved_rk,
+            primitive_rd,
+            primitive_wr,
+            wavespeed,
+            &buffer,
+            &mass_list,
+            gravity_field,
+            cs2,
+            mach_squared,
+            eos_type,
+            nu,
+            a,
+            dt,
+            velocity_ceiling,
+            density_floor,
+            first_stage,
+            final_stage);
+    }
+}
+
+// The two kernels below advance an ensemble of independent simulations,
+// which differ only in their point masses, in one launch. The index space is
+// (ni, nj, num_members), and the solution arrays have a leading axis of
+// length num_members. The point masses of each member are rows of 9 numbers,
+// (x, y, vx, vy, mass, softening_length, sink_rate, sink_radius, sink_model),
+// and each member has its own time step. The array shape constraints assume
+// the "aos" layout.
+
+PRIVATE void load_point_mass(const double *row, struct PointMass *m)
+{
+    m->x = row[0];
+    m->y = row[1];
+    m->vx = row[2];
+    m->vy = row[3];
+    m->mass = row[4];
+    m->softening_length = row[5];
+    m->sink_rate = row[6];
+    m->sink_radius = row[7];
+    m->sink_model = (int) row[8];
+}
+
+PUBLIC void cbdiso_2d_advance_rk_ensemble( // :: flops = 1100
+    int ni,
+    int nj,
+    int num_members,
+    double patch_xl, // mesh
+    double patch_xr,
+    double patch_yl,
+    double patch_yr,
+    double *conserved_rk, // :: $.shape == (num_members, ni + 4, nj + 4, 3)
+    real *primitive_rd, // :: $.shape == (num_members, ni + 4, nj + 4, 3)
+    real *primitive_wr, // :: $.shape == (num_members, ni + 4, nj + 4, 3)
+    double *wavespeed, // :: $.shape == (num_members, ni + 4, nj + 4)
+    double *point_masses, // :: $.shape == (num_members, 2, 9)
+    double *dt, // :: $.shape == (num_members,)
+    double buffer_surface_density,
+    double buffer_driving_rate,
+    double buffer_outer_radius,
+    double buffer_onset_width,
+    int buffer_is_enabled,
+    double cs2, // equation of state
+    double mach_squared,
+    int eos_type,
+    double nu, // kinematic viscosity coefficient
+    double a, // RK parameter
+    double velocity_ceiling,
+    double density_floor,
+    int first_stage, // if non-zero, also write conserved_rk from primitive_rd
+    int final_stage) // if non-zero, also write the signal speed to wavespeed
+{
+    double dx = (patch_xr - patch_xl) / ni;
+    double dy = (patch_yr - patch_yl) / nj;
+    int sm = (ni + 4) * (nj + 4); // number of zones per member
+
+    int ng = 2; // number of guard zones
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
+
+    FOR_EACH_3D(ni, nj, num_members)
+    {
+        struct PointMassList mass_list;
+        load_point_mass(&point_masses[k * 18 + 0], &mass_list.masses[0]);
+        load_point_mass(&point_masses[k * 18 + 9], &mass_list.masses[1]);
+
+        struct KeplerianBuffer buffer = {
+            buffer_surface_density,
+            mass_list.masses[0].mass + mass_list.masses[1].mass,
+            buffer_driving_rate,
+            buffer_outer_radius,
+            buffer_onset_width,
+            buffer_is_enabled
+        };
+
+        advance_rk_zone(
+            i,
+            j,
+            nj,
+            si,
+            sj,
+            sq,
+            patch_xl,
+            patch_yl,
+            dx,
+            dy,
+            &conserved_rk[k * sm * NCONS],
+            &primitive_rd[k * sm * NCONS],
+            &primitive_wr[k * sm * NCONS],
+            &wavespeed[k * sm],
+            &buffer,
+            &mass_list,
+            NULL,
+            cs2,
+            mach_squared,
+            eos_type,
+            nu,
+            a,
+            dt[k],
+            velocity_ceiling,
+            density_floor,
+            first_stage,
+            final_stage);
+    }
+}
+
+PUBLIC void cbdiso_2d_wavespeed_ensemble( // :: flops = 60
+    int ni,
+    int nj,
+    int num_members,
+    double patch_xl, // mesh
+    double patch_xr,
+    double patch_yl,
+    double patch_yr,
+    double soundspeed2, // equation of state
+    double mach_squared,
+    int eos_type,
+    double *point_masses, // :: $.shape == (num_members, 2, 9)
+    real *primitive, // :: $.shape == (num_members, ni + 4, nj + 4, 3)
+    double *wavespeed) // :: $.shape == (num_members, ni + 4, nj + 4)
+{
+    int ng = 2; // number of guard zones
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int ti = nj + 2 * ng;
+    int tj = 1;
+    int sm = (ni + 2 * ng) * (nj + 2 * ng); // number of zones per member
+    double dx = (patch_xr - patch_xl) / ni;
+    double dy = (patch_yr - patch_yl) / nj;
+
+    FOR_EACH_3D(ni, nj, num_members)
+    {
+        struct PointMassList mass_list;
+        load_point_mass(&point_masses[k * 18 + 0], &mass_list.masses[0]);
+        load_point_mass(&point_masses[k * 18 + 9], &mass_list.masses[1]);
+
+        int np = k * sm * NCONS + (i + ng) * si + (j + ng) * sj;
+        int na = k * sm + (i + ng) * ti + (j + ng) * tj;
+
+        double x = patch_xl + (i + 0.5) * dx;
+        double y = patch_yl + (j + 0.5) * dy;
+
+        double pc[NCONS];
+        load_real_fields(primitive, np, sq, pc);
+        double cs2 = sound_speed_squared(soundspeed2, mach_squared, eos_type, x, y, &mass_list);
+        wavespeed[na] = primitive_max_wavespeed(pc, cs2);
+    }
+}
+
+// Same as cbdiso_2d_advance_rk, except that the point masses (two rows in
+// the format of the ensemble kernels) and the time step are read from device
+// memory. This lets a captured CUDA graph be replayed for every time step,
+// once those arrays have been updated.
+
+PUBLIC void cbdiso_2d_advance_rk_graph( // :: flops = 1100
+    int ni,
+    int nj,
+    double patch_xl, // mesh
+    double patch_xr,
+    double patch_yl,
+    double patch_yr,
+    double *conserved_rk, // :: $.shape == (ni + 4, nj + 4, 3)
+    real *primitive_rd, // :: $.shape == (ni + 4, nj + 4, 3)
+    real *primitive_wr, // :: $.shape == (ni + 4, nj + 4, 3)
+    double *wavespeed, // :: $.shape == (ni + 4, nj + 4)
+    double *point_masses, // :: $.shape == (2, 9)
+    double *dt, // :: $.shape == (1,)
+    double buffer_surface_density,
+    double buffer_driving_rate,
+    double buffer_outer_radius,
+    double buffer_onset_width,
+    int buffer_is_enabled,
+    double cs2, // equation of state
+    double mach_squared,
+    int eos_type,
+    double nu, // kinematic viscosity coefficient
+    double a, // RK parameter
+    double velocity_ceiling,
+    double density_floor,
+    int first_stage, // if non-zero, also write conserved_rk from primitive_rd
+    int final_stage) // if non-zero, also write the signal speed to wavespeed
+{
+    double dx = (patch_xr - patch_xl) / ni;
+    double dy = (patch_yr - patch_yl) / nj;
+
+    int ng = 2; // number of guard zones
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
+
+    FOR_EACH_2D(ni, nj)
+    {
+        struct PointMassList mass_list;
+        load_point_mass(&point_masses[0], &mass_list.masses[0]);
+        load_point_mass(&point_masses[9], &mass_list.masses[1]);
+
+        struct KeplerianBuffer buffer = {
+            buffer_surface_density,
+            mass_list.masses[0].mass + mass_list.masses[1].mass,
+            buffer_driving_rate,
+            buffer_outer_radius,
+            buffer_onset_width,
+            buffer_is_enabled
+        };
+
+        advance_rk_zone(
+            i,
+            j,
+            nj,
+            si,
+            sj,
+            sq,
+            patch_xl,
+            patch_yl,
+            dx,
+            dy,
+            conserved_rk,
+            primitive_rd,
+            primitive_wr,
+            wavespeed,
+            &buffer,
+            &mass_list,
+            NULL,
+            cs2,
+            mach_squared,
+            eos_type,
+            nu,
+            a,
+            dt[0],
+            velocity_ceiling,
+            density_floor,
+            first_stage,
+            final_stage);
+    }
+}
+
+// The three kernels below are an alternative to cbdiso_2d_advance_rk, which
+// computes every PLM gradient and Riemann flux once per zone rather than
+// once per face. The gradient kernel is launched over the patch interior
+// plus one layer of guard zones, and the flux kernel is launched over the
+// patch faces (one more than the number of zones on each axis); the ni and
+// nj arguments of these two kernels are the launch shape, not the number of
+// interior zones.
+
+PUBLIC void cbdiso_2d_plm_gradients(
+    int ni, // number of interior zones + 2
+    int nj,
+    real *primitive, // :: $.shape == layout(ni + 2, nj + 2, 3)
+    double *gradient_x, // :: $.shape == layout(ni + 2, nj + 2, 3)
+    double *gradient_y) // :: $.shape == layout(ni + 2, nj + 2, 3)
+{
+    int ng = 1; // number of guard zones remaining outside the launch shape
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
+
+    FOR_EACH_2D(ni, nj)
+    {
+        int ncc = (i     + ng) * si + (j     + ng) * sj;
+        int nli = (i - 1 + ng) * si + (j     + ng) * sj;
+        int nri = (i + 1 + ng) * si + (j     + ng) * sj;
+        int nlj = (i     + ng) * si + (j - 1 + ng) * sj;
+        int nrj = (i     + ng) * si + (j + 1 + ng) * sj;
+
+        double pcc[NCONS];
+        double pli[NCONS];
+        double pri[NCONS];
+        double plj[NCONS];
+        double prj[NCONS];
+        double gx[NCONS];
+        double gy[NCONS];
+
+        load_real_fields(primitive, ncc, sq, pcc);
+        load_real_fields(primitive, nli, sq, pli);
+        load_real_fields(primitive, nri, sq, pri);
+        load_real_fields(primitive, nlj, sq, plj);
+        load_real_fields(primitive, nrj, sq, prj);
+        plm_gradient(pli, pcc, pri, gx);
+        plm_gradient(plj, pcc, prj, gy);
+        store_fields(gradient_x, ncc, sq, gx);
+        store_fields(gradient_y, ncc, sq, gy);
+    }
+}
+
+PUBLIC void cbdiso_2d_godunov_fluxes(
+    int ni, // number of interior zones + 1
+    int nj,
+    double patch_xl, // mesh
+    double patch_xr,
+    double patch_yl,
+    double patch_yr,
+    real *primitive, // :: $.shape == layout(ni + 3, nj + 3, 3)
+    double *gradient_x, // :: $.shape == layout(ni + 3, nj + 3, 3)
+    double *gradient_y, // :: $.shape == layout(ni + 3, nj + 3, 3)
+    double *flux_x, // :: $.shape == layout(ni, nj, 3)
+    double *flux_y, // :: $.shape == layout(ni, nj, 3)
+    double x1, // point mass 1
+    double y1,
+    double vx1,
+    double vy1,
+    double mass1,
+    double softening_length1,
+    double sink_rate1,
+    double sink_radius1,
+    int sink_model1,
+    double x2, // point mass 2
+    double y2,
+    double vx2,
+    double vy2,
+    double mass2,
+    double softening_length2,
+    double sink_rate2,
+    double sink_radius2,
+    int sink_model2,
+    double cs2, // equation of state
+    double mach_squared,
+    int eos_type,
+    double nu) // kinematic viscosity coefficient
+{
+    struct PointMass m1 = {x1, y1, vx1, vy1, mass1, softening_length1, sink_rate1, sink_radius1, sink_model1};
+    struct PointMass m2 = {x2, y2, vx2, vy2, mass2, softening_length2, sink_rate2, sink_radius2, sink_model2};
+    struct PointMassList mass_list = {{m1, m2}};
+
+    double dx = (patch_xr - patch_xl) / (ni - 1);
+    double dy = (patch_yr - patch_yl) / (nj - 1);
+
+    int ng = 2; // number of guard zones
+    int si = LAYOUT_STRIDE_I(ni - 1 + 2 * ng, nj - 1 + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni - 1 + 2 * ng, nj - 1 + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni - 1 + 2 * ng, nj - 1 + 2 * ng, NCONS);
+    int fi = LAYOUT_STRIDE_I(ni, nj, NCONS);
+    int fj = LAYOUT_STRIDE_J(ni, nj, NCONS);
+    int fq = LAYOUT_STRIDE_Q(ni, nj, NCONS);
+
+    FOR_EACH_2D_SIMD(ni, nj)
+    {
+        double xf = patch_xl + (i + 0.0) * dx;
+        double xc = patch_xl + (i + 0.5) * dx;
+        double yf = patch_yl + (j + 0.0) * dy;
+        double yc = patch_yl + (j + 0.5) * dy;
+        int ncc = (i     + ng) * si + (j     + ng) * sj;
+        int nli = (i - 1 + ng) * si + (j     + ng) * sj;
+        int nlj = (i     + ng) * si + (j - 1 + ng) * sj;
+        int nf = i * fi + j * fj;
+
+        double pr[NCONS];
+        double gxr[NCONS];
+        double gyr[NCONS];
+        load_real_fields(primitive, ncc, sq, pr);
+        load_fields(gradient_x, ncc, sq, gxr);
+        load_fields(gradient_y, ncc, sq, gyr);
+
+        if (j < nj - 1)
+        {
+            // flux through the face between zones li and cc
+            double pl[NCONS];
+            double gxl[NCONS];
+            double gyl[NCONS];
+            double pm[NCONS];
+            double pp[NCONS];
+            double f[NCONS];
+
+            load_real_fields(primitive, nli, sq, pl);
+            load_fields(gradient_x, nli, sq, gxl);
+            load_fields(gradient_y, nli, sq, gyl);
+
+            for (int q = 0; q < NCONS; ++q)
+            {
+                pm[q] = pl[q] + 0.5 * gxl[q];
+                pp[q] = pr[q] - 0.5 * gxr[q];
+            }
+            double cs2f = sound_speed_squared(cs2, mach_squared, eos_type, xf, yc, &mass_list);
+            riemann_hlle(pm, pp, f, cs2f, 0);
+
+            if (nu > 0.0)
+            {
+                double sl[4];
+                double sr[4];
+                shear_strain(gxl, gyl, dx, dy, sl);
+                shear_strain(gxr, gyr, dx, dy, sr);
+                f[1] -= 0.5 * nu * (pl[0] * sl[0] + pr[0] * sr[0]); // x-x
+                f[2] -= 0.5 * nu * (pl[0] * sl[1] + pr[0] * sr[1]); // x-y
+            }
+            store_fields(flux_x, nf, fq, f);
+        }
+
+        if (i < ni - 1)
+        {
+            // flux through the face between zones lj and cc
+            double pl[NCONS];
+            double gxl[NCONS];
+            double gyl[NCONS];
+            double pm[NCONS];
+            double pp[NCONS];
+            double f[NCONS];
+
+            load_real_fields(primitive, nlj, sq, pl);
+            load_fields(gradient_x, nlj, sq, gxl);
+            load_fields(gradient_y, nlj, sq, gyl);
+
+            for (int q = 0; q < NCONS; ++q)
+            {
+                pm[q] = pl[q] + 0.5 * gyl[q];
+                pp[q] = pr[q] - 0.5 * gyr[q];
+            }
+            double cs2f = sound_speed_squared(cs2, mach_squared, eos_type, xc, yf, &mass_list);
+            riemann_hlle(pm, pp, f, cs2f, 1);
+
+            if (nu > 0.0)
+            {
+                double sl[4];
+                double sr[4];
+                shear_strain(gxl, gyl, dx, dy, sl);
+                shear_strain(gxr, gyr, dx, dy, sr);
+                f[1] -= 0.5 * nu * (pl[0] * sl[2] + pr[0] * sr[2]); // y-x
+                f[2] -= 0.5 * nu * (pl[0] * sl[3] + pr[0] * sr[3]); // y-y
+            }
+            store_fields(flux_y, nf, fq, f);
+        }
+    }
+}
+
+PUBLIC void cbdiso_2d_update_from_fluxes(
+    int ni,
+    int nj,
+    double patch_xl, // mesh
+    double patch_xr,
+    double patch_yl,
+    double patch_yr,
+    double *conserved_rk, // :: $.shape == layout(ni + 4, nj + 4, 3)
+    real *primitive_rd, // :: $.shape == layout(ni + 4, nj + 4, 3)
+    real *primitive_wr, // :: $.shape == layout(ni + 4, nj + 4, 3)
+    double *wavespeed, // :: $.shape == (ni + 4, nj + 4)
+    double *flux_x, // :: $.shape == layout(ni + 1, nj + 1, 3)
+    double *flux_y, // :: $.shape == layout(ni + 1, nj + 1, 3)
+    double buffer_surface_density,
+    double buffer_central_mass,
+    double buffer_driving_rate,
+    double buffer_outer_radius,
+    double buffer_onset_width,
+    int buffer_is_enabled,
+    double x1, // point mass 1
+    double y1,
+    double vx1,
+    double vy1,
+    double mass1,
+    double softening_length1,
+    double sink_rate1,
+    double sink_radius1,
+    int sink_model1,
+    double x2, // point mass 2
+    double y2,
+    double vx2,
+    double vy2,
+    double mass2,
+    double softening_length2,
+    double sink_rate2,
+    double sink_radius2,
+    int sink_model2,
+    double cs2, // equation of state
+    double mach_squared,
+    int eos_type,
+    double a, // RK parameter
+    double dt, // timestep
+    double velocity_ceiling,
+    double density_floor,
+    int first_stage, // if non-zero, also write conserved_rk from primitive_rd
+    int final_stage) // if non-zero, also write the signal speed to wavespeed
+{
+    struct KeplerianBuffer buffer = {
+        buffer_surface_density,
+        buffer_central_mass,
+        buffer_driving_rate,
+        buffer_outer_radius,
+        buffer_onset_width,
+        buffer_is_enabled
+    };
+    struct PointMass m1 = {x1, y1, vx1, vy1, mass1, softening_length1, sink_rate1, sink_radius1, sink_model1};
+    struct PointMass m2 = {x2, y2, vx2, vy2, mass2, softening_length2, sink_rate2, sink_radius2, sink_model2};
+    struct PointMassList mass_list = {{m1, m2}};
+
+    double dx = (patch_xr - patch_xl) / ni;
+    double dy = (patch_yr - patch_yl) / nj;
+
+    int ng = 2; // number of guard zones
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int ti = nj + 2 * ng;
+    int tj = 1;
+    int fi = LAYOUT_STRIDE_I(ni + 1, nj + 1, NCONS);
+    int fj = LAYOUT_STRIDE_J(ni + 1, nj + 1, NCONS);
+    int fq = LAYOUT_STRIDE_Q(ni + 1, nj + 1, NCONS);
+
+    FOR_EACH_2D(ni, nj)
+    {
+        double xc = patch_xl + (i + 0.5) * dx;
+        double yc = patch_yl + (j + 0.5) * dy;
         int ncc = (i + ng) * si + (j + ng) * sj;
 
+        double un[NCONS];
+        double pcc[NCONS];
+        double fli[NCONS];
+        double fri[NCONS];
+        double flj[NCONS];
+        double frj[NCONS];
+        double ucc[NCONS];
+
+        load_real_fields(primitive_rd, ncc, sq, pcc);
+        load_fields(flux_x, (i + 0) * fi + (j + 0) * fj, fq, fli);
+        load_fields(flux_x, (i + 1) * fi + (j + 0) * fj, fq, fri);
+        load_fields(flux_y, (i + 0) * fi + (j + 0) * fj, fq, flj);
+        load_fields(flux_y, (i + 0) * fi + (j + 1) * fj, fq, frj);
+
+        double delta_cons[3] = {0.0, 0.0, 0.0};
+        primitive_to_conserved(pcc, ucc);
+
+        if (first_stage)
+        {
+            for (int q = 0; q < NCONS; ++q)
+            {
+                un[q] = ucc[q];
+            }
+            store_fields(conserved_rk, ncc, sq, un);
+        }
+        else
+        {
+            load_fields(conserved_rk, ncc, sq, un);
+        }
+        buffer_source_term(&buffer, xc, yc, dt, ucc, delta_cons);
+        point_masses_source_term(&mass_list, xc, yc, dt, pcc, delta_cons);
+
+        for (int q = 0; q < NCONS; ++q)
+        {
+            delta_cons[q] -= ((fri[q] - fli[q]) / dx + (frj[q] - flj[q]) / dy) * dt;
+        }
+        for (int q = 0; q < NCONS; ++q)
+        {
+            ucc[q] += delta_cons[q];
+            ucc[q] = (1.0 - a) * ucc[q] + a * un[q];
+        }
+        double pout[NCONS];
+        conserved_to_primitive(ucc, pout, velocity_ceiling, density_floor);
+        store_real_fields(primitive_wr, ncc, sq, pout);
+
+        if (final_stage)
+        {
+            double cs2cc = sound_speed_squared(cs2, mach_squared, eos_type, xc, yc, &mass_list);
+            wavespeed[(i + ng) * ti + (j + ng) * tj] = primitive_max_wavespeed(pout, cs2cc);
+        }
+    }
+}
+
+PUBLIC void cbdiso_2d_primitive_to_conserved( // :: flops = 2
+    int ni,
+    int nj,
+    real *primitive, // :: $.shape == layout(ni + 4, nj + 4, 3)
+    double *conserved) // :: $.shape == layout(ni + 4, nj + 4, 3)
+{
+    int ng = 2; // number of guard zones
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
+
+    FOR_EACH_2D(ni, nj)
+    {
+        int n = (i + ng) * si + (j + ng) * sj;
+
+        double pc[NCONS];
+        double uc[NCONS];
+        load_real_fields(primitive, n, sq, pc);
+        primitive_to_conserved(pc, uc);
+        store_fields(conserved, n, sq, uc);
+    }
+}
+
+PUBLIC void cbdiso_2d_conserved_to_primitive( // :: flops = 6
+    int ni,
+    int nj,
+    double *conserved, // :: $.shape == layout(ni + 4, nj + 4, 3)
+    real *primitive, // :: $.shape == layout(ni + 4, nj + 4, 3)
+    double velocity_ceiling,
+    double density_floor)
+{
+    int ng = 2; // number of guard zones
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
+
+    FOR_EACH_2D(ni, nj)
+    {
+        int n = (i + ng) * si + (j + ng) * sj;
+
+        double uc[NCONS];
+        double pc[NCONS];
+        load_fields(conserved, n, sq, uc);
+        conserved_to_primitive(uc, pc, velocity_ceiling, density_floor);
+        store_real_fields(primitive, n, sq, pc);
+    }
+}
+
+PUBLIC void cbdiso_2d_gravity_field( // :: flops = 90
+    int ni, // number of zones plus one on each axis
+    int nj,
+    double patch_xl, // mesh
+    double patch_yl,
+    double dx,
+    double dy,
+    double x1, // point mass 1
+    double y1,
+    double vx1,
+    double vy1,
+    double mass1,
+    double softening_length1,
+    double sink_rate1,
+    double sink_radius1,
+    int sink_model1,
+    double x2, // point mass 2
+    double y2,
+    double vx2,
+    double vy2,
+    double mass2,
+    double softening_length2,
+    double sink_rate2,
+    double sink_radius2,
+    int sink_model2,
+    double *gravity_field) // :: $.shape == (ni, nj, 9)
+{
+    struct PointMass m1 = {x1, y1, vx1, vy1, mass1, softening_length1, sink_rate1, sink_radius1, sink_model1};
+    struct PointMass m2 = {x2, y2, vx2, vy2, mass2, softening_length2, sink_rate2, sink_radius2, sink_model2};
+    struct PointMassList mass_list = {{m1, m2}};
+
+    FOR_EACH_2D(ni, nj)
+    {
+        double xl = patch_xl + (i + 0.0) * dx;
         double xc = patch_xl + (i + 0.5) * dx;
+        double yl = patch_yl + (j + 0.0) * dy;
         double yc = patch_yl + (j + 0.5) * dy;
-        double *pc = &primitive[ncc];
-        double *uc = &cons_rate[ncc];
+        double *g = &gravity_field[(i * nj + j) * NUM_GRAVITY_FIELDS];
+
+        g[GRAVITY_FIELD_PHI_X] = gravitational_potential(&mass_list, xl, yc);
+        g[GRAVITY_FIELD_PHI_Y] = gravitational_potential(&mass_list, xc, yl);
+        g[GRAVITY_FIELD_PHI_C] = gravitational_potential(&mass_list, xc, yc);
+        point_mass_profile(&m1, xc, yc, &g[GRAVITY_FIELD_PROFILE + 0]);
+        point_mass_profile(&m2, xc, yc, &g[GRAVITY_FIELD_PROFILE + 3]);
+    }
+}
+
+// Write the source term due to one point mass to the cons_rate array, on the
+// box of zones (i0 <= i < i0 + ni_box, j0 <= j < j0 + nj_box) of a patch with
+// shape (ni, nj). The box is the whole patch for gravity, but for accretion
+// it can be restricted to the zones near the sink. Zones outside the box are
+// not written.
+PUBLIC void cbdiso_2d_point_mass_source_term(
+    int ni_box,
+    int nj_box,
+    double patch_xl, // mesh
+    double patch_xr,
+    double patch_yl,
+    double patch_yr,
+    double x1, // particle
+    double y1,
+    double vx1,
+    double vy1,
+    double mass1,
+    double softening_length1,
+    double sink_rate1,
+    double sink_radius1,
+    int sink_model1,
+    real *primitive, // :: $.shape == layout(ni + 4, nj + 4, 3)
+    double *cons_rate, // :: $.shape == layout(ni + 4, nj + 4, 3)
+    int ni, // :: i0 >= 0 and i0 + ni_box <= $
+    int nj, // :: j0 >= 0 and j0 + nj_box <= $
+    int i0,
+    int j0)
+{
+    struct PointMass m1 = {x1, y1, vx1, vy1, mass1, softening_length1, sink_rate1, sink_radius1, sink_model1};
+
+    int ng = 2; // number of guard zones
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
+
+    double dx = (patch_xr - patch_xl) / ni;
+    double dy = (patch_yr - patch_yl) / nj;
+
+    FOR_EACH_2D(ni_box, nj_box)
+    {
+        int ii = i + i0;
+        int jj = j + j0;
+        int ncc = (ii + ng) * si + (jj + ng) * sj;
+
+        double xc = patch_xl + (ii + 0.5) * dx;
+        double yc = patch_yl + (jj + 0.5) * dy;
+        double pc[NCONS];
+        double uc[NCONS] = {0.0, 0.0, 0.0};
+        load_real_fields(primitive, ncc, sq, pc);
         point_mass_source_term(&m1, xc, yc, 1.0, pc, uc);
+        store_fields(cons_rate, ncc, sq, uc);
+    }
+}
+
+// Compute the sums of many diagnostic fields over a patch, in one pass over
+// the primitive data. Each row of the descriptor table describes one
+// diagnostic (see `accumulate_diagnostic`). The traversal is over rows, and
+// chunks of chunk_size zones within each row, each of which writes the
+// partial sums of every diagnostic (real and imaginary parts) to its own
+// slot of the partial array. The partial array is then summed over its
+// first two axes by the caller, which on the GPU is a device reduction.
+PUBLIC void cbdiso_2d_diagnostic_sums(
+    int ni,
+    int num_chunks, // :: $ * chunk_size >= nj
+    double patch_xl, // mesh
+    double patch_xr,
+    double patch_yl,
+    double patch_yr,
+    double x1, // point mass 1
+    double y1,
+    double vx1,
+    double vy1,
+    double mass1,
+    double softening_length1,
+    double sink_rate1,
+    double sink_radius1,
+    int sink_model1,
+    double x2, // point mass 2
+    double y2,
+    double vx2,
+    double vy2,
+    double mass2,
+    double softening_length2,
+    double sink_rate2,
+    double sink_radius2,
+    int sink_model2,
+    real *primitive, // :: $.shape == layout(ni + 4, nj + 4, 3)
+    double *descriptors, // :: $.shape == (num_diagnostics, 6)
+    double *partial, // :: $.shape == (ni, num_chunks, num_diagnostics, 2)
+    int nj,
+    int chunk_size,
+    int num_diagnostics) // :: 0 < $ <= 32
+{
+    struct PointMass m1 = {x1, y1, vx1, vy1, mass1, softening_length1, sink_rate1, sink_radius1, sink_model1};
+    struct PointMass m2 = {x2, y2, vx2, vy2, mass2, softening_length2, sink_rate2, sink_radius2, sink_model2};
+    struct PointMassList mass_list = {{m1, m2}};
+
+    int ng = 2; // number of guard zones
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
+    double dx = (patch_xr - patch_xl) / ni;
+    double dy = (patch_yr - patch_yl) / nj;
+
+    FOR_EACH_2D(ni, num_chunks)
+    {
+        double acc[MAX_DIAGNOSTICS][2];
+        int j0 = j * chunk_size;
+        int j1 = min2(j0 + chunk_size, nj);
+
+        for (int d = 0; d < num_diagnostics; ++d)
+        {
+            acc[d][0] = 0.0;
+            acc[d][1] = 0.0;
+        }
+
+        for (int jj = j0; jj < j1; ++jj)
+        {
+            int ncc = (i + ng) * si + (jj + ng) * sj;
+            double xc = patch_xl + (i + 0.5) * dx;
+            double yc = patch_yl + (jj + 0.5) * dy;
+            double pc[NCONS];
+            double u_grav[2][NCONS];
+            double u_accr[2][NCONS];
+            load_real_fields(primitive, ncc, sq, pc);
+
+            for (int p = 0; p < 2; ++p)
+            {
+                struct PointMass grav = mass_list.masses[p];
+                struct PointMass accr = mass_list.masses[p];
+                grav.sink_rate = 0.0;
+                accr.mass = 0.0;
+
+                for (int q = 0; q < NCONS; ++q)
+                {
+                    u_grav[p][q] = 0.0;
+                    u_accr[p][q] = 0.0;
+                }
+                point_mass_source_term(&grav, xc, yc, 1.0, pc, u_grav[p]);
+                point_mass_source_term(&accr, xc, yc, 1.0, pc, u_accr[p]);
+            }
+
+            for (int d = 0; d < num_diagnostics; ++d)
+            {
+                const double *row = &descriptors[d * DIAGNOSTIC_COLUMNS];
+                accumulate_diagnostic(row, xc, yc, pc, u_grav, u_accr, &mass_list, acc[d]);
+            }
+        }
+
+        for (int d = 0; d < num_diagnostics; ++d)
+        {
+            int n = ((i * num_chunks + j) * num_diagnostics + d) * 2;
+            partial[n + 0] = acc[d][0];
+            partial[n + 1] = acc[d][1];
+        }
     }
 }
 
-PUBLIC void cbdiso_2d_wavespeed(
+PUBLIC void cbdiso_2d_wavespeed( // :: flops = 60
     int ni, // mesh
     int nj,
     double patch_xl,
@@ -691,7 +1878,7 @@ PUBLIC void cbdiso_2d_wavespeed(
     double sink_rate2,
     double sink_radius2,
     int sink_model2,
-    double *primitive, // :: $.shape == (ni + 4, nj + 4, 3)
+    real *primitive, // :: $.shape == layout(ni + 4, nj + 4, 3)
     double *wavespeed) // :: $.shape == (ni + 4, nj + 4)
 {
     struct PointMass m1 = {x1, y1, vx1, vy1, mass1, softening_length1, sink_rate1, sink_radius1, sink_model1};
@@ -699,8 +1886,9 @@ PUBLIC void cbdiso_2d_wavespeed(
     struct PointMassList mass_list = {{m1, m2}};
 
     int ng = 2; // number of guard zones
-    int si = NCONS * (nj + 2 * ng);
-    int sj = NCONS;
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj + 2 * ng, NCONS);
     int ti = nj + 2 * ng;
     int tj = 1;
     double dx = (patch_xr - patch_xl)/ni;
@@ -714,9 +1902,160 @@ PUBLIC void cbdiso_2d_wavespeed(
         double x = patch_xl + (i + 0.5) * dx;
         double y = patch_yl + (j + 0.5) * dy;
 
-        double *pc = &primitive[np];
+        double pc[NCONS];
+        load_real_fields(primitive, np, sq, pc);
         double cs2 = sound_speed_squared(soundspeed2, mach_squared, eos_type, x, y, &mass_list);
         double a = primitive_max_wavespeed(pc, cs2);
         wavespeed[na] = a;
     }
 }
+
+
+// ============================ MESH REFINEMENT ===============================
+// ============================================================================
+// Interpolate the primitive fields at an offset (ox, oy), in units of the
+// coarse zone spacing, from the center of the coarse zone at index nc. The
+// slopes are limited in the same way as they are for the reconstruction.
+PRIVATE void prolong_zone(
+    const real *coarse,
+    int nc,
+    int si,
+    int sj,
+    int sq,
+    double ox,
+    double oy,
+    double *pf)
+{
+    double pl[NCONS];
+    double pc[NCONS];
+    double pr[NCONS];
+    double gx[NCONS];
+    double gy[NCONS];
+
+    load_real_fields(coarse, nc, sq, pc);
+    load_real_fields(coarse, nc - si, sq, pl);
+    load_real_fields(coarse, nc + si, sq, pr);
+    plm_gradient(pl, pc, pr, gx);
+    load_real_fields(coarse, nc - sj, sq, pl);
+    load_real_fields(coarse, nc + sj, sq, pr);
+    plm_gradient(pl, pc, pr, gy);
+
+    for (int q = 0; q < NCONS; ++q)
+    {
+        pf[q] = pc[q] + ox * gx[q] + oy * gy[q];
+    }
+}
+
+// Fill the guard zones of a fine block from its parent block, which is one
+// level coarser. The fine block covers the quadrant (quadrant_i, quadrant_j)
+// of the parent. The traversal is over the ring of 8 * block_size + 16 guard
+// zones: the first two rows, the last two rows, and then the first two and
+// last two columns of each interior row. The parent arrays must have their
+// own guard zones filled, and they hold the parent solution at the start
+// and the end of its time step; the result is interpolated linearly in time
+// between them, with the given weight for the end of the step.
+PUBLIC void cbdiso_2d_prolong_guard( // :: flops = 130
+    int num_zones, // :: $ == 8 * block_size + 16
+    real *coarse_old, // :: $.shape == layout(block_size + 4, block_size + 4, 3)
+    real *coarse_new, // :: $.shape == layout(block_size + 4, block_size + 4, 3)
+    real *fine, // :: $.shape == layout(block_size + 4, block_size + 4, 3)
+    int block_size,
+    int quadrant_i,
+    int quadrant_j,
+    double weight)
+{
+    int ng = 2; // number of guard zones
+    int nb = block_size + 2 * ng;
+    int si = LAYOUT_STRIDE_I(nb, nb, NCONS);
+    int sj = LAYOUT_STRIDE_J(nb, nb, NCONS);
+    int sq = LAYOUT_STRIDE_Q(nb, nb, NCONS);
+
+    FOR_EACH_1D(num_zones)
+    {
+        int fi;
+        int fj;
+
+        if (i < ng * nb)
+        {
+            fi = i / nb;
+            fj = i % nb;
+        }
+        else if (i < 2 * ng * nb)
+        {
+            fi = nb - ng + (i - ng * nb) / nb;
+            fj = (i - ng * nb) % nb;
+        }
+        else
+        {
+            int c = (i - 2 * ng * nb) % (2 * ng);
+            fi = ng + (i - 2 * ng * nb) / (2 * ng);
+            fj = c < ng ? c : nb - 2 * ng + c;
+        }
+
+        // Global fine index (counting the guard zones) within the parent
+        int gi = quadrant_i * block_size + fi;
+        int gj = quadrant_j * block_size + fj;
+        int nc = (gi / 2 + 1) * si + (gj / 2 + 1) * sj;
+        int nf = fi * si + fj * sj;
+        double ox = gi % 2 == 0 ? -0.25 : 0.25;
+        double oy = gj % 2 == 0 ? -0.25 : 0.25;
+
+        double p0[NCONS];
+        double p1[NCONS];
+        double pf[NCONS];
+        prolong_zone(coarse_old, nc, si, sj, sq, ox, oy, p0);
+        prolong_zone(coarse_new, nc, si, sj, sq, ox, oy, p1);
+
+        for (int q = 0; q < NCONS; ++q)
+        {
+            pf[q] = (1.0 - weight) * p0[q] + weight * p1[q];
+        }
+        store_real_fields(fine, nf, sq, pf);
+    }
+}
+
+// Replace the primitive fields of the quadrant (quadrant_i, quadrant_j) of a
+// parent block with the conservative average of the fine block covering it.
+// The traversal is over the parent zones in the quadrant, so ni and nj are
+// half the block size.
+PUBLIC void cbdiso_2d_restrict( // :: flops = 24
+    int ni,
+    int nj,
+    real *fine, // :: $.shape == layout(2 * ni + 4, 2 * nj + 4, 3)
+    real *coarse, // :: $.shape == layout(2 * ni + 4, 2 * nj + 4, 3)
+    int quadrant_i,
+    int quadrant_j,
+    double velocity_ceiling,
+    double density_floor)
+{
+    int ng = 2; // number of guard zones
+    int si = LAYOUT_STRIDE_I(2 * ni + 2 * ng, 2 * nj + 2 * ng, NCONS);
+    int sj = LAYOUT_STRIDE_J(2 * ni + 2 * ng, 2 * nj + 2 * ng, NCONS);
+    int sq = LAYOUT_STRIDE_Q(2 * ni + 2 * ng, 2 * nj + 2 * ng, NCONS);
+
+    FOR_EACH_2D(ni, nj)
+    {
+        int nc = (quadrant_i * ni + i + ng) * si + (quadrant_j * nj + j + ng) * sj;
+        double uc[NCONS] = {0.0, 0.0, 0.0};
+        double pc[NCONS];
+
+        for (int di = 0; di < 2; ++di)
+        {
+            for (int dj = 0; dj < 2; ++dj)
+            {
+                int nf = (2 * i + di + ng) * si + (2 * j + dj + ng) * sj;
+                double pf[NCONS];
+                double uf[NCONS];
+                load_real_fields(fine, nf, sq, pf);
+                primitive_to_conserved(pf, uf);
+
+                for (int q = 0; q < NCONS; ++q)
+                {
+                    uc[q] += 0.25 * uf[q];
+                }
+            }
+        }
+        conserved_to_primitive(uc, pc, velocity_ceiling, density_floor);
+        store_real_fields(coarse, nc, sq, pc);
+    }
+}
@@ -4,8 +4,15 @@ Isothermal solver for the binary accretion problem in 2D planar coordinates.
 
 from logging import getLogger
 from typing import NamedTuple, List
+from sailfish.boundary import GuardZoneFill, BoundaryCondition
+from sailfish.initial_data import initial_primitive
 from sailfish.kernel.library import Library
-from sailfish.kernel.system import get_array_module, execution_context, num_devices
+from sailfish.kernel.scratch import ScratchArena, scratch_report
+from sailfish.kernel.system import (
+    get_array_module,
+    execution_context,
+    num_devices,
+)
 from sailfish.mesh import PlanarCartesian2DMesh
 from sailfish.physics.circumbinary import (
     Physics,
@@ -14,7 +21,15 @@ from sailfish.physics.circumbinary import (
     Diagnostic,
 )
 from sailfish.solver_base import SolverBase
-from sailfish.subdivide import subdivide, to_host, concat_on_host, lazy_reduce
+from sailfish.subdivide import (
+    BlockDecomposition,
+    GuardZoneExchange,
+    to_host,
+    concat_blocks_on_host,
+    lazy_reduce,
+    deferred_reduce,
+)
+from sailfish.communicator import get_communicator
 
 
 logger = getLogger(__name__)
@@ -23,27 +38,261 @@ logger = getLogger(__name__)
 class Options(NamedTuple):
     """
     Contains parameters which are solver specific options.
+
+    If `fused_rk` is true, the primitive-to-conserved conversion at the start
+    of each time step is done by the first RK stage, and the last RK stage
+    writes the wavespeeds used for the next time step size. This saves two
+    full passes over the solution arrays per time step.
+
+    If `two_phase` is true, each RK stage first computes the PLM gradients
+    once per zone, and then the Godunov fluxes once per face, into scratch
+    arrays owned by each patch. The zone update then only differences the
+    fluxes. This avoids the redundant gradient, sound speed, and Riemann
+    solver evaluations done by the single-kernel update, at the cost of two
+    extra passes over memory.
+
+    The `layout` option is either "aos" (the fields of each zone are
+    contiguous in memory) or "soa" (each field is contiguous in memory). The
+    solution array is always returned as an "aos" array.
+
+    The `precision` option is either "double" or "single", and sets the
+    storage precision of the primitive variable arrays. In single precision,
+    the kernels still compute the reconstruction, the fluxes, and the
+    conserved variable update in double precision. The conserved variable
+    and scratch arrays are always double precision, and the solution array is
+    converted to double precision.
+
+    If `overlap_halo` is true, each RK stage first launches the update of the
+    zones which do not depend on the guard zones, then exchanges the guard
+    zones on a second stream owned by each patch, and finally launches the
+    update of the remaining zones near the patch edges. On the GPU this
+    overlaps the halo exchange with the interior update. It requires the
+    "aos" layout, is not compatible with `two_phase`, and divides the domain
+    into slabs rather than blocks (see below). Since the edge
+    launches use a shifted patch extent, results may differ from the
+    unsplit update at the level of round-off.
+
+    The domain is divided into a 2D grid of patches, chosen to minimize the
+    number of guard zones exchanged between patches. The `patch_blocks`
+    option, if given, is the number of patches `(pi, pj)` along each axis.
+
+    If `cuda_graph` is true, the first time step captures all of the RK
+    stages and guard zone fills as a CUDA graph, which is replayed on every
+    later time step. This removes the Python overhead of the kernel launches,
+    which matters for small meshes. The time step and the point masses at the
+    start of each stage are uploaded to device arrays before each replay, and
+    the update kernel reads them from there. It requires gpu mode, a single
+    patch in a single process, and the "aos" layout, and it is not compatible
+    with `two_phase` or `overlap_halo`.
+
+    If `fused_reductions` is true, the diagnostic sums for the time series
+    are all accumulated by a single kernel launch per patch, which reads the
+    primitive data once, rather than by array expressions which create
+    several temporary arrays the size of the patch for each diagnostic. The
+    sums are then added up in a different order, so they may differ from
+    the unfused ones at the level of round-off.
+
+    If `gravity_cache` is true, each patch stores the gravitational
+    potential at the zone faces and centers, and the gravitational
+    acceleration and sink rate profile of each point mass at the zone
+    centers, and the update kernel reads these rather than recomputing the
+    square roots, powers, and exponentials in every zone and RK stage. The
+    cached field takes 9 doubles per zone, and it's recomputed whenever
+    either point mass has moved by more than `gravity_cache_tolerance` (a
+    distance) since it was last computed, or their masses or sink parameters
+    have changed. The default tolerance of zero is exact, and is intended for
+    setups where the point masses are fixed. The point mass velocities are
+    not cached. It's not compatible with `two_phase` or `cuda_graph`.
+
+    The temporary arrays of the reductions and the scratch arrays of the
+    `two_phase` update are kept in a `ScratchArena` owned by each patch, so
+    they are allocated once. If `pinned_scratch` is true, the host arrays
+    which stage the device-to-host copies of the solution are in pinned
+    memory (this only has an effect in gpu mode).
+
+    If `bc_kernel` is true, the guard zones of each patch are filled by one
+    launch of the `apply_boundary_conditions` kernel (see
+    `sailfish.boundary`), rather than with array copies per guard region and
+    edge. It requires all of the patches to be in one process, and on one
+    device, and it's not compatible with `overlap_halo`.
+
+    The initial data of each patch is generated on its own device, with the
+    setup's vectorized `primitive_array` if it has one. Otherwise the setup
+    is evaluated zone by zone, and if `startup_workers` is more than one,
+    the rows of each patch are divided over a pool of that many processes.
     """
 
     velocity_ceiling: float = 1e12
     density_floor: float = 1e-12
     rk_order: int = 2
+    fused_rk: bool = False
+    two_phase: bool = False
+    layout: str = "aos"
+    precision: str = "double"
+    overlap_halo: bool = False
+    patch_blocks: tuple = None
+    cuda_graph: bool = False
+    fused_reductions: bool = False
+    gravity_cache: bool = False
+    gravity_cache_tolerance: float = 0.0
+    pinned_scratch: bool = False
+    bc_kernel: bool = False
+    startup_workers: int = 1
+
+
+# The parameter of each stage of the low-storage RK schemes, by order. The
+# stage update is u = (1 - a) * (u + du) + a * u0, where u0 is the solution at
+# the start of the time step.
+RK_PARAMETERS = {1: [0.0], 2: [0.0, 0.5], 3: [0.0, 0.75, 1.0 / 3.0]}
+
+
+# The quantity codes of the diagnostics read by the diagnostic sums kernel.
+# The codes 0, 1, 2 (mdot, fx, fy) are the conserved variable source terms
+# due to the point masses, and the codes up to 4 are derived from them.
+DIAGNOSTIC_CODES = dict(
+    mdot=0,
+    fx=1,
+    fy=2,
+    torque=3,
+    power=4,
+    sigma_m1=5,
+    eccentricity_vector=6,
+    angular_momentum=7,
+    mass=8,
+)
+COMPLEX_DIAGNOSTICS = ("sigma_m1", "eccentricity_vector")
+DIAGNOSTIC_CHUNK = 64
+MAX_DIAGNOSTICS = 32
+
 
+def diagnostic_table(diagnostics):
+    """
+    Return the descriptor table read by the `cbdiso_2d_diagnostic_sums`
+    kernel, as a list of rows, for each of the diagnostics other than time.
 
-def initial_condition(setup, mesh, time):
+    Each row is the quantity code, the point mass (1, 2, or 3 for both), the
+    gravity and accretion flags, and the radial cut. When both flags are
+    set, only the accretion term is used, as in `Solver.reductions`.
+    """
+    rows = []
+
+    for d in diagnostics:
+        if d.quantity == "time":
+            continue
+
+        if d.quantity in (0, 1, 2):
+            code = d.quantity
+        elif d.quantity in DIAGNOSTIC_CODES:
+            code = DIAGNOSTIC_CODES[d.quantity]
+        else:
+            raise ValueError(f"unknown diagnostic quantity {d.quantity}")
+
+        which_mass = {1: 1, 2: 2, "both": 3}.get(d.which_mass, 0)
+
+        if code <= DIAGNOSTIC_CODES["power"]:
+            if which_mass == 0:
+                raise ValueError(f"{d.quantity} requires which_mass = 1, 2, or 'both'")
+            if not (d.gravity or d.accretion):
+                raise ValueError(f"{d.quantity} requires gravity or accretion")
+            if code == DIAGNOSTIC_CODES["power"] and which_mass == 3:
+                raise ValueError("Mass option for 'power' must be 1 or 2.")
+
+        r0, r1 = d.radial_cut or (-1.0, float("inf"))
+        rows.append([code, which_mass, int(d.gravity), int(d.accretion), r0, r1])
+
+    if len(rows) > MAX_DIAGNOSTICS:
+        raise ValueError(f"fused_reductions supports at most {MAX_DIAGNOSTICS}")
+
+    return rows
+
+
+def point_mass_rows(masses):
+    """
+    Return the point masses as rows of 9 numbers, in the order of the
+    `PointMass` struct in the C code (this is the format read by the graph
+    and ensemble kernels).
+    """
+    return [
+        [
+            m.position_x,
+            m.position_y,
+            m.velocity_x,
+            m.velocity_y,
+            m.mass,
+            m.softening_length,
+            m.sink_rate,
+            m.sink_radius,
+            m.sink_model.value,
+        ]
+        for m in masses
+    ]
+
+
+def initial_condition(setup, mesh, time, index_range=None, xp=None, num_workers=1):
     """
     Generate a 2D array of primitive data from a mesh and a setup.
+
+    If `index_range` is given, only the zones in the block `((i0, i1), (j0,
+    j1))` are generated. The array is allocated with the array module `xp`
+    (numpy by default) on the current device. The setup's `primitive_array`
+    is used if it implements one, and otherwise its `primitive` method is
+    called once per zone, in `num_workers` processes (see
+    `sailfish.initial_data.initial_primitive`).
     """
     import numpy as np
 
-    ni, nj = mesh.shape
-    primitive = np.zeros([ni, nj, 3])
+    index_range = index_range or ((0, mesh.shape[0]), (0, mesh.shape[1]))
+    xp = xp or np
+    return initial_primitive(setup, mesh, time, index_range, 3, xp, num_workers)
 
-    for i in range(ni):
-        for j in range(nj):
-            setup.primitive(time, mesh.cell_coordinates(i, j), primitive[i, j])
 
-    return primitive
+def validate_physics(setup, mesh, physics):
+    """
+    Raise a `ValueError` if the setup, mesh, or physics parameters are not
+    supported by the isothermal solvers.
+    """
+    if type(mesh) is not PlanarCartesian2DMesh:
+        raise ValueError("solver only supports 2D cartesian mesh")
+
+    if setup.boundary_condition != "outflow":
+        raise ValueError("solver only supports outflow boundary condition")
+
+    if physics.viscosity_model not in (
+        ViscosityModel.NONE,
+        ViscosityModel.CONSTANT_NU,
+    ):
+        raise ValueError("solver only supports constant-nu viscosity")
+
+    if physics.eos_type not in (
+        EquationOfState.GLOBALLY_ISOTHERMAL,
+        EquationOfState.LOCALLY_ISOTHERMAL,
+    ):
+        raise ValueError("solver only supports isothermal equation of states")
+
+    if physics.cooling_coefficient != 0.0:
+        raise ValueError("solver does not support thermal cooling")
+
+    if not physics.constant_softening:
+        raise ValueError("solver only supports constant gravitational softening")
+
+
+def buffer_parameters(setup, mesh, physics, time):
+    """
+    Return the outer radius of the buffer zone, and the disk surface density
+    it drives toward, or zeros if the buffer is disabled.
+    """
+    if physics.buffer_is_enabled:
+        # Here we sample the initial condition at the buffer onset radius
+        # to determine the disk surface density at the radius where the
+        # buffer begins to ramp up. This procedure makes sense as long as
+        # the initial condition is axisymmetric.
+        buffer_prim = [0.0] * 3
+        buffer_outer_radius = mesh.x1  # this assumes the mesh is a centered squared
+        buffer_onset_radius = buffer_outer_radius - physics.buffer_onset_width
+        setup.primitive(time, [buffer_onset_radius, 0.0], buffer_prim)
+        return buffer_outer_radius, buffer_prim[0]
+    else:
+        return 0.0, 0.0
 
 
 class Patch:
@@ -65,21 +314,27 @@ class Patch:
         lib,
         xp,
         execution_context,
+        halo_context=None,
     ):
-        i0, i1 = index_range
-        ni, nj = i1 - i0, mesh.shape[1]
+        (i0, i1), (j0, j1) = index_range
+        ni, nj = i1 - i0, j1 - j0
         self.lib = lib
         self.mesh = mesh
         self.xp = xp
         self.execution_context = execution_context
+        self.halo_context = halo_context
+        self.halo_event = None
         self.time = self.time0 = time
-        self.shape = (i1 - i0, nj)  # not including guard zones
+        self.index_range = index_range
+        self.shape = (ni, nj)  # not including guard zones
         self.physics = physics
         self.options = options
-        self.xl, self.yl = mesh.vertex_coordinates(i0, 0)
-        self.xr, self.yr = mesh.vertex_coordinates(i1, nj)
+        self.xl, self.yl = mesh.vertex_coordinates(i0, j0)
+        self.xr, self.yr = mesh.vertex_coordinates(i1, j1)
         self.buffer_outer_radius = buffer_outer_radius
         self.buffer_surface_density = buffer_surface_density
+        self.scratch = ScratchArena(xp, pinned=options.pinned_scratch)
+        self.source_term_boxes = dict()
 
         with self.execution_context:
             x0 = self.xl + 0.5 * mesh.dx
@@ -88,10 +343,54 @@ class Patch:
             y1 = self.yr - 0.5 * mesh.dy
             self.coordinate_array_x = xp.linspace(x0, x1, ni)[:, None]
             self.coordinate_array_y = xp.linspace(y0, y1, nj)[None, :]
+            self.coordinate_array_r = (
+                self.coordinate_array_x**2 + self.coordinate_array_y**2
+            ) ** 0.5
             self.wavespeeds = xp.zeros(primitive.shape[:2])
-            self.primitive1 = xp.array(primitive)
-            self.primitive2 = xp.array(primitive)
-            self.conserved0 = xp.zeros(primitive.shape)
+            self.wavespeeds_valid = False
+            self.primitive1 = lib.to_storage(primitive, dtype=lib.real)
+            self.primitive2 = lib.to_storage(primitive, dtype=lib.real)
+            self.conserved0 = xp.zeros(lib.storage_shape(*primitive.shape))
+
+            if options.cuda_graph:
+                self.stage_point_masses = xp.zeros((options.rk_order, 2, 9))
+                self.stage_dt = xp.zeros(1)
+
+            if options.fused_reductions:
+                table = diagnostic_table(physics.diagnostics)
+                num_chunks = -(-nj // DIAGNOSTIC_CHUNK)
+                self.diagnostic_table = xp.array(table).reshape(-1, 6)
+                self.diagnostic_partial = self.scratch.zeros(
+                    "diagnostic_partial", (ni, num_chunks, len(table), 2)
+                )
+
+            if options.gravity_cache:
+                self.gravity_field = xp.zeros((ni + 1, nj + 1, 9))
+                self.gravity_field_masses = None
+
+            if options.two_phase:
+                gradient_shape = lib.storage_shape(*primitive.shape)
+                flux_shape = lib.storage_shape(ni + 1, nj + 1, 3)
+                self.gradient_x = self.scratch.zeros("gradient_x", gradient_shape)
+                self.gradient_y = self.scratch.zeros("gradient_y", gradient_shape)
+                self.flux_x = self.scratch.zeros("flux_x", flux_shape)
+                self.flux_y = self.scratch.zeros("flux_y", flux_shape)
+
+    def primitive_on_host(self):
+        """
+        Return the primitive data on this patch, without guard zones, on the
+        host. In gpu mode, the array is a host scratch array, which is
+        overwritten by the next call.
+        """
+        ng = 2  # number of guard cells
+        interior = self.primitive[ng:-ng, ng:-ng]
+
+        if self.xp.__name__ != "cupy":
+            return interior
+
+        with self.execution_context:
+            out = self.scratch.host("primitive", interior.shape, interior.dtype)
+            return interior.get(out=out)
 
     @property
     def cell_center_coordinate_arrays(self):
@@ -107,6 +406,17 @@ class Patch:
         Return an array of the rates of conserved quantities, resulting from
         the application of gravitational and/or accretion source terms due to
         point masses.
+
+        The accretion source term vanishes outside of `r < 4 r_sink`, so if
+        gravity is not included, the kernel is only launched on the zones
+        near the sink (see `sink_index_box`), and not at all if the sink does
+        not overlap this patch. The array is a scratch array, which is
+        overwritten by the next call with the same arguments.
+
+        The kernel writes every zone of its box, so with gravity (where the
+        box is the whole patch) the array is not cleared. Otherwise it is
+        zeroed once, and then only the box written by the previous call is
+        cleared, so the cost of each call scales with the size of the box.
         """
         ng = 2  # number of guard cells
         if which_mass not in (1, 2):
@@ -114,10 +424,34 @@ class Patch:
 
         m = self.physics.point_masses(self.time)[which_mass - 1]
 
+        if gravity:
+            (i0, i1), (j0, j1) = (0, self.shape[0]), (0, self.shape[1])
+        elif accretion and m.sink_rate != 0.0:
+            (i0, i1), (j0, j1) = self.sink_index_box(m)
+        else:
+            (i0, i1), (j0, j1) = (0, 0), (0, 0)
+
         with self.execution_context:
-            cons_rate = self.xp.zeros_like(self.conserved0)
+            key = ("source_term", which_mass, gravity, accretion)
+
+            if gravity:
+                cons_rate = self.scratch.empty(key, self.conserved0.shape)
+            else:
+                cons_rate = self.scratch.zeroed(key, self.conserved0.shape)
+                box = (i0, i1), (j0, j1)
+                previous = self.source_term_boxes.get(key)
+
+                if previous is not None and previous != box:
+                    (p0, p1), (q0, q1) = previous
+                    view = self.lib.logical_view(cons_rate)
+                    view[ng + p0 : ng + p1, ng + q0 : ng + q1] = 0.0
+
+                self.source_term_boxes[key] = box
+
+            if i1 <= i0 or j1 <= j0:
+                return self.lib.logical_view(cons_rate)[ng:-ng, ng:-ng]
 
-            self.lib.cbdiso_2d_point_mass_source_term[self.shape](
+            self.lib.cbdiso_2d_point_mass_source_term[i1 - i0, j1 - j0](
                 self.xl,
                 self.xr,
                 self.yl,
@@ -133,13 +467,86 @@ class Patch:
                 m.sink_model.value,
                 self.primitive1,
                 cons_rate,
+                *self.shape,
+                i0,
+                j0,
             )
-        return cons_rate[ng:-ng, ng:-ng]
+        return self.lib.logical_view(cons_rate)[ng:-ng, ng:-ng]
+
+    def sink_index_box(self, m):
+        """
+        Return the index range `((i0, i1), (j0, j1))` of the zones on this
+        patch whose centers may be within `4 r_sink` of the given point mass.
+        The range is empty if the sink region does not overlap the patch.
+        """
+        from math import floor
+
+        ni, nj = self.shape
+        dx = (self.xr - self.xl) / ni
+        dy = (self.yr - self.yl) / nj
+        reach = 4.0 * m.sink_radius
+
+        i0 = floor((m.position_x - reach - self.xl) / dx - 0.5)
+        i1 = floor((m.position_x + reach - self.xl) / dx - 0.5) + 1
+        j0 = floor((m.position_y - reach - self.yl) / dy - 0.5)
+        j1 = floor((m.position_y + reach - self.yl) / dy - 0.5) + 1
+
+        return (max(i0, 0), min(i1, ni)), (max(j0, 0), min(j1, nj))
+
+    def diagnostic_sums(self):
+        """
+        Return an array of shape `(num_diagnostics, 2)`, with the sums of the
+        real and imaginary parts of each diagnostic (other than time) over
+        this patch. The array may be allocated on a GPU device.
+        """
+        m1, m2 = self.physics.point_masses(self.time)
+        ni, nj = self.shape
+        num_chunks = self.diagnostic_partial.shape[1]
+
+        with self.execution_context:
+            self.lib.cbdiso_2d_diagnostic_sums[ni, num_chunks](
+                self.xl,
+                self.xr,
+                self.yl,
+                self.yr,
+                m1.position_x,
+                m1.position_y,
+                m1.velocity_x,
+                m1.velocity_y,
+                m1.mass,
+                m1.softening_length,
+                m1.sink_rate,
+                m1.sink_radius,
+                m1.sink_model.value,
+                m2.position_x,
+                m2.position_y,
+                m2.velocity_x,
+                m2.velocity_y,
+                m2.mass,
+                m2.softening_length,
+                m2.sink_rate,
+                m2.sink_radius,
+                m2.sink_model.value,
+                self.primitive1,
+                self.diagnostic_table,
+                self.diagnostic_partial,
+                nj,
+                DIAGNOSTIC_CHUNK,
+                len(self.diagnostic_table),
+            )
+            return self.diagnostic_partial.sum(axis=(0, 1))
 
     def maximum_wavespeed(self):
         """
         Return the maximum wavespeed over a given patch.
+
+        If the wavespeeds were written by the final stage of the most recent
+        time step (the fused RK path), they are not recomputed.
         """
+        if self.wavespeeds_valid:
+            with self.execution_context:
+                return self.wavespeeds.max()
+
         m1, m2 = self.physics.point_masses(self.time)
         with self.execution_context:
             self.lib.cbdiso_2d_wavespeed[self.shape](
@@ -183,19 +590,183 @@ class Patch:
                 self.conserved0,
             )
 
-    def advance_rk(self, rk_param, dt):
+    def advance_rk(self, rk_param, dt, first_stage=False, final_stage=False):
         """
         Pass required parameters for time evolution of the setup.
 
         This function calls the C-module function responsible for performing time evolution using a
-        RK algorithm to update the parameters of the setup.
+        RK algorithm to update the parameters of the setup. The `first_stage`
+        and `final_stage` flags only have an effect on the fused RK path.
+        """
+        if self.options.two_phase:
+            self.advance_rk_two_phase(rk_param, dt, first_stage, final_stage)
+            return
+
+        self.launch_rk(rk_param, dt, first_stage, final_stage)
+        self.finish_rk(rk_param, dt, final_stage)
+
+    def launch_rk(self, rk_param, dt, first_stage, final_stage, zones=None):
+        """
+        Launch the RK update kernel, without advancing the patch time.
+
+        If `zones` is a tuple `(a, b)`, only the zones `a <= i < b` (not
+        counting guard zones) are updated. This requires the "aos" layout,
+        so that the sub-arrays of rows are contiguous.
         """
         m1, m2 = self.physics.point_masses(self.time)
         buffer_central_mass = m1.mass + m2.mass
         buffer_surface_density = self.buffer_surface_density
+        fused = self.options.fused_rk
+        ng = 2  # number of guard cells
+        ni, nj = self.shape
+
+        if zones is None:
+            xl, xr = self.xl, self.xr
+            rows = slice(None)
+            field_rows = slice(None)
+            shape = self.shape
+        else:
+            a, b = zones
+            dx = (self.xr - self.xl) / ni
+            xl = self.xl + a * dx
+            xr = self.xl + b * dx
+            rows = slice(a, b + 2 * ng)
+            field_rows = slice(a, b + 1)
+            shape = (b - a, nj)
+
+        if self.options.gravity_cache:
+            self.update_gravity_field(m1, m2)
+            kernel = self.lib.cbdiso_2d_advance_rk_cached
+            gravity_field = (self.gravity_field[field_rows],)
+        else:
+            kernel = self.lib.cbdiso_2d_advance_rk
+            gravity_field = ()
 
         with self.execution_context:
-            self.lib.cbdiso_2d_advance_rk[self.shape](
+            kernel[shape](
+                xl,
+                xr,
+                self.yl,
+                self.yr,
+                self.conserved0[rows],
+                self.primitive1[rows],
+                self.primitive2[rows],
+                self.wavespeeds[rows],
+                *gravity_field,
+                buffer_surface_density,
+                buffer_central_mass,
+                self.physics.buffer_driving_rate,
+                self.buffer_outer_radius,
+                self.physics.buffer_onset_width,
+                int(self.physics.buffer_is_enabled),
+                m1.position_x,
+                m1.position_y,
+                m1.velocity_x,
+                m1.velocity_y,
+                m1.mass,
+                m1.softening_length,
+                m1.sink_rate,
+                m1.sink_radius,
+                m1.sink_model.value,
+                m2.position_x,
+                m2.position_y,
+                m2.velocity_x,
+                m2.velocity_y,
+                m2.mass,
+                m2.softening_length,
+                m2.sink_rate,
+                m2.sink_radius,
+                m2.sink_model.value,
+                self.physics.sound_speed**2,
+                self.physics.mach_number**2,
+                self.physics.eos_type.value,
+                self.physics.viscosity_coefficient,
+                rk_param,
+                dt,
+                self.options.velocity_ceiling,
+                self.options.density_floor,
+                int(fused and first_stage),
+                int(fused and final_stage),
+            )
+
+    def update_gravity_field(self, m1, m2):
+        """
+        Recompute the cached gravity field for the given point masses, unless
+        it was computed for point masses which are the same, up to the
+        `gravity_cache_tolerance` on their positions.
+        """
+        rows = point_mass_rows((m1, m2))
+        cached = self.gravity_field_masses
+        tolerance = self.options.gravity_cache_tolerance
+
+        if cached is not None and all(
+            abs(r[0] - c[0]) <= tolerance
+            and abs(r[1] - c[1]) <= tolerance
+            and r[4:] == c[4:]
+            for r, c in zip(rows, cached)
+        ):
+            return
+
+        ni, nj = self.shape
+        dx = (self.xr - self.xl) / ni
+        dy = (self.yr - self.yl) / nj
+
+        with self.execution_context:
+            self.lib.cbdiso_2d_gravity_field[ni + 1, nj + 1](
+                self.xl,
+                self.yl,
+                dx,
+                dy,
+                m1.position_x,
+                m1.position_y,
+                m1.velocity_x,
+                m1.velocity_y,
+                m1.mass,
+                m1.softening_length,
+                m1.sink_rate,
+                m1.sink_radius,
+                m1.sink_model.value,
+                m2.position_x,
+                m2.position_y,
+                m2.velocity_x,
+                m2.velocity_y,
+                m2.mass,
+                m2.softening_length,
+                m2.sink_rate,
+                m2.sink_radius,
+                m2.sink_model.value,
+                self.gravity_field,
+            )
+        self.gravity_field_masses = rows
+
+    def upload_stage_parameters(self, stages, dt):
+        """
+        Write the time step, and the point masses at the start of each of the
+        given RK stages, to the device arrays read by `launch_rk_graph`.
+        """
+        import numpy as np
+
+        rows = []
+        time = self.time
+
+        for rk_param in stages:
+            rows.append(point_mass_rows(self.physics.point_masses(time)))
+            time = self.time0 * rk_param + (time + dt) * (1.0 - rk_param)
+
+        with self.execution_context:
+            self.stage_point_masses.set(np.array(rows))
+            self.stage_dt.set(np.array([dt]))
+
+    def launch_rk_graph(self, stage, rk_param, first_stage, final_stage):
+        """
+        Launch the RK update kernel for a CUDA graph capture. The point
+        masses and the time step are read from device memory rather than
+        passed as kernel arguments.
+        """
+        fused = self.options.fused_rk
+
+        with self.execution_context:
+            self.lib.cbdiso_2d_advance_rk_graph[self.shape](
                 self.xl,
                 self.xr,
                 self.yl,
@@ -203,6 +774,95 @@ class Patch:
                 self.conserved0,
                 self.primitive1,
                 self.primitive2,
+                self.wavespeeds,
+                self.stage_point_masses[stage],
+                self.stage_dt,
+                self.buffer_surface_density,
+                self.physics.buffer_driving_rate,
+                self.buffer_outer_radius,
+                self.physics.buffer_onset_width,
+                int(self.physics.buffer_is_enabled),
+                self.physics.sound_speed**2,
+                self.physics.mach_number**2,
+                self.physics.eos_type.value,
+                self.physics.viscosity_coefficient,
+                rk_param,
+                self.options.velocity_ceiling,
+                self.options.density_floor,
+                int(fused and first_stage),
+                int(fused and final_stage),
+            )
+
+    def finish_rk(self, rk_param, dt, final_stage):
+        """
+        Advance the patch time, and swap the primitive arrays, after all the
+        update kernels for an RK stage have been launched.
+        """
+        self.time = self.time0 * rk_param + (self.time + dt) * (1.0 - rk_param)
+        self.primitive1, self.primitive2 = self.primitive2, self.primitive1
+        self.wavespeeds_valid = self.options.fused_rk and final_stage
+
+    def advance_rk_two_phase(self, rk_param, dt, first_stage, final_stage):
+        """
+        Same as `advance_rk`, but computes the PLM gradients and the Godunov
+        fluxes in separate passes, once per zone and once per face.
+        """
+        m1, m2 = self.physics.point_masses(self.time)
+        buffer_central_mass = m1.mass + m2.mass
+        buffer_surface_density = self.buffer_surface_density
+        fused = self.options.fused_rk
+        ni, nj = self.shape
+
+        with self.execution_context:
+            self.lib.cbdiso_2d_plm_gradients[ni + 2, nj + 2](
+                self.primitive1,
+                self.gradient_x,
+                self.gradient_y,
+            )
+            self.lib.cbdiso_2d_godunov_fluxes[ni + 1, nj + 1](
+                self.xl,
+                self.xr,
+                self.yl,
+                self.yr,
+                self.primitive1,
+                self.gradient_x,
+                self.gradient_y,
+                self.flux_x,
+                self.flux_y,
+                m1.position_x,
+                m1.position_y,
+                m1.velocity_x,
+                m1.velocity_y,
+                m1.mass,
+                m1.softening_length,
+                m1.sink_rate,
+                m1.sink_radius,
+                m1.sink_model.value,
+                m2.position_x,
+                m2.position_y,
+                m2.velocity_x,
+                m2.velocity_y,
+                m2.mass,
+                m2.softening_length,
+                m2.sink_rate,
+                m2.sink_radius,
+                m2.sink_model.value,
+                self.physics.sound_speed**2,
+                self.physics.mach_number**2,
+                self.physics.eos_type.value,
+                self.physics.viscosity_coefficient,
+            )
+            self.lib.cbdiso_2d_update_from_fluxes[self.shape](
+                self.xl,
+                self.xr,
+                self.yl,
+                self.yr,
+                self.conserved0,
+                self.primitive1,
+                self.primitive2,
+                self.wavespeeds,
+                self.flux_x,
+                self.flux_y,
                 buffer_surface_density,
                 buffer_central_mass,
                 self.physics.buffer_driving_rate,
@@ -230,22 +890,59 @@ class Patch:
                 self.physics.sound_speed**2,
                 self.physics.mach_number**2,
                 self.physics.eos_type.value,
-                self.physics.viscosity_coefficient,
                 rk_param,
                 dt,
                 self.options.velocity_ceiling,
                 self.options.density_floor,
+                int(fused and first_stage),
+                int(fused and final_stage),
             )
         self.time = self.time0 * rk_param + (self.time + dt) * (1.0 - rk_param)
         self.primitive1, self.primitive2 = self.primitive2, self.primitive1
+        self.wavespeeds_valid = fused and final_stage
 
     def new_iteration(self):
         self.time0 = self.time
-        self.recompute_conserved()
+        if not self.options.fused_rk:
+            self.recompute_conserved()
+
+    def rollback(self):
+        """
+        Restore the primitive array and the time to the start of the current
+        time step. The primitive data is recovered from the conserved data in
+        `conserved0`, which holds the solution at the start of the step on
+        every update path, so the restored data may differ from the original
+        at the level of round-off.
+        """
+        with self.execution_context:
+            self.lib.cbdiso_2d_conserved_to_primitive[self.shape](
+                self.conserved0,
+                self.primitive1,
+                self.options.velocity_ceiling,
+                self.options.density_floor,
+            )
+        self.time = self.time0
+        self.wavespeeds_valid = False
 
     @property
     def primitive(self):
-        return self.primitive1
+        return self.lib.logical_view(self.primitive1)
+
+
+def make_library(options, mode):
+    """
+    Compile the kernel library used by the solver with the given options.
+    """
+    with open(__file__.replace(".py", ".c")) as f:
+        code = f.read()
+
+    return Library(
+        code,
+        mode=mode,
+        debug=False,
+        layout=options.layout,
+        precision=options.precision,
+    )
 
 
 class Solver(SolverBase):
@@ -264,8 +961,6 @@ class Solver(SolverBase):
         physics=dict(),
         options=dict(),
     ):
-        import numpy as np
-
         physics["diagnostics"] = [
             Diagnostic(**v) for v in physics.get("diagnostics", [])
         ]
@@ -273,36 +968,42 @@ class Solver(SolverBase):
         self._physics = physics = Physics(**physics)
         self._options = options = Options(**options)
 
-        if type(mesh) is not PlanarCartesian2DMesh:
-            raise ValueError("solver only supports 2D cartesian mesh")
+        validate_physics(setup, mesh, physics)
 
-        if setup.boundary_condition != "outflow":
-            raise ValueError("solver only supports outflow boundary condition")
+        if options.overlap_halo and options.layout != "aos":
+            raise ValueError("overlap_halo requires the aos layout")
 
-        if physics.viscosity_model not in (
-            ViscosityModel.NONE,
-            ViscosityModel.CONSTANT_NU,
-        ):
-            raise ValueError("solver only supports constant-nu viscosity")
+        if options.overlap_halo and options.two_phase:
+            raise ValueError("overlap_halo is not compatible with two_phase")
 
-        if physics.eos_type not in (
-            EquationOfState.GLOBALLY_ISOTHERMAL,
-            EquationOfState.LOCALLY_ISOTHERMAL,
-        ):
-            raise ValueError("solver only supports isothermal equation of states")
+        if options.rk_order not in RK_PARAMETERS:
+            raise ValueError(f"rk_order must be 1, 2, or 3, got {options.rk_order}")
 
-        if physics.cooling_coefficient != 0.0:
-            raise ValueError("solver does not support thermal cooling")
+        if options.cuda_graph:
+            if mode != "gpu":
+                raise ValueError("cuda_graph requires gpu mode")
+            if num_patches != 1 or get_communicator().size != 1:
+                raise ValueError("cuda_graph requires a single patch")
+            if options.layout != "aos":
+                raise ValueError("cuda_graph requires the aos layout")
+            if options.two_phase or options.overlap_halo:
+                raise ValueError("cuda_graph is not compatible with two_phase")
 
-        if not physics.constant_softening:
-            raise ValueError("solver only supports constant gravitational softening")
+        if options.bc_kernel:
+            if get_communicator().size != 1:
+                raise ValueError("bc_kernel requires a single process")
+            if mode == "gpu" and num_devices(mode) > 1 and num_patches > 1:
+                raise ValueError("bc_kernel requires a single device")
+            if options.overlap_halo:
+                raise ValueError("bc_kernel is not compatible with overlap_halo")
+
+        if options.gravity_cache and (options.two_phase or options.cuda_graph):
+            raise ValueError("gravity_cache requires two_phase and cuda_graph off")
 
         xp = get_array_module(mode)
         ng = 2  # number of guard zones
         nq = 3  # number of conserved quantities
-        with open(__file__.replace(".py", ".c")) as f:
-            code = f.read()
-        lib = Library(code, mode=mode, debug=False)
+        lib = make_library(options, mode)
 
         logger.info(f"initiate with time={time:0.4f}")
         logger.info(f"subdivide grid over {num_patches} patches")
@@ -315,50 +1016,96 @@ class Solver(SolverBase):
         self.num_cons = nq
         self.xp = xp
         self.patches = []
+        self.comm = comm = get_communicator()
+        self.num_patches = num_patches
+        self.graphs = dict()
         ni, nj = mesh.shape
 
-        if solution is None:
-            primitive = initial_condition(setup, mesh, time)
+        buffer_outer_radius, buffer_surface_density = buffer_parameters(
+            setup, mesh, physics, time
+        )
+
+        if options.overlap_halo:
+            blocks = (num_patches, 1)
         else:
-            primitive = solution
-
-        if physics.buffer_is_enabled:
-            # Here we sample the initial condition at the buffer onset radius
-            # to determine the disk surface density at the radius where the
-            # buffer begins to ramp up. This procedure makes sense as long as
-            # the initial condition is axisymmetric.
-            buffer_prim = [0.0] * 3
-            buffer_outer_radius = mesh.x1  # this assumes the mesh is a centered squared
-            buffer_onset_radius = buffer_outer_radius - physics.buffer_onset_width
-            setup.primitive(time, [buffer_onset_radius, 0.0], buffer_prim)
-            buffer_surface_density = buffer_prim[0]
+            blocks = options.patch_blocks
+
+        self.decomposition = BlockDecomposition(mesh.shape, num_patches, blocks, comm)
+        self.exchange = GuardZoneExchange(self.decomposition, ng)
+        n0, n1 = self.decomposition.owned.start, self.decomposition.owned.stop
+        logger.info(f"patch blocks are {self.decomposition.blocks}")
+        logger.info(f"this process owns patches [{n0}, {n1})")
+
+        if options.bc_kernel:
+            self.guard_zone_fill = GuardZoneFill(
+                self.decomposition,
+                ng,
+                nq,
+                [BoundaryCondition.OUTFLOW] * 4,
+                mode,
+                layout=options.layout,
+                precision=options.precision,
+            )
         else:
-            buffer_outer_radius = 0.0
-            buffer_surface_density = 0.0
+            self.guard_zone_fill = None
+
+        for n in self.decomposition.owned:
+            (a, b), (c, d) = index_range = self.decomposition.index_range(n)
+            device_id = n % num_devices(mode)
+            context = execution_context(mode, device_id=device_id, stream=True)
+
+            with context:
+                prim = xp.zeros([b - a + 2 * ng, d - c + 2 * ng, nq])
+                if solution is None:
+                    prim[ng:-ng, ng:-ng] = initial_condition(
+                        setup,
+                        mesh,
+                        time,
+                        index_range,
+                        xp,
+                        options.startup_workers,
+                    )
+                else:
+                    prim[ng:-ng, ng:-ng] = xp.asarray(solution[a:b, c:d])
 
-        for n, (a, b) in enumerate(subdivide(ni, num_patches)):
-            prim = np.zeros([b - a + 2 * ng, nj + 2 * ng, nq])
-            prim[ng:-ng, ng:-ng] = primitive[a:b]
             patch = Patch(
                 time,
                 prim,
                 mesh,
-                (a, b),
+                index_range,
                 physics,
                 options,
                 buffer_outer_radius,
                 buffer_surface_density,
                 lib,
                 xp,
-                execution_context(mode, device_id=n % num_devices(mode)),
+                context,
+                execution_context(mode, device_id=device_id, stream=True),
             )
             self.patches.append(patch)
 
     @property
     def solution(self):
-        return concat_on_host(
-            [p.primitive for p in self.patches], (self.num_guard, self.num_guard)
-        )
+        """
+        Return the primitive solution array, on the host.
+
+        In an MPI run, the array is gathered to the root process, and None is
+        returned on the other processes.
+        """
+        arrays = [p.primitive_on_host() for p in self.patches]
+        ranges = [p.index_range for p in self.patches]
+
+        if self.comm.size > 1:
+            arrays = self.comm.gather(arrays)
+            ranges = self.comm.gather(ranges)
+
+            if arrays is None:
+                return None
+
+            arrays = sum(arrays, [])
+            ranges = sum(ranges, [])
+
+        return concat_blocks_on_host(arrays, ranges)
 
     @property
     def primitive(self):
@@ -367,10 +1114,16 @@ class Solver(SolverBase):
         """
         return None
 
+    def solution_blocks(self):
+        ng = self.num_guard
+        return [(p.index_range, p.primitive[ng:-ng, ng:-ng]) for p in self.patches]
+
     def reductions(self):
         """
         Generate runtime reductions on the solution data for time series.
         """
+        if self._options.fused_reductions:
+            return self.fused_reductions()
 
         diagnostics = self._physics.diagnostics
         udots1_acc = [p.point_mass_source_term(1, accretion=True) for p in self.patches]
@@ -387,7 +1140,7 @@ class Solver(SolverBase):
             1, 2, or 'both'), term (either 'acc' or 'grv').
             """
             x, y = patch.cell_center_coordinate_arrays
-            r = (x**2 + y**2) ** 0.5
+            r = patch.coordinate_array_r
 
             def apply_radial_cut(f):
                 if cut is not None:
@@ -482,7 +1235,7 @@ class Solver(SolverBase):
                         gravity=d.gravity,
                         accretion=d.accretion,
                     )
-                    result.append(f.sum())
+                    result.append(self.patch_sum(p, f))
             return result
 
         pass1 = []
@@ -496,12 +1249,49 @@ class Solver(SolverBase):
 
         for item in pass1:
             if type(item) is not float:
-                pass2.append(sum(to_host(x) for x in item) * da)
+                local = sum(to_host(x) for x in item) * da
+                pass2.append(self.comm.allreduce(local))
             else:
                 pass2.append(item)
 
         return pass2
 
+    def fused_reductions(self):
+        """
+        Same as `reductions`, but all of the sums on each patch are done by
+        one kernel launch (see `Patch.diagnostic_sums`).
+        """
+        diagnostics = self._physics.diagnostics
+        da = self.mesh.dx * self.mesh.dy
+        result = []
+
+        if any(d.quantity != "time" for d in diagnostics):
+            sums = [p.diagnostic_sums() for p in self.patches]
+            local = sum(to_host(s) for s in sums) * da
+        else:
+            local = []
+
+        values = iter(local)
+
+        for d in diagnostics:
+            if d.quantity == "time":
+                result.append(self.time / self.setup.reference_time_scale)
+            else:
+                re, im = next(values)
+                if d.quantity in COMPLEX_DIAGNOSTICS:
+                    result.append(self.comm.allreduce(complex(re, im)))
+                else:
+                    result.append(self.comm.allreduce(float(re)))
+
+        return result
+
+    def patch_sum(self, patch, f):
+        """
+        Return the sum of a diagnostic field over one patch, which `reductions`
+        multiplies by the zone area.
+        """
+        return f.sum()
+
     @property
     def time(self):
         return self.patches[0].time
@@ -514,6 +1304,13 @@ class Solver(SolverBase):
     def physics(self):
         return self._physics._asdict()
 
+    @property
+    def supports_mpi(self):
+        return True
+
+    def runtime_report(self):
+        return scratch_report([p.scratch for p in self.patches], self.xp)
+
     @property
     def recommended_cfl(self):
         return 0.3
@@ -526,64 +1323,214 @@ class Solver(SolverBase):
         """
         Return the global maximum wavespeed over the whole domain.
         """
-        return lazy_reduce(
+        local = lazy_reduce(
             max,
             float,
             (patch.maximum_wavespeed for patch in self.patches),
             (patch.execution_context for patch in self.patches),
         )
+        return self.comm.allreduce(local, op="max")
+
+    def deferred_maximum_wavespeed(self):
+        """
+        Start the reduction for the global maximum wavespeed, and return a
+        callable which waits for it and returns the value (see
+        `deferred_reduce`). On the fused RK path this reuses the wavespeeds
+        written by the final stage of the most recent time step.
+        """
+        local = deferred_reduce(
+            max,
+            float,
+            (patch.maximum_wavespeed for patch in self.patches),
+            (patch.execution_context for patch in self.patches),
+        )
+        return lambda: self.comm.allreduce(local(), op="max")
+
+    @property
+    def supports_rollback(self):
+        return True
+
+    def rollback(self):
+        for patch in self.patches:
+            patch.rollback()
 
     def advance(self, dt):
+        if self._options.cuda_graph:
+            self.advance_graph(dt)
+            return
+
         self.new_iteration()
-        if self._options.rk_order == 1:
-            self.advance_rk(0.0, dt)
-        elif self._options.rk_order == 2:
-            self.advance_rk(0.0, dt)
-            self.advance_rk(0.5, dt)
-        elif self._options.rk_order == 3:
-            self.advance_rk(0.0, dt)
-            self.advance_rk(0.75, dt)
-            self.advance_rk(1.0 / 3.0, dt)
-
-    def advance_rk(self, rk_param, dt):
+        stages = RK_PARAMETERS[self._options.rk_order]
+
+        for n, rk_param in enumerate(stages):
+            first_stage = n == 0
+            final_stage = n == len(stages) - 1
+            self.advance_rk(rk_param, dt, first_stage, final_stage)
+
+    def advance_graph(self, dt):
+        """
+        Same as `advance`, but replays a CUDA graph of the whole time step.
+
+        The graph is keyed by the address of the primitive array it starts
+        from. With an odd number of RK stages the two primitive arrays trade
+        places on every step, so two graphs are captured in that case.
+        """
+        (patch,) = self.patches
+        stages = RK_PARAMETERS[self._options.rk_order]
+        key = patch.primitive1.data.ptr
+
+        patch.time0 = patch.time
+        patch.upload_stage_parameters(stages, dt)
+
+        if key not in self.graphs:
+            capture = lambda: self.launch_graph_stages(stages)
+            self.graphs[key] = patch.execution_context.capture(capture)
+
+        with patch.execution_context:
+            self.graphs[key].launch()
+
+        for n, rk_param in enumerate(stages):
+            patch.finish_rk(rk_param, dt, final_stage=(n == len(stages) - 1))
+
+    def launch_graph_stages(self, stages):
+        """
+        Issue the work of one time step for `advance_graph` to capture. The
+        primitive arrays are swapped after each stage, as they are by
+        `Patch.finish_rk`, and restored at the end.
+        """
+        (patch,) = self.patches
+        arrays = patch.primitive1, patch.primitive2
+
+        if not self._options.fused_rk:
+            patch.recompute_conserved()
+
+        for n, rk_param in enumerate(stages):
+            self.set_bc("primitive1")
+            patch.launch_rk_graph(n, rk_param, n == 0, n == len(stages) - 1)
+            patch.primitive1, patch.primitive2 = patch.primitive2, patch.primitive1
+
+        patch.primitive1, patch.primitive2 = arrays
+
+    def advance_rk(self, rk_param, dt, first_stage=False, final_stage=False):
+        if self._options.overlap_halo:
+            self.advance_rk_overlap(rk_param, dt, first_stage, final_stage)
+            return
+
         self.set_bc("primitive1")
         for patch in self.patches:
-            patch.advance_rk(rk_param, dt)
+            patch.advance_rk(rk_param, dt, first_stage, final_stage)
 
-    def set_bc(self, array):
-        ng = self.num_guard
-        num_patches = len(self.patches)
-        for i0 in range(num_patches):
-            il = (i0 + num_patches - 1) % num_patches
-            ir = (i0 + num_patches + 1) % num_patches
-            pl = getattr(self.patches[il], array)
-            pc = getattr(self.patches[i0], array)
-            pr = getattr(self.patches[ir], array)
-            self.set_bc_patch(pl, pc, pr, i0)
-
-    def set_bc_patch(self, pl, pc, pr, patch_index):
-        ni, nj = self.mesh.shape
+    def advance_rk_overlap(self, rk_param, dt, first_stage, final_stage):
+        """
+        Same as `advance_rk`, but overlaps the update of the interior zones
+        with the guard zone exchange. The patches are slabs in this case, so
+        only the guard zones on the first axis are exchanged.
+
+        Work on each patch is ordered by events: the guard zone copies wait
+        for the neighbor patches to finish the previous stage, the edge zone
+        updates wait for the guard zone copies, and the next stage's writes
+        to a patch wait for the neighbors to finish reading it. Messages to
+        other ranks are posted before the interior launches, and completed
+        after them.
+        """
         ng = self.num_guard
+        exchange = self.exchange
+        patches = self.patches
+        contexts = [p.execution_context for p in patches]
+        ready = [context.record() for context in contexts]
+        views = [p.primitive for p in patches]
+        buffers, requests = exchange.start(views, contexts, 0)
+
+        for n, patch in enumerate(patches):
+            ni = patch.shape[0]
+            neighbors = exchange.local_neighbors(n, 0)
+            patch.execution_context.wait(*(patches[m].halo_event for m in neighbors))
+
+            with patch.execution_context:
+                self.set_bc_columns(views[n][ng:-ng])
+
+            if ni > 2 * ng:
+                patch.launch_rk(rk_param, dt, first_stage, final_stage, (ng, ni - ng))
+
+        for n, patch in enumerate(patches):
+            events = [ready[m] for m in [n] + exchange.local_neighbors(n, 0)]
+
+            with patch.halo_context:
+                patch.halo_context.wait(*events)
+                exchange.copy_local(views, n, 0)
+
+        self.comm.wait(requests)
+
+        for n, patch in enumerate(patches):
+            pc = views[n]
+
+            with patch.halo_context:
+                exchange.copy_remote(views, buffers, n, 0)
 
-        with self.patches[patch_index].execution_context:
-            # 1. write to the guard zones of pc, the internal BC
-            pc[:+ng] = pl[-2 * ng : -ng]
-            pc[-ng:] = pr[+ng : +2 * ng]
+                for side in exchange.edges(n, 0):
+                    self.set_bc_edge(pc, n, 0, side)
 
-            # 2. Set outflow BC on the left/right patch edges
-            if patch_index == 0:
+                self.set_bc_columns(pc[:ng])
+                self.set_bc_columns(pc[-ng:])
+                patch.halo_event = patch.halo_context.record()
+
+        for patch in patches:
+            ni = patch.shape[0]
+            patch.execution_context.wait(patch.halo_event)
+
+            if ni > 2 * ng:
+                patch.launch_rk(rk_param, dt, first_stage, final_stage, (0, ng))
+                patch.launch_rk(rk_param, dt, first_stage, final_stage, (ni - ng, ni))
+            else:
+                patch.launch_rk(rk_param, dt, first_stage, final_stage)
+            patch.finish_rk(rk_param, dt, final_stage)
+
+    def set_bc(self, array):
+        """
+        Fill the guard zones of the given array on each patch (see
+        `GuardZoneExchange.fill` and `GuardZoneFill.fill`).
+        """
+        if self.guard_zone_fill is not None:
+            self.guard_zone_fill.fill(
+                [getattr(p, array) for p in self.patches],
+                [p.execution_context for p in self.patches],
+            )
+            return
+
+        self.exchange.fill(
+            [p.lib.logical_view(getattr(p, array)) for p in self.patches],
+            [p.execution_context for p in self.patches],
+            self.set_bc_edge,
+        )
+
+    def set_bc_edge(self, pc, n, axis, side):
+        """
+        Set outflow BC on one of the domain edges of the array pc.
+        """
+        ng = self.num_guard
+
+        if axis == 0:
+            if side == 0:
                 for i in range(ng):
                     pc[i] = pc[ng]
-            if patch_index == len(self.patches) - 1:
+            else:
                 for i in range(pc.shape[0] - ng, pc.shape[0]):
                     pc[i] = pc[-ng - 1]
+        else:
+            if side == 0:
+                for i in range(ng):
+                    pc[:, i] = pc[:, ng]
+            else:
+                for i in range(pc.shape[1] - ng, pc.shape[1]):
+                    pc[:, i] = pc[:, -ng - 1]
 
-            # 3. Set outflow BC on bottom and top edges
-            for i in range(ng):
-                pc[:, i] = pc[:, ng]
-
-            for i in range(pc.shape[1] - ng, pc.shape[1]):
-                pc[:, i] = pc[:, -ng - 1]
+    def set_bc_columns(self, pc):
+        """
+        Set outflow BC on the bottom and top edges (second axis) of the rows
+        pc.
+        """
+        self.set_bc_edge(pc, None, 1, 0)
+        self.set_bc_edge(pc, None, 1, 1)
 
     def new_iteration(self):
         for patch in self.patches:
@@ -0,0 +1,418 @@
+"""
+Ensemble version of the isothermal binary accretion solver in 2D.
+
+An ensemble is a set of independent simulations on the same mesh, which
+differ only in their point masses (e.g. a grid of mass ratios and
+eccentricities for a parameter survey). All of the members are stored in
+arrays with a leading axis of length `num_members`, and each RK stage of the
+whole ensemble is a single launch of a rank-3 kernel. This keeps a GPU busy
+even when the individual members are small.
+"""
+
+from logging import getLogger
+from typing import NamedTuple
+from sailfish.kernel.system import get_array_module, execution_context
+from sailfish.mesh import PlanarCartesian2DMesh
+from sailfish.physics.circumbinary import (
+    Physics,
+    EquationOfState,
+    ViscosityModel,
+    Diagnostic,
+)
+from sailfish.solver_base import SolverBase
+from sailfish.solvers import cbdiso_2d
+from sailfish.solvers.cbdiso_2d import (
+    initial_condition,
+    point_mass_rows,
+    RK_PARAMETERS,
+)
+from sailfish.subdivide import to_host
+
+
+logger = getLogger(__name__)
+
+
+class Options(NamedTuple):
+    """
+    Contains parameters which are solver specific options.
+
+    If `member_dt` is false, all members are advanced with the same time step,
+    which is limited by the member with the largest wavespeed, so the member
+    times stay equal. If it is true, each member takes the largest time step
+    allowed by its own wavespeeds. The member times then drift apart, and the
+    solver time, which is used by the driver to schedule events, is the time
+    of the member which is furthest behind.
+    """
+
+    velocity_ceiling: float = 1e12
+    density_floor: float = 1e-12
+    rk_order: int = 2
+    member_dt: bool = False
+
+
+class Solver(SolverBase):
+    """
+    Adapter class to drive the ensemble kernels of the cbdiso_2d C extension
+    module.
+
+    The solution array has shape `(num_members, ni, nj, 3)`. The wavespeeds
+    and conserved variables at the start of the time step are computed by the
+    first and final RK stages (like the `fused_rk` option of the cbdiso_2d
+    solver). The domain is not subdivided, and MPI is not supported.
+    """
+
+    def __init__(
+        self,
+        setup=None,
+        mesh=None,
+        time=0.0,
+        solution=None,
+        num_patches=1,
+        mode="cpu",
+        physics=dict(),
+        options=dict(),
+    ):
+        import numpy as np
+
+        physics["diagnostics"] = [
+            Diagnostic(**v) for v in physics.get("diagnostics", [])
+        ]
+
+        self._physics = physics = Physics(**physics)
+        self._options = options = Options(**options)
+
+        if type(mesh) is not PlanarCartesian2DMesh:
+            raise ValueError("solver only supports 2D cartesian mesh")
+
+        if setup.boundary_condition != "outflow":
+            raise ValueError("solver only supports outflow boundary condition")
+
+        if physics.viscosity_model not in (
+            ViscosityModel.NONE,
+            ViscosityModel.CONSTANT_NU,
+        ):
+            raise ValueError("solver only supports constant-nu viscosity")
+
+        if physics.eos_type not in (
+            EquationOfState.GLOBALLY_ISOTHERMAL,
+            EquationOfState.LOCALLY_ISOTHERMAL,
+        ):
+            raise ValueError("solver only supports isothermal equation of states")
+
+        if physics.cooling_coefficient != 0.0:
+            raise ValueError("solver does not support thermal cooling")
+
+        if not physics.constant_softening:
+            raise ValueError("solver only supports constant gravitational softening")
+
+        if not physics.ensemble_point_mass_functions:
+            raise ValueError("solver requires the ensemble point mass functions")
+
+        for f in physics.ensemble_point_mass_functions:
+            if len(f(time)) != 2:
+                raise ValueError("solver requires two point masses per member")
+
+        if num_patches != 1:
+            raise ValueError("solver does not subdivide the domain")
+
+        for d in physics.diagnostics:
+            if d.quantity not in ("time", "mass", "mdot", "fx", "fy", "torque"):
+                raise ValueError(f"solver does not support diagnostic {d.quantity}")
+
+        if options.rk_order not in RK_PARAMETERS:
+            raise ValueError(f"rk_order must be 1, 2, or 3, got {options.rk_order}")
+
+        xp = get_array_module(mode)
+        ng = 2  # number of guard zones
+        nq = 3  # number of conserved quantities
+        nm = len(physics.ensemble_point_mass_functions)
+        ni, nj = mesh.shape
+
+        lib = cbdiso_2d.make_library(cbdiso_2d.Options(), mode)
+
+        logger.info(f"initiate with time={time:0.4f}")
+        logger.info(f"ensemble has {nm} members")
+        logger.info(f"mesh is {mesh}")
+        logger.info(f"boundary condition is outflow")
+
+        if physics.buffer_is_enabled:
+            # See the comment in the cbdiso_2d solver.
+            buffer_prim = [0.0] * 3
+            buffer_outer_radius = mesh.x1
+            buffer_onset_radius = buffer_outer_radius - physics.buffer_onset_width
+            setup.primitive(time, [buffer_onset_radius, 0.0], buffer_prim)
+            buffer_surface_density = buffer_prim[0]
+        else:
+            buffer_outer_radius = 0.0
+            buffer_surface_density = 0.0
+
+        prim = np.zeros([nm, ni + 2 * ng, nj + 2 * ng, nq])
+
+        if solution is None:
+            prim[:, ng:-ng, ng:-ng] = initial_condition(setup, mesh, time)
+        elif solution.shape != (nm, ni, nj, nq):
+            raise ValueError(
+                f"solution has shape {solution.shape}, expected {(nm, ni, nj, nq)}"
+            )
+        else:
+            prim[:, ng:-ng, ng:-ng] = solution
+
+        self.mesh = mesh
+        self.setup = setup
+        self.lib = lib
+        self.xp = xp
+        self.num_guard = ng
+        self.num_members = nm
+        self.buffer_outer_radius = buffer_outer_radius
+        self.buffer_surface_density = buffer_surface_density
+        self.execution_context = execution_context(mode, device_id=0)
+        self.times = self.times0 = np.full(nm, time)
+        self.member_wavespeeds = None
+
+        with self.execution_context:
+            self.primitive1 = xp.array(prim)
+            self.primitive2 = xp.array(prim)
+            self.conserved0 = xp.zeros_like(self.primitive1)
+            self.wavespeeds = xp.zeros(prim.shape[:3])
+            self.wavespeeds_valid = False
+
+    @property
+    def solution(self):
+        """
+        Return the primitive solution array of all the members, on the host.
+        """
+        ng = self.num_guard
+        return to_host(self.primitive1[:, ng:-ng, ng:-ng])
+
+    @property
+    def primitive(self):
+        """
+        This solver uses primitive data as the solution array.
+        """
+        return None
+
+    def point_mass_array(self):
+        """
+        Return an array of shape `(num_members, 2, 9)` with the point masses
+        of each member at that member's time, on the device.
+        """
+        functions = self._physics.ensemble_point_mass_functions
+        rows = [point_mass_rows(f(t)) for f, t in zip(functions, self.times)]
+        with self.execution_context:
+            return self.xp.array(rows)
+
+    def reductions(self):
+        """
+        Generate runtime reductions on the solution data for time series.
+
+        Each reduction is a list with one value per member. The supported
+        quantities are the time, the disk mass, and the accretion or
+        gravitational rates of mass, force, and torque on the point masses.
+        """
+        ng = self.num_guard
+        da = self.mesh.dx * self.mesh.dy
+        ni, nj = self.mesh.shape
+        x0, x1 = self.mesh.x0, self.mesh.x1
+        y0, y1 = self.mesh.y0, self.mesh.y1
+        xp = self.xp
+        point_mass_functions = self._physics.ensemble_point_mass_functions
+
+        with self.execution_context:
+            x = xp.linspace(x0 + 0.5 * self.mesh.dx, x1 - 0.5 * self.mesh.dx, ni)
+            y = xp.linspace(y0 + 0.5 * self.mesh.dy, y1 - 0.5 * self.mesh.dy, nj)
+            x, y = x[:, None], y[None, :]
+            r = (x**2 + y**2) ** 0.5
+
+        def source_term(n, which_mass, gravity, accretion):
+            m = point_mass_functions[n](self.times[n])[which_mass - 1]
+            prim = self.primitive1[n]
+            cons_rate = xp.zeros_like(prim)
+            self.lib.cbdiso_2d_point_mass_source_term[ni, nj](
+                x0,
+                x1,
+                y0,
+                y1,
+                m.position_x,
+                m.position_y,
+                m.velocity_x,
+                m.velocity_y,
+                m.mass * gravity,
+                m.softening_length,
+                m.sink_rate * accretion,
+                m.sink_radius,
+                m.sink_model.value,
+                prim,
+                cons_rate,
+                ni,
+                nj,
+                0,
+                0,
+            )
+            return cons_rate[ng:-ng, ng:-ng]
+
+        def get_field(n, d):
+            if d.quantity == "mass":
+                f = self.primitive1[n, ng:-ng, ng:-ng, 0]
+            else:
+                masses = (1, 2) if d.which_mass == "both" else (d.which_mass,)
+                udot = sum(
+                    source_term(n, k, d.gravity, d.accretion) for k in masses
+                )
+                if d.quantity == "mdot":
+                    f = udot[..., 0]
+                elif d.quantity == "fx":
+                    f = udot[..., 1]
+                elif d.quantity == "fy":
+                    f = udot[..., 2]
+                elif d.quantity == "torque":
+                    f = x * udot[..., 2] - y * udot[..., 1]
+
+            if d.radial_cut is not None:
+                r0, r1 = d.radial_cut
+                f = f * (r0 < r) * (r < r1)
+            return f
+
+        result = []
+
+        for d in self._physics.diagnostics:
+            if d.quantity == "time":
+                result.append(list(self.times / self.setup.reference_time_scale))
+            else:
+                with self.execution_context:
+                    sums = [get_field(n, d).sum() for n in range(self.num_members)]
+                result.append([float(to_host(s)) * da for s in sums])
+
+        return result
+
+    @property
+    def time(self):
+        return float(self.times.min())
+
+    @property
+    def options(self):
+        return self._options._asdict()
+
+    @property
+    def physics(self):
+        return self._physics._asdict()
+
+    @property
+    def recommended_cfl(self):
+        return 0.3
+
+    @property
+    def maximum_cfl(self):
+        return 0.4
+
+    def maximum_wavespeed(self):
+        """
+        Return the maximum wavespeed over all the members.
+
+        The maximum wavespeed of each member is also kept, to set the member
+        time steps if the `member_dt` option is enabled. All of the members
+        are reduced in a single pass.
+        """
+        ni, nj = self.mesh.shape
+
+        with self.execution_context:
+            if not self.wavespeeds_valid:
+                self.lib.cbdiso_2d_wavespeed_ensemble[ni, nj, self.num_members](
+                    self.mesh.x0,
+                    self.mesh.x1,
+                    self.mesh.y0,
+                    self.mesh.y1,
+                    self._physics.sound_speed**2,
+                    self._physics.mach_number**2,
+                    self._physics.eos_type.value,
+                    self.point_mass_array(),
+                    self.primitive1,
+                    self.wavespeeds,
+                )
+                self.wavespeeds_valid = True
+
+            a = self.wavespeeds.reshape(self.num_members, -1).max(axis=1)
+            self.member_wavespeeds = to_host(a)
+
+        return float(self.member_wavespeeds.max())
+
+    def advance(self, dt):
+        """
+        Advance all of the members by one time step. The given `dt` is the
+        time step of the member with the largest wavespeed; if `member_dt`
+        is enabled, the other members take proportionally larger steps.
+        """
+        import numpy as np
+
+        if self._options.member_dt and self.member_wavespeeds is not None:
+            a = self.member_wavespeeds
+            dts = dt * a.max() / a
+        else:
+            dts = np.full(self.num_members, dt)
+
+        stages = RK_PARAMETERS[self._options.rk_order]
+
+        with self.execution_context:
+            dts_device = self.xp.array(dts)
+
+        self.times0 = self.times
+
+        for n, rk_param in enumerate(stages):
+            self.advance_rk(
+                rk_param,
+                dts,
+                dts_device,
+                first_stage=(n == 0),
+                final_stage=(n == len(stages) - 1),
+            )
+
+    def advance_rk(self, rk_param, dts, dts_device, first_stage, final_stage):
+        ni, nj = self.mesh.shape
+        physics = self._physics
+        options = self._options
+
+        self.set_bc()
+
+        with self.execution_context:
+            self.lib.cbdiso_2d_advance_rk_ensemble[ni, nj, self.num_members](
+                self.mesh.x0,
+                self.mesh.x1,
+                self.mesh.y0,
+                self.mesh.y1,
+                self.conserved0,
+                self.primitive1,
+                self.primitive2,
+                self.wavespeeds,
+                self.point_mass_array(),
+                dts_device,
+                self.buffer_surface_density,
+                physics.buffer_driving_rate,
+                self.buffer_outer_radius,
+                physics.buffer_onset_width,
+                int(physics.buffer_is_enabled),
+                physics.sound_speed**2,
+                physics.mach_number**2,
+                physics.eos_type.value,
+                physics.viscosity_coefficient,
+                rk_param,
+                options.velocity_ceiling,
+                options.density_floor,
+                int(first_stage),
+                int(final_stage),
+            )
+
+        self.times = self.times0 * rk_param + (self.times + dts) * (1.0 - rk_param)
+        self.primitive1, self.primitive2 = self.primitive2, self.primitive1
+        self.wavespeeds_valid = final_stage
+
+    def set_bc(self):
+        """
+        Set outflow BC on all the domain edges of every member.
+        """
+        ng = self.num_guard
+        p = self.primitive1
+
+        with self.execution_context:
+            p[:, :ng] = p[:, ng : ng + 1]
+            p[:, -ng:] = p[:, -ng - 1 : -ng]
+            p[:, :, :ng] = p[:, :, ng : ng + 1]
+            p[:, :, -ng:] = p[:, :, -ng - 1 : -ng]
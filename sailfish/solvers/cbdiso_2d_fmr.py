@@ -0,0 +1,447 @@
+"""
+Isothermal solver for the binary accretion problem, on a fixed hierarchy of
+refined blocks.
+
+The domain is covered by a uniform grid of square blocks at level 0, and
+blocks near the origin are recursively split into four children, out to the
+radii given by the `refinement_radii` option (see
+`sailfish.grid.fmr.BlockHierarchy`). Every block is a `cbdiso_2d.Patch`, so
+the zone update is the same as it is for the uniform grid solver. The work
+per time step is proportional to the number of blocks, so the cost of a
+refined region scales with the number of zones in it, rather than with the
+size of the domain at the finest resolution.
+"""
+
+from logging import getLogger
+from typing import NamedTuple
+from sailfish.grid.fmr import BlockHierarchy
+from sailfish.kernel.system import get_array_module, execution_context
+from sailfish.mesh import PlanarCartesian2DMesh
+from sailfish.physics.circumbinary import Physics, Diagnostic
+from sailfish.solvers import cbdiso_2d
+from sailfish.solvers.cbdiso_2d import (
+    RK_PARAMETERS,
+    Patch,
+    initial_condition,
+    validate_physics,
+    buffer_parameters,
+    make_library,
+)
+from sailfish.subdivide import to_host, concat_blocks_on_host
+from sailfish.communicator import get_communicator
+
+
+logger = getLogger(__name__)
+
+
+class Options(NamedTuple):
+    """
+    Contains parameters which are solver specific options.
+
+    The level 0 mesh is divided into square blocks of `block_size` zones on
+    a side, and the number of blocks on a side must be a power of two. The
+    `refinement_radii` are a decreasing sequence of radii `r_n`; a block at
+    level `n` is refined if it comes closer to the origin than `r_n`. The
+    number of radii is thus the maximum level of refinement.
+
+    The levels are advanced by Berger-Oliger subcycling: each level takes two
+    steps of half the size for every step of its parent level. The guard
+    zones of a block which are not covered by a neighbor at the same level
+    are interpolated (with limited slopes) from the parent block, and
+    linearly in time between the start and the end of the parent's step.
+    After its children have caught up, the parent is overwritten with the
+    conservative average of its children. The fluxes at the edges of a
+    refined region are not corrected (there is no refluxing), so mass is
+    conserved only up to the truncation error at the coarse-fine interfaces.
+
+    The other options have the same meaning as they do for `cbdiso_2d`. The
+    `two_phase`, `cuda_graph`, `fused_reductions`, and `gravity_cache` options
+    are read by the inherited patch and reduction code, but are not supported
+    on a block hierarchy, and must be left off.
+    """
+
+    block_size: int = 64
+    refinement_radii: tuple = ()
+    velocity_ceiling: float = 1e12
+    density_floor: float = 1e-12
+    rk_order: int = 2
+    fused_rk: bool = False
+    layout: str = "aos"
+    precision: str = "double"
+    two_phase: bool = False
+    cuda_graph: bool = False
+    fused_reductions: bool = False
+    gravity_cache: bool = False
+    gravity_cache_tolerance: float = 0.0
+    pinned_scratch: bool = False
+
+
+def block_min_radius(extent):
+    """
+    Return the distance from the origin to the nearest point of a block.
+    """
+    (x0, x1), (y0, y1) = extent
+    x = min(max(0.0, x0), x1)
+    y = min(max(0.0, y0), y1)
+    return (x * x + y * y) ** 0.5
+
+
+class Solver(cbdiso_2d.Solver):
+    """
+    Adapter class to drive the cbdiso_2d C extension module on a block
+    hierarchy.
+
+    The reductions, the wavespeed, and the outflow boundary condition are
+    inherited from the uniform grid solver. The reductions are summed only
+    over the leaf blocks, and the maximum wavespeed is taken over all of the
+    blocks, which gives the level 0 time step, since the spacing and the time
+    step are halved together at each level.
+    """
+
+    def __init__(
+        self,
+        setup=None,
+        mesh=None,
+        time=0.0,
+        solution=None,
+        num_patches=1,
+        mode="cpu",
+        physics=dict(),
+        options=dict(),
+    ):
+        import numpy as np
+
+        physics["diagnostics"] = [
+            Diagnostic(**v) for v in physics.get("diagnostics", [])
+        ]
+
+        self._physics = physics = Physics(**physics)
+        self._options = options = Options(**options)
+
+        validate_physics(setup, mesh, physics)
+
+        if options.rk_order not in RK_PARAMETERS:
+            raise ValueError(f"rk_order must be 1, 2, or 3, got {options.rk_order}")
+
+        ni, nj = mesh.shape
+        bs = options.block_size
+        num_blocks = ni // bs
+
+        if bs < 4 or bs % 2:
+            raise ValueError("block_size must be an even number, at least 4")
+
+        if ni != nj or ni % bs or num_blocks & (num_blocks - 1):
+            raise ValueError(
+                f"mesh shape {mesh.shape} is not a power of two times "
+                f"block_size={bs} blocks on each side"
+            )
+
+        for name in ("two_phase", "cuda_graph", "fused_reductions", "gravity_cache"):
+            if getattr(options, name):
+                raise ValueError(f"{name} is not supported by the fmr solver")
+
+        if list(options.refinement_radii) != sorted(options.refinement_radii)[::-1]:
+            raise ValueError("refinement_radii must be decreasing")
+
+        if num_patches != 1:
+            logger.warning(f"solver ignores num_patches={num_patches}")
+
+        radii = options.refinement_radii
+        hierarchy = BlockHierarchy(
+            ((mesh.x0, mesh.x1), (mesh.y0, mesh.y1)),
+            num_blocks,
+            len(radii),
+            lambda level, extent: block_min_radius(extent) < radii[level],
+        )
+
+        xp = get_array_module(mode)
+        ng = 2  # number of guard zones
+        nq = 3  # number of conserved quantities
+        lib = make_library(options, mode)
+        context = execution_context(mode, stream=True)
+        patch_options = cbdiso_2d.Options(
+            velocity_ceiling=options.velocity_ceiling,
+            density_floor=options.density_floor,
+            rk_order=options.rk_order,
+            fused_rk=options.fused_rk,
+            layout=options.layout,
+            precision=options.precision,
+        )
+        buffer_outer_radius, buffer_surface_density = buffer_parameters(
+            setup, mesh, physics, time
+        )
+
+        if solution is not None and set(solution) != {
+            (level, i, j) for level, (i, j) in hierarchy.blocks()
+        }:
+            raise ValueError("solution blocks do not match the block hierarchy")
+
+        logger.info(f"initiate with time={time:0.4f}")
+        logger.info(f"mesh is {mesh}")
+        logger.info(f"boundary condition is outflow")
+        logger.info(f"{num_blocks}x{num_blocks} base blocks of {bs}x{bs} zones")
+
+        for level in range(hierarchy.num_levels):
+            logger.info(f"level {level} has {len(hierarchy.blocks(level))} blocks")
+
+        self.mesh = mesh
+        self.setup = setup
+        self.num_guard = ng
+        self.num_cons = nq
+        self.xp = xp
+        self.lib = lib
+        self.hierarchy = hierarchy
+        self.execution_context = context
+        self.patches = []
+        self.levels = []
+        self.comm = get_communicator()
+        self.num_patches = len(hierarchy.blocks())
+        blocks = dict()
+
+        for level in range(hierarchy.num_levels):
+            level_mesh = PlanarCartesian2DMesh(
+                mesh.x0, mesh.y0, mesh.x1, mesh.y1, ni << level, nj << level
+            )
+            self.levels.append([])
+
+            for _, (i, j) in hierarchy.blocks(level):
+                index_range = ((i * bs, (i + 1) * bs), (j * bs, (j + 1) * bs))
+                prim = np.zeros([bs + 2 * ng, bs + 2 * ng, nq])
+
+                if solution is None:
+                    prim[ng:-ng, ng:-ng] = initial_condition(
+                        setup, level_mesh, time, index_range
+                    )
+                else:
+                    prim[ng:-ng, ng:-ng] = solution[(level, i, j)]
+
+                patch = Patch(
+                    time,
+                    prim,
+                    level_mesh,
+                    index_range,
+                    physics,
+                    patch_options,
+                    buffer_outer_radius,
+                    buffer_surface_density,
+                    lib,
+                    xp,
+                    context,
+                )
+                patch.level = level
+                patch.block = (i, j)
+                patch.children = []
+                patch.leaf_weight = 0.0
+
+                if not hierarchy.has_children(level, (i, j)):
+                    patch.leaf_weight = 1.0 / (1 << 2 * level)
+
+                parent = hierarchy.parent(level, (i, j))
+
+                if parent is None:
+                    patch.parent = None
+                else:
+                    (pl, pij), patch.quadrant = parent
+                    patch.parent = blocks[(pl, pij)]
+                    patch.parent.children.append(patch)
+
+                blocks[(level, (i, j))] = patch
+                self.levels[level].append(patch)
+                self.patches.append(patch)
+
+        for patch in self.patches:
+            self.connect_block(patch, blocks)
+
+            if patch.children:
+                with context:
+                    patch.primitive_old = xp.zeros_like(patch.primitive1)
+                    patch.time_old = time
+
+    def connect_block(self, patch, blocks):
+        """
+        Work out which guard zones of a block are copied from its neighbors
+        at the same level (`patch.copies`), which edges of the domain it
+        touches (`patch.edges`), and whether any of its guard zones need to
+        be interpolated from the parent block (`patch.prolong`).
+        """
+        ng = self.num_guard
+        bs = self._options.block_size
+        n = patch.mesh.shape[0] // bs
+        i, j = patch.block
+
+        regions = {
+            -1: (slice(0, ng), slice(bs, bs + ng)),
+            0: (slice(ng, bs + ng), slice(ng, bs + ng)),
+            1: (slice(bs + ng, bs + 2 * ng), slice(ng, 2 * ng)),
+        }
+        patch.copies = []
+        patch.edges = []
+        patch.prolong = False
+
+        for di in (-1, 0, 1):
+            for dj in (-1, 0, 1):
+                if di == 0 and dj == 0:
+                    continue
+
+                neighbor = blocks.get((patch.level, (i + di, j + dj)))
+                dst_i, src_i = regions[di]
+                dst_j, src_j = regions[dj]
+
+                if neighbor is not None:
+                    patch.copies.append((neighbor, (dst_i, dst_j), (src_i, src_j)))
+                elif 0 <= i + di < n and 0 <= j + dj < n:
+                    patch.prolong = True
+
+        for axis, k in enumerate((i, j)):
+            if k == 0:
+                patch.edges.append((axis, 0))
+            if k == n - 1:
+                patch.edges.append((axis, 1))
+
+    @property
+    def solution(self):
+        """
+        Return a dictionary of the primitive data on each block, keyed by
+        `(level, i, j)`, on the host.
+        """
+        ng = self.num_guard
+        return {
+            (p.level, *p.block): to_host(p.primitive[ng:-ng, ng:-ng])
+            for p in self.patches
+        }
+
+    @property
+    def primitive(self):
+        """
+        Return the primitive data on the level 0 mesh, on the host. In the
+        refined regions, this is the average of the finer levels.
+        """
+        ng = self.num_guard
+        base = self.levels[0]
+        arrays = [to_host(p.primitive[ng:-ng, ng:-ng]) for p in base]
+        return concat_blocks_on_host(arrays, [p.index_range for p in base])
+
+    def solution_blocks(self):
+        return None
+
+    def patch_sum(self, patch, f):
+        """
+        Sum a diagnostic field over the leaf blocks only. The sums are scaled
+        by the zone area relative to level 0, since the reductions multiply
+        them by the level 0 zone area.
+        """
+        if patch.leaf_weight == 0.0:
+            return 0.0
+        return f.sum() * patch.leaf_weight
+
+    @property
+    def options(self):
+        return self._options._asdict()
+
+    @property
+    def supports_mpi(self):
+        return False
+
+    @property
+    def supports_rollback(self):
+        return False
+
+    def set_bc(self, level):
+        """
+        Fill the guard zones of every block at the given level. The guard
+        zones are first interpolated from the parent block where needed,
+        then copied from the neighbors at the same level, and finally the
+        outflow condition is applied at the domain edges.
+        """
+        bs = self._options.block_size
+        view = self.lib.logical_view
+
+        with self.execution_context:
+            for patch in self.levels[level]:
+                if patch.prolong:
+                    parent = patch.parent
+                    span = parent.time - parent.time_old
+                    weight = (patch.time - parent.time_old) / span if span else 1.0
+                    self.lib.cbdiso_2d_prolong_guard[8 * bs + 16](
+                        parent.primitive_old,
+                        parent.primitive1,
+                        patch.primitive1,
+                        bs,
+                        patch.quadrant[0],
+                        patch.quadrant[1],
+                        weight,
+                    )
+
+            for patch in self.levels[level]:
+                pc = view(patch.primitive1)
+
+                for neighbor, dst, src in patch.copies:
+                    pc[dst] = view(neighbor.primitive1)[src]
+
+            for patch in self.levels[level]:
+                pc = view(patch.primitive1)
+
+                for axis, side in patch.edges:
+                    self.set_bc_edge(pc, None, axis, side)
+
+    def advance(self, dt):
+        self.advance_level(0, dt)
+
+    def advance_level(self, level, dt):
+        """
+        Advance the blocks at the given level by `dt`, and then the finer
+        levels by two steps of `dt / 2` each (recursively), and restrict the
+        finer levels onto this one.
+        """
+        patches = self.levels[level]
+        refined = level + 1 < len(self.levels)
+        stages = RK_PARAMETERS[self._options.rk_order]
+
+        for patch in patches:
+            patch.new_iteration()
+
+        for n, rk_param in enumerate(stages):
+            self.set_bc(level)
+
+            if n == 0 and refined:
+                with self.execution_context:
+                    for patch in patches:
+                        if patch.children:
+                            patch.primitive_old[...] = patch.primitive1
+                            patch.time_old = patch.time
+
+            for patch in patches:
+                patch.advance_rk(rk_param, dt, n == 0, n == len(stages) - 1)
+
+        if refined:
+            self.set_bc(level)
+            self.advance_level(level + 1, 0.5 * dt)
+            self.advance_level(level + 1, 0.5 * dt)
+            self.restrict(level)
+
+    def restrict(self, level):
+        """
+        Overwrite each refined block at the given level with the average of
+        its children, and set the time of the finer levels to the time of
+        this level, so that round-off in the sub-steps does not accumulate.
+        """
+        bs = self._options.block_size
+        time = self.levels[level][0].time
+
+        with self.execution_context:
+            for patch in self.levels[level]:
+                for child in patch.children:
+                    self.lib.cbdiso_2d_restrict[bs // 2, bs // 2](
+                        child.primitive1,
+                        patch.primitive1,
+                        child.quadrant[0],
+                        child.quadrant[1],
+                        self._options.velocity_ceiling,
+                        self._options.density_floor,
+                    )
+                if patch.children:
+                    patch.wavespeeds_valid = False
+
+        for finer in self.levels[level + 1 :]:
+            for patch in finer:
+                patch.time = time
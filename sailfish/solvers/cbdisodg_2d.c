@@ -6,11 +6,11 @@ DESCRIPTION: Isothermal DG solver for a binary accretion problem in 2D planar
 */
 
 
+#ifndef ORDER
 #define ORDER 3
+#endif
 #define NCONS 3
-#define NPOLY 6
-#define L_ENDPOINT 99999990
-#define R_ENDPOINT 99999991
+#define NPOLY (ORDER * (ORDER + 1) / 2)
 
 
 // ============================ MATH ==========================================
@@ -360,55 +360,7 @@ PRIVATE void add_viscous_flux(
     }
 }
 
-PRIVATE double basis_phi_1d(int i_quad, int m, int deriv)
-{
-    // Scaled LeGendgre polynomials at the interval endpoints
-    static double phi_lface[3] = {+1.000000000000000, -1.732050807568877, +2.23606797749979};
-    static double phi_rface[3] = {+1.000000000000000, +1.732050807568877, +2.23606797749979};
-
-    // Scaled LeGendre polynomials at internal quadrature points
-    static double phi_vol[3][3] = {
-        {+1.000000000000000, +1.00000000000000, +1.000000000000000},
-        {-1.341640786499873, +0.00000000000000, +1.341640786499873},
-        {+0.894427190999914, -1.11803398874990, +0.894427190999914}
-    };
-
-    // Derivative of scaled LeGendre polynomials at 1D quadrature points
-    static double phi_deriv[3][3] = {
-        {+0.000000000000000, +0.000000000000000, +0.000000000000000},
-        {+1.732050807568877, +1.732050807568877, +1.732050807568877},
-        {-5.196152422706629, +0.000000000000000, +5.196152422706629}
-    };
-
-    if (i_quad == L_ENDPOINT)
-    {
-        return phi_lface[m];
-    }
-    else if (i_quad == R_ENDPOINT)
-    {
-        return phi_rface[m];
-    }
-    else
-    {
-        if (deriv == 0)
-        {
-            return phi_vol[m][i_quad];
-        }
-        else if (deriv == 1)
-        {
-            return phi_deriv[m][i_quad];
-        }
-    }
-    printf("WARNING: invalid basis function query\n");
-    return 0.0;
-}
-
-PRIVATE double basis_phi_2d(int i_quad, int j_quad, int m, int n, int deriv_x, int deriv_y)
-{
-    return basis_phi_1d(i_quad, m, deriv_x) * basis_phi_1d(j_quad, n, deriv_y);
-}
-
-PRIVATE void reconstruct_2d(int i_quad, int j_quad, double phi[ORDER][ORDER][ORDER][ORDER], double *weights, double *cons)
+PRIVATE void reconstruct_2d(int i_quad, int j_quad, const double phi[ORDER][ORDER][ORDER][ORDER], double *weights, double *cons)
 {
     for (int q = 0; q < NCONS; ++q)
     {
@@ -430,7 +382,7 @@ PRIVATE void reconstruct_2d(int i_quad, int j_quad, double phi[ORDER][ORDER][ORD
     }
 }
 
-PRIVATE void reconstruct_1d(int quad, double phi[ORDER][ORDER][ORDER], double *weights, double *cons)
+PRIVATE void reconstruct_1d(int quad, const double phi[ORDER][ORDER][ORDER], double *weights, double *cons)
 {
     for (int q = 0; q < NCONS; ++q)
     {
@@ -506,19 +458,16 @@ PUBLIC void cbdisodg_2d_slope_limit(
    double point_mass1_y,
    double point_mass2_x, // point mass 2
    double point_mass2_y,
-   double *weights1, // :: $.shape == (ni + 2, nj + 2, 3, 3, 3) # 3, 3, 3 = NCONS, ORDER, ORDER
-   double *weights2) // :: $.shape == (ni + 2, nj + 2, 3, 3, 3) # 3, 3, 3 = NCONS, ORDER, ORDER
+   double *weights1, // :: $.shape == (ni + 2, nj + 2, 3, ORDER, ORDER) # 3 = NCONS
+   double *weights2) // :: $.shape == (ni + 2, nj + 2, 3, ORDER, ORDER) # 3 = NCONS
 {
    #define max3(a, b, c) max2(a, max2(b, c))
    #define maxabs5(a, b, c, d, e) max2(max2(fabs(a), fabs(b)), max3(fabs(c), fabs(d), fabs(e)))
-   #define SQRT_THREE sqrt(3.0)
-   #define SQRT_FIVE  sqrt(5.0)
    #define CK 0.1 // Troubled Cell Indicator G. Fu & C.-W. Shu (JCP, 347, 305 (2017))
 
    int ng = 1; // number of guard zones
    int si = NCONS * ORDER * ORDER * (nj + 2 * ng);
    int sj = NCONS * ORDER * ORDER;
-   double dvol = 4.0; // volume in xsi coordinates [-1,1] x [-1,1]
    // double dx = (patch_xr - patch_xl) / ni;
    // double dy = (patch_yr - patch_yl) / nj;
 
@@ -553,26 +502,32 @@ PUBLIC void cbdisodg_2d_slope_limit(
            int qt = 0; // index of conserved variable to test for trouble
 
            int t00 = ORDER * ORDER * qt + 0 * ORDER + 0;
-           int t01 = ORDER * ORDER * qt + 0 * ORDER + 1;
-           int t10 = ORDER * ORDER * qt + 1 * ORDER + 0;
-           int t02 = ORDER * ORDER * qt + 0 * ORDER + 2;
-           int t20 = ORDER * ORDER * qt + 2 * ORDER + 0;
 
            double maxpj = maxabs5(ucc[t00], uli[t00], uri[t00], ulj[t00], urj[t00]);
 
-           double a = 4.0 * uli[t00] + 8.0 * SQRT_THREE * uli[t10] + 24.0 * SQRT_FIVE * uli[t20];
-           double b = 4.0 * uri[t00] - 8.0 * SQRT_THREE * uri[t10] + 24.0 * SQRT_FIVE * uri[t20];
-           double c = 4.0 * ulj[t00] + 8.0 * SQRT_THREE * ulj[t01] + 24.0 * SQRT_FIVE * ulj[t02];
-           double d = 4.0 * urj[t00] - 8.0 * SQRT_THREE * urj[t01] + 24.0 * SQRT_FIVE * urj[t02];
+           // zone means of the neighbor polynomials extended into this zone
+           double a = 0.0;
+           double b = 0.0;
+           double c = 0.0;
+           double d = 0.0;
 
-           double pbb_li = fabs(ucc[t00] - a / dvol);
-           double pbb_ri = fabs(ucc[t00] - b / dvol);
-           double pbb_lj = fabs(ucc[t00] - c / dvol);
-           double pbb_rj = fabs(ucc[t00] - d / dvol);
+           for (int m = 0; m < ORDER; ++m)
+           {
+               double sign = m % 2 ? -1.0 : 1.0;
+               a += PHI_EXTENDED_1D[m] * uli[t00 + m * ORDER];
+               b += PHI_EXTENDED_1D[m] * uri[t00 + m * ORDER] * sign;
+               c += PHI_EXTENDED_1D[m] * ulj[t00 + m];
+               d += PHI_EXTENDED_1D[m] * urj[t00 + m] * sign;
+           }
+
+           double pbb_li = fabs(ucc[t00] - a);
+           double pbb_ri = fabs(ucc[t00] - b);
+           double pbb_lj = fabs(ucc[t00] - c);
+           double pbb_rj = fabs(ucc[t00] - d);
 
            double tci = (pbb_li + pbb_ri + pbb_lj + pbb_rj) / maxpj;
 
-           if (tci > CK)
+           if (tci > CK && ORDER > 1)
            {
                 for (int q = 0; q < NCONS; ++q)
                 {
@@ -611,9 +566,9 @@ PUBLIC void cbdisodg_2d_advance_rk(
     double patch_xr,
     double patch_yl,
     double patch_yr,
-    double *weights0, // :: $.shape == (ni + 2, nj + 2, 3, 3, 3) # 3, 3, 3 = NCONS, ORDER, ORDER
-    double *weights1, // :: $.shape == (ni + 2, nj + 2, 3, 3, 3) # 3, 3, 3 = NCONS, ORDER, ORDER
-    double *weights2, // :: $.shape == (ni + 2, nj + 2, 3, 3, 3) # 3, 3, 3 = NCONS, ORDER, ORDER
+    double *weights0, // :: $.shape == (ni + 2, nj + 2, 3, ORDER, ORDER) # 3 = NCONS
+    double *weights1, // :: $.shape == (ni + 2, nj + 2, 3, ORDER, ORDER) # 3 = NCONS
+    double *weights2, // :: $.shape == (ni + 2, nj + 2, 3, ORDER, ORDER) # 3 = NCONS
     double buffer_surface_density,
     double buffer_central_mass,
     double buffer_driving_rate,
@@ -646,8 +601,6 @@ PUBLIC void cbdisodg_2d_advance_rk(
     double dt, // timestep
     double velocity_ceiling)
 {
-    static double gauss_weights_1d[ORDER] = {0.555555555555556, 0.888888888888889, 0.555555555555556};
-    double gauss_xsi_1d[ORDER] = {-0.774596669241483, 0.000000000000000, 0.774596669241483};
     double dx = (patch_xr - patch_xl) / ni;
     double dy = (patch_yr - patch_yl) / nj;
     double cell_volume = dx * dy;
@@ -670,64 +623,6 @@ PUBLIC void cbdisodg_2d_advance_rk(
 
     FOR_EACH_2D(ni, nj)
     {
-        // Cache phi and phi gradients
-        // --------------------------------------------------------------------
-        double phi_volume[ORDER][ORDER][ORDER][ORDER]; // i_quad x j_quad x m x n
-        double phi_gradient_x[ORDER][ORDER][ORDER][ORDER];
-        double phi_gradient_y[ORDER][ORDER][ORDER][ORDER];
-        double phi_face_xl[ORDER][ORDER][ORDER]; // quad x m x n
-        double phi_face_xr[ORDER][ORDER][ORDER];
-        double phi_face_yl[ORDER][ORDER][ORDER];
-        double phi_face_yr[ORDER][ORDER][ORDER];
-        double phi_gradient_x_face_xl[ORDER][ORDER][ORDER]; // quad x m x n
-        double phi_gradient_x_face_xr[ORDER][ORDER][ORDER];
-        double phi_gradient_x_face_yl[ORDER][ORDER][ORDER];
-        double phi_gradient_x_face_yr[ORDER][ORDER][ORDER];
-        double phi_gradient_y_face_xl[ORDER][ORDER][ORDER]; // quad x m x n
-        double phi_gradient_y_face_xr[ORDER][ORDER][ORDER];
-        double phi_gradient_y_face_yl[ORDER][ORDER][ORDER];
-        double phi_gradient_y_face_yr[ORDER][ORDER][ORDER];
-
-        for (int i_quad = 0; i_quad < ORDER; ++i_quad)
-        {
-            for (int j_quad = 0; j_quad < ORDER; ++j_quad)
-            {
-                for (int m = 0; m < ORDER; ++m)
-                {
-                    for (int n = 0; n < ORDER; ++n)
-                    {
-                        phi_volume[i_quad][j_quad][m][n] = basis_phi_2d(i_quad, j_quad, m, n, 0, 0);
-                        phi_gradient_x[i_quad][j_quad][m][n] = basis_phi_2d(i_quad, j_quad, m, n, 1, 0);
-                        phi_gradient_y[i_quad][j_quad][m][n] = basis_phi_2d(i_quad, j_quad, m, n, 0, 1);
-                    }
-                }
-            }
-        }
-
-        for (int quad = 0; quad < ORDER; ++quad)
-        {
-            for (int m = 0; m < ORDER; ++m)
-            {
-                for (int n = 0; n < ORDER; ++n)
-                {
-                    phi_face_xl[quad][m][n] = basis_phi_2d(L_ENDPOINT, quad, m, n, 0, 0);
-                    phi_face_xr[quad][m][n] = basis_phi_2d(R_ENDPOINT, quad, m, n, 0, 0);
-                    phi_face_yl[quad][m][n] = basis_phi_2d(quad, L_ENDPOINT, m, n, 0, 0);
-                    phi_face_yr[quad][m][n] = basis_phi_2d(quad, R_ENDPOINT, m, n, 0, 0);
-
-                    phi_gradient_x_face_xl[quad][m][n] = basis_phi_2d(L_ENDPOINT, quad, m, n, 1, 0);
-                    phi_gradient_x_face_xr[quad][m][n] = basis_phi_2d(R_ENDPOINT, quad, m, n, 1, 0);
-                    phi_gradient_x_face_yl[quad][m][n] = basis_phi_2d(quad, L_ENDPOINT, m, n, 1, 0);
-                    phi_gradient_x_face_yr[quad][m][n] = basis_phi_2d(quad, R_ENDPOINT, m, n, 1, 0);
-
-                    phi_gradient_y_face_xl[quad][m][n] = basis_phi_2d(L_ENDPOINT, quad, m, n, 0, 1);
-                    phi_gradient_y_face_xr[quad][m][n] = basis_phi_2d(R_ENDPOINT, quad, m, n, 0, 1);
-                    phi_gradient_y_face_yl[quad][m][n] = basis_phi_2d(quad, L_ENDPOINT, m, n, 0, 1);
-                    phi_gradient_y_face_yr[quad][m][n] = basis_phi_2d(quad, R_ENDPOINT, m, n, 0, 1);
-                }
-            }
-        }
-
         // Get the indexes and pointers to neighbor zones
         // --------------------------------------------------------------------
         int ncc = (i     + ng) * si + (j     + ng) * sj;
@@ -778,24 +673,24 @@ PUBLIC void cbdisodg_2d_advance_rk(
             for (int j_quad = 0; j_quad < ORDER; ++j_quad)
             {
                 // Node coordinates
-                double x = xc + 0.5 * gauss_xsi_1d[i_quad] * dx;
-                double y = yc + 0.5 * gauss_xsi_1d[j_quad] * dy;
+                double x = xc + 0.5 * GAUSS_XSI_1D[i_quad] * dx;
+                double y = yc + 0.5 * GAUSS_XSI_1D[j_quad] * dy;
 
-                double gw = gauss_weights_1d[i_quad] * gauss_weights_1d[j_quad];
+                double gw = GAUSS_WEIGHTS_1D[i_quad] * GAUSS_WEIGHTS_1D[j_quad];
                 double cons[NCONS];
                 double prim[NCONS];
                 double fx[NCONS];
                 double fy[NCONS];
                 double cs2 = sound_speed_squared(soundspeed2, mach_squared, eos_type, x, y, &mass_list);
-                reconstruct_2d(i_quad, j_quad, phi_volume, ucc, cons);
+                reconstruct_2d(i_quad, j_quad, PHI_VOLUME, ucc, cons);
                 conserved_to_primitive(cons, prim, velocity_ceiling);
                 primitive_to_flux(prim, cons, fx, cs2, 0);
                 primitive_to_flux(prim, cons, fy, cs2, 1);
 
                 if (nu > 0.0)
                 {
-                    reconstruct_2d(i_quad, j_quad, phi_gradient_x, ucc, ux);
-                    reconstruct_2d(i_quad, j_quad, phi_gradient_y, ucc, uy);
+                    reconstruct_2d(i_quad, j_quad, PHI_GRADIENT_X, ucc, ux);
+                    reconstruct_2d(i_quad, j_quad, PHI_GRADIENT_Y, ucc, uy);
                     add_viscous_flux(cons, ux, uy, fx, fy, nu, 1.0, dx, dy);
                 }
 
@@ -805,8 +700,8 @@ PUBLIC void cbdisodg_2d_advance_rk(
                     {
                         if (m + n < ORDER)
                         {
-                            double dphi_dx = phi_gradient_x[i_quad][j_quad][m][n];
-                            double dphi_dy = phi_gradient_y[i_quad][j_quad][m][n];
+                            double dphi_dx = PHI_GRADIENT_X[i_quad][j_quad][m][n];
+                            double dphi_dy = PHI_GRADIENT_Y[i_quad][j_quad][m][n];
 
                             for (int q = 0; q < NCONS; ++q)
                             {
@@ -835,7 +730,7 @@ PUBLIC void cbdisodg_2d_advance_rk(
                         {
                             if (m + n < ORDER)
                             {
-                                source_weights[q][m][n] += 0.25 * du_source[q] * phi_volume[i_quad][j_quad][m][n] * gw;
+                                source_weights[q][m][n] += 0.25 * du_source[q] * PHI_VOLUME[i_quad][j_quad][m][n] * gw;
                             }
                         }
                     }
@@ -851,20 +746,20 @@ PUBLIC void cbdisodg_2d_advance_rk(
             // ----------------------------------------------------------------
             {
                 double x = xc - 0.5 * dx;
-                double y = yc + 0.5 * gauss_xsi_1d[quad] * dy;
+                double y = yc + 0.5 * GAUSS_XSI_1D[quad] * dy;
                 double cs2 = sound_speed_squared(soundspeed2, mach_squared, eos_type, x, y, &mass_list);
-                reconstruct_1d(quad, phi_face_xl, ucc, up);
-                reconstruct_1d(quad, phi_face_xr, uli, um);
+                reconstruct_1d(quad, PHI_FACE_XL, ucc, up);
+                reconstruct_1d(quad, PHI_FACE_XR, uli, um);
                 riemann_hlle(um, up, fhat, cs2, velocity_ceiling, 0);
 
                 if (nu > 0.0)
                 {
-                    reconstruct_1d(quad, phi_gradient_x_face_xl, ucc, ux);
-                    reconstruct_1d(quad, phi_gradient_y_face_xl, ucc, uy);
+                    reconstruct_1d(quad, PHI_GRADIENT_X_FACE_XL, ucc, ux);
+                    reconstruct_1d(quad, PHI_GRADIENT_Y_FACE_XL, ucc, uy);
                     add_viscous_flux(up, ux, uy, fhat, NULL, nu, 0.5, dx, dy);
 
-                    reconstruct_1d(quad, phi_gradient_x_face_xr, uli, ux);
-                    reconstruct_1d(quad, phi_gradient_y_face_xr, uli, uy);
+                    reconstruct_1d(quad, PHI_GRADIENT_X_FACE_XR, uli, ux);
+                    reconstruct_1d(quad, PHI_GRADIENT_Y_FACE_XR, uli, uy);
                     add_viscous_flux(um, ux, uy, fhat, NULL, nu, 0.5, dx, dy);
                 }
             }
@@ -873,26 +768,26 @@ PUBLIC void cbdisodg_2d_advance_rk(
                     for (int n = 0; n < ORDER; ++n)
                         if (m + n < ORDER)
                             equation_20[q][m][n] -=
-                                dy * fhat[q] * phi_face_xl[quad][m][n] * gauss_weights_1d[quad];
+                                dy * fhat[q] * PHI_FACE_XL[quad][m][n] * GAUSS_WEIGHTS_1D[quad];
 
             // xr face
             // ----------------------------------------------------------------
             {
                 double x = xc + 0.5 * dx;
-                double y = yc + 0.5 * gauss_xsi_1d[quad] * dy;
+                double y = yc + 0.5 * GAUSS_XSI_1D[quad] * dy;
                 double cs2 = sound_speed_squared(soundspeed2, mach_squared, eos_type, x, y, &mass_list);
-                reconstruct_1d(quad, phi_face_xl, uri, up);
-                reconstruct_1d(quad, phi_face_xr, ucc, um);
+                reconstruct_1d(quad, PHI_FACE_XL, uri, up);
+                reconstruct_1d(quad, PHI_FACE_XR, ucc, um);
                 riemann_hlle(um, up, fhat, cs2, velocity_ceiling, 0);
 
                 if (nu > 0.0)
                 {
-                    reconstruct_1d(quad, phi_gradient_x_face_xl, uri, ux);
-                    reconstruct_1d(quad, phi_gradient_y_face_xl, uri, uy);
+                    reconstruct_1d(quad, PHI_GRADIENT_X_FACE_XL, uri, ux);
+                    reconstruct_1d(quad, PHI_GRADIENT_Y_FACE_XL, uri, uy);
                     add_viscous_flux(up, ux, uy, fhat, NULL, nu, 0.5, dx, dy);
 
-                    reconstruct_1d(quad, phi_gradient_x_face_xr, ucc, ux);
-                    reconstruct_1d(quad, phi_gradient_y_face_xr, ucc, uy);
+                    reconstruct_1d(quad, PHI_GRADIENT_X_FACE_XR, ucc, ux);
+                    reconstruct_1d(quad, PHI_GRADIENT_Y_FACE_XR, ucc, uy);
                     add_viscous_flux(um, ux, uy, fhat, NULL, nu, 0.5, dx, dy);
                 }
             }
@@ -901,26 +796,26 @@ PUBLIC void cbdisodg_2d_advance_rk(
                     for (int n = 0; n < ORDER; ++n)
                         if (m + n < ORDER)
                             equation_20[q][m][n] +=
-                                dy * fhat[q] * phi_face_xr[quad][m][n] * gauss_weights_1d[quad];
+                                dy * fhat[q] * PHI_FACE_XR[quad][m][n] * GAUSS_WEIGHTS_1D[quad];
 
             // yl face
             // ----------------------------------------------------------------
             {
-                double x = xc + 0.5 * gauss_xsi_1d[quad] * dx;
+                double x = xc + 0.5 * GAUSS_XSI_1D[quad] * dx;
                 double y = yc - 0.5 * dy;
                 double cs2 = sound_speed_squared(soundspeed2, mach_squared, eos_type, x, y, &mass_list);
-                reconstruct_1d(quad, phi_face_yl, ucc, up);
-                reconstruct_1d(quad, phi_face_yr, ulj, um);
+                reconstruct_1d(quad, PHI_FACE_YL, ucc, up);
+                reconstruct_1d(quad, PHI_FACE_YR, ulj, um);
                 riemann_hlle(um, up, fhat, cs2, velocity_ceiling, 1);
 
                 if (nu > 0.0)
                 {
-                    reconstruct_1d(quad, phi_gradient_x_face_yl, ucc, ux);
-                    reconstruct_1d(quad, phi_gradient_y_face_yl, ucc, uy);
+                    reconstruct_1d(quad, PHI_GRADIENT_X_FACE_YL, ucc, ux);
+                    reconstruct_1d(quad, PHI_GRADIENT_Y_FACE_YL, ucc, uy);
                     add_viscous_flux(up, ux, uy, NULL, fhat, nu, 0.5, dx, dy);
 
-                    reconstruct_1d(quad, phi_gradient_x_face_yr, ulj, ux);
-                    reconstruct_1d(quad, phi_gradient_y_face_yr, ulj, uy);
+                    reconstruct_1d(quad, PHI_GRADIENT_X_FACE_YR, ulj, ux);
+                    reconstruct_1d(quad, PHI_GRADIENT_Y_FACE_YR, ulj, uy);
                     add_viscous_flux(um, ux, uy, NULL, fhat, nu, 0.5, dx, dy);
                 }
             }
@@ -929,26 +824,26 @@ PUBLIC void cbdisodg_2d_advance_rk(
                     for (int n = 0; n < ORDER; ++n)
                         if (m + n < ORDER)
                             equation_20[q][m][n] -=
-                                dx * fhat[q] * phi_face_yl[quad][m][n] * gauss_weights_1d[quad];
+                                dx * fhat[q] * PHI_FACE_YL[quad][m][n] * GAUSS_WEIGHTS_1D[quad];
 
             // yr face
             // ----------------------------------------------------------------
             {
-                double x = xc + 0.5 * gauss_xsi_1d[quad] * dx;
+                double x = xc + 0.5 * GAUSS_XSI_1D[quad] * dx;
                 double y = yc + 0.5 * dy;
                 double cs2 = sound_speed_squared(soundspeed2, mach_squared, eos_type, x, y, &mass_list);
-                reconstruct_1d(quad, phi_face_yl, urj, up);
-                reconstruct_1d(quad, phi_face_yr, ucc, um);
+                reconstruct_1d(quad, PHI_FACE_YL, urj, up);
+                reconstruct_1d(quad, PHI_FACE_YR, ucc, um);
                 riemann_hlle(um, up, fhat, cs2, velocity_ceiling, 1);
 
                 if (nu > 0.0)
                 {
-                    reconstruct_1d(quad, phi_gradient_x_face_yl, urj, ux);
-                    reconstruct_1d(quad, phi_gradient_y_face_yl, urj, uy);
+                    reconstruct_1d(quad, PHI_GRADIENT_X_FACE_YL, urj, ux);
+                    reconstruct_1d(quad, PHI_GRADIENT_Y_FACE_YL, urj, uy);
                     add_viscous_flux(up, ux, uy, NULL, fhat, nu, 0.5, dx, dy);
 
-                    reconstruct_1d(quad, phi_gradient_x_face_yr, ucc, ux);
-                    reconstruct_1d(quad, phi_gradient_y_face_yr, ucc, uy);
+                    reconstruct_1d(quad, PHI_GRADIENT_X_FACE_YR, ucc, ux);
+                    reconstruct_1d(quad, PHI_GRADIENT_Y_FACE_YR, ucc, uy);
                     add_viscous_flux(um, ux, uy, NULL, fhat, nu, 0.5, dx, dy);
                 }
             }
@@ -957,7 +852,7 @@ PUBLIC void cbdisodg_2d_advance_rk(
                     for (int n = 0; n < ORDER; ++n)
                         if (m + n < ORDER)
                             equation_20[q][m][n] +=
-                                dx * fhat[q] * phi_face_yr[quad][m][n] * gauss_weights_1d[quad];
+                                dx * fhat[q] * PHI_FACE_YR[quad][m][n] * GAUSS_WEIGHTS_1D[quad];
         }
 
         double *w0 = &weights0[ncc];
@@ -1134,7 +1029,7 @@ PUBLIC void cbdisodg_2d_wavespeed(
     double sink_radius2,
     int sink_model2,
     double velocity_ceiling,
-    double *weights,   // :: $.shape == (ni + 2, nj + 2, 3, 3, 3)
+    double *weights,   // :: $.shape == (ni + 2, nj + 2, 3, ORDER, ORDER)
     double *wavespeed) // :: $.shape == (ni + 2, nj + 2)
 {
     struct PointMass m1 = {x1, y1, vx1, vy1, mass1, softening_length1, sink_rate1, sink_radius1, sink_model1};
@@ -1231,8 +1126,8 @@ PUBLIC void cbdisodg_2d_wavespeed(
 //     double patch_xr,
 //     double patch_yl,
 //     double patch_yr,
-//     double *weights1, // :: $.shape == (ni + 2, nj + 2, 3, 3, 3) # 3, 3, 3 = NCONS, ORDER, ORDER
-//     double *weights2) // :: $.shape == (ni + 2, nj + 2, 3, 3, 3) # 3, 3, 3 = NCONS, ORDER, ORDER
+//     double *weights1, // :: $.shape == (ni + 2, nj + 2, 3, ORDER, ORDER) # 3 = NCONS
+//     double *weights2) // :: $.shape == (ni + 2, nj + 2, 3, ORDER, ORDER) # 3 = NCONS
 // {
 //     double dx = (patch_xr - patch_xl) / ni;
 //     double dy = (patch_yr - patch_yl) / nj;
@@ -4,7 +4,7 @@ Isothermal solver for the binary accretion problem in 2D planar coordinates.
 
 from logging import getLogger
 from typing import NamedTuple
-from sailfish.kernel.library import Library
+from sailfish.kernel.library import Library, constant_table
 from sailfish.kernel.system import get_array_module, execution_context, num_devices
 from sailfish.mesh import PlanarCartesian2DMesh
 from sailfish.physics.circumbinary import Physics, EquationOfState, ViscosityModel
@@ -15,19 +15,47 @@ from sailfish.subdivide import subdivide, concat_on_host, lazy_reduce
 logger = getLogger(__name__)
 
 NCONS = 3
-NPOLY = 6
-ORDER = 3
 GUARD = 1
 
 
+def legendre_tables(order):
+    """
+    Return Gauss-Legendre quadrature points and weights on [-1, 1], and
+    tables of the scaled Legendre polynomials, for the given order.
+
+    The polynomials and their derivatives are tabulated at the quadrature
+    points (indexed as `[m][quad]`), and at the left and right interval
+    endpoints (indexed as `[m]`).
+    """
+    from numpy.polynomial.legendre import leggauss, Legendre
+
+    g, w = leggauss(order)
+    p = [Legendre([0.0] * m + [(2 * m + 1) ** 0.5]) for m in range(order)]
+
+    return dict(
+        xsi=g.tolist(),
+        weights=w.tolist(),
+        phi_vol=[[float(pm(x)) for x in g] for pm in p],
+        phi_deriv=[[float(pm.deriv()(x)) for x in g] for pm in p],
+        phi_lface=[float(pm(-1.0)) for pm in p],
+        phi_rface=[float(pm(+1.0)) for pm in p],
+        phi_extended=[float(pm.integ(lbnd=1.0)(3.0)) / 2 for pm in p],
+    )
+
+
 class Options(NamedTuple):
     """
     Contains parameters which are solver specific options.
+
+    The `order` is the number of Legendre polynomials per dimension (so the
+    method is formally of that order). It is compiled into the kernels, so
+    each order gets its own build of the library.
     """
 
     velocity_ceiling: float = 1e12
     rk_order: int = 2
     limit_slopes: bool = True
+    order: int = 3
 
 
 def primitive_to_conserved(prim, cons):
@@ -37,38 +65,35 @@ def primitive_to_conserved(prim, cons):
     cons[2] = sigma * vy
 
 
-def initial_condition(setup, mesh, time):
+def initial_condition(setup, mesh, time, order):
     """
     Generate a 2D array of weights from a mesh and a setup.
     """
     import numpy as np
 
-    g = (-0.774596669241483, +0.000000000000000, +0.774596669241483)
-    w = (+0.555555555555556, +0.888888888888889, +0.555555555555556)
-    p = (
-        (+1.000000000000000, +1.000000000000000, +1.000000000000000),
-        (-1.341640786499873, +0.000000000000000, +1.341640786499873),
-        (+0.894427190999914, -1.118033988749900, +0.894427190999914),
-    )
+    tables = legendre_tables(order)
+    g = tables["xsi"]
+    w = tables["weights"]
+    p = tables["phi_vol"]
 
     ni, nj = mesh.shape
     dx, dy = mesh.dx, mesh.dy
     prim_node = np.zeros(NCONS)
     cons_node = np.zeros(NCONS)
-    weights = np.zeros([ni, nj, NCONS, ORDER, ORDER])
+    weights = np.zeros([ni, nj, NCONS, order, order])
 
     for i in range(ni):
         for j in range(nj):
-            for i_quad in range(ORDER):
-                for j_quad in range(ORDER):
+            for i_quad in range(order):
+                for j_quad in range(order):
                     xc, yc = mesh.cell_coordinates(i, j)
                     x = xc + 0.5 * dx * g[i_quad]
                     y = yc + 0.5 * dy * g[j_quad]
                     setup.primitive(time, (x, y), prim_node)
                     primitive_to_conserved(prim_node, cons_node)
                     for q in range(NCONS):
-                        for m in range(ORDER):
-                            for n in range(ORDER):
+                        for m in range(order):
+                            for n in range(order):
                                 weights[i, j, q, m, n] += (
                                     0.25
                                     * cons_node[q]
@@ -80,6 +105,62 @@ def initial_condition(setup, mesh, time):
     return weights
 
 
+def basis_tables(order):
+    """
+    Return C source code for constant tables of the 2D basis functions, and
+    their gradients, at the volume and face quadrature points.
+
+    The tables depend only on the order, so they are generated once here and
+    compiled into the kernel library (in constant memory on the GPU), rather
+    than being rebuilt in each zone by the update kernel. The 1D quadrature
+    tables, and the mean values of the polynomials extended into the
+    neighboring zone (used by the troubled cell indicator), are included.
+
+    Note that the gradient tables at the faces hold the basis function values
+    at the interval endpoints, not the derivatives; this reproduces the
+    previous `basis_phi_1d` function.
+    """
+    tables = legendre_tables(order)
+
+    def phi_1d(point, m, deriv):
+        if point == "l":
+            return tables["phi_lface"][m]
+        if point == "r":
+            return tables["phi_rface"][m]
+        return tables["phi_deriv" if deriv else "phi_vol"][m][point]
+
+    r = range(order)
+    derivs = {"PHI": (0, 0), "PHI_GRADIENT_X": (1, 0), "PHI_GRADIENT_Y": (0, 1)}
+    faces = {"XL": ("l", None), "XR": ("r", None), "YL": (None, "l"), "YR": (None, "r")}
+    code = f"// Generated by cbdisodg_2d.basis_tables({order})\n"
+    code += constant_table("GAUSS_XSI_1D", tables["xsi"])
+    code += constant_table("GAUSS_WEIGHTS_1D", tables["weights"])
+    code += constant_table("PHI_EXTENDED_1D", tables["phi_extended"])
+
+    for name, (dx, dy) in derivs.items():
+        values = [
+            [
+                [[phi_1d(i, m, dx) * phi_1d(j, n, dy) for n in r] for m in r]
+                for j in r
+            ]
+            for i in r
+        ]
+        code += constant_table("PHI_VOLUME" if name == "PHI" else name, values)
+
+    for name, (dx, dy) in derivs.items():
+        for face, (i, j) in faces.items():
+            values = [
+                [
+                    [phi_1d(i or q, m, dx) * phi_1d(j or q, n, dy) for n in r]
+                    for m in r
+                ]
+                for q in r
+            ]
+            code += constant_table(f"{name}_FACE_{face}", values)
+
+    return code
+
+
 class Patch:
     """
     Holds the array buffer state for the solution on a subset of the
@@ -299,6 +380,21 @@ class Patch:
             return p0
 
 
+def make_library(options, mode):
+    """
+    Compile the kernel library used by the solver with the given options.
+    """
+    with open(__file__.replace(".py", ".c")) as f:
+        code = f.read()
+
+    return Library(
+        basis_tables(options.order) + code,
+        mode=mode,
+        debug=True,
+        define_macros=dict(ORDER=options.order),
+    )
+
+
 class Solver(SolverBase):
     """
     Adapter class to drive the cbdisodg_2d C extension module.
@@ -344,17 +440,19 @@ class Solver(SolverBase):
         if not physics.constant_softening:
             raise ValueError("solver only supports constant gravitational softening")
 
+        if not 1 <= options.order <= 5:
+            raise ValueError("solver only supports orders 1 through 5")
+
         xp = get_array_module(mode)
         ng = GUARD  # number of guard zones
         nq = NCONS  # number of conserved quantities
-        np = NPOLY  # number of polynomials
-        with open(__file__.replace(".py", ".c")) as f:
-            code = f.read()
-        lib = Library(code, mode=mode, debug=True)
+        no = options.order  # number of polynomials per dimension
+        lib = make_library(options, mode)
 
         logger.info(f"initiate with time={time:0.4f}")
         logger.info(f"subdivide grid over {num_patches} patches")
         logger.info(f"mesh is {mesh}")
+        logger.info(f"order is {no}")
         logger.info(f"boundary condition is outflow")
         logger.info(f"viscosity is {physics.viscosity_coefficient}")
 
@@ -367,7 +465,9 @@ class Solver(SolverBase):
         ni, nj = mesh.shape
 
         if solution is None:
-            weights = initial_condition(setup, mesh, time)
+            weights = initial_condition(setup, mesh, time, no)
+        elif solution.shape[2:] != (nq, no, no):
+            raise ValueError(f"solution has shape {solution.shape}, not order {no}")
         else:
             weights = solution
 
@@ -386,7 +486,7 @@ class Solver(SolverBase):
             buffer_surface_density = 0.0
 
         for n, (a, b) in enumerate(subdivide(ni, num_patches)):
-            weights_patch = numpy.zeros([b - a + 2 * ng, nj + 2 * ng, nq, ORDER, ORDER])
+            weights_patch = numpy.zeros([b - a + 2 * ng, nj + 2 * ng, nq, no, no])
             weights_patch[ng:-ng, ng:-ng] = weights[a:b]
             patch = Patch(
                 time,
@@ -1,6 +1,8 @@
 #define BETA_TVB 1.0
-#define NPOLY 3      // Hard wire for 1D 3rd order for now
-#define NUM_POINTS 3 // Hard wire for 1D 3rd order for now
+#ifndef NPOLY
+#define NPOLY 3      // number of polynomials (the order), set by the solver
+#endif
+#define NUM_POINTS NPOLY
 #define PDE 1        // 0 for linear advection, 1 for Burgers
 #define WAVESPEED 1.0
 
@@ -40,7 +42,7 @@ PRIVATE double upwind(double ul, double ur)
     }
 }
 
-PRIVATE double dot(double *u, double *p) 
+PRIVATE double dot(double *u, const double *p) 
 {
     double sum = 0.0;
 
@@ -50,76 +52,118 @@ PRIVATE double dot(double *u, double *p)
     return sum;
 }
 
+PRIVATE void zone_udot(int num_zones, int i, double *u_rd, double *uc_dot, double dx)
+{
+    // The Gaussian weights (GAUSS_WEIGHTS), and the scaled Legendre
+    // polynomials and their derivatives at the quadrature points (PHI_VALUE,
+    // PHI_DERIV) and faces (PHI_FACE_L, PHI_FACE_R) are generated by the
+    // solver for the compiled order.
+
+    // Unit normal vector at left and right faces
+    double nhat[2] = {-1.0, 1.0};
+
+    int i0 = i;
+    int il = (i + num_zones - 1) % num_zones;
+    int ir = (i + num_zones + 1) % num_zones;
+    double *uc = &u_rd[NPOLY * i0];
+    double *ul = &u_rd[NPOLY * il];
+    double *ur = &u_rd[NPOLY * ir];
+
+    double uimh_l = dot(ul, PHI_FACE_R);
+    double uimh_r = dot(uc, PHI_FACE_L);
+    double uiph_l = dot(uc, PHI_FACE_R);
+    double uiph_r = dot(ur, PHI_FACE_L);
+    double fimh = upwind(uimh_l, uimh_r);
+    double fiph = upwind(uiph_l, uiph_r);
+
+    double fx[NUM_POINTS];
+
+    for (int n = 0; n < NUM_POINTS; ++n)
+    {
+        double ux = 0.0;
+
+        for (int l = 0; l < NPOLY; ++l)
+        {
+            ux += uc[l] * PHI_VALUE[l][n];
+        }
+        fx[n] = flux(ux); 
+    }
+
+    for (int l = 0; l < NPOLY; ++l)
+    {
+        double udot_v = 0.0;
+
+        for (int n = 0; n < NUM_POINTS; ++n)
+        {
+            udot_v += fx[n] * PHI_DERIV[l][n] * GAUSS_WEIGHTS[n] / dx;
+        }
+        double udot_s = -(fimh * PHI_FACE_L[l] * nhat[0] + fiph * PHI_FACE_R[l] * nhat[1]) / dx;
+
+        uc_dot[l] = udot_v + udot_s;
+    }
+}
+
 PUBLIC void scdg_1d_udot(
     int num_zones,    // number of zones, not including guard zones
-    double *u_rd,     // :: $.shape == (num_zones, 1, 3) # NPOLY = 3
-    double *udot,     // :: $.shape == (num_zones, 1, 3) # NPOLY = 3
+    double *u_rd,     // :: $.shape == (num_zones, 1, NPOLY)
+    double *udot,     // :: $.shape == (num_zones, 1, NPOLY)
     double dx)        // grid spacing
 {
     // int ng = 0; // number of guard zones (zero; assume periodic)
 
     // TODO: pass cell data as a struct argument
 
-    // Gaussian quadrature points in scaled domain xsi=[-1,1]
-    // double g[3] = {-0.774596669241483, 0.000000000000000, 0.774596669241483}; 
-    // Gaussian weights at quadrature points
-    double w[3] = { 0.555555555555556, 0.888888888888889, 0.555555555555556};
-    // Scaled LeGendre polynomials at quadrature points
-    double p[3][3] = {{ 1.000000000000000, 1.000000000000000, 1.000000000000000},
-                      {-1.341640786499873, 0.000000000000000, 1.341640786499873},
-                      { 0.894427190999914, -1.11803398874990, 0.894427190999914}}; 
-    // Derivative of Scaled LeGendre polynomials at quadrature points
-    double pp[3][3] = {{ 0.000000000000000, 0.000000000000000, 0.000000000000000},
-                       { 1.732050807568877, 1.732050807568877, 1.732050807568877},
-                       {-5.196152422706629, 0.000000000000000, 5.196152422706629}};
-    // Unit normal vector at left and right faces
-    double nhat[2] = {-1.0, 1.0};
-    // Scaled LeGendre polynomials at left face
-    double pfl[3] = {1.000000000000000, -1.732050807568877, 2.23606797749979};
-    // Scaled LeGendre polynomials at right face
-    double pfr[3] = {1.000000000000000,  1.732050807568877, 2.23606797749979};
-
     FOR_EACH_1D(num_zones)
     {
-        int i0 = i;
-        int il = (i + num_zones - 1) % num_zones;
-        int ir = (i + num_zones + 1) % num_zones;
-        double *uc = &u_rd[NPOLY * i0];
-        double *ul = &u_rd[NPOLY * il];
-        double *ur = &u_rd[NPOLY * ir];
-        double *uc_dot = &udot[NPOLY * i0];
-
-        double uimh_l = dot(ul, pfr);
-        double uimh_r = dot(uc, pfl);
-        double uiph_l = dot(uc, pfr);
-        double uiph_r = dot(ur, pfl);
-        double fimh = upwind(uimh_l, uimh_r);
-        double fiph = upwind(uiph_l, uiph_r);
-
-        double fx[NUM_POINTS];
+        zone_udot(num_zones, i, u_rd, &udot[NPOLY * i], dx);
+    }
+}
 
-        for (int n = 0; n < NUM_POINTS; ++n)
-        {
-            double ux = 0.0;
+PUBLIC void scdg_1d_advance_rk(
+    int num_zones,    // number of zones, not including guard zones
+    double *u,        // :: $.shape == (num_stages + 1, num_zones, 1, NPOLY)
+    double *udot,     // :: $.shape == (num_stages, num_zones, 1, NPOLY)
+    double *alpha,    // :: $.shape == (num_stages, num_stages)
+    double *beta,     // :: $.shape == (num_stages, num_stages)
+    int num_stages,   // :: $ > 0
+    int stage,        // :: 1 <= $ <= num_stages
+    int first_slot,   // :: 0 <= $ <= num_stages
+    double dx,        // grid spacing
+    double dt)        // time step
+{
+    // Apply one stage of an explicit Runge-Kutta method in Shu-Osher form,
+    //
+    //     u(s) = sum_{k < s} alpha[s - 1][k] u(k) + beta[s - 1][k] dt L(u(k))
+    //
+    // where L is the spatial operator, u(0) is the solution at the start of
+    // the step, and u(num_stages) is the solution at the end of the step.
+    // The stages are kept in num_stages + 1 slots of the u array, used as a
+    // ring buffer starting at first_slot, so that no stage is overwritten
+    // while it is read by neighboring zones. L(u(k)) is kept in udot[k], and
+    // is computed here for u(stage - 1).
+
+    int nu = num_zones * NPOLY;
+    int s = stage - 1;
 
-            for (int l = 0; l < NPOLY; ++l)
-            {
-                ux += uc[l] * p[l][n];
-            }
-            fx[n] = flux(ux); 
-        }
+    FOR_EACH_1D(num_zones)
+    {
+        double *u_rd = &u[((first_slot + s) % (num_stages + 1)) * nu];
+        double *u_wr = &u[((first_slot + stage) % (num_stages + 1)) * nu];
+
+        zone_udot(num_zones, i, u_rd, &udot[s * nu + NPOLY * i], dx);
 
         for (int l = 0; l < NPOLY; ++l)
         {
-            double udot_v = 0.0;
+            double u_new = 0.0;
 
-            for (int n = 0; n < NUM_POINTS; ++n)
+            for (int k = 0; k <= s; ++k)
             {
-                udot_v += fx[n] * pp[l][n] * w[n] / dx;
+                double a = alpha[s * num_stages + k];
+                double b = beta[s * num_stages + k];
+                double *uk = &u[((first_slot + k) % (num_stages + 1)) * nu];
+                u_new += a * uk[NPOLY * i + l] + b * dt * udot[k * nu + NPOLY * i + l];
             }
-            double udot_s = -(fimh * pfl[l] * nhat[0] + fiph * pfr[l] * nhat[1]) / dx;
-
-            uc_dot[l] = udot_v + udot_s;
+            u_wr[NPOLY * i + l] = u_new;
         }
     }
 }
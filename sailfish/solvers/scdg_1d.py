@@ -5,7 +5,7 @@ An n-th order discontinuous Galerkin solver for 1D scalar advection and inviscid
 from typing import NamedTuple
 from sailfish.mesh import PlanarCartesianMesh
 from sailfish.solver_base import SolverBase
-from sailfish.kernel.library import Library
+from sailfish.kernel.library import Library, constant_table
 from numpy.polynomial.legendre import leggauss, Legendre
 import numpy as np
 
@@ -64,6 +64,20 @@ class CellData:
                 ux[q] += uw[q, n] * self.phi_faces[j, n]
         return ux
 
+    def tables(self):
+        """
+        Return C source code declaring the Gauss weights and tabulated
+        Legendre polynomials as constant tables, indexed as `[n][point]`, for
+        the kernel library.
+        """
+        return (
+            constant_table("GAUSS_WEIGHTS", self.weights)
+            + constant_table("PHI_VALUE", self.phi_value.T)
+            + constant_table("PHI_DERIV", self.phi_deriv.T)
+            + constant_table("PHI_FACE_L", self.phi_faces[0])
+            + constant_table("PHI_FACE_R", self.phi_faces[1])
+        )
+
     @property
     def num_points(self):
         return self.order
@@ -179,6 +193,287 @@ def rhs(physics, uw, cell, dx, uwdot):
             uwdot[i, 0, n] = udot_s + udot_v
 
 
+# Coefficients of the explicit Runge-Kutta methods, in Shu-Osher form:
+#
+#     u(s) = sum_{k < s} alpha[s - 1][k] u(k) + beta[s - 1][k] dt L(u(k))
+#
+# where u(0) is the solution at the start of the time step, and the last stage
+# is the solution at the end of the step. These are not low-storage methods in
+# general: every stage, and its time derivative, is kept for the later stages.
+SHU_OSHER_COEFFICIENTS = dict()
+
+# Forward Euler
+SHU_OSHER_COEFFICIENTS["rk1"] = dict(alpha=[[1.0]], beta=[[1.0]])
+
+# SSP-RK2 of Shu & Osher (1988; Eq. 2.15)
+SHU_OSHER_COEFFICIENTS["rk2"] = dict(
+    alpha=[[1.0, 0.0], [0.5, 0.5]],
+    beta=[[1.0, 0.0], [0.0, 0.5]],
+)
+
+# SSP-RK3 of Shu & Osher (1988; Eq. 2.18)
+SHU_OSHER_COEFFICIENTS["rk3"] = dict(
+    alpha=[
+        [1.0, 0.0, 0.0],
+        [3.0 / 4.0, 1.0 / 4.0, 0.0],
+        [1.0 / 3.0, 0.0, 2.0 / 3.0],
+    ],
+    beta=[
+        [1.0, 0.0, 0.0],
+        [0.0, 1.0 / 4.0, 0.0],
+        [0.0, 0.0, 2.0 / 3.0],
+    ],
+)
+
+# Four-stage 3rd Order SSP-4RK3 of Spiteri & Ruuth (2002)
+SHU_OSHER_COEFFICIENTS["rk3-sr02"] = dict(
+    alpha=[
+        [1.0, 0.0, 0.0, 0.0],
+        [0.0, 1.0, 0.0, 0.0],
+        [2.0 / 3.0, 0.0, 1.0 / 3.0, 0.0],
+        [0.0, 0.0, 0.0, 1.0],
+    ],
+    beta=[
+        [0.5, 0.0, 0.0, 0.0],
+        [0.0, 0.5, 0.0, 0.0],
+        [0.0, 0.0, 1.0 / 6.0, 0.0],
+        [0.0, 0.0, 0.0, 0.5],
+    ],
+)
+
+# 3-stage 2nd-order Strong Stability Preserving SSPRK(3,2) integrator
+# Reference: Kubatko+, J Sci Comput (2014) 60:313–344; Table 7
+SHU_OSHER_COEFFICIENTS["SSPRK32"] = dict(
+    alpha=[
+        [1.000000000000000, 0.000000000000000, 0.000000000000000],
+        [0.087353119859156, 0.912646880140844, 0.000000000000000],
+        [0.344956917166841, 0.000000000000000, 0.655043082833159],
+    ],
+    beta=[
+        [0.528005024856522, 0.000000000000000, 0.000000000000000],
+        [0.000000000000000, 0.481882138633993, 0.000000000000000],
+        [0.022826837460491, 0.000000000000000, 0.345866039233415],
+    ],
+)
+
+# 4-stage 3rd-order Strong Stability Preserving SSPRK(4,3) integrator
+# C = 1.683339717642499
+# Reference: Kubatko+, J Sci Comput (2014) 60:313–344; Table 13
+SHU_OSHER_COEFFICIENTS["SSPRK43"] = dict(
+    alpha=[
+        [
+            1.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+        ],
+        [
+            0.522361915162541,
+            0.477638084837459,
+            0.000000000000000,
+            0.000000000000000,
+        ],
+        [
+            0.368530939472566,
+            0.000000000000000,
+            0.631469060527434,
+            0.000000000000000,
+        ],
+        [
+            0.334082932462285,
+            0.006966183666289,
+            0.000000000000000,
+            0.658950883871426,
+        ],
+    ],
+    beta=[
+        [
+            0.594057152884440,
+            0.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+        ],
+        [
+            0.000000000000000,
+            0.283744320787718,
+            0.000000000000000,
+            0.000000000000000,
+        ],
+        [
+            0.000000038023030,
+            0.000000000000000,
+            0.375128712231540,
+            0.000000000000000,
+        ],
+        [
+            0.116941419604231,
+            0.004138311235266,
+            0.000000000000000,
+            0.391454485963345,
+        ],
+    ],
+)
+
+# 5-stage 3rd-order Strong Stability Preserving SSPRK(5,3) integrator
+# C = 2.387300839230550
+# Reference: Kubatko+, J Sci Comput (2014) 60:313–344; Table 18
+SHU_OSHER_COEFFICIENTS["SSPRK53"] = dict(
+    alpha=[
+        [
+            1.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+        ],
+        [
+            0.495124140877703,
+            0.504875859122297,
+            0.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+        ],
+        [
+            0.105701991897526,
+            0.000000000000000,
+            0.894298008102474,
+            0.000000000000000,
+            0.000000000000000,
+        ],
+        [
+            0.411551205755676,
+            0.011170516177380,
+            0.000000000000000,
+            0.577278278066944,
+            0.000000000000000,
+        ],
+        [
+            0.186911123548222,
+            0.013354480555382,
+            0.012758264566319,
+            0.000000000000000,
+            0.786976131330077,
+        ],
+    ],
+    beta=[
+        [
+            0.418883109982196,
+            0.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+        ],
+        [
+            0.000000000000000,
+            0.211483970024081,
+            0.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+        ],
+        [
+            0.000000000612488,
+            0.000000000000000,
+            0.374606330884848,
+            0.000000000000000,
+            0.000000000000000,
+        ],
+        [
+            0.046744815663888,
+            0.004679140556487,
+            0.000000000000000,
+            0.241812120441849,
+            0.000000000000000,
+        ],
+        [
+            0.071938257223857,
+            0.005593966347235,
+            0.005344221539515,
+            0.000000000000000,
+            0.329651009373300,
+        ],
+    ],
+)
+
+# 5-stage 4th-order Strong Stability Preserving SSPRK(5,4) integrator
+# Reference: Kubatko+, J Sci Comput (2014) 60:313–344; Table 18
+SHU_OSHER_COEFFICIENTS["SSPRK54"] = dict(
+    alpha=[
+        [
+            1.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+        ],
+        [
+            0.261216512493821,
+            0.738783487506179,
+            0.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+        ],
+        [
+            0.623613752757655,
+            0.000000000000000,
+            0.376386247242345,
+            0.000000000000000,
+            0.000000000000000,
+        ],
+        [
+            0.444745181201454,
+            0.120932584902288,
+            0.000000000000000,
+            0.434322233896258,
+            0.000000000000000,
+        ],
+        [
+            0.213357715199957,
+            0.209928473023448,
+            0.063353148180384,
+            0.000000000000000,
+            0.513360663596212,
+        ],
+    ],
+    beta=[
+        [
+            0.605491839566400,
+            0.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+        ],
+        [
+            0.000000000000000,
+            0.447327372891397,
+            0.000000000000000,
+            0.000000000000000,
+            0.000000000000000,
+        ],
+        [
+            0.000000844149769,
+            0.000000000000000,
+            0.227898801230261,
+            0.000000000000000,
+            0.000000000000000,
+        ],
+        [
+            0.002856233144485,
+            0.073223693296006,
+            0.000000000000000,
+            0.262978568366434,
+            0.000000000000000,
+        ],
+        [
+            0.002362549760441,
+            0.127109977308333,
+            0.038359814234063,
+            0.000000000000000,
+            0.310835692561898,
+        ],
+    ],
+)
+
+
 class Options(NamedTuple):
     order: int = 1
     integrator: str = "rk2"
@@ -189,6 +484,21 @@ class Physics(NamedTuple):
     equation: str = "advection"  # or burgers
 
 
+def make_library(options, mode):
+    """
+    Compile the kernel library used by the solver with the given options.
+    """
+    with open(__file__.replace(".py", ".c"), "r") as f:
+        source = f.read()
+
+    return Library(
+        CellData(order=options.order).tables() + source,
+        mode=mode,
+        debug=True,
+        define_macros=dict(NPOLY=options.order),
+    )
+
+
 class Solver(SolverBase):
     """
     An n-th order, discontinuous Galerkin solver for 1D scalar advection.
@@ -231,16 +541,7 @@ class Solver(SolverBase):
         if physics.equation not in ["advection", "burgers"]:
             raise ValueError("physics.equation must be advection or burgers")
 
-        if options.integrator not in [
-            "rk1",
-            "rk2",
-            "rk3",
-            "rk3-sr02",
-            "SSPRK32",
-            "SSPRK43",
-            "SSPRK53",
-            "SSPRK54",
-        ]:
+        if options.integrator not in SHU_OSHER_COEFFICIENTS:
             raise ValueError(
                 "options.integrator must be "
                 "rk1|rk2|rk3|rk3-sr02|SSPRK32|SSPRK43|SSPRK53|SSPRK54"
@@ -249,10 +550,7 @@ class Solver(SolverBase):
         if options.order <= 0:
             raise ValueError("option.order must be greater than 0")
 
-        with open(__file__.replace(".py", ".c"), "r") as f:
-            source = f.read()
-
-        self.lib = Library(source, mode=mode, debug=True)
+        self.lib = make_library(options, mode)
 
         if solution is None:
             num_zones = mesh.shape[0]
@@ -272,9 +570,21 @@ class Solver(SolverBase):
 
             for i in range(num_zones):
                 uw[i] = cell.to_weights(ux[i])
-            self.conserved_w = uw
         else:
-            self.conserved_w = solution
+            uw = solution
+
+        # The Runge-Kutta stages are kept in a ring buffer of num_stages + 1
+        # slots (see scdg_1d_advance_rk), and the solution is in the slot
+        # `self.slot`. The time derivative of each stage is kept in
+        # `self.udot`. The buffers are allocated once, here.
+        coefficients = SHU_OSHER_COEFFICIENTS[options.integrator]
+        self.alpha = np.array(coefficients["alpha"])
+        self.beta = np.array(coefficients["beta"])
+        num_stages = self.alpha.shape[0]
+        self.stages = np.zeros((num_stages + 1,) + uw.shape)
+        self.stages[0] = uw
+        self.udot = np.zeros((num_stages,) + uw.shape)
+        self.slot = 0
 
         self.t = time
         self.mesh = mesh
@@ -282,6 +592,10 @@ class Solver(SolverBase):
         self._options = options
         self._physics = physics
 
+    @property
+    def conserved_w(self):
+        return self.stages[self.slot]
+
     @property
     def solution(self):
         return self.conserved_w
@@ -334,423 +648,23 @@ class Solver(SolverBase):
             return abs(self.conserved_w[:, 0]).max()
 
     def advance(self, dt):
-        def udot(u):
-            udot = np.zeros_like(u)
-            # rhs(self._physics, u, self.cell, self.mesh.dx, udot)
-            self.lib.scdg_1d_udot[u.shape[0]](u, udot, self.mesh.dx)
-            return udot
-
-        if self._options.integrator == "rk1":
-            u = self.conserved_w
-            u += dt * udot(u)
-
-        if self._options.integrator == "rk2":
-            b1 = 0.0
-            b2 = 0.5
-            u = u0 = self.conserved_w.copy()
-            u = u0 * b1 + (1.0 - b1) * (u + dt * udot(u))
-            u = u0 * b2 + (1.0 - b2) * (u + dt * udot(u))
-
-        if self._options.integrator == "rk3":
-            b1 = 0.0
-            b2 = 3.0 / 4.0
-            b3 = 1.0 / 3.0
-            u = u0 = self.conserved_w.copy()
-            u = u0 * b1 + (1.0 - b1) * (u + dt * udot(u))
-            u = u0 * b2 + (1.0 - b2) * (u + dt * udot(u))
-            u = u0 * b3 + (1.0 - b3) * (u + dt * udot(u))
-
-        if self._options.integrator == "rk3-sr02":
-            u = u0 = self.conserved_w.copy()
-            u = u0 + 0.5 * dt * udot(u)
-            u = u + 0.5 * dt * udot(u)
-            u = 2.0 / 3.0 * u0 + 1.0 / 3.0 * (u + 0.5 * dt * udot(u))
-            u = u + 0.5 * dt * udot(u)
-
-        if self._options.integrator == "SSPRK32":
-            """
-            3-stage 2nd-order Strong Stability Preserving SSPRK(3,2) integrator in Shu-Osher form
-            Not a low storage integrator: requires 3 copies of the conserved array, plus 2 copies
-            of its time derivative (optionally) which could instead be recomputed e.g. on a GPU
-            Reference: Kubatko+, J Sci Comput (2014) 60:313–344; Table 7
-            """
-            alpha = [
-                [1.000000000000000, 0.000000000000000, 0.000000000000000],
-                [0.087353119859156, 0.912646880140844, 0.000000000000000],
-                [0.344956917166841, 0.000000000000000, 0.655043082833159],
-            ]
-            beta = [
-                [0.528005024856522, 0.000000000000000, 0.000000000000000],
-                [0.000000000000000, 0.481882138633993, 0.000000000000000],
-                [0.022826837460491, 0.000000000000000, 0.345866039233415],
-            ]
-
-            u = u0 = self.conserved_w.copy()
-            udot_0 = udot(u0)
-            u1 = alpha[1 - 1][0] * u0 + beta[1 - 1][0] * dt * udot_0
-            udot_1 = udot(u1)
-            u2 = (
-                alpha[2 - 1][0] * u0
-                + beta[2 - 1][0] * dt * udot_0
-                + alpha[2 - 1][1] * u1
-                + beta[2 - 1][1] * dt * udot_1
-            )
-            # udot_2 = udot(u2)
-            u = (
-                alpha[3 - 1][0] * u0
-                + beta[3 - 1][0] * dt * udot_0
-                + alpha[3 - 1][1] * u1
-                + beta[3 - 1][1] * dt * udot_1
-                + alpha[3 - 1][2] * u2
-                + beta[3 - 1][2] * dt * udot(u2)
-            )
-
-        if self._options.integrator == "SSPRK43":
-            """
-            4-stage 3rd-order Strong Stability Preserving SSPRK(4,3) integrator in Shu-Osher form
-            Not a low storage integrator: requires 4 copies of the conserved array, plus 3 copies
-            of its time derivative (optionally) which could instead be recomputed e.g. on a GPU
-            C = 1.683339717642499
-            Reference: Kubatko+, J Sci Comput (2014) 60:313–344; Table 13
-            """
-            alpha = [
-                [
-                    1.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                ],
-                [
-                    0.522361915162541,
-                    0.477638084837459,
-                    0.000000000000000,
-                    0.000000000000000,
-                ],
-                [
-                    0.368530939472566,
-                    0.000000000000000,
-                    0.631469060527434,
-                    0.000000000000000,
-                ],
-                [
-                    0.334082932462285,
-                    0.006966183666289,
-                    0.000000000000000,
-                    0.658950883871426,
-                ],
-            ]
-            beta = [
-                [
-                    0.594057152884440,
-                    0.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                ],
-                [
-                    0.000000000000000,
-                    0.283744320787718,
-                    0.000000000000000,
-                    0.000000000000000,
-                ],
-                [
-                    0.000000038023030,
-                    0.000000000000000,
-                    0.375128712231540,
-                    0.000000000000000,
-                ],
-                [
-                    0.116941419604231,
-                    0.004138311235266,
-                    0.000000000000000,
-                    0.391454485963345,
-                ],
-            ]
-
-            u = u0 = self.conserved_w.copy()
-            udot_0 = udot(u0)
-            u1 = alpha[1 - 1][0] * u0 + beta[1 - 1][0] * dt * udot_0
-            udot_1 = udot(u1)
-            u2 = (
-                alpha[2 - 1][0] * u0
-                + beta[2 - 1][0] * dt * udot_0
-                + alpha[2 - 1][1] * u1
-                + beta[2 - 1][1] * dt * udot_1
-            )
-            udot_2 = udot(u2)
-            u3 = (
-                alpha[3 - 1][0] * u0
-                + beta[3 - 1][0] * dt * udot_0
-                + alpha[3 - 1][1] * u1
-                + beta[3 - 1][1] * dt * udot_1
-                + alpha[3 - 1][2] * u2
-                + beta[3 - 1][2] * dt * udot_2
-            )
-            # udot_3 = udot(u3)
-            u = (
-                alpha[4 - 1][0] * u0
-                + beta[4 - 1][0] * dt * udot_0
-                + alpha[4 - 1][1] * u1
-                + beta[4 - 1][1] * dt * udot_1
-                + alpha[4 - 1][2] * u2
-                + beta[4 - 1][2] * dt * udot_2
-                + alpha[4 - 1][3] * u3
-                + beta[4 - 1][3] * dt * udot(u3)
-            )
-
-        if self._options.integrator == "SSPRK53":
-            """
-            5-stage 3rd-order Strong Stability Preserving SSPRK(5,3) integrator in Shu-Osher form
-            Not a low storage integrator: requires 5 copies of the conserved array, plus 4 copies
-            of its time derivative (optionally) which could instead be recomputed e.g. on a GPU
-            C = 2.387300839230550
-            Reference: Kubatko+, J Sci Comput (2014) 60:313–344; Table 18
-            """
-            alpha = [
-                [
-                    1.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                ],
-                [
-                    0.495124140877703,
-                    0.504875859122297,
-                    0.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                ],
-                [
-                    0.105701991897526,
-                    0.000000000000000,
-                    0.894298008102474,
-                    0.000000000000000,
-                    0.000000000000000,
-                ],
-                [
-                    0.411551205755676,
-                    0.011170516177380,
-                    0.000000000000000,
-                    0.577278278066944,
-                    0.000000000000000,
-                ],
-                [
-                    0.186911123548222,
-                    0.013354480555382,
-                    0.012758264566319,
-                    0.000000000000000,
-                    0.786976131330077,
-                ],
-            ]
-            beta = [
-                [
-                    0.418883109982196,
-                    0.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                ],
-                [
-                    0.000000000000000,
-                    0.211483970024081,
-                    0.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                ],
-                [
-                    0.000000000612488,
-                    0.000000000000000,
-                    0.374606330884848,
-                    0.000000000000000,
-                    0.000000000000000,
-                ],
-                [
-                    0.046744815663888,
-                    0.004679140556487,
-                    0.000000000000000,
-                    0.241812120441849,
-                    0.000000000000000,
-                ],
-                [
-                    0.071938257223857,
-                    0.005593966347235,
-                    0.005344221539515,
-                    0.000000000000000,
-                    0.329651009373300,
-                ],
-            ]
-
-            u = u0 = self.conserved_w.copy()
-            udot_0 = udot(u0)
-            u1 = alpha[1 - 1][0] * u0 + beta[1 - 1][0] * dt * udot_0
-            udot_1 = udot(u1)
-            u2 = (
-                alpha[2 - 1][0] * u0
-                + beta[2 - 1][0] * dt * udot_0
-                + alpha[2 - 1][1] * u1
-                + beta[2 - 1][1] * dt * udot_1
-            )
-            udot_2 = udot(u2)
-            u3 = (
-                alpha[3 - 1][0] * u0
-                + beta[3 - 1][0] * dt * udot_0
-                + alpha[3 - 1][1] * u1
-                + beta[3 - 1][1] * dt * udot_1
-                + alpha[3 - 1][2] * u2
-                + beta[3 - 1][2] * dt * udot_2
-            )
-            udot_3 = udot(u3)
-            u4 = (
-                alpha[4 - 1][0] * u0
-                + beta[4 - 1][0] * dt * udot_0
-                + alpha[4 - 1][1] * u1
-                + beta[4 - 1][1] * dt * udot_1
-                + alpha[4 - 1][2] * u2
-                + beta[4 - 1][2] * dt * udot_2
-                + alpha[4 - 1][3] * u3
-                + beta[4 - 1][3] * dt * udot_3
-            )
-            # udot_4 = udot(u4)
-            u = (
-                alpha[5 - 1][0] * u0
-                + beta[5 - 1][0] * dt * udot_0
-                + alpha[5 - 1][1] * u1
-                + beta[5 - 1][1] * dt * udot_1
-                + alpha[5 - 1][2] * u2
-                + beta[5 - 1][2] * dt * udot_2
-                + alpha[5 - 1][3] * u3
-                + beta[5 - 1][3] * dt * udot_3
-                + alpha[5 - 1][4] * u4
-                + beta[5 - 1][4] * dt * udot(u4)
-            )
-
-        if self._options.integrator == "SSPRK54":
-            """
-            5-stage 4th-order Strong Stability Preserving SSPRK(5,4) integrator in Shu-Osher form
-            Not a low storage integrator: requires 5 copies of the conserved array, plus 4 copies
-            of its time derivative (optionally) which could instead be recomputed e.g. on a GPU
-            Reference: Kubatko+, J Sci Comput (2014) 60:313–344; Table 18
-            """
-            alpha = [
-                [
-                    1.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                ],
-                [
-                    0.261216512493821,
-                    0.738783487506179,
-                    0.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                ],
-                [
-                    0.623613752757655,
-                    0.000000000000000,
-                    0.376386247242345,
-                    0.000000000000000,
-                    0.000000000000000,
-                ],
-                [
-                    0.444745181201454,
-                    0.120932584902288,
-                    0.000000000000000,
-                    0.434322233896258,
-                    0.000000000000000,
-                ],
-                [
-                    0.213357715199957,
-                    0.209928473023448,
-                    0.063353148180384,
-                    0.000000000000000,
-                    0.513360663596212,
-                ],
-            ]
-            beta = [
-                [
-                    0.605491839566400,
-                    0.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                ],
-                [
-                    0.000000000000000,
-                    0.447327372891397,
-                    0.000000000000000,
-                    0.000000000000000,
-                    0.000000000000000,
-                ],
-                [
-                    0.000000844149769,
-                    0.000000000000000,
-                    0.227898801230261,
-                    0.000000000000000,
-                    0.000000000000000,
-                ],
-                [
-                    0.002856233144485,
-                    0.073223693296006,
-                    0.000000000000000,
-                    0.262978568366434,
-                    0.000000000000000,
-                ],
-                [
-                    0.002362549760441,
-                    0.127109977308333,
-                    0.038359814234063,
-                    0.000000000000000,
-                    0.310835692561898,
-                ],
-            ]
-
-            u = u0 = self.conserved_w.copy()
-            udot_0 = udot(u0)
-            u1 = alpha[1 - 1][0] * u0 + beta[1 - 1][0] * dt * udot_0
-            udot_1 = udot(u1)
-            u2 = (
-                alpha[2 - 1][0] * u0
-                + beta[2 - 1][0] * dt * udot_0
-                + alpha[2 - 1][1] * u1
-                + beta[2 - 1][1] * dt * udot_1
-            )
-            udot_2 = udot(u2)
-            u3 = (
-                alpha[3 - 1][0] * u0
-                + beta[3 - 1][0] * dt * udot_0
-                + alpha[3 - 1][1] * u1
-                + beta[3 - 1][1] * dt * udot_1
-                + alpha[3 - 1][2] * u2
-                + beta[3 - 1][2] * dt * udot_2
-            )
-            udot_3 = udot(u3)
-            u4 = (
-                alpha[4 - 1][0] * u0
-                + beta[4 - 1][0] * dt * udot_0
-                + alpha[4 - 1][1] * u1
-                + beta[4 - 1][1] * dt * udot_1
-                + alpha[4 - 1][2] * u2
-                + beta[4 - 1][2] * dt * udot_2
-                + alpha[4 - 1][3] * u3
-                + beta[4 - 1][3] * dt * udot_3
-            )
-            # udot_4 = udot(u4)
-            u = (
-                alpha[5 - 1][0] * u0
-                + beta[5 - 1][0] * dt * udot_0
-                + alpha[5 - 1][1] * u1
-                + beta[5 - 1][1] * dt * udot_1
-                + alpha[5 - 1][2] * u2
-                + beta[5 - 1][2] * dt * udot_2
-                + alpha[5 - 1][3] * u3
-                + beta[5 - 1][3] * dt * udot_3
-                + alpha[5 - 1][4] * u4
-                + beta[5 - 1][4] * dt * udot(u4)
+        num_stages = self.alpha.shape[0]
+        num_zones = self.mesh.shape[0]
+
+        for stage in range(1, num_stages + 1):
+            self.lib.scdg_1d_advance_rk[num_zones](
+                self.stages,
+                self.udot,
+                self.alpha,
+                self.beta,
+                num_stages,
+                stage,
+                self.slot,
+                self.mesh.dx,
+                dt,
             )
 
-        # limit_troubled_cells(u)
+        # limit_troubled_cells(self.conserved_w)
 
-        self.conserved_w = u
+        self.slot = (self.slot + num_stages) % (num_stages + 1)
         self.t += dt
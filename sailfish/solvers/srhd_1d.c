@@ -18,6 +18,14 @@ DESCRIPTION:
 #define ADIABATIC_GAMMA (4.0 / 3.0)
 #define NOMINAL_FOUR_PI 1.0
 
+#ifndef BOUNDED_RECOVERY
+#define BOUNDED_RECOVERY 0 // 1=bracketed Newton with a bisection fallback
+#endif
+
+#ifndef RECOVERY_ITER_MAX
+#define RECOVERY_ITER_MAX 8 // Newton steps before the bisection fallback
+#endif
+
 
 // ============================ MATH ==========================================
 // ============================================================================
@@ -36,7 +44,7 @@ PRIVATE double plm_gradient_scalar(double yl, double y0, double yr)
     return 0.25 * fabs(sign(a) + sign(b)) * (sign(a) + sign(c)) * minabs(a, b, c);
 }
 
-PRIVATE void plm_gradient(double *yl, double *y0, double *yr, double *g)
+PRIVATE void plm_gradient(const double *yl, const double *y0, const double *yr, double *g)
 {
     for (int q = 0; q < NCONS; ++q)
     {
@@ -92,9 +100,32 @@ PRIVATE void primitive_to_conserved(const double *prim, double *cons, double dv)
     cons[3] = dv * m * prim[3];
 }
 
-PRIVATE void conserved_to_primitive(double *cons, double *prim, double dv, double coordinate)
+#if (BOUNDED_RECOVERY == 1)
+// One step of the bounded pressure iteration. The bracket [p_lo, p_hi] is
+// narrowed using the sign of the residual f (which decreases with p), and a
+// Newton step which leaves the bracket is replaced by bisection. After the
+// first RECOVERY_ITER_MAX iterations, every step is a bisection, so the
+// number of iterations is bounded by how many halvings of the initial
+// bracket reach round-off.
+PRIVATE double bracketed_newton_step(double p, double f, double g, int iteration, double *p_lo, double *p_hi)
 {
-    const double newton_iter_max = 500;
+    if (f > 0.0) {
+        *p_lo = p;
+    } else {
+        *p_hi = p;
+    }
+    double p_next = p - f / g;
+
+    if (iteration >= RECOVERY_ITER_MAX || !(p_next >= *p_lo && p_next <= *p_hi)) {
+        p_next = 0.5 * (*p_lo + *p_hi);
+    }
+    return p_next;
+}
+#endif
+
+PRIVATE int conserved_to_primitive(double *cons, double *prim, double dv, double coordinate)
+{
+    const int newton_iter_max    = BOUNDED_RECOVERY ? RECOVERY_ITER_MAX + 64 : 500;
     const double error_tolerance = 1e-12 * (cons[0] + cons[2]) / dv;
     const double gm              = ADIABATIC_GAMMA;
     const double m               = cons[0] / dv;
@@ -105,6 +136,15 @@ PRIVATE void conserved_to_primitive(double *cons, double *prim, double dv, doubl
     double w0;
     double f;
 
+    #if (BOUNDED_RECOVERY == 1)
+    // At the lower bound the velocity would be the speed of light, and at the
+    // upper bound all of the energy would be internal energy. The initial
+    // guess is the existing pressure, moved inside the bracket if needed.
+    double p_lo = max2(sqrt(ss) - tau - m, 0.0);
+    double p_hi = (gm - 1.0) * (tau + m);
+    p = min2(max2(p, p_lo), p_hi);
+    #endif
+
     while (1) {
         const double et = tau + p + m;
         const double b2 = min2(ss / et / et, 1.0 - 1e-10);
@@ -117,7 +157,16 @@ PRIVATE void conserved_to_primitive(double *cons, double *prim, double dv, doubl
         const double g  = b2 * a2 - 1.0;
 
         f  = d * e * (gm - 1.0) - p;
+
+        #if (BOUNDED_RECOVERY == 1)
+        if (fabs(f) < error_tolerance) {
+            p -= f / g;
+        } else {
+            p = bracketed_newton_step(p, f, g, iteration, &p_lo, &p_hi);
+        }
+        #else
         p -= f / g;
+        #endif
 
         if (fabs(f) < error_tolerance || iteration == newton_iter_max) {
             w0 = w;
@@ -142,7 +191,7 @@ PRIVATE void conserved_to_primitive(double *cons, double *prim, double dv, doubl
     }
 
     #if (EXEC_MODE != EXEC_GPU)
-    if (iteration == newton_iter_max) {
+    if (iteration == newton_iter_max && !BOUNDED_RECOVERY) {
         printf(
             "[FATAL] srhd_1d_conserved_to_primitive reached max "
             "iteration at position %.3f "
@@ -162,6 +211,7 @@ PRIVATE void conserved_to_primitive(double *cons, double *prim, double dv, doubl
         exit(1);
     }
     #endif
+    return iteration;
 }
 
 PRIVATE void primitive_to_flux(const double *prim, const double *cons, double *flux)
@@ -387,6 +437,128 @@ PRIVATE void geometric_source_terms(int coords, double x0, double x1, const doub
     }
 }
 
+// The comoving geometry of a zone is its face areas, its volume, and the
+// coefficient of its geometric source term, at unit scale factor. The mesh
+// is homologous, so at scale factor a the areas and the source coefficient
+// are multiplied by area_scale(coords, a), and the volume by a times that
+// (a^2 and a^3 in spherical coordinates, or 1 and a in cartesian).
+#define NUM_GEOMETRY_FIELDS 4
+#define GEOMETRY_AREA_L 0
+#define GEOMETRY_AREA_R 1
+#define GEOMETRY_VOLUME 2
+#define GEOMETRY_SOURCE 3
+
+PRIVATE double area_scale(int coords, double a)
+{
+    return coords == COORDS_SPHERICAL ? a * a : 1.0;
+}
+
+PRIVATE void comoving_geometry(int coords, double y0, double y1, double *geometry)
+{
+    geometry[GEOMETRY_AREA_L] = face_area(coords, y0);
+    geometry[GEOMETRY_AREA_R] = face_area(coords, y1);
+    geometry[GEOMETRY_VOLUME] = cell_volume(coords, y0, y1);
+    geometry[GEOMETRY_SOURCE] = coords == COORDS_SPHERICAL ? (y1 * y1 - y0 * y0) * NOMINAL_FOUR_PI : 0.0;
+}
+
+
+// ============================ ZONE UPDATE ===================================
+// ============================================================================
+// Advance zone i by one Runge-Kutta step. If the geometry is not NULL, it's
+// the comoving geometry of the patch (see srhd_1d_comoving_geometry), which
+// is scaled to the current scale factor, rather than computed.
+PRIVATE void advance_rk_zone(
+    int i,
+    int num_zones,
+    const double *face_positions,
+    const double *geometry,
+    const double *conserved_rk,
+    const double *primitive_rd,
+    const double *conserved_rd,
+    double *conserved_wr,
+    double a0,
+    double adot,
+    double time,
+    double rk_param,
+    double dt,
+    int fix_i0,
+    int fix_i1,
+    int coords)
+{
+    int ng = 2; // number of guard zones
+    int fixed_zone = (fix_i0 && i == 0) || (fix_i1 && i == num_zones - 1);
+
+    if (!fixed_zone)
+    {
+        double yl = face_positions[i];
+        double yr = face_positions[i + 1];
+        double xl = yl * (a0 + adot * time);
+        double xr = yr * (a0 + adot * time);
+
+        const double *urk = &conserved_rk[NCONS * (i + ng)];
+        const double *urd = &conserved_rd[NCONS * (i + ng)];
+        double *uwr = &conserved_wr[NCONS * (i + ng)];
+        const double *prd = &primitive_rd[NCONS * (i + ng)];
+        const double *pli = &primitive_rd[NCONS * (i + ng - 1)];
+        const double *pri = &primitive_rd[NCONS * (i + ng + 1)];
+        const double *pki = &primitive_rd[NCONS * (i + ng - 2)];
+        const double *pti = &primitive_rd[NCONS * (i + ng + 2)];
+
+        double plip[NCONS];
+        double plim[NCONS];
+        double prip[NCONS];
+        double prim[NCONS];
+        double gxli[NCONS];
+        double gxri[NCONS];
+        double gxcc[NCONS];
+
+        plm_gradient(pki, pli, prd, gxli);
+        plm_gradient(pli, prd, pri, gxcc);
+        plm_gradient(prd, pri, pti, gxri);
+
+        for (int q = 0; q < NCONS; ++q)
+        {
+            plim[q] = pli[q] + 0.5 * gxli[q];
+            plip[q] = prd[q] - 0.5 * gxcc[q];
+            prim[q] = prd[q] + 0.5 * gxcc[q];
+            prip[q] = pri[q] - 0.5 * gxri[q];
+        }
+
+        double fli[NCONS];
+        double fri[NCONS];
+        double sources[NCONS];
+        double dal;
+        double dar;
+
+        riemann_hllc(plim, plip, yl * adot, fli);
+        riemann_hllc(prim, prip, yr * adot, fri);
+
+        if (geometry != NULL)
+        {
+            const double *g = &geometry[NUM_GEOMETRY_FIELDS * i];
+            double s = area_scale(coords, a0 + adot * time);
+            dal = g[GEOMETRY_AREA_L] * s;
+            dar = g[GEOMETRY_AREA_R] * s;
+            sources[0] = 0.0;
+            sources[1] = prd[2] * g[GEOMETRY_SOURCE] * s;
+            sources[2] = 0.0;
+            sources[3] = 0.0;
+        }
+        else
+        {
+            dal = face_area(coords, xl);
+            dar = face_area(coords, xr);
+            geometric_source_terms(coords, xl, xr, prd, sources);
+        }
+
+        for (int q = 0; q < NCONS; ++q)
+        {
+            uwr[q] = urd[q] + (fli[q] * dal - fri[q] * dar + sources[q]) * dt;
+            uwr[q] = (1.0 - rk_param) * uwr[q] + rk_param * urk[q];
+        }
+    }
+}
+
 
 // ============================ KERNELS =======================================
 // ============================================================================
@@ -421,13 +593,16 @@ PUBLIC void srhd_1d_primitive_to_conserved(
 
 
 /**
- * Converts an array of conserved data to an array of primitive data.
+ * Converts an array of conserved data to an array of primitive data. The
+ * existing primitive data is the initial guess for the pressure, and the
+ * number of iterations taken in each zone is written to `iterations`.
  */
 PUBLIC void srhd_1d_conserved_to_primitive(
     int num_zones,
     double *face_positions, // :: $.shape == (num_zones + 1,)
     double *conserved,      // :: $.shape == (num_zones + 4, 4)
     double *primitive,      // :: $.shape == (num_zones + 4, 4)
+    double *iterations,     // :: $.shape == (num_zones,)
     double scale_factor,    // :: $ >= 0.0
     int coords)             // :: $ in [0, 1]
 {
@@ -442,7 +617,35 @@ PUBLIC void srhd_1d_conserved_to_primitive(
         double xl = yl * scale_factor;
         double xr = yr * scale_factor;
         double dv = cell_volume(coords, xl, xr);
-        conserved_to_primitive(u, p, dv, xl);
+        iterations[i] = conserved_to_primitive(u, p, dv, xl);
+    }
+}
+
+
+/**
+ * Same as srhd_1d_conserved_to_primitive, except the zone volumes are scaled
+ * from the comoving geometry written by srhd_1d_comoving_geometry.
+ */
+PUBLIC void srhd_1d_conserved_to_primitive_tabulated(
+    int num_zones,
+    double *face_positions, // :: $.shape == (num_zones + 1,)
+    double *geometry,       // :: $.shape == (num_zones, 4)
+    double *conserved,      // :: $.shape == (num_zones + 4, 4)
+    double *primitive,      // :: $.shape == (num_zones + 4, 4)
+    double *iterations,     // :: $.shape == (num_zones,)
+    double scale_factor,    // :: $ >= 0.0
+    int coords)             // :: $ in [0, 1]
+{
+    int ng = 2; // number of guard zones
+    double s = area_scale(coords, scale_factor) * scale_factor;
+
+    FOR_EACH_1D(num_zones)
+    {
+        double *p = &primitive[NCONS * (i + ng)];
+        double *u = &conserved[NCONS * (i + ng)];
+        double xl = face_positions[i] * scale_factor;
+        double dv = geometry[NUM_GEOMETRY_FIELDS * i + GEOMETRY_VOLUME] * s;
+        iterations[i] = conserved_to_primitive(u, p, dv, xl);
     }
 }
 
@@ -495,63 +698,87 @@ PUBLIC void srhd_1d_advance_rk(
     int fix_i1,             // don't evolve the final zone in the patch
     int coords)             // :: $ in [0, 1]
 {
-    int ng = 2; // number of guard zones
+    FOR_EACH_1D(num_zones)
+    {
+        advance_rk_zone(
+            i,
+            num_zones,
+            face_positions,
+            NULL,
+            conserved_rk,
+            primitive_rd,
+            conserved_rd,
+            conserved_wr,
+            a0,
+            adot,
+            time,
+            rk_param,
+            dt,
+            fix_i0,
+            fix_i1,
+            coords);
+    }
+}
 
+
+/**
+ * Same as srhd_1d_advance_rk, except the face areas and geometric source
+ * terms are scaled from the comoving geometry written by
+ * srhd_1d_comoving_geometry, rather than computed in every zone.
+ */
+PUBLIC void srhd_1d_advance_rk_tabulated(
+    int num_zones,          // number of zones, not including guard zones
+    double *face_positions, // :: $.shape == (num_zones + 1,)
+    double *geometry,       // :: $.shape == (num_zones, 4)
+    double *conserved_rk,   // :: $.shape == (num_zones + 4, 4)
+    double *primitive_rd,   // :: $.shape == (num_zones + 4, 4)
+    double *conserved_rd,   // :: $.shape == (num_zones + 4, 4)
+    double *conserved_wr,   // :: $.shape == (num_zones + 4, 4)
+    double a0,              // scale factor at t=0
+    double adot,            // scale factor derivative
+    double time,            // current time
+    double rk_param,        // runge-kutta parameter
+    double dt,              // timestep size
+    int fix_i0,             // don't evolve the first zone in the patch
+    int fix_i1,             // don't evolve the final zone in the patch
+    int coords)             // :: $ in [0, 1]
+{
     FOR_EACH_1D(num_zones)
     {
-        int fixed_zone = (fix_i0 && i == 0) || (fix_i1 && i == num_zones - 1);
+        advance_rk_zone(
+            i,
+            num_zones,
+            face_positions,
+            geometry,
+            conserved_rk,
+            primitive_rd,
+            conserved_rd,
+            conserved_wr,
+            a0,
+            adot,
+            time,
+            rk_param,
+            dt,
+            fix_i0,
+            fix_i1,
+            coords);
+    }
+}
 
-        if (!fixed_zone)
-        {
-            double yl = face_positions[i];
-            double yr = face_positions[i + 1];
-            double xl = yl * (a0 + adot * time);
-            double xr = yr * (a0 + adot * time);
-
-            double *urk = &conserved_rk[NCONS * (i + ng)];
-            double *urd = &conserved_rd[NCONS * (i + ng)];
-            double *uwr = &conserved_wr[NCONS * (i + ng)];
-            double *prd = &primitive_rd[NCONS * (i + ng)];
-            double *pli = &primitive_rd[NCONS * (i + ng - 1)];
-            double *pri = &primitive_rd[NCONS * (i + ng + 1)];
-            double *pki = &primitive_rd[NCONS * (i + ng - 2)];
-            double *pti = &primitive_rd[NCONS * (i + ng + 2)];
-
-            double plip[NCONS];
-            double plim[NCONS];
-            double prip[NCONS];
-            double prim[NCONS];
-            double gxli[NCONS];
-            double gxri[NCONS];
-            double gxcc[NCONS];
-
-            plm_gradient(pki, pli, prd, gxli);
-            plm_gradient(pli, prd, pri, gxcc);
-            plm_gradient(prd, pri, pti, gxri);
-
-            for (int q = 0; q < NCONS; ++q)
-            {
-                plim[q] = pli[q] + 0.5 * gxli[q];
-                plip[q] = prd[q] - 0.5 * gxcc[q];
-                prim[q] = prd[q] + 0.5 * gxcc[q];
-                prip[q] = pri[q] - 0.5 * gxri[q];
-            }
-
-            double fli[NCONS];
-            double fri[NCONS];
-            double sources[NCONS];
-            double dal = face_area(coords, xl);
-            double dar = face_area(coords, xr);
-
-            riemann_hllc(plim, plip, yl * adot, fli);
-            riemann_hllc(prim, prip, yr * adot, fri);
-            geometric_source_terms(coords, xl, xr, prd, sources);
 
-            for (int q = 0; q < NCONS; ++q)
-            {
-                uwr[q] = urd[q] + (fli[q] * dal - fri[q] * dar + sources[q]) * dt;
-                uwr[q] = (1.0 - rk_param) * uwr[q] + rk_param * urk[q];
-            }
-        }
+/**
+ * Writes the comoving geometry of each zone: its face areas, volume, and
+ * geometric source term coefficient at unit scale factor. The geometry only
+ * depends on the mesh, so it can be computed once per patch.
+ */
+PUBLIC void srhd_1d_comoving_geometry(
+    int num_zones,
+    double *face_positions, // :: $.shape == (num_zones + 1,)
+    double *geometry,       // :: $.shape == (num_zones, 4)
+    int coords)             // :: $ in [0, 1]
+{
+    FOR_EACH_1D(num_zones)
+    {
+        comoving_geometry(coords, face_positions[i], face_positions[i + 1], &geometry[NUM_GEOMETRY_FIELDS * i]);
     }
 }
@@ -18,7 +18,9 @@ from logging import getLogger
 from typing import NamedTuple
 from sailfish.kernel.library import Library
 from sailfish.kernel.system import get_array_module, execution_context, num_devices
-from sailfish.subdivide import subdivide, concat_on_host, lazy_reduce
+from contextlib import nullcontext
+from sailfish.balance import LoadBalancer
+from sailfish.subdivide import subdivide, concat_on_host, lazy_reduce, copy_range
 from sailfish.mesh import PlanarCartesianMesh, LogSphericalMesh
 from sailfish.solver_base import SolverBase
 
@@ -26,6 +28,7 @@ logger = getLogger(__name__)
 
 NUM_GUARD = 2
 NUM_CONS = 4
+NUM_GEOMETRY_FIELDS = 4
 
 BC_PERIODIC = 0
 BC_OUTFLOW = 1
@@ -56,8 +59,103 @@ def initial_condition(setup, mesh, i0, i1, time, xp):
 
 
 class Options(NamedTuple):
+    """
+    Contains parameters which are solver specific options.
+
+    The primitive variable recovery solves for the pressure by Newton
+    iteration, starting from the pressure in the existing primitive array.
+    If `bounded_recovery` is true, the iteration is kept inside a bracket
+    which contains the physical root, and after `recovery_iter_max` Newton
+    steps it falls back to bisection of the bracket, so it cannot diverge,
+    and the number of iterations is bounded. Otherwise, up to 500 Newton
+    steps are taken, and the program exits if they do not converge.
+
+    If `recovery_stats` is true, the number of iterations taken in each zone
+    is accumulated over the run, and a summary for each patch is reported
+    at the end of the run (see `Solver.recovery_statistics`).
+
+    If `geometry_tables` is true, each patch computes the face areas, zone
+    volumes, and geometric source term coefficients of its zones once, at
+    unit scale factor, and the kernels scale them to the current scale
+    factor, rather than computing them in every zone and stage. The mesh is
+    homologous, so the results agree with the default to rounding error.
+
+    If `load_balance_cadence` is positive, the time spent in the kernels of
+    each patch is measured, and after every that many folds, if the slowest
+    patch took more than `1 + load_balance_tolerance` times the mean, the
+    patch index ranges are repartitioned to even out the measured cost (see
+    `sailfish.balance.LoadBalancer`). The solution data is moved to the new
+    patches in place, directly between devices in gpu mode.
+    """
+
     compute_wavespeed: bool = False
     rk_order: int = 2
+    bounded_recovery: bool = False
+    recovery_iter_max: int = 8
+    recovery_stats: bool = False
+    geometry_tables: bool = False
+    load_balance_cadence: int = 0
+    load_balance_tolerance: float = 0.1
+
+
+class RecoveryStatistics:
+    """
+    Accumulates the number of iterations taken by the primitive variable
+    recovery in each zone of a patch.
+    """
+
+    def __init__(self, shape, xp):
+        self.xp = xp
+        self.num_calls = 0
+        self.total = xp.zeros(shape)
+        self.peak = xp.zeros(shape)
+
+    def add(self, iterations):
+        self.num_calls += 1
+        self.total += iterations
+        self.xp.maximum(self.peak, iterations, out=self.peak)
+
+    def summary(self, index_range, fallback_after=None):
+        """
+        Return a dictionary with the mean and maximum iteration counts, the
+        global index of the zone with the most iterations in total, and (if
+        `fallback_after` is given) the number of zones whose recovery took
+        more than that many iterations at least once.
+        """
+        xp = self.xp
+        calls = max(self.num_calls, 1)
+        hottest = xp.unravel_index(int(self.total.argmax()), self.total.shape)
+        hottest = tuple(int(n) for n in hottest)
+        hottest = (hottest[0] + index_range[0],) + hottest[1:]
+        fallback = None
+
+        if fallback_after is not None:
+            fallback = int((self.peak > fallback_after).sum())
+
+        return dict(
+            index_range=index_range,
+            calls=self.num_calls,
+            mean=float(self.total.sum()) / calls / self.total.size,
+            max=int(self.peak.max()),
+            hottest_zone=hottest,
+            fallback_zones=fallback,
+        )
+
+
+def recovery_report(statistics):
+    """
+    Return a printable table of the per-patch recovery statistics.
+    """
+    lines = [
+        f"{'patch':<16} {'mean iter':>10} {'max iter':>9} {'fallback':>9} hottest"
+    ]
+    for s in statistics:
+        fallback = "-" if s["fallback_zones"] is None else s["fallback_zones"]
+        lines.append(
+            f"{str(s['index_range']):<16} {s['mean']:>10.3f} {s['max']:>9} "
+            f"{fallback:>9} {s['hottest_zone']}"
+        )
+    return "\n".join(lines)
 
 
 class Physics(NamedTuple):
@@ -84,6 +182,8 @@ class Patch:
         lib,
         xp,
         execution_context,
+        recovery_stats=False,
+        geometry_tables=False,
     ):
         import numpy as np
 
@@ -112,6 +212,8 @@ class Patch:
             faces = xp.array(mesh.faces(*index_range))
             conserved_with_guard = xp.zeros([num_zones + 2 * ng, nq])
 
+            primitive = None
+
             if conserved is None:
                 primitive = initial_condition(setup, mesh, i0, i1, time, xp)
                 conserved = xp.zeros_like(primitive)
@@ -128,26 +230,97 @@ class Patch:
                 conserved_with_guard[ng:-ng] = xp.array(conserved)
 
             self.faces = faces
+            self.geometry = self.comoving_geometry() if geometry_tables else None
+
             self.wavespeeds = xp.zeros(num_zones)
             self.primitive1 = xp.zeros_like(conserved_with_guard)
+            self.iterations = xp.zeros(num_zones)
+            self.recovery_stats = None
+
+            if primitive is not None:
+                # The first recovery is warm-started from the initial data
+                self.primitive1[ng:-ng] = primitive
+
+            if recovery_stats:
+                self.recovery_stats = RecoveryStatistics(num_zones, xp)
             self.conserved0 = conserved_with_guard.copy()
             self.conserved1 = conserved_with_guard.copy()
             self.conserved2 = conserved_with_guard.copy()
 
+    def comoving_geometry(self):
+        """
+        Return the comoving geometry of the zones in this patch (see
+        `srhd_1d_comoving_geometry`).
+        """
+        geometry = self.xp.zeros([self.num_zones, NUM_GEOMETRY_FIELDS])
+        self.lib.srhd_1d_comoving_geometry[self.num_zones](
+            self.faces,
+            geometry,
+            self.coordinates,
+        )
+        return geometry
+
+    def set_index_range(self, index_range, mesh, conserved, primitive, recovery):
+        """
+        Move this patch to a new index range. The patch takes the given
+        conserved and primitive arrays, which cover the new range (with guard
+        zones), and are on this patch's device. The `recovery` arrays, if
+        given, are the recovery statistics totals and peaks on the new range.
+        The face positions and geometry tables are recomputed from the mesh.
+        """
+        xp = self.xp
+        self.index_range = index_range
+        self.num_zones = num_zones = index_range[1] - index_range[0]
+
+        with self.execution_context:
+            self.faces = xp.array(mesh.faces(*index_range))
+
+            if self.geometry is not None:
+                self.geometry = self.comoving_geometry()
+
+            self.wavespeeds = xp.zeros(num_zones)
+            self.iterations = xp.zeros(num_zones)
+            self.primitive1 = primitive
+            self.conserved0 = conserved.copy()
+            self.conserved1 = conserved
+            self.conserved2 = conserved.copy()
+
+            if recovery is not None:
+                self.recovery_stats.total, self.recovery_stats.peak = recovery
+
     def recompute_primitive(self):
         with self.execution_context:
-            self.lib.srhd_1d_conserved_to_primitive[self.num_zones](
+            if self.geometry is not None:
+                kernel = self.lib.srhd_1d_conserved_to_primitive_tabulated
+                geometry = (self.geometry,)
+            else:
+                kernel = self.lib.srhd_1d_conserved_to_primitive
+                geometry = ()
+
+            kernel[self.num_zones](
                 self.faces,
+                *geometry,
                 self.conserved1,
                 self.primitive1,
+                self.iterations,
                 self.scale_factor,
                 self.coordinates,
             )
+            if self.recovery_stats is not None:
+                self.recovery_stats.add(self.iterations)
 
     def advance_rk(self, rk_param, dt):
         with self.execution_context:
-            self.lib.srhd_1d_advance_rk[self.num_zones](
+            if self.geometry is not None:
+                kernel = self.lib.srhd_1d_advance_rk_tabulated
+                geometry = (self.geometry,)
+            else:
+                kernel = self.lib.srhd_1d_advance_rk
+                geometry = ()
+
+            kernel[self.num_zones](
                 self.faces,
+                *geometry,
                 self.conserved0,
                 self.primitive1,
                 self.conserved1,
@@ -193,6 +366,24 @@ class Patch:
         return self.primitive1
 
 
+def make_library(options, mode):
+    """
+    Compile the kernel library used by the solver with the given options.
+    """
+    with open(__file__.replace(".py", ".c")) as f:
+        code = f.read()
+
+    return Library(
+        code,
+        mode=mode,
+        debug=False,
+        define_macros=dict(
+            BOUNDED_RECOVERY=int(options.bounded_recovery),
+            RECOVERY_ITER_MAX=options.recovery_iter_max,
+        ),
+    )
+
+
 class Solver(SolverBase):
     """
     Adapter class to drive the srhd_1d C extension module.
@@ -209,14 +400,11 @@ class Solver(SolverBase):
         physics=dict(),
         options=dict(),
     ):
-        with open(__file__.replace(".py", ".c")) as f:
-            code = f.read()
-
         xp = get_array_module(mode)
-        lib = Library(code, mode=mode, debug=False)
 
         self._physics = physics = Physics(**physics)
         self._options = options = Options(**options)
+        lib = make_library(options, mode)
 
         try:
             bcl, bcr = setup.boundary_condition
@@ -231,6 +419,12 @@ class Solver(SolverBase):
         if options.rk_order not in (1, 2, 3):
             raise ValueError("solver only supports rk_order in 1, 2, 3")
 
+        if options.recovery_iter_max < 1:
+            raise ValueError("recovery_iter_max must be at least 1")
+
+        if options.load_balance_cadence < 0:
+            raise ValueError("load_balance_cadence must be non-negative")
+
         logger.info(f"initiate with time={time:0.4f}")
         logger.info(f"subdivide grid over {num_patches} patches")
         logger.info(f"mesh is {mesh}")
@@ -251,6 +445,8 @@ class Solver(SolverBase):
                 lib,
                 xp,
                 execution_context(mode, device_id=n % num_devices(mode)),
+                options.recovery_stats,
+                options.geometry_tables,
             )
             patches.append(patch)
 
@@ -260,6 +456,16 @@ class Solver(SolverBase):
         self.num_cons = NUM_CONS
         self.xp = xp
         self.patches = patches
+        self.balancer = None
+        self.num_folds = 0
+
+        if options.load_balance_cadence > 0 and num_patches > 1:
+            self.balancer = LoadBalancer(
+                mode,
+                num_patches,
+                tolerance=options.load_balance_tolerance,
+                min_size=NUM_GUARD,
+            )
 
     @property
     def solution(self):
@@ -300,6 +506,107 @@ class Solver(SolverBase):
         else:
             return 1.0
 
+    def recovery_statistics(self):
+        """
+        Return a list of the recovery statistics of each patch (see
+        `RecoveryStatistics.summary`), or None if `recovery_stats` is off.
+        """
+        if not self._options.recovery_stats:
+            return None
+
+        budget = self._options.recovery_iter_max
+        fallback_after = budget if self._options.bounded_recovery else None
+        return [
+            p.recovery_stats.summary(p.index_range, fallback_after)
+            for p in self.patches
+        ]
+
+    def runtime_report(self):
+        statistics = self.recovery_statistics()
+        lines = list()
+
+        if statistics is not None:
+            lines.append("primitive recovery iterations:")
+            lines.append(recovery_report(statistics))
+
+        if self.balancer is not None:
+            lines.append(
+                f"patches were rebalanced {self.balancer.num_rebalances} times, "
+                f"to index ranges {[p.index_range for p in self.patches]}"
+            )
+
+        if lines:
+            return "\n".join(lines)
+
+    def timing(self, n):
+        """
+        Return a context which times the work of patch n (inside its execution
+        context) for the load balancer, if load balancing is enabled.
+        """
+        if self.balancer is None:
+            return nullcontext()
+
+        return self.balancer.timing(n)
+
+    def end_fold(self):
+        """
+        Repartition the patches at the load balancing cadence, if the
+        measured patch costs are uneven.
+        """
+        if self.balancer is None:
+            return
+
+        self.num_folds += 1
+
+        if self.num_folds % self._options.load_balance_cadence != 0:
+            return
+
+        index_ranges = self.balancer.propose([p.index_range for p in self.patches])
+
+        if index_ranges is not None:
+            logger.info(f"rebalance patches to index ranges {index_ranges}")
+            self.repartition(index_ranges)
+
+    def repartition(self, index_ranges):
+        """
+        Move the patches to the given index ranges, which must cover the mesh
+        in order. Each patch keeps its device, and its new solution data is
+        copied from the old patches that overlap it, without a restart, and
+        without going through the host. The guard zones are filled by the
+        next call to `set_bc`.
+        """
+        ng = self.num_guard
+        sources = dict(
+            conserved=(ng, [(p.index_range, p.conserved1) for p in self.patches]),
+            primitive=(ng, [(p.index_range, p.primitive1) for p in self.patches]),
+        )
+
+        if self._options.recovery_stats:
+            stats = [(p.index_range, p.recovery_stats) for p in self.patches]
+            sources["total"] = (0, [(r, s.total) for r, s in stats])
+            sources["peak"] = (0, [(r, s.peak) for r, s in stats])
+
+        arrays = list()
+
+        for patch, index_range in zip(self.patches, index_ranges):
+            with patch.execution_context:
+                arrays.append(
+                    {
+                        name: copy_range(source, index_range, g, self.xp)
+                        for name, (g, source) in sources.items()
+                    }
+                )
+
+        for patch, index_range, a in zip(self.patches, index_ranges, arrays):
+            recovery = (a["total"], a["peak"]) if "total" in a else None
+            patch.set_index_range(
+                index_range,
+                self.mesh,
+                a["conserved"],
+                a["primitive"],
+                recovery,
+            )
+
     def advance(self, dt):
         bs_rk1 = [0 / 1]
         bs_rk2 = [0 / 1, 1 / 2]
@@ -312,13 +619,15 @@ class Solver(SolverBase):
             self.advance_rk(b, dt)
 
     def advance_rk(self, rk_param, dt):
-        for patch in self.patches:
-            patch.recompute_primitive()
+        for n, patch in enumerate(self.patches):
+            with patch.execution_context, self.timing(n):
+                patch.recompute_primitive()
 
         self.set_bc("primitive1")
 
-        for patch in self.patches:
-            patch.advance_rk(rk_param, dt)
+        for n, patch in enumerate(self.patches):
+            with patch.execution_context, self.timing(n):
+                patch.advance_rk(rk_param, dt)
 
     def set_bc(self, array):
         ng = self.num_guard
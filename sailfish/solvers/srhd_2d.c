@@ -26,6 +26,14 @@ DESCRIPTION:
 #define PLM_THETA 1.5
 #endif
 
+#ifndef BOUNDED_RECOVERY
+#define BOUNDED_RECOVERY 0 // 1=bracketed Newton with a bisection fallback
+#endif
+
+#ifndef RECOVERY_ITER_MAX
+#define RECOVERY_ITER_MAX 8 // Newton steps before the bisection fallback
+#endif
+
 
 // ============================ MATH ==========================================
 // ============================================================================
@@ -53,6 +61,25 @@ PRIVATE void plm_gradient(double *yl, double *y0, double *yr, double *g)
 }
 
 
+// ============================ MEMORY LAYOUT =================================
+// ============================================================================
+PRIVATE void load_fields(const double *array, int n, int sq, double *fields)
+{
+    for (int q = 0; q < NCONS; ++q)
+    {
+        fields[q] = array[n + q * sq];
+    }
+}
+
+PRIVATE void store_fields(double *array, int n, int sq, const double *fields)
+{
+    for (int q = 0; q < NCONS; ++q)
+    {
+        array[n + q * sq] = fields[q];
+    }
+}
+
+
 // ============================ HYDRO =========================================
 // ============================================================================
 PRIVATE double primitive_to_gamma_beta_squared(const double *prim)
@@ -104,9 +131,32 @@ PRIVATE void primitive_to_conserved(const double *prim, double *cons, double dv)
     // cons[4] = dv * m * prim[3];
 }
 
-PRIVATE void conserved_to_primitive(double *cons1, double *cons2, double *prim, double dv, double x, double q)
+#if (BOUNDED_RECOVERY == 1)
+// One step of the bounded pressure iteration. The bracket [p_lo, p_hi] is
+// narrowed using the sign of the residual f (which decreases with p), and a
+// Newton step which leaves the bracket is replaced by bisection. After the
+// first RECOVERY_ITER_MAX iterations, every step is a bisection, so the
+// number of iterations is bounded by how many halvings of the initial
+// bracket reach round-off.
+PRIVATE double bracketed_newton_step(double p, double f, double g, int iteration, double *p_lo, double *p_hi)
 {
-    const double newton_iter_max = 500;
+    if (f > 0.0) {
+        *p_lo = p;
+    } else {
+        *p_hi = p;
+    }
+    double p_next = p - f / g;
+
+    if (iteration >= RECOVERY_ITER_MAX || !(p_next >= *p_lo && p_next <= *p_hi)) {
+        p_next = 0.5 * (*p_lo + *p_hi);
+    }
+    return p_next;
+}
+#endif
+
+PRIVATE int conserved_to_primitive(double *cons1, double *cons2, double *prim, double dv, double x, double q)
+{
+    const int newton_iter_max    = BOUNDED_RECOVERY ? RECOVERY_ITER_MAX + 64 : 500;
     const double error_tolerance = 1e-12 * (cons1[0] + cons1[3]) / dv;
     const double gm              = ADIABATIC_GAMMA;
     const double m               = cons1[0] / dv;
@@ -119,6 +169,15 @@ PRIVATE void conserved_to_primitive(double *cons1, double *cons2, double *prim,
     double w0;
     double f;
 
+    #if (BOUNDED_RECOVERY == 1)
+    // At the lower bound the velocity would be the speed of light, and at the
+    // upper bound all of the energy would be internal energy. The initial
+    // guess is the existing pressure, moved inside the bracket if needed.
+    double p_lo = max2(sqrt(ss) - tau - m, 0.0);
+    double p_hi = (gm - 1.0) * (tau + m);
+    p = min2(max2(p, p_lo), p_hi);
+    #endif
+
     while (1) {
         const double et = tau + p + m;
         const double b2 = min2(ss / et / et, 1.0 - 1e-10);
@@ -131,7 +190,16 @@ PRIVATE void conserved_to_primitive(double *cons1, double *cons2, double *prim,
         const double g  = b2 * a2 - 1.0;
 
         f  = d * e * (gm - 1.0) - p;
+
+        #if (BOUNDED_RECOVERY == 1)
+        if (fabs(f) < error_tolerance) {
+            p -= f / g;
+        } else {
+            p = bracketed_newton_step(p, f, g, iteration, &p_lo, &p_hi);
+        }
+        #else
         p -= f / g;
+        #endif
 
         if (fabs(f) < error_tolerance || iteration == newton_iter_max) {
             w0 = w;
@@ -162,7 +230,7 @@ PRIVATE void conserved_to_primitive(double *cons1, double *cons2, double *prim,
     }
 
     #if (EXEC_MODE != EXEC_GPU)
-    if (iteration == newton_iter_max) {
+    if (iteration == newton_iter_max && !BOUNDED_RECOVERY) {
         printf(
             "[FATAL] srhd_2d_conserved_to_primitive reached max "
             "iteration at comoving position (%.3f %.3f) "
@@ -182,6 +250,7 @@ PRIVATE void conserved_to_primitive(double *cons1, double *cons2, double *prim,
         exit(1);
     }
     #endif
+    return iteration;
 }
 
 PRIVATE void primitive_to_flux(const double *prim, const double *cons, double *flux, int direction)
@@ -230,6 +299,12 @@ PRIVATE void primitive_with_radial_boost(const double *prim, double *prim_booste
     prim_boosted[3] = prim[3];
 }
 
+// The Riemann solvers below select between the left, right, and star states
+// with conditional expressions rather than branches, so that a row of faces
+// can be evaluated in SIMD lanes (see the FOR_EACH_2D_SIMD loop in
+// srhd_2d_advance_rk). All of the candidate fluxes are computed, and the
+// unused ones are discarded.
+
 #if (RIEMANN_SOLVER == 0)
 PRIVATE void riemann_hlle(const double *pl, const double *pr, double v_face, double *flux, int direction)
 {
@@ -250,28 +325,14 @@ PRIVATE void riemann_hlle(const double *pl, const double *pr, double v_face, dou
     const double am = min2(al[0], ar[0]);
     const double ap = max2(al[1], ar[1]);
 
-    if (v_face < am)
-    {
-        for (int q = 0; q < NCONS; ++q)
-        {
-            flux[q] = fl[q] - v_face * ul[q];
-        }
-    }
-    else if (v_face > ap)
+    for (int q = 0; q < NCONS; ++q)
     {
-        for (int q = 0; q < NCONS; ++q)
-        {
-            flux[q] = fr[q] - v_face * ur[q];
-        }
-    }
-    else
-    {    
-        for (int q = 0; q < NCONS; ++q)
-        {
-            double u_hll = (ur[q] * ap - ul[q] * am + (fl[q] - fr[q]))           / (ap - am);
-            double f_hll = (fl[q] * ap - fr[q] * am - (ul[q] - ur[q]) * ap * am) / (ap - am);
-            flux[q] = f_hll - v_face * u_hll;
-        }
+        double u_hll = (ur[q] * ap - ul[q] * am + (fl[q] - fr[q]))           / (ap - am);
+        double f_hll = (fl[q] * ap - fr[q] * am - (ul[q] - ur[q]) * ap * am) / (ap - am);
+        double f_l = fl[q] - v_face * ul[q];
+        double f_r = fr[q] - v_face * ur[q];
+        double f_m = f_hll - v_face * u_hll;
+        flux[q] = v_face < am ? f_l : (v_face > ap ? f_r : f_m);
     }
 }
 #endif
@@ -285,6 +346,7 @@ PRIVATE void riemann_hllc(const double *pl, const double *pr, double v_face, dou
     double fr[NCONS];
     double u_hll[NCONS];
     double f_hll[NCONS];
+    double f_star[NCONS];
     double al[2];
     double ar[2];
 
@@ -297,132 +359,64 @@ PRIVATE void riemann_hllc(const double *pl, const double *pr, double v_face, dou
 
     const double am = min2(al[0], ar[0]);
     const double ap = max2(al[1], ar[1]);
+    const int dn = direction;     // index of the face-normal momentum
+    const int dt = 3 - direction; // index of the face-transverse momentum
 
-    if (v_face < am)
-    {
-        for (int q = 0; q < NCONS; ++q)
-        {
-            flux[q] = fl[q] - v_face * ul[q];
-        }
-    }
-    else if (v_face > ap)
+    for (int q = 0; q < NCONS; ++q)
     {
-        for (int q = 0; q < NCONS; ++q)
-        {
-            flux[q] = fr[q] - v_face * ur[q];
-        }
+        u_hll[q] = (ur[q] * ap - ul[q] * am + (fl[q] - fr[q]))           / (ap - am);
+        f_hll[q] = (fl[q] * ap - fr[q] * am - (ul[q] - ur[q]) * ap * am) / (ap - am);
     }
-    else
-    {    
-        double D_star;
-        double S1_star;
-        double S2_star;
-        double E_star; // total energy E = tau + D
-        double tau_star;
-
-        for (int q = 0; q < NCONS; ++q)
-        {
-            u_hll[q] = (ur[q] * ap - ul[q] * am + (fl[q] - fr[q]))           / (ap - am);
-            f_hll[q] = (fl[q] * ap - fr[q] * am - (ul[q] - ur[q]) * ap * am) / (ap - am);
-        }
-        double uhll, fhll;
-        if (direction == 1)
-        {
-            uhll = u_hll[1];
-            fhll = f_hll[1];
-        }
-        else //if (direction == 2)
-        {
-            uhll = u_hll[2];
-            fhll = f_hll[2];
-        }
-
-        double a = f_hll[3] + f_hll[0]; // total energy flux
-        double b = -(u_hll[3] + u_hll[0] + fhll);
-        double c = uhll;
-        double v_star; 
-        double vl, vr;
-
-        if (fabs(a) < 1e-10)
-        {
-            v_star = -c / b;
-        }
-        else
-        {
-            v_star = (-b - sqrt(b * b - 4.0 * a * c)) / (2.0 * a);
-        }
+    double uhll = u_hll[dn];
+    double fhll = f_hll[dn];
+
+    double a = f_hll[3] + f_hll[0]; // total energy flux
+    double b = -(u_hll[3] + u_hll[0] + fhll);
+    double c = uhll;
+    double v_star = fabs(a) < 1e-10 ? -c / b : (-b - sqrt(b * b - 4.0 * a * c)) / (2.0 * a);
+    double p_star = -a * v_star + fhll;
+
+    // The star state is on the left of the contact if v_face < v_star, and
+    // on the right otherwise. Note: the left wavespeed am is used in both
+    // star states.
+    int left = v_face < v_star;
+    double vs = left ? primitive_to_beta_component(pl, direction) : primitive_to_beta_component(pr, direction);
+    double us0 = left ? ul[0] : ur[0];
+    double usn = left ? ul[dn] : ur[dn];
+    double ust = left ? ul[dt] : ur[dt];
+    double us3 = left ? ul[3] : ur[3];
+
+    double D_star = us0 * (am - vs) / (am - v_star);
+    double E_star = (am * (us3 + us0) - usn + p_star * v_star) / (am - v_star); // total energy E = tau + D
+    double Sn_star = (E_star + p_star) * v_star;
+    double St_star = ust * (am - vs) / (am - v_star);
+    double S1_star = direction == 1 ? Sn_star : St_star;
+    double S2_star = direction == 1 ? St_star : Sn_star;
+    double tau_star = E_star - D_star;
+
+    f_star[0] = D_star * v_star - v_face * D_star;
+    f_star[1] = S1_star * v_star + p_star * (direction == 1) - v_face * S1_star;
+    f_star[2] = S2_star * v_star + p_star * (direction == 2) - v_face * S2_star;
+    f_star[3] = Sn_star - D_star * v_star - v_face * tau_star;
 
-        double p_star = -a * v_star + fhll;
-
-        if (v_face < v_star) // in left star state
-        {   
-            vl = primitive_to_beta_component(pl, direction);
-            D_star = ul[0] * (am - vl) / (am - v_star);
-            if (direction == 1)
-            {
-                E_star = (am * (ul[3] + ul[0]) - ul[1] + p_star * v_star) / (am - v_star);
-                S1_star = (E_star + p_star) * v_star;   
-                S2_star = ul[2] * (am - vl) / (am - v_star);
-            }
-            else // if (direction == 2)
-            {
-                E_star = (am * (ul[3] + ul[0]) - ul[2] + p_star * v_star) / (am - v_star);                
-                S1_star = ul[1] * (am - vl) / (am - v_star);
-                S2_star = (E_star + p_star) * v_star;
-            }
-
-            tau_star = E_star - D_star;
-
-            flux[0] = D_star * v_star - v_face * D_star;
-            flux[1] = S1_star * v_star + p_star * (direction == 1) - v_face * S1_star;
-            flux[2] = S2_star * v_star + p_star * (direction == 2) - v_face * S2_star;            
-            
-            if (direction == 1) 
-            {
-                flux[3] = S1_star - D_star * v_star - v_face * tau_star;
-            }
-            else //if (direction == 2)
-            {
-                flux[3] = S2_star - D_star * v_star - v_face * tau_star;
-            }
-        }
-        else // in right star state
-        {
-            vr = primitive_to_beta_component(pr, direction);
-            D_star = ur[0] * (am - vr) / (am - v_star);
-
-            if (direction == 1)
-            {
-                E_star = (am * (ur[3] + ur[0]) - ur[1] + p_star * v_star) / (am - v_star);
-                S1_star = (E_star + p_star) * v_star;   
-                S2_star = ur[2] * (am - vr) / (am - v_star);
-            }
-            else //if (direction == 2)
-            {
-                E_star = (am * (ur[3] + ur[0]) - ur[2] + p_star * v_star) / (am - v_star);                
-                S1_star = ur[1] * (am - vr) / (am - v_star);
-                S2_star = (E_star + p_star) * v_star;
-            }
-
-            tau_star = E_star - D_star;
-
-            flux[0] = D_star * v_star - v_face * D_star;
-            flux[1] = S1_star * v_star + p_star * (direction == 1) - v_face * S1_star;
-            flux[2] = S2_star * v_star + p_star * (direction == 2) - v_face * S2_star;            
-            
-            if (direction == 1) 
-            {
-                flux[3] = S1_star - D_star * v_star - v_face * tau_star;
-            }
-            else //if (direction == 2)
-            {
-                flux[3] = S2_star - D_star * v_star - v_face * tau_star;
-            }
-        }   
+    for (int q = 0; q < NCONS; ++q)
+    {
+        double f_l = fl[q] - v_face * ul[q];
+        double f_r = fr[q] - v_face * ur[q];
+        flux[q] = v_face < am ? f_l : (v_face > ap ? f_r : f_star[q]);
     }
 }
 #endif
 
+PRIVATE void riemann_solver(const double *pl, const double *pr, double v_face, double *flux, int direction)
+{
+    #if (RIEMANN_SOLVER == 0)
+    riemann_hlle(pl, pr, v_face, flux, direction);
+    #elif (RIEMANN_SOLVER == 1)
+    riemann_hllc(pl, pr, v_face, flux, direction);
+    #endif
+}
+
 // ============================ GEOMETRY ======================================
 // ============================================================================
 PRIVATE double face_area(double r0, double r1, double q0, double q1)
@@ -467,6 +461,229 @@ PRIVATE void geometric_source_terms(double r0, double r1, double q0, double q1,
     // source[4] = 0.0;
 }
 
+// The geometry of a zone is separable into radial and polar factors. The
+// radial factors are powers of the comoving face radii, so at scale factor a
+// the radial factors of the areas and source terms are multiplied by a^2,
+// and that of the volume by a^3. The polar factors do not depend on the
+// scale factor.
+#define NUM_RADIAL_GEOMETRY 4
+#define RADIAL_SQUARE_0 0    // y0^2
+#define RADIAL_SQUARE_1 1    // y1^2
+#define RADIAL_SQUARE_DIFF 2 // y1^2 - y0^2
+#define RADIAL_CUBE_DIFF 3   // y1^3 - y0^3
+
+#define NUM_POLAR_GEOMETRY 6
+#define POLAR_RADIAL_AREA 0  // area of a radial face over its radius squared
+#define POLAR_POLAR_AREA_0 1 // area of the lower polar face over y1^2 - y0^2
+#define POLAR_POLAR_AREA_1 2 // area of the upper polar face over y1^2 - y0^2
+#define POLAR_VOLUME 3       // zone volume over y1^3 - y0^3
+#define POLAR_DCOS 4         // pi * (cos(q1) - cos(q0))
+#define POLAR_DSIN 5         // pi * (sin(q1) - sin(q0))
+
+PRIVATE void comoving_radial_geometry(double y0, double y1, double *geometry)
+{
+    geometry[RADIAL_SQUARE_0] = y0 * y0;
+    geometry[RADIAL_SQUARE_1] = y1 * y1;
+    geometry[RADIAL_SQUARE_DIFF] = y1 * y1 - y0 * y0;
+    geometry[RADIAL_CUBE_DIFF] = y1 * y1 * y1 - y0 * y0 * y0;
+}
+
+PRIVATE void comoving_polar_geometry(double q0, double q1, double *geometry)
+{
+    geometry[POLAR_RADIAL_AREA] = face_area(1.0, 1.0, q0, q1);
+    geometry[POLAR_POLAR_AREA_0] = PI * sin(q0);
+    geometry[POLAR_POLAR_AREA_1] = PI * sin(q1);
+    geometry[POLAR_VOLUME] = cell_volume(0.0, 1.0, q0, q1);
+    geometry[POLAR_DCOS] = PI * (cos(q1) - cos(q0));
+    geometry[POLAR_DSIN] = PI * (sin(q1) - sin(q0));
+}
+
+// Same as geometric_source_terms, where dr2 is r1^2 - r0^2 and the polar
+// factors are from comoving_polar_geometry.
+PRIVATE void geometric_source_terms_tabulated(double dr2, const double *polar, const double *prim, double *source)
+{
+    double ur = prim[1];
+    double uq = prim[2];
+    double up = 0.0;
+    double pg = prim[3];
+    double rhoh = primitive_to_enthalpy_density(prim);
+    double srdot = -dr2 * polar[POLAR_DCOS] * (rhoh * (uq * uq + up * up) + 2 * pg);
+    double sqdot = +dr2 * (polar[POLAR_DCOS] * rhoh * ur * uq + polar[POLAR_DSIN] * (pg + rhoh * up * up));
+
+    source[0] = 0.0;
+    source[1] = srdot;
+    source[2] = sqdot;
+    source[3] = 0.0;
+}
+
+
+// ============================ ZONE UPDATE ===================================
+// ============================================================================
+// Advance zone (i, j) by one Runge-Kutta step. If the radial and polar
+// geometry are not NULL, they're the comoving geometry of the patch (see
+// srhd_2d_radial_geometry and srhd_2d_polar_geometry), which is scaled to the
+// current scale factor, rather than computed.
+PRIVATE void advance_rk_zone(
+    int i,
+    int j,
+    int nj,
+    int si,
+    int sj,
+    int sq,
+    const double *face_positions,
+    const double *radial_geometry,
+    const double *polar_geometry,
+    const double *conserved_rk,
+    const double *primitive_rd,
+    const double *conserved_rd,
+    double *conserved_wr,
+    double dq,
+    double a0,
+    double adot,
+    double time,
+    double rk_param,
+    double dt,
+    double jet_mdot,
+    double jet_gamma_beta,
+    double jet_theta,
+    double jet_duration,
+    int num_first_order_zones)
+{
+    int ng = 2; // number of guard zones in the radial direction
+    double x0 = face_positions[i];
+    double x1 = face_positions[i + 1];
+    double r0 = x0 * (a0 + adot * time);
+    double r1 = x1 * (a0 + adot * time);
+    double q0 = dq * (j + 0);
+    double q1 = dq * (j + 1);
+    double qc = 0.5 * (q0 + q1);
+
+    if (i == 0 && jet_mdot > 0.0 && qc < jet_theta * 2.0 && time < 1.0 + jet_duration) // assumes the jet starts at t=1.0
+    {
+        double uwr[NCONS];
+        double jet_u = jet_gamma_beta;// * min2((time - 1.0) / (0.1 * jet_duration), 1.0);
+        double jet_rho = jet_mdot / (4.0 * PI * r0 * r0 * jet_u);
+        double jet_prof = exp(-pow(qc / jet_theta, 2.0));
+        double prim[NCONS] = {jet_rho, jet_u * jet_prof, 0.0, 1e-6 * jet_rho};
+        double dv = cell_volume(r0, r1, q0, q1);
+        primitive_to_conserved(prim, uwr, dv);
+        store_fields(conserved_wr, (i + 0 + ng) * si + (j + 0) * sj, sq, uwr);
+    }
+    else if (jet_mdot > 0.0 && i == 0) // if the jet is enabled, then fix the innermost zone
+    {
+
+    }
+    else
+    {
+        double urk[NCONS];
+        double urd[NCONS];
+        double uwr[NCONS];
+        double pcc[NCONS];
+        double pli[NCONS];
+        double pri[NCONS];
+        double pki[NCONS];
+        double pti[NCONS];
+        double plj[NCONS];
+        double prj[NCONS];
+        double pkj[NCONS];
+        double ptj[NCONS];
+
+        load_fields(conserved_rk, (i + 0 + ng) * si + (j + 0) * sj, sq, urk);
+        load_fields(conserved_rd, (i + 0 + ng) * si + (j + 0) * sj, sq, urd);
+        load_fields(primitive_rd, (i + 0 + ng) * si + (j + 0) * sj, sq, pcc);
+        load_fields(primitive_rd, (i - 1 + ng) * si + (j + 0) * sj, sq, pli);
+        load_fields(primitive_rd, (i + 1 + ng) * si + (j + 0) * sj, sq, pri);
+        load_fields(primitive_rd, (i - 2 + ng) * si + (j + 0) * sj, sq, pki);
+        load_fields(primitive_rd, (i + 2 + ng) * si + (j + 0) * sj, sq, pti);
+        load_fields(primitive_rd, (i + 0 + ng) * si + max2(j - 1, 0) * sj, sq, plj);
+        load_fields(primitive_rd, (i + 0 + ng) * si + min2(j + 1, nj - 1) * sj, sq, prj);
+        load_fields(primitive_rd, (i + 0 + ng) * si + max2(j - 2, 0) * sj, sq, pkj);
+        load_fields(primitive_rd, (i + 0 + ng) * si + min2(j + 2, nj - 1) * sj, sq, ptj);
+
+        double plip[NCONS];
+        double plim[NCONS];
+        double prip[NCONS];
+        double prim[NCONS];
+        double pljp[NCONS];
+        double pljm[NCONS];
+        double prjp[NCONS];
+        double prjm[NCONS];
+        double grli[NCONS] = {0.0};
+        double grri[NCONS] = {0.0};
+        double grcc[NCONS] = {0.0};
+        double gqlj[NCONS] = {0.0};
+        double gqrj[NCONS] = {0.0};
+        double gqcc[NCONS] = {0.0};
+        double fli[NCONS];
+        double fri[NCONS];
+        double flj[NCONS];
+        double frj[NCONS];
+        double sources[NCONS];
+
+        if (i >= num_first_order_zones)
+        {
+            plm_gradient(pki, pli, pcc, grli);
+            plm_gradient(pli, pcc, pri, grcc);
+            plm_gradient(pcc, pri, pti, grri);
+            plm_gradient(pkj, plj, pcc, gqlj);
+            plm_gradient(plj, pcc, prj, gqcc);
+            plm_gradient(pcc, prj, ptj, gqrj);
+        }
+
+        for (int q = 0; q < NCONS; ++q)
+        {
+            plim[q] = pli[q] + 0.5 * grli[q];
+            plip[q] = pcc[q] - 0.5 * grcc[q];
+            prim[q] = pcc[q] + 0.5 * grcc[q];
+            prip[q] = pri[q] - 0.5 * grri[q];
+            pljm[q] = plj[q] + 0.5 * gqlj[q];
+            pljp[q] = pcc[q] - 0.5 * gqcc[q];
+            prjm[q] = pcc[q] + 0.5 * gqcc[q];
+            prjp[q] = prj[q] - 0.5 * gqrj[q];
+        }
+
+        double da_r0;
+        double da_r1;
+        double da_q0;
+        double da_q1;
+
+        riemann_solver(plim, plip, x0 * adot, fli, 1);
+        riemann_solver(prim, prip, x1 * adot, fri, 1);
+        riemann_solver(pljm, pljp, 0.0, flj, 2);
+        riemann_solver(prjm, prjp, 0.0, frj, 2);
+
+        if (radial_geometry != NULL && polar_geometry != NULL)
+        {
+            const double *gr = &radial_geometry[i * NUM_RADIAL_GEOMETRY];
+            const double *gq = &polar_geometry[j * NUM_POLAR_GEOMETRY];
+            double a = a0 + adot * time;
+            double a2 = a * a;
+            da_r0 = gr[RADIAL_SQUARE_0] * gq[POLAR_RADIAL_AREA] * a2;
+            da_r1 = gr[RADIAL_SQUARE_1] * gq[POLAR_RADIAL_AREA] * a2;
+            da_q0 = gr[RADIAL_SQUARE_DIFF] * gq[POLAR_POLAR_AREA_0] * a2;
+            da_q1 = gr[RADIAL_SQUARE_DIFF] * gq[POLAR_POLAR_AREA_1] * a2;
+            geometric_source_terms_tabulated(gr[RADIAL_SQUARE_DIFF] * a2, gq, pcc, sources);
+        }
+        else
+        {
+            da_r0 = face_area(r0, r0, q0, q1);
+            da_r1 = face_area(r1, r1, q0, q1);
+            da_q0 = face_area(r0, r1, q0, q0);
+            da_q1 = face_area(r0, r1, q1, q1);
+            geometric_source_terms(r0, r1, q0, q1, pcc, sources);
+        }
+
+        for (int q = 0; q < NCONS; ++q)
+        {
+            uwr[q] = urd[q] + (
+                fli[q] * da_r0 - fri[q] * da_r1 +
+                flj[q] * da_q0 - frj[q] * da_q1 + sources[q]
+            ) * dt;
+            uwr[q] = (1.0 - rk_param) * uwr[q] + rk_param * urk[q];
+        }
+        store_fields(conserved_wr, (i + 0 + ng) * si + (j + 0) * sj, sq, uwr);
+    }}
+
 
 // ============================ KERNELS =======================================
 // ============================================================================
@@ -482,20 +699,22 @@ PUBLIC void srhd_2d_primitive_to_conserved(
     int ni,
     int nj,
     double *face_positions,  // :: $.shape == (ni + 1,)
-    double *primitive,       // :: $.shape == (ni, nj, 4)
-    double *conserved,       // :: $.shape == (ni, nj, 4)
+    double *primitive,       // :: $.shape == layout(ni, nj, 4)
+    double *conserved,       // :: $.shape == layout(ni, nj, 4)
     double polar_extent,
     double scale_factor)     // :: $ >= 0.0
 {
-    int si = NCONS * nj;
-    int sj = NCONS;
+    int si = LAYOUT_STRIDE_I(ni, nj, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni, nj, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni, nj, NCONS);
     double dq = polar_extent / nj; // polar zone spacing
 
     FOR_EACH_2D(ni, nj)
     {
         int n = i * si + j * sj;
-        double *p = &primitive[n];
-        double *u = &conserved[n];
+        double p[NCONS];
+        double u[NCONS];
+        load_fields(primitive, n, sq, p);
         double x0 = face_positions[i];
         double x1 = face_positions[i + 1];
         double r0 = x0 * scale_factor;
@@ -504,34 +723,41 @@ PUBLIC void srhd_2d_primitive_to_conserved(
         double q1 = dq * (j + 1);
         double dv = cell_volume(r0, r1, q0, q1);
         primitive_to_conserved(p, u, dv);
+        store_fields(conserved, n, sq, u);
     }
 }
 
 
 /**
- * Converts an array of conserved data to an array of primitive data.
+ * Converts an array of conserved data to an array of primitive data. The
+ * existing primitive data is the initial guess for the pressure, and the
+ * number of iterations taken in each zone is written to `iterations`.
  */
 PUBLIC void srhd_2d_conserved_to_primitive(
     int ni,
     int nj,
     double *face_positions,  // :: $.shape == (ni + 1,)
-    double *conserved1,      // :: $.shape == (ni + 4, nj, 4)
-    double *conserved2,      // :: $.shape == (ni + 4, nj, 4)
-    double *primitive,       // :: $.shape == (ni + 4, nj, 4)
+    double *conserved1,      // :: $.shape == layout(ni + 4, nj, 4)
+    double *conserved2,      // :: $.shape == layout(ni + 4, nj, 4)
+    double *primitive,       // :: $.shape == layout(ni + 4, nj, 4)
+    double *iterations,      // :: $.shape == (ni, nj)
     double polar_extent,
     double scale_factor)     // :: $ >= 0.0
 {
     int ng = 2; // number of guard zones in the radial direction
-    int si = NCONS * nj;
-    int sj = NCONS;
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj, NCONS);
     double dq = polar_extent / nj; // polar zone spacing
 
     FOR_EACH_2D(ni, nj)
     {
         int n = (i + ng) * si + j * sj;
-        double *p = &primitive[n];
-        double *u1 = &conserved1[n];
-        double *u2 = &conserved2[n];
+        double p[NCONS];
+        double u1[NCONS];
+        double u2[NCONS];
+        load_fields(primitive, n, sq, p);
+        load_fields(conserved1, n, sq, u1);
         double x0 = face_positions[i];
         double x1 = face_positions[i + 1];
         double r0 = x0 * scale_factor;
@@ -539,7 +765,53 @@ PUBLIC void srhd_2d_conserved_to_primitive(
         double q0 = dq * (j + 0);
         double q1 = dq * (j + 1);
         double dv = cell_volume(r0, r1, q0, q1);
-        conserved_to_primitive(u1, u2, p, dv, x0, q0);
+        iterations[i * nj + j] = conserved_to_primitive(u1, u2, p, dv, x0, q0);
+        store_fields(primitive, n, sq, p);
+        store_fields(conserved2, n, sq, u2);
+    }
+}
+
+
+/**
+ * Same as srhd_2d_conserved_to_primitive, except the zone volumes are scaled
+ * from the comoving geometry written by srhd_2d_radial_geometry and
+ * srhd_2d_polar_geometry.
+ */
+PUBLIC void srhd_2d_conserved_to_primitive_tabulated(
+    int ni,
+    int nj,
+    double *face_positions,  // :: $.shape == (ni + 1,)
+    double *radial_geometry, // :: $.shape == (ni, 4)
+    double *polar_geometry,  // :: $.shape == (nj, 6)
+    double *conserved1,      // :: $.shape == layout(ni + 4, nj, 4)
+    double *conserved2,      // :: $.shape == layout(ni + 4, nj, 4)
+    double *primitive,       // :: $.shape == layout(ni + 4, nj, 4)
+    double *iterations,      // :: $.shape == (ni, nj)
+    double polar_extent,
+    double scale_factor)     // :: $ >= 0.0
+{
+    int ng = 2; // number of guard zones in the radial direction
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj, NCONS);
+    double dq = polar_extent / nj; // polar zone spacing
+    double a3 = scale_factor * scale_factor * scale_factor;
+
+    FOR_EACH_2D(ni, nj)
+    {
+        int n = (i + ng) * si + j * sj;
+        double p[NCONS];
+        double u1[NCONS];
+        double u2[NCONS];
+        load_fields(primitive, n, sq, p);
+        load_fields(conserved1, n, sq, u1);
+        double x0 = face_positions[i];
+        double q0 = dq * (j + 0);
+        double dr3 = radial_geometry[i * NUM_RADIAL_GEOMETRY + RADIAL_CUBE_DIFF];
+        double dv = dr3 * polar_geometry[j * NUM_POLAR_GEOMETRY + POLAR_VOLUME] * a3;
+        iterations[i * nj + j] = conserved_to_primitive(u1, u2, p, dv, x0, q0);
+        store_fields(primitive, n, sq, p);
+        store_fields(conserved2, n, sq, u2);
     }
 }
 
@@ -551,20 +823,22 @@ PUBLIC void srhd_2d_max_wavespeeds(
     int ni,
     int nj,
     double *face_positions,  // :: $.shape == (ni + 1,)
-    double *primitive,       // :: $.shape == (ni + 4, nj, 4)
+    double *primitive,       // :: $.shape == layout(ni + 4, nj, 4)
     double *wavespeed,       // :: $.shape == (ni, nj)
     double adot)             // :: $ >= 0.0
 {
     int ng = 2; // number of guard zones in the radial direction
-    int si = NCONS * nj;
-    int sj = NCONS;
+    int si = LAYOUT_STRIDE_I(ni + 2 * ng, nj, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 2 * ng, nj, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 2 * ng, nj, NCONS);
     int ti = nj;
     int tj = 1;
 
     FOR_EACH_2D(ni, nj)
     {
-        double *p = &primitive[(i + ng) * si + j * sj];
+        double p[NCONS];
         double *a = &wavespeed[(i +  0) * ti + j * tj];
+        load_fields(primitive, (i + ng) * si + j * sj, sq, p);
         double x0 = face_positions[i];
         double x1 = face_positions[i + 1];
         double p_boosted[NCONS];
@@ -586,10 +860,10 @@ PUBLIC void srhd_2d_advance_rk(
     int ni,
     int nj,
     double *face_positions, // :: $.shape == (ni + 1,)
-    double *conserved_rk,   // :: $.shape == (ni + 4, nj, 4)
-    double *primitive_rd,   // :: $.shape == (ni + 4, nj, 4)
-    double *conserved_rd,   // :: $.shape == (ni + 4, nj, 4)
-    double *conserved_wr,   // :: $.shape == (ni + 4, nj, 4)
+    double *conserved_rk,   // :: $.shape == layout(ni + 4, nj, 4)
+    double *primitive_rd,   // :: $.shape == layout(ni + 4, nj, 4)
+    double *conserved_rd,   // :: $.shape == layout(ni + 4, nj, 4)
+    double *conserved_wr,   // :: $.shape == layout(ni + 4, nj, 4)
     double polar_extent,
     double a0,              // scale factor at t=0
     double adot,            // scale factor derivative
@@ -602,111 +876,138 @@ PUBLIC void srhd_2d_advance_rk(
     double jet_duration,
     int num_first_order_zones)
 {
-    int ng = 2; // number of guard zones in the radial direction
-    int si = NCONS * nj;
-    int sj = NCONS;
     double dq = polar_extent / nj; // polar zone spacing
 
-    FOR_EACH_2D(ni, nj)
+    int si = LAYOUT_STRIDE_I(ni + 4, nj, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 4, nj, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 4, nj, NCONS);
+
+    FOR_EACH_2D_SIMD(ni, nj)
     {
-        double x0 = face_positions[i];
-        double x1 = face_positions[i + 1];
-        double r0 = x0 * (a0 + adot * time);
-        double r1 = x1 * (a0 + adot * time);
-        double q0 = dq * (j + 0);
-        double q1 = dq * (j + 1);
-        double qc = 0.5 * (q0 + q1);
+        advance_rk_zone(
+            i,
+            j,
+            nj,
+            si,
+            sj,
+            sq,
+            face_positions,
+            NULL,
+            NULL,
+            conserved_rk,
+            primitive_rd,
+            conserved_rd,
+            conserved_wr,
+            dq,
+            a0,
+            adot,
+            time,
+            rk_param,
+            dt,
+            jet_mdot,
+            jet_gamma_beta,
+            jet_theta,
+            jet_duration,
+            num_first_order_zones);
+    }
+}
 
-        if (i == 0 && jet_mdot > 0.0 && qc < jet_theta * 2.0 && time < 1.0 + jet_duration) // assumes the jet starts at t=1.0
-        {
-            double *uwr = &conserved_wr[(i + 0 + ng) * si + (j + 0) * sj];
-	    double jet_u = jet_gamma_beta;// * min2((time - 1.0) / (0.1 * jet_duration), 1.0);
-            double jet_rho = jet_mdot / (4.0 * PI * r0 * r0 * jet_u);
-            double jet_prof = exp(-pow(qc / jet_theta, 2.0));
-            double prim[NCONS] = {jet_rho, jet_u * jet_prof, 0.0, 1e-6 * jet_rho};
-            double dv = cell_volume(r0, r1, q0, q1);
-            primitive_to_conserved(prim, uwr, dv);
-        }
-        else if (jet_mdot > 0.0 && i == 0) // if the jet is enabled, then fix the innermost zone
-        {
 
-        }
-        else
-        {
-            double *urk = &conserved_rk[(i + 0 + ng) * si + (j + 0) * sj];
-            double *urd = &conserved_rd[(i + 0 + ng) * si + (j + 0) * sj];
-            double *uwr = &conserved_wr[(i + 0 + ng) * si + (j + 0) * sj];
-            double *pcc = &primitive_rd[(i + 0 + ng) * si + (j + 0) * sj];
-            double *pli = &primitive_rd[(i - 1 + ng) * si + (j + 0) * sj];
-            double *pri = &primitive_rd[(i + 1 + ng) * si + (j + 0) * sj];
-            double *pki = &primitive_rd[(i - 2 + ng) * si + (j + 0) * sj];
-            double *pti = &primitive_rd[(i + 2 + ng) * si + (j + 0) * sj];
-            double *plj = &primitive_rd[(i + 0 + ng) * si + max2(j - 1, 0) * sj];
-            double *prj = &primitive_rd[(i + 0 + ng) * si + min2(j + 1, nj - 1) * sj];
-            double *pkj = &primitive_rd[(i + 0 + ng) * si + max2(j - 2, 0) * sj];
-            double *ptj = &primitive_rd[(i + 0 + ng) * si + min2(j + 2, nj - 1) * sj];
-
-            double plip[NCONS];
-            double plim[NCONS];
-            double prip[NCONS];
-            double prim[NCONS];
-            double pljp[NCONS];
-            double pljm[NCONS];
-            double prjp[NCONS];
-            double prjm[NCONS];
-            double grli[NCONS] = {0.0};
-            double grri[NCONS] = {0.0};
-            double grcc[NCONS] = {0.0};
-            double gqlj[NCONS] = {0.0};
-            double gqrj[NCONS] = {0.0};
-            double gqcc[NCONS] = {0.0};
-            double fli[NCONS];
-            double fri[NCONS];
-            double flj[NCONS];
-            double frj[NCONS];
-            double sources[NCONS];
-
-            if (i >= num_first_order_zones)
-            {
-                plm_gradient(pki, pli, pcc, grli);
-                plm_gradient(pli, pcc, pri, grcc);
-                plm_gradient(pcc, pri, pti, grri);
-                plm_gradient(pkj, plj, pcc, gqlj);
-                plm_gradient(plj, pcc, prj, gqcc);
-                plm_gradient(pcc, prj, ptj, gqrj);
-            }
-
-            for (int q = 0; q < NCONS; ++q)
-            {
-                plim[q] = pli[q] + 0.5 * grli[q];
-                plip[q] = pcc[q] - 0.5 * grcc[q];
-                prim[q] = pcc[q] + 0.5 * grcc[q];
-                prip[q] = pri[q] - 0.5 * grri[q];
-                pljm[q] = plj[q] + 0.5 * gqlj[q];
-                pljp[q] = pcc[q] - 0.5 * gqcc[q];
-                prjm[q] = pcc[q] + 0.5 * gqcc[q];
-                prjp[q] = prj[q] - 0.5 * gqrj[q];
-            }
-
-            double da_r0 = face_area(r0, r0, q0, q1);
-            double da_r1 = face_area(r1, r1, q0, q1);
-            double da_q0 = face_area(r0, r1, q0, q0);
-            double da_q1 = face_area(r0, r1, q1, q1);
-
-            riemann_hllc(plim, plip, x0 * adot, fli, 1);
-            riemann_hllc(prim, prip, x1 * adot, fri, 1);
-            riemann_hllc(pljm, pljp, 0.0, flj, 2);
-            riemann_hllc(prjm, prjp, 0.0, frj, 2);
-            geometric_source_terms(r0, r1, q0, q1, pcc, sources);
+/**
+ * Same as srhd_2d_advance_rk, except the face areas and geometric source
+ * terms are scaled from the comoving geometry written by
+ * srhd_2d_radial_geometry and srhd_2d_polar_geometry, rather than computed
+ * in every zone.
+ */
+PUBLIC void srhd_2d_advance_rk_tabulated(
+    int ni,
+    int nj,
+    double *face_positions,  // :: $.shape == (ni + 1,)
+    double *radial_geometry, // :: $.shape == (ni, 4)
+    double *polar_geometry,  // :: $.shape == (nj, 6)
+    double *conserved_rk,    // :: $.shape == layout(ni + 4, nj, 4)
+    double *primitive_rd,    // :: $.shape == layout(ni + 4, nj, 4)
+    double *conserved_rd,    // :: $.shape == layout(ni + 4, nj, 4)
+    double *conserved_wr,    // :: $.shape == layout(ni + 4, nj, 4)
+    double polar_extent,
+    double a0,               // scale factor at t=0
+    double adot,             // scale factor derivative
+    double time,             // current time
+    double rk_param,         // runge-kutta parameter
+    double dt,               // timestep size
+    double jet_mdot,
+    double jet_gamma_beta,
+    double jet_theta,
+    double jet_duration,
+    int num_first_order_zones)
+{
+    double dq = polar_extent / nj; // polar zone spacing
 
-            for (int q = 0; q < NCONS; ++q)
-            {
-                uwr[q] = urd[q] + (
-                    fli[q] * da_r0 - fri[q] * da_r1 +
-                    flj[q] * da_q0 - frj[q] * da_q1 + sources[q]
-                ) * dt;
-                uwr[q] = (1.0 - rk_param) * uwr[q] + rk_param * urk[q];
-            }
-        }
+    int si = LAYOUT_STRIDE_I(ni + 4, nj, NCONS);
+    int sj = LAYOUT_STRIDE_J(ni + 4, nj, NCONS);
+    int sq = LAYOUT_STRIDE_Q(ni + 4, nj, NCONS);
+
+    FOR_EACH_2D_SIMD(ni, nj)
+    {
+        advance_rk_zone(
+            i,
+            j,
+            nj,
+            si,
+            sj,
+            sq,
+            face_positions,
+            radial_geometry,
+            polar_geometry,
+            conserved_rk,
+            primitive_rd,
+            conserved_rd,
+            conserved_wr,
+            dq,
+            a0,
+            adot,
+            time,
+            rk_param,
+            dt,
+            jet_mdot,
+            jet_gamma_beta,
+            jet_theta,
+            jet_duration,
+            num_first_order_zones);
+    }
+}
+
+
+/**
+ * Writes the radial part of the comoving geometry of each zone (see
+ * comoving_radial_geometry). It only depends on the mesh, so it can be
+ * computed once per patch.
+ */
+PUBLIC void srhd_2d_radial_geometry(
+    int ni,
+    double *face_positions,  // :: $.shape == (ni + 1,)
+    double *radial_geometry) // :: $.shape == (ni, 4)
+{
+    FOR_EACH_1D(ni)
+    {
+        comoving_radial_geometry(face_positions[i], face_positions[i + 1], &radial_geometry[i * NUM_RADIAL_GEOMETRY]);
+    }
+}
+
+
+/**
+ * Writes the polar part of the comoving geometry of each zone (see
+ * comoving_polar_geometry), for a polar grid of nj zones.
+ */
+PUBLIC void srhd_2d_polar_geometry(
+    int nj,
+    double *polar_geometry, // :: $.shape == (nj, 6)
+    double polar_extent)
+{
+    double dq = polar_extent / nj; // polar zone spacing
+
+    FOR_EACH_1D(nj)
+    {
+        comoving_polar_geometry(dq * (i + 0), dq * (i + 1), &polar_geometry[i * NUM_POLAR_GEOMETRY]);
     }
 }
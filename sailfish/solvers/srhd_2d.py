@@ -17,15 +17,27 @@ value of 2.0.
 from logging import getLogger
 from typing import NamedTuple
 from sailfish.kernel.library import Library
-from sailfish.kernel.system import get_array_module, execution_context, num_devices
-from sailfish.subdivide import subdivide, concat_on_host, lazy_reduce
+from sailfish.kernel.system import (
+    get_array_module,
+    execution_context,
+    num_devices,
+)
+from sailfish.subdivide import (
+    BlockDecomposition,
+    GuardZoneExchange,
+    concat_on_host,
+    lazy_reduce,
+)
 from sailfish.mesh import PlanarCartesianMesh, LogSphericalMesh
 from sailfish.solver_base import SolverBase
+from sailfish.solvers.srhd_1d import RecoveryStatistics, recovery_report
 
 logger = getLogger(__name__)
 
 NUM_GUARD = 2
 NUM_CONS = 4
+NUM_RADIAL_GEOMETRY = 4
+NUM_POLAR_GEOMETRY = 6
 
 BC_INTERNAL = 0  # internal BC (guard zones overlap a neighbor patch)
 BC_PERIODIC = 1  # period BC (not handled in C)
@@ -60,10 +72,31 @@ def initial_condition(setup, mesh, i0, i1, j0, j1, time, xp):
 
 
 class Options(NamedTuple):
+    """
+    Contains parameters which are solver specific options.
+
+    The `bounded_recovery`, `recovery_iter_max`, and `recovery_stats` options
+    control the primitive variable recovery, in the same way as they do for
+    the `srhd_1d` solver.
+
+    If `geometry_tables` is true, each patch computes the radial and polar
+    factors of its zone geometry (face areas, volumes, and geometric source
+    term coefficients) once, at unit scale factor, and the kernels scale
+    them to the current scale factor, rather than evaluating powers and
+    trigonometric functions in every zone and stage. This removes the trig
+    calls from the zone update, and the tables only take `4 * ni + 6 * nj`
+    numbers per patch.
+    """
+
     compute_wavespeed: bool = False
     rk_order: int = 2
     plm_theta: float = 1.5
     mach_ceiling: float = 1e6
+    layout: str = "aos"
+    bounded_recovery: bool = False
+    recovery_iter_max: int = 8
+    recovery_stats: bool = False
+    geometry_tables: bool = False
 
 
 class Physics(NamedTuple):
@@ -93,6 +126,8 @@ class Patch:
         lib,
         xp,
         execution_context,
+        recovery_stats=False,
+        geometry_tables=False,
     ):
         ng = NUM_GUARD
         nq = NUM_CONS
@@ -120,8 +155,11 @@ class Patch:
             faces = xp.array(mesh.faces(*index_range))
             conserved_with_guard = xp.zeros([shape[0] + 2 * ng, nj, nq])
 
+            primitive = None
+
             if conserved is None:
                 primitive = initial_condition(setup, mesh, i0, i1, 0, nj, time, xp)
+                primitive = lib.to_storage(primitive)
                 conserved = xp.zeros_like(primitive)
 
                 lib.srhd_2d_primitive_to_conserved[shape](
@@ -131,33 +169,72 @@ class Patch:
                     mesh.polar_extent,
                     mesh.scale_factor(time),
                 )
-                conserved_with_guard[ng:-ng] = conserved
+                conserved_with_guard[ng:-ng] = lib.logical_view(conserved)
             else:
                 conserved_with_guard[ng:-ng] = xp.array(conserved)
 
+            conserved_with_guard = lib.to_storage(conserved_with_guard)
+
             self.faces = faces
+            self.geometry = None
+
+            if geometry_tables:
+                radial_geometry = xp.zeros([shape[0], NUM_RADIAL_GEOMETRY])
+                polar_geometry = xp.zeros([shape[1], NUM_POLAR_GEOMETRY])
+                lib.srhd_2d_radial_geometry[shape[0]](faces, radial_geometry)
+                lib.srhd_2d_polar_geometry[shape[1]](
+                    polar_geometry,
+                    mesh.polar_extent,
+                )
+                self.geometry = (radial_geometry, polar_geometry)
+
             self.wavespeeds = xp.zeros(shape)
             self.primitive1 = xp.zeros_like(conserved_with_guard)
+            self.iterations = xp.zeros(shape)
+            self.recovery_stats = None
+
+            if primitive is not None:
+                # The first recovery is warm-started from the initial data
+                lib.logical_view(self.primitive1)[ng:-ng] = lib.logical_view(primitive)
+
+            if recovery_stats:
+                self.recovery_stats = RecoveryStatistics(shape, xp)
             self.conserved0 = conserved_with_guard.copy()
             self.conserved1 = conserved_with_guard.copy()
             self.conserved2 = conserved_with_guard.copy()
 
     def recompute_primitive(self):
         with self.execution_context:
-            self.lib.srhd_2d_conserved_to_primitive[self.shape](
+            if self.geometry is not None:
+                kernel = self.lib.srhd_2d_conserved_to_primitive_tabulated
+            else:
+                kernel = self.lib.srhd_2d_conserved_to_primitive
+
+            kernel[self.shape](
                 self.faces,
+                *(self.geometry or ()),
                 self.conserved1,
                 self.conserved2,
                 self.primitive1,
+                self.iterations,
                 self.polar_extent,
                 self.scale_factor,
             )
             self.conserved1, self.conserved2 = self.conserved2, self.conserved1
 
+            if self.recovery_stats is not None:
+                self.recovery_stats.add(self.iterations)
+
     def advance_rk(self, rk_param, dt):
         with self.execution_context:
-            self.lib.srhd_2d_advance_rk[self.shape](
+            if self.geometry is not None:
+                kernel = self.lib.srhd_2d_advance_rk_tabulated
+            else:
+                kernel = self.lib.srhd_2d_advance_rk
+
+            kernel[self.shape](
                 self.faces,
+                *(self.geometry or ()),
                 self.conserved0,
                 self.primitive1,
                 self.conserved1,
@@ -198,12 +275,33 @@ class Patch:
 
     @property
     def conserved(self):
-        return self.conserved1
+        return self.lib.logical_view(self.conserved1)
 
     @property
     def primitive(self):
         self.recompute_primitive()
-        return self.primitive1
+        return self.lib.logical_view(self.primitive1)
+
+
+def make_library(options, mode):
+    """
+    Compile the kernel library used by the solver with the given options.
+    """
+    with open(__file__.replace(".py", ".c")) as f:
+        code = f.read()
+
+    return Library(
+        code,
+        mode=mode,
+        debug=False,
+        layout=options.layout,
+        define_macros=dict(
+            PLM_THETA=options.plm_theta,
+            MACH_CEILING=options.mach_ceiling,
+            BOUNDED_RECOVERY=int(options.bounded_recovery),
+            RECOVERY_ITER_MAX=options.recovery_iter_max,
+        ),
+    )
 
 
 class Solver(SolverBase):
@@ -222,22 +320,11 @@ class Solver(SolverBase):
         physics=dict(),
         options=dict(),
     ):
-        with open(__file__.replace(".py", ".c")) as f:
-            code = f.read()
-
         self._physics = physics = Physics(**physics)
         self._options = options = Options(**options)
 
         xp = get_array_module(mode)
-        lib = Library(
-            code,
-            mode=mode,
-            debug=False,
-            define_macros=dict(
-                PLM_THETA=options.plm_theta,
-                MACH_CEILING=options.mach_ceiling,
-            ),
-        )
+        lib = make_library(options, mode)
 
         try:
             bcl, bcr = setup.boundary_condition
@@ -256,9 +343,22 @@ class Solver(SolverBase):
         if options.rk_order not in (1, 2, 3):
             raise ValueError("solver only supports rk_order in 1, 2, 3")
 
+        if options.recovery_iter_max < 1:
+            raise ValueError("recovery_iter_max must be at least 1")
+
+        # The polar boundaries are handled in the kernels, so the patches are
+        # slabs, and the arrays have no guard zones on the polar axis. The
+        # decomposition is periodic on the radial axis, so the guard zones at
+        # the domain edges are first copied from the opposite edge, and then
+        # overwritten by the boundary condition, if it is not periodic.
+        self.decomposition = BlockDecomposition(
+            mesh.shape, num_patches, (num_patches, 1), periodic=(True, False)
+        )
+        self.exchange = GuardZoneExchange(self.decomposition, (NUM_GUARD, 0))
         patches = list()
 
-        for n, (a, b) in enumerate(subdivide(mesh.shape[0], num_patches)):
+        for n in self.decomposition.owned:
+            a, b = self.decomposition.index_range(n)[0]
             if n == 0 and bcl == "jet":
                 # introduction of some extra diffusion near the jet inlet is
                 # effective at preventing crashes
@@ -275,7 +375,9 @@ class Solver(SolverBase):
                 num_first_order_zones,
                 lib,
                 xp,
-                execution_context(mode, device_id=n % num_devices(mode)),
+                execution_context(mode, device_id=n % num_devices(mode), stream=True),
+                options.recovery_stats,
+                options.geometry_tables,
             )
             patches.append(patch)
 
@@ -294,6 +396,11 @@ class Solver(SolverBase):
     def primitive(self):
         return concat_on_host([p.primitive for p in self.patches], (self.num_guard, 0))
 
+    def solution_blocks(self):
+        ng = self.num_guard
+        nj = self.mesh.shape[1]
+        return [((p.index_range, (0, nj)), p.conserved[ng:-ng]) for p in self.patches]
+
     @property
     def time(self):
         return self.patches[0].time
@@ -330,6 +437,27 @@ class Solver(SolverBase):
         else:
             return 1.0
 
+    def recovery_statistics(self):
+        """
+        Return a list of the recovery statistics of each patch (see
+        `RecoveryStatistics.summary`), or None if `recovery_stats` is off.
+        """
+        if not self._options.recovery_stats:
+            return None
+
+        budget = self._options.recovery_iter_max
+        fallback_after = budget if self._options.bounded_recovery else None
+        return [
+            p.recovery_stats.summary(p.index_range, fallback_after)
+            for p in self.patches
+        ]
+
+    def runtime_report(self):
+        statistics = self.recovery_statistics()
+
+        if statistics is not None:
+            return "primitive recovery iterations:\n" + recovery_report(statistics)
+
     def advance(self, dt):
         bs_rk1 = [0 / 1]
         bs_rk2 = [0 / 1, 1 / 2]
@@ -351,56 +479,56 @@ class Solver(SolverBase):
             patch.advance_rk(rk_param, dt)
 
     def set_bc(self, array):
-        ng = self.num_guard
-        num_patches = len(self.patches)
-        for ic in range(num_patches):
-            il = (ic + num_patches - 1) % num_patches
-            ir = (ic + num_patches + 1) % num_patches
-            pl = getattr(self.patches[il], array)
-            pc = getattr(self.patches[ic], array)
-            pr = getattr(self.patches[ir], array)
-            self.set_bc_patch(pl, pc, pr, ic)
-
-    def set_bc_patch(self, pl, pc, pr, patch_index):
+        """
+        Fill the guard zones of the given array on each patch (see
+        `GuardZoneExchange.fill`).
+        """
+        self.exchange.fill(
+            [p.lib.logical_view(getattr(p, array)) for p in self.patches],
+            [p.execution_context for p in self.patches],
+            self.set_bc_edge,
+        )
+
+    def set_bc_edge(self, pc, patch_index, axis, side):
+        """
+        Apply the boundary condition to one of the radial domain edges of the
+        array pc.
+        """
         t = self.time
         ni = self.mesh.shape[0]
         nj = self.mesh.shape[1]
         ng = self.num_guard
         bcl, bcr = self.boundary_condition
 
-        with self.patches[patch_index].execution_context:
-            pc[:+ng] = pl[-2 * ng : -ng]
-            pc[-ng:] = pr[+ng : +2 * ng]
-
-            def negative_vel(p):
-                return self.xp.asarray([p[0], -p[1], p[2], p[3]])
-
-            if patch_index == 0:
-                if bcl == BC_OUTFLOW:
-                    pc[:+ng] = pc[+ng : +2 * ng]
-                elif bcl == BC_INFLOW:
-                    for i in range(-ng, 0):
-                        for j in range(nj):
-                            x = self.mesh.cell_coordinates(t, i, j)
-                            self.setup.primitive(t, x, pc[i + ng, j])
-                elif bcl == BC_REFLECT:
+        def negative_vel(p):
+            return self.xp.asarray([p[0], -p[1], p[2], p[3]])
+
+        if side == 0:
+            if bcl == BC_OUTFLOW:
+                pc[:+ng] = pc[+ng : +2 * ng]
+            elif bcl == BC_INFLOW:
+                for i in range(-ng, 0):
                     for j in range(nj):
-                        pc[0, j] = negative_vel(pc[3, j])
-                        pc[1, j] = negative_vel(pc[2, j])
-
-            if patch_index == len(self.patches) - 1:
-                if bcr == BC_OUTFLOW:
-                    pc[-ng:] = pc[-2 * ng : -ng]
-                elif bcr == BC_INFLOW:
-                    i0 = self.patches[patch_index].index_range[0]
-                    for i in range(ni, ni + ng):
-                        for j in range(nj):
-                            x = self.mesh.zone_center(t, i, j)
-                            self.setup.primitive(t, x, pc[i - i0 + ng, j])
-                elif bcr == BC_REFLECT:
+                        x = self.mesh.cell_coordinates(t, i, j)
+                        self.setup.primitive(t, x, pc[i + ng, j])
+            elif bcl == BC_REFLECT:
+                for j in range(nj):
+                    pc[0, j] = negative_vel(pc[3, j])
+                    pc[1, j] = negative_vel(pc[2, j])
+
+        if side == 1:
+            if bcr == BC_OUTFLOW:
+                pc[-ng:] = pc[-2 * ng : -ng]
+            elif bcr == BC_INFLOW:
+                i0 = self.patches[patch_index].index_range[0]
+                for i in range(ni, ni + ng):
                     for j in range(nj):
-                        pc[-2, j] = negative_vel(pc[-3, j])
-                        pc[-1, j] = negative_vel(pc[-4, j])
+                        x = self.mesh.zone_center(t, i, j)
+                        self.setup.primitive(t, x, pc[i - i0 + ng, j])
+            elif bcr == BC_REFLECT:
+                for j in range(nj):
+                    pc[-2, j] = negative_vel(pc[-3, j])
+                    pc[-1, j] = negative_vel(pc[-4, j])
 
     def new_iteration(self):
         for patch in self.patches:
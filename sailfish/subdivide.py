@@ -23,6 +23,12 @@ def lazy_reduce(reduction, block, launches, contexts):
     built-in `float`). The `contexts` argument is a sequence of execution
     contexts which should switch to the device on which the respective launch
     callable was executed.
+
+    If the contexts are instances of `StreamContext`, the launch callables
+    are expected to have issued their work to the stream of the respective
+    context. The block is then done inside the context, so that it waits on
+    that stream (and only on that stream), which permits the launches on
+    different devices and streams to run concurrently.
     """
     tokens = [launch() for launch in launches]
     results = []
@@ -32,6 +38,50 @@ def lazy_reduce(reduction, block, launches, contexts):
     return reduction(results)
 
 
+readback_streams = dict()
+
+
+def deferred_reduce(reduction, block, launches, contexts):
+    """
+    Same as `lazy_reduce`, but returns a callable which blocks and returns
+    the reduced value, instead of the value itself.
+
+    If the contexts are instances of `StreamContext` in gpu mode, an event is
+    recorded on each context's stream after its launch, and the callable
+    copies each token to the host on a separate non-blocking stream which
+    waits for that event. It therefore waits only for the work issued
+    before `deferred_reduce` was called, and not for any work issued to the
+    same streams afterwards. This lets the host keep issuing work, such as
+    the next time step, before the value is needed. In cpu and omp modes the
+    tokens are host values, and the callable just applies the reduction.
+    """
+    tokens = [launch() for launch in launches]
+    events = [getattr(context, "record", lambda: None)() for context in contexts]
+
+    def result():
+        results = []
+
+        for token, event, context in zip(tokens, events, contexts):
+            if event is None:
+                with context:
+                    results.append(block(token))
+                continue
+
+            from cupy.cuda import Stream
+
+            with context.device as device:
+                if device.id not in readback_streams:
+                    readback_streams[device.id] = Stream(non_blocking=True)
+
+                stream = readback_streams[device.id]
+                stream.wait_event(event)
+                results.append(block(token.get(stream=stream)))
+
+        return reduction(results)
+
+    return result
+
+
 def partition(elements, num_parts):
     """
     Equitably divide the given number of elements into `num_parts` partitions.
@@ -60,6 +110,405 @@ def subdivide(interval, num_parts):
         a += n
 
 
+def weighted_subdivide(costs, num_parts, min_size=1):
+    """
+    Divide the index range `[0, len(costs))` into `num_parts` contiguous
+    sub-intervals, whose summed costs are as close to equal as possible.
+
+    Each cut is placed where the cumulative cost is nearest to its share of
+    the total, subject to every sub-interval having at least `min_size`
+    elements.
+    """
+    from bisect import bisect_left
+    from itertools import accumulate
+
+    n = len(costs)
+
+    if num_parts * min_size > n:
+        raise ValueError(f"cannot divide {n} elements into {num_parts} parts")
+
+    cumulative = [0.0] + list(accumulate(costs))
+    total = cumulative[-1]
+    cuts = [0]
+
+    for k in range(1, num_parts):
+        target = total * k / num_parts
+        i = bisect_left(cumulative, target)
+
+        if i > 0 and target - cumulative[i - 1] <= cumulative[i] - target:
+            i -= 1
+
+        lower = cuts[-1] + min_size
+        upper = n - (num_parts - k) * min_size
+        cuts.append(min(max(i, lower), upper))
+
+    cuts.append(n)
+    return list(zip(cuts[:-1], cuts[1:]))
+
+
+def block_shape(shape, num_patches):
+    """
+    Return the number of patches `(pi, pj)` along each axis of a 2D block
+    decomposition of an index space with the given shape.
+
+    The factorization of `num_patches` is chosen to minimize the total length
+    of the internal patch boundaries, which is proportional to the number of
+    guard zones to be exchanged. Ties are broken in favor of more patches
+    along the first axis, since rows of an array are contiguous in memory.
+    """
+    ni, nj = shape
+    best = None
+
+    for pi in range(num_patches, 0, -1):
+        if num_patches % pi != 0:
+            continue
+        pj = num_patches // pi
+        if pi > ni or pj > nj:
+            continue
+        cost = (pi - 1) * nj + (pj - 1) * ni
+        if best is None or cost < best[0]:
+            best = (cost, (pi, pj))
+
+    if best is None:
+        raise ValueError(f"cannot divide shape {shape} into {num_patches} patches")
+
+    return best[1]
+
+
+class BlockDecomposition:
+    """
+    Divides a 2D index space into a `(pi, pj)` grid of rectangular patches.
+
+    Patches are numbered in row-major order, so the patch with global index
+    `n` is at block index `divmod(n, pj)`. If `blocks` is None, it is chosen
+    by `block_shape`. The patches are distributed over the processes of the
+    communicator `comm` in contiguous ranges of global index; `owned` is the
+    range of patches owned by this process. If `periodic[axis]` is true, the
+    patches at the domain edges on that axis are neighbors of one another.
+    """
+
+    def __init__(
+        self, shape, num_patches, blocks=None, comm=None, periodic=(False, False)
+    ):
+        from sailfish.communicator import SerialCommunicator, partition_patches
+
+        pi, pj = blocks or block_shape(shape, num_patches)
+
+        if pi * pj != num_patches:
+            raise ValueError(f"blocks {blocks} do not make {num_patches} patches")
+
+        self.shape = shape
+        self.blocks = (pi, pj)
+        self.comm = comm or SerialCommunicator()
+        self.periodic = periodic
+        self.ranges = [list(subdivide(n, p)) for n, p in zip(shape, self.blocks)]
+        self.owned = range(*partition_patches(num_patches, self.comm))
+
+    def __len__(self):
+        return self.blocks[0] * self.blocks[1]
+
+    def index_range(self, n):
+        """
+        Return the index range `((i0, i1), (j0, j1))` of global patch n.
+        """
+        bi, bj = divmod(n, self.blocks[1])
+        return self.ranges[0][bi], self.ranges[1][bj]
+
+    def neighbor(self, n, axis, side):
+        """
+        Return the global index of the patch adjacent to global patch n on the
+        given axis and side (0 for the lower side, 1 for the upper side), or
+        None if patch n is at a non-periodic domain edge.
+        """
+        b = list(divmod(n, self.blocks[1]))
+        b[axis] += 2 * side - 1
+
+        if self.periodic[axis]:
+            b[axis] %= self.blocks[axis]
+        elif not 0 <= b[axis] < self.blocks[axis]:
+            return None
+
+        return b[0] * self.blocks[1] + b[1]
+
+    def at_edge(self, n, axis, side):
+        """
+        Return True if global patch n is at the domain edge on the given axis
+        and side.
+        """
+        b = divmod(n, self.blocks[1])[axis]
+        return b == (0 if side == 0 else self.blocks[axis] - 1)
+
+    def patch_rank(self, n):
+        """
+        Return the rank of the process which owns global patch n.
+        """
+        for rank, (a, b) in enumerate(subdivide(len(self), self.comm.size)):
+            if a <= n < b:
+                return rank
+
+    def is_local(self, n):
+        return n is not None and n in self.owned
+
+
+class GuardZoneExchange:
+    """
+    Fills the guard zones of the patches in a `BlockDecomposition`.
+
+    The guard zones are filled one axis at a time, first along axis 0 and
+    then along axis 1. On axis 0, only the rows of interior columns are
+    exchanged. On axis 1, whole columns are exchanged, including the guard
+    rows filled in the first pass, so that the corners are also filled from
+    the diagonal neighbor. If `num_guard` is a tuple, its second entry may be
+    zero, for arrays with no guard zones on axis 1.
+
+    Each patch is associated with an execution context, which must support
+    `record` and `wait` (see `sailfish.kernel.system.StreamContext`). The
+    copies into a patch are made in its context, after its neighbors have
+    finished their pending work. Guard zones shared with patches on other
+    processes are exchanged with nonblocking messages, which are in flight
+    while the copies between local patches are made.
+    """
+
+    def __init__(self, decomposition, num_guard):
+        try:
+            self.num_guard = tuple(num_guard)
+        except TypeError:
+            self.num_guard = (num_guard, num_guard)
+
+        self.decomposition = decomposition
+        self.comm = decomposition.comm
+
+    def guard_region(self, axis, side):
+        """
+        Return the index of the guard zones on one side of an array.
+        """
+        ng = self.num_guard[axis]
+        s = slice(None, ng) if side == 0 else slice(-ng, None)
+        return (s, self.transverse(axis)) if axis == 0 else (slice(None), s)
+
+    def source_region(self, axis, side):
+        """
+        Return the index of the zones which are copied into the guard zones
+        of the neighbor on the opposite side, i.e. into the neighbor's guard
+        region on side `1 - side`.
+        """
+        ng = self.num_guard[axis]
+        s = slice(ng, 2 * ng) if side == 0 else slice(-2 * ng, -ng)
+        return (s, self.transverse(axis)) if axis == 0 else (slice(None), s)
+
+    def transverse(self, axis):
+        ngj = self.num_guard[1]
+        return slice(ngj, -ngj) if ngj > 0 else slice(None)
+
+    def axes(self):
+        return [axis for axis in (0, 1) if self.num_guard[axis] > 0]
+
+    def global_index(self, n):
+        return self.decomposition.owned[n]
+
+    def neighbors(self, n, axis):
+        """
+        Return the global indexes of the neighbors of local patch n on the
+        given axis, with None at the domain edges.
+        """
+        g = self.global_index(n)
+        return [self.decomposition.neighbor(g, axis, side) for side in (0, 1)]
+
+    def local_neighbors(self, n, axis):
+        """
+        Return the local indexes of the neighbors of local patch n on the
+        given axis which are owned by this process.
+        """
+        n0 = self.decomposition.owned.start
+        is_local = self.decomposition.is_local
+        return [h - n0 for h in self.neighbors(n, axis) if is_local(h)]
+
+    def edges(self, n, axis):
+        """
+        Return the sides of local patch n on the given axis which are at the
+        domain edge (including periodic edges).
+        """
+        g = self.global_index(n)
+        return [side for side in (0, 1) if self.decomposition.at_edge(g, axis, side)]
+
+    def start(self, views, contexts, axis):
+        """
+        Post the messages for the guard zones on the given axis shared with
+        patches on other processes.
+
+        The zones to be sent are staged in contiguous buffers, on the host
+        unless the communicator is CUDA-aware. Return a dict of the receive
+        buffers, keyed by local patch index and side, and the list of
+        requests.
+        """
+        import numpy as np
+
+        comm = self.comm
+        sends, recvs, buffers = [], [], dict()
+
+        for n, (pc, context) in enumerate(zip(views, contexts)):
+            g = self.global_index(n)
+
+            for side, h in enumerate(self.neighbors(n, axis)):
+                if h is None or self.decomposition.is_local(h):
+                    continue
+
+                zones = pc[self.source_region(axis, side)]
+                rank = self.decomposition.patch_rank(h)
+
+                with context:
+                    if comm.cuda_aware:
+                        xp = get_array_module_of(pc)
+                        send = xp.ascontiguousarray(zones)
+                        recv = xp.empty_like(send)
+                        context.synchronize()
+                    else:
+                        send = np.ascontiguousarray(to_host(zones))
+                        recv = np.empty_like(send)
+
+                # Message tags are 4 * (receiving patch) + 2 * axis + side, where
+                # side is the side of the receiving patch.
+                sends.append((rank, 4 * h + 2 * axis + 1 - side, send))
+                recvs.append((rank, 4 * g + 2 * axis + side, recv))
+                buffers[n, side] = recv
+
+        return buffers, comm.start_exchange(sends, recvs)
+
+    def copy_local(self, views, n, axis):
+        """
+        Copy the guard zones of local patch n on the given axis from its
+        neighbors which are owned by this process.
+        """
+        from sailfish.kernel.system import peer_copy
+
+        n0 = self.decomposition.owned.start
+
+        for side, h in enumerate(self.neighbors(n, axis)):
+            if self.decomposition.is_local(h):
+                source = views[h - n0][self.source_region(axis, 1 - side)]
+                peer_copy(views[n][self.guard_region(axis, side)], source)
+
+    def copy_remote(self, views, buffers, n, axis):
+        """
+        Copy the guard zones of local patch n on the given axis, received from
+        patches on other processes.
+        """
+        pc = views[n]
+        xp = get_array_module_of(pc)
+
+        for side in (0, 1):
+            if (n, side) in buffers:
+                pc[self.guard_region(axis, side)] = xp.asarray(buffers[n, side])
+
+    def fill(self, views, contexts, edge_condition):
+        """
+        Fill the guard zones of the local patches.
+
+        The `views` are the arrays of the local patches, with the spatial
+        axes first (i.e. logical views if the storage layout is not "aos").
+        The callable `edge_condition(pc, n, axis, side)` is called in the
+        context of local patch n, to fill its guard zones at the domain
+        edges. At periodic edges it's called after the copy from the
+        neighbor, and may do nothing.
+        """
+        for axis in self.axes():
+            ready = [context.record() for context in contexts]
+            buffers, requests = self.start(views, contexts, axis)
+
+            for n, context in enumerate(contexts):
+                context.wait(*(ready[m] for m in self.local_neighbors(n, axis)))
+
+                with context:
+                    self.copy_local(views, n, axis)
+
+            self.comm.wait(requests)
+
+            for n, context in enumerate(contexts):
+                with context:
+                    self.copy_remote(views, buffers, n, axis)
+
+                    for side in self.edges(n, axis):
+                        edge_condition(views[n], n, axis, side)
+
+            done = [context.record() for context in contexts]
+
+            for n, context in enumerate(contexts):
+                context.wait(*(done[m] for m in self.local_neighbors(n, axis)))
+
+
+def get_array_module_of(a):
+    """
+    Return either numpy or cupy, whichever the given array belongs to.
+    """
+    if type(a).__module__.startswith("cupy"):
+        import cupy
+
+        return cupy
+    else:
+        import numpy
+
+        return numpy
+
+
+def copy_range(sources, index_range, num_guard, xp):
+    """
+    Return a new array covering the given index range on the first axis,
+    with `num_guard` guard zones at each end, which is assembled from a list
+    of `(index_range, array)` pairs, where each array has guard zones of the
+    same width. The arrays may be on different devices; the result is on the
+    current device. The guard zones of the result are not filled.
+
+    This is used to move patch data to a new decomposition without going
+    through the host. In gpu mode, the copies of contiguous rows are made
+    directly from the memory of the source device.
+    """
+    i0, i1 = index_range
+    ng = num_guard
+    first = sources[0][1]
+    result = xp.zeros((i1 - i0 + 2 * ng,) + first.shape[1:], dtype=first.dtype)
+
+    for (a, b), array in sources:
+        lo, hi = max(a, i0), min(b, i1)
+
+        if lo >= hi:
+            continue
+
+        dst = result[lo - i0 + ng : hi - i0 + ng]
+        src = array[lo - a + ng : hi - a + ng]
+
+        if xp.__name__ == "cupy" and src.flags.c_contiguous:
+            dst.data.copy_from_device(src.data, src.nbytes)
+        else:
+            dst[...] = src
+
+    return result
+
+
+def concat_blocks_on_host(arrays: list, index_ranges: list, num_guard=None):
+    """
+    Assemble a list of 2D block arrays, which may be allocated on different
+    devices, into a single array on the host.
+
+    Each array covers the index range `((i0, i1), (j0, j1))` at the
+    respective entry of `index_ranges`. Guard zones, if any, are stripped
+    from each array, and the shape of the result is determined from the
+    largest index ranges.
+    """
+    import numpy as np
+
+    ngi, ngj = num_guard or (0, 0)
+    si = slice(ngi, -ngi) if ngi > 0 else slice(None)
+    sj = slice(ngj, -ngj) if ngj > 0 else slice(None)
+    ni = max(i1 for (i0, i1), _ in index_ranges)
+    nj = max(j1 for _, (j0, j1) in index_ranges)
+    result = np.zeros((ni, nj) + arrays[0].shape[2:])
+
+    for array, ((i0, i1), (j0, j1)) in zip(arrays, index_ranges):
+        result[i0:i1, j0:j1] = to_host(array[si, sj])
+
+    return result
+
+
 def concat_on_host(arrays: list, num_guard=None, rank=None):
     """
     Concatenate a list of arrays, which may be allocated on different devices.
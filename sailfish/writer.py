@@ -0,0 +1,120 @@
+"""
+Background writing of output files.
+
+The driver can hand checkpoint files to an `AsyncWriter`, which serializes
+and writes them on a background thread, so the simulation continues while
+the file system is busy. The solution data is copied to the host when the
+checkpoint is taken, with `snapshot`, so the solver is free to overwrite its
+arrays as soon as the task is submitted. The number of snapshots waiting to
+be written is bounded, which caps the host memory spent on them; when the
+queue is full, the driver waits for the oldest one to be written.
+"""
+
+import os
+import threading
+from logging import getLogger
+from queue import Queue
+
+logger = getLogger(__name__)
+
+
+def snapshot(value):
+    """
+    Return a copy of a checkpoint item, which does not share any array data
+    with the solver. Dictionaries, lists, and tuples are copied recursively,
+    numpy arrays are copied, and cupy arrays are copied to the host. Other
+    objects are assumed to be immutable, and are returned as-is.
+    """
+    import numpy as np
+
+    if isinstance(value, dict):
+        return {k: snapshot(v) for k, v in value.items()}
+    elif isinstance(value, list):
+        return [snapshot(v) for v in value]
+    elif isinstance(value, tuple) and not hasattr(value, "_fields"):
+        return tuple(snapshot(v) for v in value)
+    elif isinstance(value, np.ndarray):
+        return value.copy()
+    elif hasattr(value, "get") and hasattr(value, "shape"):
+        return value.get()
+    else:
+        return value
+
+
+def fsync_path(filename):
+    """
+    Flush the contents of a closed file to the storage device.
+    """
+    fd = os.open(filename, os.O_RDONLY)
+    try:
+        os.fsync(fd)
+    finally:
+        os.close(fd)
+
+
+def staging_filename(filename):
+    """
+    Return the name of the temporary file that a file is written to before
+    it's renamed into place. The name does not look like a checkpoint file,
+    so a partly written file is never picked up by a restart.
+    """
+    dirname, basename = os.path.split(filename)
+    return os.path.join(dirname, "." + basename.replace(".", "-") + ".tmp")
+
+
+class AsyncWriter:
+    """
+    Runs file writing tasks on a background thread, in the order in which
+    they were submitted.
+
+    At most `max_pending` tasks wait in the queue, in addition to the one
+    being written; `submit` blocks while the queue is full. If a task raises
+    an exception, the later tasks are discarded, and the exception is raised
+    again in the calling thread by the next call to `submit` or `close`.
+    """
+
+    def __init__(self, max_pending=1):
+        self.queue = Queue(maxsize=max_pending)
+        self.error = None
+        self.thread = threading.Thread(target=self.run, name="writer", daemon=True)
+        self.thread.start()
+
+    def run(self):
+        while True:
+            task = self.queue.get()
+            try:
+                if task is None:
+                    return
+                if self.error is None:
+                    task()
+            except Exception as e:
+                self.error = e
+            finally:
+                self.queue.task_done()
+
+    def check(self):
+        if self.error is not None:
+            error, self.error = self.error, None
+            raise error
+
+    def submit(self, task):
+        """
+        Queue a callable to be run on the writer thread.
+        """
+        self.check()
+        self.queue.put(task)
+
+    def flush(self):
+        """
+        Wait for all of the submitted tasks to finish.
+        """
+        self.queue.join()
+        self.check()
+
+    def close(self):
+        """
+        Wait for all of the submitted tasks to finish, and stop the thread.
+        """
+        self.queue.put(None)
+        self.thread.join()
+        self.check()